@@ -0,0 +1,56 @@
+#include "SyntheticArchive.hpp"
+#include <Stopwatch.hpp>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+static void printUsage()
+{
+	printf("Usage: FfGenerate output.ff [--records N] [options]\n"
+	       "Generates synthetic MQDB file for benchmarks and stress tests.\n"
+	       "  --records N          number of data records, 10000 by default\n"
+	       "%s",
+	       syntheticOptionsUsage);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string outputPath;
+	SyntheticOptions synthetic;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string argument = argv[i];
+
+		if (parseSyntheticOption(argc, argv, i, synthetic)) {
+			continue;
+		}
+
+		if (argument == "--records" && i + 1 < argc) {
+			synthetic.records = static_cast<uint32_t>(strtoul(argv[++i], NULL, 10));
+		} else if (argument[0] != '-' && outputPath.empty()) {
+			outputPath = argument;
+		} else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (outputPath.empty()) {
+		printUsage();
+		return 1;
+	}
+
+	try {
+		Stopwatch stopwatch;
+		writeSyntheticArchive(outputPath, synthetic);
+
+		printf("Generated %s with %u records, %u listed, in %.3f s\n", outputPath.c_str(),
+		       synthetic.records, syntheticListedRecords(synthetic), stopwatch.elapsed());
+	} catch (const std::exception& e) {
+		printf("Error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
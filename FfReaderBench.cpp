@@ -0,0 +1,704 @@
+#include "SyntheticArchive.hpp"
+#include <AsyncReader.hpp>
+#include <ContentIndex.hpp>
+#include <FfReader.hpp>
+#include <FfWriter.hpp>
+#include <ImageUnpacker.hpp>
+#include <IndexSidecar.hpp>
+#include <NameQuery.hpp>
+#include <RecordScanner.hpp>
+#include <Stopwatch.hpp>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+/** Returns resident set size of the process, in bytes, 0 if it is not known. */
+static size_t residentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.WorkingSetSize;
+	}
+
+	return 0;
+#else
+	// Second field of statm is resident size in pages, Linux only
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (!statm) {
+		return 0;
+	}
+
+	unsigned long pages = 0;
+	unsigned long resident = 0;
+	const bool parsed = fscanf(statm, "%lu %lu", &pages, &resident) == 2;
+	fclose(statm);
+
+	return parsed ? static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+}
+
+static void report(const char* name, double value, const char* unit)
+{
+	printf("%-28s %14.3f %s\n", name, value, unit);
+}
+
+/** Re-runs each parsing phase of already opened reader and reports its duration. */
+static void benchmarkPhases(const std::string& filePath, FfReader& reader, int iterations)
+{
+	double phases[5] = {0};
+
+	for (int i = 0; i < iterations; ++i) {
+		std::ifstream file(filePath.c_str(), std::ios_base::binary);
+
+		Stopwatch stopwatch;
+		reader.checkFileHeader(file);
+		phases[0] += stopwatch.elapsed();
+
+		stopwatch.restart();
+		reader.readTableOfContents(file);
+		phases[1] += stopwatch.elapsed();
+
+		stopwatch.restart();
+		std::vector<char> nameListContents;
+		reader.readNameListContents(file, nameListContents);
+		reader.readNameList(file, nameListContents);
+		phases[2] += stopwatch.elapsed();
+
+		stopwatch.restart();
+		reader.readIndex(file, reader.findTocRecord("-INDEX.OPT"));
+		phases[3] += stopwatch.elapsed();
+
+		stopwatch.restart();
+		reader.readImages(file, reader.findTocRecord("-IMAGES.OPT"), NULL);
+		phases[4] += stopwatch.elapsed();
+	}
+
+	const char* names[5] = {"checkFileHeader", "readTableOfContents", "readNameList",
+	                        "readIndex", "readImages"};
+
+	for (int i = 0; i < 5; ++i) {
+		report(names[i], phases[i] / iterations * 1e3, "ms");
+	}
+}
+
+static void benchmarkOpen(const std::string& filePath, int iterations)
+{
+	FfReaderOptions options;
+
+	const char* names[5] = {"open (stream)", "open (mapped)", "open (mapped, lazy)",
+	                        "open (mapped, sidecar)", "open (mapped, parallel)"};
+
+	const std::string sidecarPath = indexSidecarPath(filePath);
+
+	for (int mode = 0; mode < 5; ++mode) {
+		options.memoryMapped = mode > 0;
+		options.lazyImages = mode == 2;
+		options.loadIndexSidecar = mode == 3;
+		options.parseThreads = mode == 4 ? 0 : 1;
+
+		if (options.loadIndexSidecar && !writeIndexSidecar(FfReader(filePath), sidecarPath)) {
+			continue;
+		}
+
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; ++i) {
+			FfReader reader(filePath, options);
+		}
+
+		report(names[mode], stopwatch.elapsed() / iterations * 1e3, "ms");
+	}
+
+	remove(sidecarPath.c_str());
+}
+
+static void benchmarkLookups(const FfReader& reader, int iterations)
+{
+	const std::vector<std::string> names = reader.getNames();
+	if (names.empty()) {
+		return;
+	}
+
+	// Cold lookups visit every name in random order, hot ones repeat a few names
+	std::vector<const char*> cold(names.size());
+	for (size_t i = 0; i < names.size(); ++i) {
+		cold[i] = names[i].c_str();
+	}
+
+	Random random;
+	for (size_t i = cold.size(); i > 1; --i) {
+		std::swap(cold[i - 1], cold[random.next() % i]);
+	}
+
+	std::vector<const char*> hot(1024);
+	for (size_t i = 0; i < hot.size(); ++i) {
+		hot[i] = cold[i % std::min<size_t>(cold.size(), 8)];
+	}
+
+	size_t found = 0;
+	const char* titles[2] = {"name lookup (hot)", "name lookup (cold)"};
+	const std::vector<const char*>* sets[2] = {&hot, &cold};
+
+	for (int set = 0; set < 2; ++set) {
+		const std::vector<const char*>& lookups = *sets[set];
+
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; ++i) {
+			for (size_t j = 0; j < lookups.size(); ++j) {
+				found += reader.findTocRecord(lookups[j]) != NULL;
+			}
+		}
+
+		report(titles[set], stopwatch.elapsed() * 1e9 / (iterations * lookups.size()), "ns");
+	}
+
+	std::vector<RecordId> ids;
+	for (size_t i = 0; i < cold.size(); ++i) {
+		ids.push_back(reader.findTocRecord(cold[i])->recordId);
+	}
+
+	const std::vector<RecordId> coldIds(ids);
+	std::vector<RecordId> hotIds(1024);
+	for (size_t i = 0; i < hotIds.size(); ++i) {
+		hotIds[i] = ids[i % std::min<size_t>(ids.size(), 8)];
+	}
+
+	const char* idTitles[2] = {"id lookup (hot)", "id lookup (cold)"};
+	const std::vector<RecordId>* idSets[2] = {&hotIds, &coldIds};
+
+	for (int set = 0; set < 2; ++set) {
+		const std::vector<RecordId>& lookups = *idSets[set];
+
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; ++i) {
+			for (size_t j = 0; j < lookups.size(); ++j) {
+				found += reader.findTocRecord(lookups[j]) != NULL;
+			}
+		}
+
+		report(idTitles[set], stopwatch.elapsed() * 1e9 / (iterations * lookups.size()), "ns");
+	}
+
+	std::vector<const char*> imageNames(reader.indexData.images.names);
+	for (size_t i = imageNames.size(); i > 1; --i) {
+		std::swap(imageNames[i - 1], imageNames[random.next() % i]);
+	}
+
+	if (!imageNames.empty()) {
+		RecordId recordId = 0;
+		PackedImageInfo packedInfo;
+
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; ++i) {
+			for (size_t j = 0; j < imageNames.size(); ++j) {
+				found += reader.findImageIndex(imageNames[j], recordId, packedInfo);
+			}
+		}
+
+		report("image index lookup (cold)",
+		       stopwatch.elapsed() * 1e9 / (iterations * imageNames.size()), "ns");
+	}
+
+	if (!found) {
+		printf("lookups failed\n");
+	}
+}
+
+/** Queries names by prefixes and substrings of their own, compared to scanning getNames(). */
+static void benchmarkNameQueries(const FfReader& reader, int iterations)
+{
+	const NameIndex& names = reader.getNameIndex();
+	if (names.empty()) {
+		return;
+	}
+
+	// Prefixes and substrings of 4 bytes taken from every name
+	std::vector<std::string> prefixes;
+	std::vector<std::string> substrings;
+	for (size_t i = 0; i < names.size(); ++i) {
+		const std::string name(names.name(i), names.nameLength(i));
+		prefixes.push_back(name.substr(0, 4));
+		substrings.push_back(name.substr(name.size() > 4 ? (name.size() - 4) / 2 : 0, 4));
+	}
+
+	Stopwatch buildStopwatch;
+	NameQuery query(names);
+	report("name query build", buildStopwatch.elapsed() * 1e3, "ms");
+
+	std::vector<NameIndex::Item> matches;
+	size_t found = 0;
+
+	const char* titles[3] = {"prefix query (scan)", "prefix query (index)",
+	                         "substring query (index)"};
+
+	for (int mode = 0; mode < 3; ++mode) {
+		const std::vector<std::string>& queries = mode == 2 ? substrings : prefixes;
+
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; ++i) {
+			for (size_t j = 0; j < queries.size(); ++j) {
+				if (mode == 0) {
+					const std::vector<std::string> all = reader.getNames();
+					for (size_t k = 0; k < all.size(); ++k) {
+						found += all[k].compare(0, queries[j].size(), queries[j]) == 0;
+					}
+				} else if (mode == 1) {
+					found += query.findPrefix(queries[j], matches);
+				} else {
+					found += query.findSubstring(queries[j], matches);
+				}
+			}
+		}
+
+		report(titles[mode], stopwatch.elapsed() * 1e9 / (iterations * queries.size()), "ns");
+	}
+
+	if (!found) {
+		printf("name queries failed\n");
+	}
+}
+
+static void benchmarkReads(const std::string& filePath, int iterations)
+{
+	FfReaderOptions options;
+	options.readImageData = false;
+
+	const char* titles[3] = {"record read (pread)", "record read (mapped)", "record view (mapped)"};
+
+	for (int mode = 0; mode < 3; ++mode) {
+		options.memoryMapped = mode > 0;
+		FfReader reader(filePath, options);
+
+		const std::vector<std::string> names = reader.getNames();
+		std::vector<char> data;
+		double bytes = 0.0;
+		char checksum = 0;
+
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; ++i) {
+			for (size_t j = 0; j < names.size(); ++j) {
+				if (mode == 2) {
+					const RecordView view = reader.getRecordView(names[j]);
+					checksum ^= view.size ? view.data[view.size - 1] : 0;
+					bytes += view.size;
+				} else if (reader.getRecordData(names[j], data)) {
+					checksum ^= data.empty() ? 0 : data.back();
+					bytes += static_cast<double>(data.size());
+				}
+			}
+		}
+
+		report(titles[mode], bytes / (1024.0 * 1024.0) / stopwatch.elapsed(), "MB/s");
+
+		if (checksum == 42) {
+			// Keep reads from being optimized away
+			printf("\n");
+		}
+	}
+}
+
+static void benchmarkScan(const std::string& filePath, int iterations)
+{
+	FfReaderOptions options;
+	options.readImageData = false;
+
+	const char* titles[2] = {"record scan (sequential)", "record scan (mapped)"};
+
+	for (int mode = 0; mode < 2; ++mode) {
+		options.memoryMapped = mode > 0;
+		FfReader reader(filePath, options);
+
+		double bytes = 0.0;
+		char checksum = 0;
+
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; ++i) {
+			RecordScanner scanner(reader);
+			ScannedRecord record;
+
+			while (scanner.next(record)) {
+				if (record.contents.data && record.contents.size) {
+					checksum ^= record.contents.data[record.contents.size - 1];
+					bytes += record.contents.size;
+				}
+			}
+		}
+
+		report(titles[mode], bytes / (1024.0 * 1024.0) / stopwatch.elapsed(), "MB/s");
+
+		if (checksum == 42) {
+			// Keep reads from being optimized away
+			printf("\n");
+		}
+	}
+}
+
+/** Hashes every record of mapped archive, once on a single thread and once on all of them. */
+static void benchmarkContentIndex(const std::string& filePath, int iterations)
+{
+	FfReaderOptions options;
+	options.readImageData = false;
+	options.memoryMapped = true;
+	FfReader reader(filePath, options);
+
+	const char* titles[2] = {"content hash (1 thread)", "content hash (all threads)"};
+
+	for (int mode = 0; mode < 2; ++mode) {
+		ContentIndexOptions contentOptions;
+		contentOptions.threadsTotal = mode == 0 ? 1 : 0;
+
+		double bytes = 0.0;
+		size_t duplicates = 0;
+
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; ++i) {
+			ContentIndex contents;
+			contents.build(reader, contentOptions);
+
+			const std::vector<ContentRecord>& records = contents.getRecords();
+			for (size_t j = 0; j < records.size(); ++j) {
+				bytes += records[j].size;
+			}
+
+			duplicates = contents.duplicatesTotal();
+		}
+
+		report(titles[mode], bytes / (1024.0 * 1024.0) / stopwatch.elapsed(), "MB/s");
+
+		if (duplicates == 42) {
+			// Keep hashing from being optimized away
+			printf("\n");
+		}
+	}
+}
+
+/** Reads every named record as a single batch, once coalesced and once record by record. */
+static void benchmarkAsync(const std::string& filePath, int iterations)
+{
+	FfReaderOptions options;
+	options.readImageData = false;
+
+	FfReader reader(filePath, options);
+	const std::vector<std::string> names = reader.getNames();
+
+	const char* titles[2] = {"record read (async)", "record read (async, coalesced)"};
+	const uint32_t gaps[2] = {0, 64 * 1024};
+
+	for (int mode = 0; mode < 2; ++mode) {
+		AsyncReadOptions asyncOptions;
+		asyncOptions.coalesceGap = gaps[mode];
+
+		AsyncReader asyncReader(reader, asyncOptions);
+		ReadBatch batch;
+
+		for (size_t i = 0; i < names.size(); ++i) {
+			batch.add(names[i]);
+		}
+
+		double bytes = 0.0;
+
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; ++i) {
+			asyncReader.submit(batch);
+			batch.wait();
+
+			for (size_t j = 0; j < batch.size(); ++j) {
+				bytes += static_cast<double>(batch.data(j).size());
+			}
+		}
+
+		report(titles[mode], bytes / (1024.0 * 1024.0) / stopwatch.elapsed(), "MB/s");
+	}
+}
+
+/** Copies every named record of a mapped reader into a new archive. */
+static void benchmarkWrite(const std::string& filePath, int iterations)
+{
+	FfReaderOptions options;
+	options.readImageData = false;
+	options.memoryMapped = true;
+
+	FfReader reader(filePath, options);
+	const std::string outputPath = filePath + ".write";
+
+	FfWriter writer;
+	double bytes = 0.0;
+
+	for (size_t i = 0; i < reader.recordNames.size(); ++i) {
+		const RecordView record = reader.getRecordView(reader.recordNames.value(i));
+		if (writer.addRecord(reader.recordNames.value(i), reader.recordNames.name(i), record.data,
+		                     record.size)) {
+			bytes += record.size;
+		}
+	}
+
+	Stopwatch stopwatch;
+	for (int i = 0; i < iterations; ++i) {
+		if (!writer.write(outputPath)) {
+			printf("archive write failed\n");
+			break;
+		}
+	}
+
+	report("archive write", bytes * iterations / (1024.0 * 1024.0) / stopwatch.elapsed(), "MB/s");
+	remove(outputPath.c_str());
+}
+
+static void benchmarkUnpack(const FfReader& reader, int iterations)
+{
+	std::vector<const ImageFrame*> frames;
+	for (size_t i = 0; i < reader.packedImages.size(); ++i) {
+		const ArrayView<ImageFrame>& imageFrames = reader.packedImages[i].frames;
+
+		for (size_t j = 0; j < imageFrames.size(); ++j) {
+			frames.push_back(&imageFrames[j]);
+		}
+	}
+
+	if (frames.empty()) {
+		return;
+	}
+
+	// Source image large enough for every part of every frame
+	uint32_t sourceWidth = 1;
+	uint32_t sourceHeight = 1;
+	for (size_t i = 0; i < frames.size(); ++i) {
+		for (size_t j = 0; j < frames[i]->parts.size(); ++j) {
+			const ImagePart& part = frames[i]->parts[j];
+			sourceWidth = std::max(sourceWidth, part.sourceX + part.width);
+			sourceHeight = std::max(sourceHeight, part.sourceY + part.height);
+		}
+	}
+
+	const uint32_t bytesPerPixel[2] = {1, 4};
+	const char* titles[2] = {"frame unpack (8-bit)", "frame unpack (32-bit)"};
+
+	for (int mode = 0; mode < 2; ++mode) {
+		const uint32_t bpp = bytesPerPixel[mode];
+		std::vector<char> source(static_cast<size_t>(sourceWidth) * sourceHeight * bpp, 1);
+		std::vector<char> target;
+		double pixels = 0.0;
+
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; ++i) {
+			for (size_t j = 0; j < frames.size(); ++j) {
+				const ImageFrame& frame = *frames[j];
+				target.resize(static_cast<size_t>(frame.width) * frame.height * bpp + 1);
+
+				if (unpackFrame(frame, &source[0], sourceWidth, sourceHeight, bpp, &target[0])) {
+					pixels += static_cast<double>(frame.width) * frame.height;
+				}
+			}
+		}
+
+		report(titles[mode], pixels / 1e6 / stopwatch.elapsed(), "MP/s");
+	}
+}
+
+/**
+ * Generates archives of growing size and measures how open time, memory
+ * and lookup and read throughput scale.
+ * @returns false if open time per record grew more than gateFactor times
+ * between the smallest and the largest archive.
+ */
+static bool benchmarkSweep(const std::string& filePath,
+                           const SyntheticOptions& base,
+                           uint32_t maxRecords,
+                           double gateFactor)
+{
+	printf("%10s %10s %10s %10s %10s %12s %12s\n", "records", "file MB", "open ms", "RSS MB",
+	       "meta MB", "lookup ns", "read MB/s");
+
+	double firstCost = 0.0;
+	double lastCost = 0.0;
+	uint32_t firstRecords = 0;
+
+	for (uint64_t records = 1000; records <= maxRecords; records *= 10) {
+		SyntheticOptions synthetic(base);
+		synthetic.records = static_cast<uint32_t>(records);
+		writeSyntheticArchive(filePath, synthetic);
+
+		// Resident growth of the first open, later ones reuse freed heap
+		const size_t residentBefore = residentBytes();
+		FfReader reader(filePath);
+		const size_t residentAfter = residentBytes();
+		const double residentMb = residentAfter > residentBefore
+		                              ? (residentAfter - residentBefore) / (1024.0 * 1024.0)
+		                              : 0.0;
+
+		// Repeat small opens, so timer resolution does not matter
+		int opens = 0;
+		Stopwatch openStopwatch;
+		do {
+			FfReader reopened(filePath);
+			++opens;
+		} while (openStopwatch.elapsed() < 0.2);
+
+		const double openSeconds = openStopwatch.elapsed() / opens;
+#ifndef FFREADER_NO_STATS
+		const double metadataMb = reader.getStats().metadataBytes / (1024.0 * 1024.0);
+#else
+		const double metadataMb = 0.0;
+#endif
+
+		// Cold lookups of listed names in random order
+		const uint32_t listed = syntheticListedRecords(synthetic);
+		const uint32_t lookupsTotal = std::min<uint32_t>(listed, 100000);
+		std::vector<std::string> names;
+		names.reserve(lookupsTotal);
+
+		Random random;
+		for (uint32_t i = 0; i < lookupsTotal; ++i) {
+			names.push_back(syntheticRecordName(random.next() % listed));
+		}
+
+		size_t found = 0;
+		Stopwatch lookupStopwatch;
+		for (size_t i = 0; i < names.size(); ++i) {
+			found += reader.findTocRecord(names[i]) != NULL;
+		}
+
+		const double lookupNs = names.empty() ? 0.0
+		                                      : lookupStopwatch.elapsed() * 1e9 / names.size();
+
+		// Positional reads of every data record in id order
+		std::vector<char> data;
+		double bytes = 0.0;
+
+		Stopwatch readStopwatch;
+		for (size_t i = 0; i < reader.tableOfContents.size(); ++i) {
+			if (reader.getRecordData(reader.tableOfContents[i].recordId, data)) {
+				bytes += data.size();
+			}
+		}
+
+		const double readMbs = bytes / (1024.0 * 1024.0) / readStopwatch.elapsed();
+
+		printf("%10u %10.1f %10.3f %10.1f %10.1f %12.1f %12.1f\n", synthetic.records,
+		       reader.recordFile.size() / (1024.0 * 1024.0), openSeconds * 1e3, residentMb,
+		       metadataMb, lookupNs, readMbs);
+
+		if (found != names.size()) {
+			printf("lookups failed\n");
+		}
+
+		lastCost = openSeconds / records;
+		if (!firstRecords) {
+			firstRecords = synthetic.records;
+			firstCost = lastCost;
+		}
+	}
+
+	remove(filePath.c_str());
+
+	if (gateFactor > 0.0 && firstCost > 0.0 && lastCost > firstCost * gateFactor) {
+		printf("Open time per record grew %.1f times since %u records, more than %.1f allowed\n",
+		       lastCost / firstCost, firstRecords, gateFactor);
+		return false;
+	}
+
+	return true;
+}
+
+static void printUsage()
+{
+	printf("Usage: FfReaderBench [file.ff] [--iterations N] [--synthetic RECORDS]\n"
+	       "                     [--sweep MAX_RECORDS] [--gate FACTOR] [--output file.ff]\n"
+	       "                     [generator options]\n"
+	       "Benchmarks FfReader on specified file, Icons.ff by default.\n"
+	       "--synthetic generates MQDB file with specified number of records first.\n"
+	       "--sweep generates archives of 1000, 10000, ... records up to specified number\n"
+	       "and reports open time, memory, lookup and read throughput of each.\n"
+	       "--gate fails sweep if open time per record grows more than FACTOR times.\n"
+	       "Generator options:\n"
+	       "%s",
+	       syntheticOptionsUsage);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string filePath = "Icons.ff";
+	std::string syntheticPath = "FfReaderBench-synthetic.ff";
+	SyntheticOptions synthetic;
+	bool generate = false;
+	int iterations = 10;
+	uint32_t sweepRecords = 0;
+	double gateFactor = 0.0;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string argument = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		if (parseSyntheticOption(argc, argv, i, synthetic)) {
+			continue;
+		}
+
+		if (argument == "--iterations" && hasValue) {
+			iterations = std::max(1, atoi(argv[++i]));
+		} else if (argument == "--synthetic" && hasValue) {
+			synthetic.records = static_cast<uint32_t>(strtoul(argv[++i], NULL, 10));
+			generate = true;
+		} else if (argument == "--sweep" && hasValue) {
+			sweepRecords = static_cast<uint32_t>(strtoul(argv[++i], NULL, 10));
+		} else if (argument == "--gate" && hasValue) {
+			gateFactor = atof(argv[++i]);
+		} else if (argument == "--output" && hasValue) {
+			syntheticPath = argv[++i];
+		} else if (argument[0] != '-') {
+			filePath = argument;
+		} else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	try {
+		if (sweepRecords) {
+			return benchmarkSweep(syntheticPath, synthetic, sweepRecords, gateFactor) ? 0 : 1;
+		}
+
+		if (generate) {
+			Stopwatch stopwatch;
+			writeSyntheticArchive(syntheticPath, synthetic);
+			filePath = syntheticPath;
+
+			printf("Generated %s with %u records in %.3f s\n", syntheticPath.c_str(),
+			       synthetic.records, stopwatch.elapsed());
+		}
+
+		printf("Benchmarking %s, %d iterations\n", filePath.c_str(), iterations);
+
+		FfReader reader(filePath);
+
+		benchmarkOpen(filePath, iterations);
+		benchmarkPhases(filePath, reader, iterations);
+		benchmarkLookups(reader, iterations);
+		benchmarkNameQueries(reader, iterations);
+		benchmarkReads(filePath, iterations);
+		benchmarkScan(filePath, iterations);
+		benchmarkContentIndex(filePath, iterations);
+		benchmarkAsync(filePath, iterations);
+		benchmarkWrite(filePath, iterations);
+		benchmarkUnpack(reader, iterations);
+	} catch (const std::exception& e) {
+		printf("Error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
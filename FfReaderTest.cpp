@@ -1,5 +1,343 @@
+#include <AnimationDecoder.hpp>
+#include <AssetExporter.hpp>
+#include <AssetCache.hpp>
+#include <AsyncReader.hpp>
+#include <BatchExtractor.hpp>
+#include <ContentIndex.hpp>
+#include <FfArchiveSet.hpp>
 #include <FfReader.hpp>
+#include <FfWriter.hpp>
+#include <ImageUnpacker.hpp>
+#include <IndexSidecar.hpp>
+#include <NameQuery.hpp>
+#include <RecordScanner.hpp>
+#include <ReplacingFile.hpp>
+#include <TextureAtlas.hpp>
+#include <ThreadPool.hpp>
+#include <algorithm>
 #include <assert.h>
+#include <map>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <utility>
+
+/** 11-byte header and 256 4-byte colors. */
+static const size_t paletteSize = 11 + 1024;
+
+/** Reads only PNG dimensions and produces blank 8-bit pixels. */
+class BlankPngDecoder : public ImageDecoder
+{
+public:
+	bool decode(const char* data, uint32_t size, std::vector<char>& pixels,
+	            uint32_t& width, uint32_t& height, uint32_t& bytesPerPixel)
+	{
+		if (size < 24 || memcmp(data + 1, "PNG", 3)) {
+			return false;
+		}
+
+		const unsigned char* header = reinterpret_cast<const unsigned char*>(data + 16);
+		width = (header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+		height = (header[4] << 24) | (header[5] << 16) | (header[6] << 8) | header[7];
+		bytesPerPixel = 1;
+
+		pixels.assign(width * height, '\0');
+		return true;
+	}
+};
+
+/** Fails every decode with an exception, as third-party decoders may do. */
+class ThrowingPngDecoder : public ImageDecoder
+{
+public:
+	bool decode(const char*, uint32_t, std::vector<char>&, uint32_t&, uint32_t&, uint32_t&)
+	{
+		throw std::runtime_error("Decoder failed");
+	}
+};
+
+/** Produces 8-bit pixels that differ between neighbours, so misplaced parts are noticed. */
+class PatternPngDecoder : public BlankPngDecoder
+{
+public:
+	bool decode(const char* data, uint32_t size, std::vector<char>& pixels,
+	            uint32_t& width, uint32_t& height, uint32_t& bytesPerPixel)
+	{
+		if (!BlankPngDecoder::decode(data, size, pixels, width, height, bytesPerPixel)) {
+			return false;
+		}
+
+		for (size_t i = 0; i < pixels.size(); ++i) {
+			pixels[i] = static_cast<char>(i * 7 + i / width);
+		}
+
+		return true;
+	}
+};
+
+static void appendUint32(std::vector<char>& contents, uint32_t value)
+{
+	const char* bytes = reinterpret_cast<const char*>(&value);
+	contents.insert(contents.end(), bytes, bytes + sizeof(value));
+}
+
+/** Serializes packed image the way it is stored in '-IMAGES.OPT' and '-ANIMS.OPT'. */
+static void appendPackedImage(std::vector<char>& contents, const char* palette,
+                              const std::vector<const ImageFrame*>& frames)
+{
+	contents.insert(contents.end(), palette, palette + paletteSize);
+	appendUint32(contents, static_cast<uint32_t>(frames.size()));
+
+	for (size_t i = 0; i < frames.size(); ++i) {
+		const ImageFrame& frame = *frames[i];
+
+		contents.insert(contents.end(), frame.name, frame.name + strlen(frame.name) + 1);
+		appendUint32(contents, static_cast<uint32_t>(frame.parts.size()));
+		appendUint32(contents, frame.width);
+		appendUint32(contents, frame.height);
+
+		for (size_t j = 0; j < frame.parts.size(); ++j) {
+			const ImagePart& part = frame.parts[j];
+
+			appendUint32(contents, part.targetX);
+			appendUint32(contents, part.targetY);
+			appendUint32(contents, part.sourceX);
+			appendUint32(contents, part.sourceY);
+			appendUint32(contents, part.width);
+			appendUint32(contents, part.height);
+		}
+	}
+}
+
+/** Reads whole file, used to compare outputs byte by byte. */
+static std::vector<char> readFile(const char* filePath)
+{
+	std::vector<char> contents;
+
+	FILE* file = fopen(filePath, "rb");
+	assert(file);
+
+	char buffer[4096];
+	size_t read = 0;
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		contents.insert(contents.end(), buffer, buffer + read);
+	}
+
+	fclose(file);
+	return contents;
+}
+
+/** Stores bytes in reverse order, enough to tell compressed blobs from stored ones. */
+class ReversingCodec : public BlobCodec
+{
+public:
+	uint32_t method() const
+	{
+		return 1;
+	}
+
+	bool compress(const char* data, size_t size, std::vector<char>& output)
+	{
+		output.assign(data, data + size);
+		std::reverse(output.begin(), output.end());
+		return true;
+	}
+
+	bool decompress(const char* data, size_t size, char* output, size_t rawSize)
+	{
+		if (size != rawSize) {
+			return false;
+		}
+
+		std::reverse_copy(data, data + size, output);
+		return true;
+	}
+};
+
+/** Compares extracted records against FfReader::getRecordData. */
+class CheckingSink : public RecordSink
+{
+public:
+	CheckingSink(FfReader& reader)
+		: reader(reader)
+		, records(0)
+		, frames(0)
+		, errors(0)
+	{ }
+
+	void onRecord(RecordId recordId, const std::string& name, const char* data, uint32_t size)
+	{
+		std::vector<char> expected;
+		assert(reader.getRecordData(recordId, expected));
+		assert(expected.size() == size && std::equal(expected.begin(), expected.end(), data));
+		assert(reader.findTocRecord(name)->recordId == recordId);
+		++records;
+	}
+
+	void onFrame(RecordId, const ImageFrame&, const char*, uint32_t)
+	{
+		++frames;
+	}
+
+	void onError(RecordId, const std::string&)
+	{
+		++errors;
+	}
+
+	FfReader& reader;
+	size_t records;
+	size_t frames;
+	size_t errors;
+};
+
+/** Reads every record and packed image of shared readers and compares results. */
+class SharedReadTask : public Task
+{
+public:
+	SharedReadTask(const FfReader& reader, const FfReader& lazyReader)
+		: reader(reader)
+		, lazyReader(lazyReader)
+		, failures(0)
+	{ }
+
+	void run()
+	{
+		const std::vector<std::string> names = reader.getNames();
+
+		for (size_t i = 0; i < names.size(); ++i) {
+			std::vector<char> data;
+			std::vector<char> lazyData;
+
+			if (!reader.getRecordData(names[i], data) || !lazyReader.getRecordData(names[i], lazyData)
+			    || data != lazyData) {
+				++failures;
+			}
+		}
+
+		const ImageIndices& images = reader.indexData.images;
+		for (size_t i = 0; i < images.packedInfo.size(); ++i) {
+			PackedImageCopy copy;
+			if (!lazyReader.getPackedImage(images.packedInfo[i].first, copy)
+			    || memcmp(copy.image.palette, reader.getPackedImage(images.packedInfo[i])->palette,
+			              paletteSize)) {
+				++failures;
+			}
+		}
+	}
+
+	const FfReader& reader;
+	const FfReader& lazyReader;
+	size_t failures;
+};
+
+/** Reads every record and frame through shared cache. */
+class CacheReadTask : public Task
+{
+public:
+	CacheReadTask(const FfReader& reader, AssetCache& cache)
+		: reader(reader)
+		, cache(cache)
+		, failures(0)
+	{ }
+
+	void run()
+	{
+		for (size_t i = 0; i < reader.recordNames.size(); ++i) {
+			std::vector<char> data;
+			std::vector<char> expected;
+
+			if (!cache.getRecordData(reader.recordNames.value(i), data)
+			    || !reader.getRecordData(reader.recordNames.value(i), expected) || data != expected) {
+				++failures;
+			}
+		}
+
+		const ImageIndices& images = reader.indexData.images;
+		for (size_t i = 0; i < images.ids.size(); ++i) {
+			CachedFrame frame;
+			if (!cache.getFrame(images.ids[i], images.names[i], frame)) {
+				++failures;
+			}
+		}
+	}
+
+	const FfReader& reader;
+	AssetCache& cache;
+	size_t failures;
+};
+
+/** Counts records reported by AsyncReader. */
+class CountingCallback : public ReadCallback
+{
+public:
+	CountingCallback()
+		: reads(0)
+		, errors(0)
+	{ }
+
+	void onRead(size_t, RecordId, const char*, uint32_t)
+	{
+		ScopedLock lock(mutex);
+		++reads;
+	}
+
+	void onError(size_t, RecordId)
+	{
+		ScopedLock lock(mutex);
+		++errors;
+	}
+
+	Mutex mutex;
+	size_t reads;
+	size_t errors;
+};
+
+/** Throws from every successful read. */
+class ThrowingCallback : public ReadCallback
+{
+public:
+	void onRead(size_t, RecordId, const char*, uint32_t)
+	{
+		throw std::runtime_error("Callback failed");
+	}
+
+	void onError(size_t, RecordId)
+	{ }
+};
+
+/** Collects statistics events of FfReader. */
+class RecordingHook : public FfReaderStatsHook
+{
+public:
+	RecordingHook()
+		: phases(0)
+		, bytes(0)
+		, lookups(0)
+	{ }
+
+	void onPhase(FfReaderPhase, double seconds)
+	{
+		assert(seconds >= 0.0);
+		++phases;
+	}
+
+	void onRead(uint64_t readBytes)
+	{
+		ScopedLock lock(mutex);
+		bytes += readBytes;
+	}
+
+	void onLookup(double)
+	{
+		ScopedLock lock(mutex);
+		++lookups;
+	}
+
+	Mutex mutex;
+	size_t phases;
+	uint64_t bytes;
+	size_t lookups;
+};
 
 int main()
 {
@@ -7,5 +345,1283 @@ int main()
 
 	assert(file.getNames().size() == 21);
 
+	const std::vector<std::string> names = file.getNames();
+	for (size_t i = 0; i < names.size(); ++i) {
+		const TocRecord* record = file.findTocRecord(names[i].c_str());
+		assert(record && record == file.findTocRecord(record->recordId));
+	}
+
+	assert(file.findTocRecord(NameList));
+	assert(!file.findTocRecord(static_cast<RecordId>(100000)));
+	assert(!file.findTocRecord("NOT_EXISTING.PNG"));
+
+	// Name index holds the same names in names list order
+	{
+		std::vector<std::string> indexNames;
+		const NameIndex& nameIndex = file.getNameIndex();
+
+		for (NameIndex::const_iterator it = nameIndex.begin(); it != nameIndex.end(); ++it) {
+			assert(it->nameLength == strlen(it->name));
+			assert(file.findTocRecord(it->name)->recordId == it->value);
+			indexNames.push_back(std::string(it->name, it->nameLength));
+		}
+
+		std::sort(indexNames.begin(), indexNames.end());
+		assert(indexNames == names);
+	}
+
+	{
+		// Names with explicit length do not need to be terminated
+		assert(file.findTocRecord("CITY1.PNG.EXTRA", 9) == file.findTocRecord("CITY1.PNG"));
+		assert(!file.findTocRecord("CITY1.PNG", 5));
+
+		RecordId recordId = 0;
+		PackedImageInfo packedInfo;
+		assert(file.findImageIndex("CITY1.PNG", 5, recordId, packedInfo));
+		assert(recordId == file.findTocRecord("CITY1.PNG")->recordId);
+		assert(!file.findAnimationIndex("ABIL0001", 8, packedInfo));
+	}
+
+#ifdef FFREADER_STRING_VIEW
+	{
+		const std::string_view name = std::string_view("CITY1.PNG.EXTRA").substr(0, 9);
+		assert(file.findTocRecord(name) == file.findTocRecord("CITY1.PNG"));
+
+		std::vector<char> viewData;
+		std::vector<char> nameData;
+		assert(file.getRecordData(name, viewData) && file.getRecordData("CITY1.PNG", nameData));
+		assert(viewData == nameData);
+
+		RecordId recordId = 0;
+		PackedImageInfo packedInfo;
+		assert(file.findImageIndex(std::string_view("CITY1"), recordId, packedInfo));
+		assert(!file.findAnimationIndex(std::string_view("CITY1"), packedInfo));
+	}
+#endif
+
+	FfReaderOptions options;
+	options.memoryMapped = true;
+
+	FfReader mapped("Icons.ff", options);
+
+	assert(mapped.isMemoryMapped());
+	assert(mapped.getNames().size() == 21);
+
+	std::vector<char> streamData;
+	std::vector<char> mappedData;
+	assert(file.getRecordData("CITY1.PNG", streamData));
+	assert(mapped.getRecordData("CITY1.PNG", mappedData));
+	assert(!mappedData.empty() && streamData == mappedData);
+
+	const RecordView view = mapped.getRecordView("CITY1.PNG");
+	assert(view.data && view.size == mappedData.size());
+	assert(std::equal(view.data, view.data + view.size, mappedData.begin()));
+	assert(!file.getRecordView("CITY1.PNG").data);
+	assert(!mapped.getRecordView("NOT_EXISTING.PNG").data);
+
+	const IndexData& index = file.indexData;
+	assert(!index.images.names.empty());
+	assert(index.images.names.size() == index.images.packedInfo.size());
+	assert(index.animations.names.empty());
+
+	for (size_t i = 0; i < index.images.names.size(); ++i) {
+		RecordId recordId = 0;
+		PackedImageInfo packedInfo;
+		assert(file.findImageIndex(index.images.names[i], recordId, packedInfo));
+		assert(recordId == index.images.ids[i] && packedInfo == index.images.packedInfo[i]);
+	}
+
+	{
+		RecordId recordId = 0;
+		PackedImageInfo packedInfo;
+		assert(!file.findImageIndex(std::string("NOT_EXISTING"), recordId, packedInfo));
+		assert(!file.findAnimationIndex("ABIL0001", packedInfo));
+	}
+
+	const PackedImage* eagerImage = file.getPackedImage(index.images.packedInfo.back());
+	assert(eagerImage && !eagerImage->frames.empty());
+
+	FfReaderOptions lazyOptions;
+	lazyOptions.lazyImages = true;
+	lazyOptions.imageCacheLimit = 2;
+
+	FfReader lazy("Icons.ff", lazyOptions);
+	assert(lazy.packedImages.empty());
+
+	for (size_t i = 0; i < index.images.packedInfo.size(); ++i) {
+		const PackedImage* expected = file.getPackedImage(index.images.packedInfo[i]);
+		const PackedImage* lazyImage = lazy.getPackedImage(index.images.packedInfo[i]);
+
+		assert(expected && lazyImage);
+		assert(!memcmp(lazyImage->palette, expected->palette, paletteSize));
+		assert(lazyImage->frames.size() == expected->frames.size());
+		assert(!strcmp(lazyImage->frames[0].name, expected->frames[0].name));
+		assert(lazyImage->frames[0].parts.size() == expected->frames[0].parts.size());
+	}
+
+	assert(lazy.imageCache.size() <= 2);
+	assert(!lazy.getPackedImage(1));
+
+	// Source image has right and left halves of the frame swapped
+	const char shuffled[] = { 3, 4, 1, 2,
+	                          7, 8, 5, 6 };
+
+	ImagePart parts[2] = { { 0, 0, 2, 0, 2, 2 },
+	                       { 2, 0, 0, 0, 2, 2 } };
+
+	ImageFrame frame("FRAME", 4, 2);
+	frame.parts.data = parts;
+	frame.parts.count = 2;
+
+	char unpacked[8] = { 0 };
+	assert(unpackFrame(frame, shuffled, 4, 2, 1, unpacked));
+	for (int i = 0; i < 8; ++i) {
+		assert(unpacked[i] == i + 1);
+	}
+
+	parts[1].targetY = 1;
+	assert(!unpackFrame(frame, shuffled, 4, 2, 1, unpacked));
+
+	PaletteTable palette;
+	assert(decodePalette(eagerImage->palette, palette, RgbaOrder, 0));
+
+	// Expand more pixels than a single vector step to cover both kernels
+	char indices[19];
+	for (int i = 0; i < 19; ++i) {
+		indices[i] = static_cast<char>(i * 13);
+	}
+
+	char rgba[19 * 4];
+	expandPalette(indices, 19, palette, rgba);
+
+	for (int i = 0; i < 19; ++i) {
+		const unsigned char index = static_cast<unsigned char>(indices[i]);
+		const char* color = &eagerImage->palette[11 + index * 4];
+
+		assert(rgba[i * 4] == color[2]);
+		assert(rgba[i * 4 + 1] == color[1]);
+		assert(rgba[i * 4 + 2] == color[0]);
+		assert(static_cast<unsigned char>(rgba[i * 4 + 3]) == (index ? 0xff : 0));
+	}
+
+	BlankPngDecoder decoder;
+
+	BatchOptions batchOptions;
+	batchOptions.threadsTotal = 4;
+	batchOptions.decoder = &decoder;
+
+	CheckingSink sink(file);
+	BatchExtractor extractor(mapped, batchOptions);
+
+	assert(extractor.extractAll(sink) == 21);
+	assert(sink.records == 21 && sink.errors == 0);
+	assert(sink.frames == index.images.names.size());
+
+	std::vector<std::string> batchNames;
+	batchNames.push_back("CITY1.PNG");
+	batchNames.push_back("NOT_EXISTING.PNG");
+
+	CheckingSink namedSink(file);
+	assert(BatchExtractor(file).extract(batchNames, namedSink) == 1);
+	assert(namedSink.records == 1 && namedSink.errors == 1);
+
+	// Lazy reader with small cache hands images to tasks as copies
+	CheckingSink lazySink(file);
+	assert(BatchExtractor(lazy, batchOptions).extractAll(lazySink) == 21);
+	assert(lazySink.records == 21 && lazySink.errors == 0);
+	assert(lazySink.frames == index.images.names.size());
+
+	// Throwing decoder fails records with images instead of dropping them
+	ThrowingPngDecoder throwingDecoder;
+	batchOptions.decoder = &throwingDecoder;
+
+	CheckingSink throwingSink(file);
+	const size_t throwingExtracted = BatchExtractor(mapped, batchOptions).extractAll(throwingSink);
+	assert(throwingSink.errors && throwingExtracted + throwingSink.errors == 21);
+	batchOptions.decoder = &decoder;
+
+	{
+		ThreadPool pool(4);
+		std::vector<SharedReadTask*> readTasks;
+
+		for (int i = 0; i < 16; ++i) {
+			readTasks.push_back(new SharedReadTask(file, lazy));
+			pool.submit(readTasks.back());
+		}
+
+		pool.wait();
+
+		for (size_t i = 0; i < readTasks.size(); ++i) {
+			assert(readTasks[i]->failures == 0);
+			delete readTasks[i];
+		}
+	}
+
+	{
+		// Scans visit used records in file order with the same contents as random reads
+		const FfReader* readers[2] = { &file, &mapped };
+
+		for (int i = 0; i < 2; ++i) {
+			ScanOptions scanOptions;
+			// Small buffer makes scanner refill it several times
+			scanOptions.bufferSize = 4096;
+
+			RecordScanner scanner(*readers[i], scanOptions);
+			ScannedRecord record;
+			uint32_t lastOffset = 0;
+			size_t named = 0;
+
+			while (scanner.next(record)) {
+				const TocRecord* tocRecord = readers[i]->findTocRecord(record.recordId);
+				assert(tocRecord && tocRecord->offset >= lastOffset);
+				assert(record.contents.data && record.header.used);
+				lastOffset = tocRecord->offset;
+
+				std::vector<char> data;
+				assert(readers[i]->getRecordData(*tocRecord, data));
+				assert(data.size() == record.contents.size);
+				assert(std::equal(data.begin(), data.end(), record.contents.data));
+
+				if (*record.name) {
+					assert(readers[i]->findTocRecord(record.name) == tocRecord);
+					++named;
+				}
+			}
+
+			assert(named == 21);
+		}
+	}
+
+	{
+		// Rebuild archive from records and packed images of the original one
+		FfWriterOptions writerOptions;
+		writerOptions.recordSlack = 16;
+		// Small buffer makes most records go directly from reader mapping
+		writerOptions.bufferSize = 4096;
+
+		FfWriter writer(writerOptions);
+		std::vector<RecordId> namedIds;
+
+		for (size_t i = 0; i < mapped.recordNames.size(); ++i) {
+			const std::string name = mapped.recordNames.name(i);
+			const RecordId recordId = mapped.recordNames.value(i);
+			namedIds.push_back(recordId);
+
+			if (name != "-INDEX.OPT" && name != "-IMAGES.OPT") {
+				const RecordView record = mapped.getRecordView(recordId);
+				assert(writer.addRecord(recordId, name, record.data, record.size));
+			}
+		}
+
+		for (size_t i = 0; i < mapped.tableOfContents.size(); ++i) {
+			const RecordId recordId = mapped.tableOfContents[i].recordId;
+
+			if (recordId != TableOfContents && recordId != NameList
+			    && std::find(namedIds.begin(), namedIds.end(), recordId) == namedIds.end()) {
+				const RecordView record = mapped.getRecordView(recordId);
+				assert(writer.addRecord(recordId, "", record.data, record.size));
+			}
+		}
+
+		assert(!writer.addRecord(NameList, "NAMES", NULL, 0));
+		assert(!writer.addRecord(100000, "CITY1.PNG", NULL, 0));
+
+		std::map<RelativeOffset, PackedImageInfo> rebuiltImages;
+		for (size_t i = 0; i < file.packedImages.size(); ++i) {
+			rebuiltImages[file.packedImageOffsets[i]] = writer.addPackedImage(file.packedImages[i]);
+		}
+
+		for (size_t i = 0; i < index.images.ids.size(); ++i) {
+			writer.addImageIndex(index.images.ids[i], index.images.names[i],
+			                     rebuiltImages[index.images.packedInfo[i].first]);
+		}
+
+		assert(writer.write("FfWriterTest.ff"));
+
+		FfReader rebuilt("FfWriterTest.ff");
+		assert(rebuilt.getNames() == file.getNames());
+		assert(rebuilt.tableOfContents.size() == file.tableOfContents.size());
+
+		for (size_t i = 0; i < names.size(); ++i) {
+			std::vector<char> expected;
+			std::vector<char> data;
+			assert(file.getRecordData(names[i], expected) && rebuilt.getRecordData(names[i], data));
+			assert(data == expected);
+		}
+
+		assert(rebuilt.indexData.images.ids == index.images.ids);
+		assert(rebuilt.packedImageOffsets == file.packedImageOffsets);
+
+		// Smaller contents are patched in place
+		std::vector<char> data;
+		std::vector<char> patch(100, 'x');
+		const TocRecord allocation = *rebuilt.findTocRecord("CITY1.PNG");
+		const uint64_t rebuiltSize = rebuilt.recordFile.size();
+
+		assert(FfWriter::patchRecord("FfWriterTest.ff", "CITY1.PNG", &patch[0], 100));
+		{
+			FfReader patched("FfWriterTest.ff");
+			assert(patched.recordFile.size() == rebuiltSize);
+			assert(patched.getRecordData("CITY1.PNG", data) && data == patch);
+		}
+
+		// Larger contents are moved to the end of file
+		patch.assign(allocation.sizeAllocated + 1, 'y');
+		assert(FfWriter::patchRecord("FfWriterTest.ff", "CITY1.PNG", &patch[0],
+		                             static_cast<uint32_t>(patch.size())));
+		{
+			FfReader patched("FfWriterTest.ff");
+			assert(patched.recordFile.size() > rebuiltSize);
+			assert(patched.getRecordData("CITY1.PNG", data) && data == patch);
+			assert(patched.getRecordData("ICONABIL.PNG", data) && file.getRecordData("ICONABIL.PNG", patch));
+			assert(data == patch);
+		}
+
+		assert(!FfWriter::patchRecord("FfWriterTest.ff", "NOT_EXISTING.PNG", NULL, 0));
+		remove("FfWriterTest.ff");
+	}
+
+	{
+		// Mod archive overrides one record of the base archive and adds a new one
+		const std::vector<char> modContents(10, 'm');
+
+		FfWriter modWriter;
+		assert(modWriter.addRecord(3, "CITY1.PNG", modContents));
+		assert(modWriter.addRecord(4, "MOD.PNG", modContents));
+		assert(modWriter.write("FfArchiveSetTest.ff"));
+
+		FfArchiveSet archives;
+		assert(archives.mount(file) == 0);
+		assert(archives.mount("FfArchiveSetTest.ff") == 1);
+		assert(archives.size() == 2 && archives.namesTotal() == 22);
+
+		const ArchiveRecord* city = archives.find("CITY1.PNG");
+		assert(city && city->archiveIndex == 1 && city->recordId == 3);
+		assert(&archives.archive(1) == city->reader);
+
+		const ArchiveRecord* icon = archives.find(std::string("ICONABIL.PNG"));
+		assert(icon && icon->reader == &file && icon->recordId == file.findTocRecord("ICONABIL.PNG")->recordId);
+
+		std::vector<char> data;
+		assert(archives.getRecordData("MOD.PNG", data) && data == modContents);
+		assert(archives.getRecordData("CITY1.PNG", data) && data == modContents);
+		assert(!archives.find("NOT_EXISTING.PNG"));
+		assert(!archives.getRecordView("CITY1.PNG").data);
+
+		// Merged names can be queried as well
+		std::vector<NameIndex::Item> modMatches;
+		assert(NameQuery(archives.getNameIndex()).findPrefix("MOD", 3, modMatches) == 1);
+		assert(archives.record(modMatches[0].value).archiveIndex == 1);
+
+		remove("FfArchiveSetTest.ff");
+	}
+
+	{
+		AssetCacheOptions cacheOptions;
+		cacheOptions.decoder = &decoder;
+		cacheOptions.shardsTotal = 4;
+
+		AssetCache cache(file, cacheOptions);
+
+		std::vector<char> data;
+		assert(cache.getRecordData(file.findTocRecord("CITY1.PNG")->recordId, data));
+		assert(data == streamData);
+		assert(cache.getRecordData(file.findTocRecord("CITY1.PNG")->recordId, data));
+		assert(data == streamData);
+		assert(!cache.getRecordData(100000, data));
+
+		AssetCacheStats stats = cache.stats();
+		assert(stats.hits == 1 && stats.misses == 2 && stats.entries == 1);
+
+		// Frames of packed images are named after their index entries
+		CachedFrame frame;
+		assert(cache.getFrame(index.images.ids[0], index.images.names[0], frame));
+		assert(frame.bytesPerPixel == 1 && frame.width && frame.height);
+		assert(frame.pixels.size() == frame.width * frame.height);
+		assert(!cache.getFrame(index.images.ids[0], "NOT_EXISTING", frame));
+
+		{
+			ThreadPool pool(4);
+			std::vector<CacheReadTask*> cacheTasks;
+
+			for (int i = 0; i < 8; ++i) {
+				cacheTasks.push_back(new CacheReadTask(file, cache));
+				pool.submit(cacheTasks.back());
+			}
+
+			pool.wait();
+
+			for (size_t i = 0; i < cacheTasks.size(); ++i) {
+				assert(cacheTasks[i]->failures == 0);
+				delete cacheTasks[i];
+			}
+		}
+
+		stats = cache.stats();
+		assert(stats.hits > stats.misses && !stats.evictions);
+
+		// Budget fits only a few records, the rest is evicted
+		cacheOptions.byteBudget = 16 * 1024;
+		cacheOptions.shardsTotal = 1;
+
+		AssetCache smallCache(file, cacheOptions);
+		CacheReadTask smallTask(file, smallCache);
+		smallTask.run();
+
+		stats = smallCache.stats();
+		assert(smallTask.failures == 0 && stats.evictions && stats.bytes <= 16 * 1024);
+
+		smallCache.clear();
+		assert(smallCache.stats().entries == 0);
+	}
+
+	{
+		// Every record in one coalesced read, then every record on its own
+		const uint32_t gaps[2] = { 1024 * 1024, 0 };
+
+		for (int i = 0; i < 2; ++i) {
+			AsyncReadOptions asyncOptions;
+			asyncOptions.coalesceGap = gaps[i];
+
+			AsyncReader asyncReader(file, asyncOptions);
+			ReadBatch batch;
+
+			for (size_t j = 0; j < names.size(); ++j) {
+				assert(batch.add(names[j]) == j);
+			}
+
+			const size_t missing = batch.add("NOT_EXISTING.PNG");
+			const size_t byId = batch.add(file.findTocRecord("CITY1.PNG")->recordId);
+
+			CountingCallback callback;
+			asyncReader.submit(batch, &callback);
+			batch.wait();
+
+			assert(batch.isDone() && callback.reads == names.size() + 1 && callback.errors == 1);
+			assert(!batch.succeeded(missing));
+			assert(batch.succeeded(byId) && batch.data(byId) == streamData);
+
+			for (size_t j = 0; j < names.size(); ++j) {
+				std::vector<char> expected;
+				assert(file.getRecordData(names[j], expected));
+				assert(batch.succeeded(j) && batch.data(j) == expected);
+			}
+
+			// Throwing callback fails its requests, batch still finishes
+			ReadBatch throwingBatch;
+			for (size_t j = 0; j < names.size(); ++j) {
+				throwingBatch.add(names[j]);
+			}
+
+			ThrowingCallback throwingCallback;
+			asyncReader.submit(throwingBatch, &throwingCallback);
+			throwingBatch.wait();
+
+			for (size_t j = 0; j < names.size(); ++j) {
+				assert(!throwingBatch.succeeded(j));
+			}
+		}
+	}
+
+	{
+		PatternPngDecoder patternDecoder;
+
+		AnimationOptions animationOptions;
+		animationOptions.decoder = &patternDecoder;
+
+		AnimationDecoder animations(file, animationOptions);
+		assert(animations.animationsTotal() == 0);
+
+		// Multi-frame image, every frame is unpacked from the same record
+		const PackedImage* abil = file.getPackedImage(index.images.packedInfo[0]);
+		assert(!strcmp(index.images.names[0], "ABIL0001") && abil->frames.size() == 11);
+
+		AnimationStrip strip;
+		assert(animations.decode("ABIL0001", strip));
+		assert(strip.palette == abil->palette && strip.bytesPerPixel == 1);
+		assert(strip.frames.size() == 11 && strip.cellsTotal == 11);
+		assert(strip.width == 11 * 31 && strip.height == 36);
+
+		std::vector<char> sourceData;
+		std::vector<char> sourcePixels;
+		uint32_t sourceWidth = 0;
+		uint32_t sourceHeight = 0;
+		uint32_t bytesPerPixel = 0;
+		assert(file.getRecordData(index.images.ids[0], sourceData));
+		assert(patternDecoder.decode(&sourceData[0], static_cast<uint32_t>(sourceData.size()),
+		                             sourcePixels, sourceWidth, sourceHeight, bytesPerPixel));
+
+		for (size_t i = 0; i < strip.frames.size(); ++i) {
+			const ImageFrame& frame = abil->frames[i];
+			const AnimationFrame& stripFrame = strip.frames[i];
+			assert(!strcmp(stripFrame.name, frame.name) && stripFrame.cell == i);
+
+			std::vector<char> framePixels(frame.width * frame.height);
+			assert(unpackFrame(frame, &sourcePixels[0], sourceWidth, sourceHeight, 1,
+			                   &framePixels[0]));
+
+			for (uint32_t y = 0; y < frame.height; ++y) {
+				assert(!memcmp(&strip.pixels[(stripFrame.y + y) * strip.width + stripFrame.x],
+				               &framePixels[y * frame.width], frame.width));
+			}
+		}
+
+		// Atlas unpacked on a pool holds the same frames
+		ThreadPool pool(4);
+		animationOptions.pool = &pool;
+		animationOptions.layout = AtlasLayout;
+
+		AnimationDecoder atlasAnimations(file, animationOptions);
+		AnimationStrip atlas;
+		assert(atlasAnimations.decode(std::string("ABIL0001"), atlas));
+		assert(atlas.width == 4 * 31 && atlas.height == 3 * 36);
+
+		for (size_t i = 0; i < atlas.frames.size(); ++i) {
+			const AnimationFrame& atlasFrame = atlas.frames[i];
+			const AnimationFrame& stripFrame = strip.frames[i];
+
+			for (uint32_t y = 0; y < atlasFrame.height; ++y) {
+				assert(!memcmp(&atlas.pixels[(atlasFrame.y + y) * atlas.width + atlasFrame.x],
+				               &strip.pixels[(stripFrame.y + y) * strip.width + stripFrame.x],
+				               atlasFrame.width));
+			}
+		}
+
+		AnimationStrip missing;
+		assert(!animations.decode("NOT_EXISTING", missing));
+
+		// Animation in '-ANIMS.OPT' repeats its first frame, the repeat shares the first cell
+		std::vector<const ImageFrame*> animationFrames;
+		animationFrames.push_back(&abil->frames[0]);
+		animationFrames.push_back(&abil->frames[1]);
+		animationFrames.push_back(&abil->frames[0]);
+
+		std::vector<char> animsContents;
+		appendPackedImage(animsContents, abil->palette, animationFrames);
+
+		FfWriter animationWriter;
+		assert(animationWriter.addRecord(10, "ABIL.PNG", sourceData));
+		assert(animationWriter.addRecord(11, "-ANIMS.OPT", animsContents));
+
+		const PackedImageInfo abilInfo = animationWriter.addPackedImage(*abil);
+		animationWriter.addImageIndex(10, "ABIL0001", abilInfo);
+		animationWriter.addImageIndex(10, "ABIL0002", abilInfo);
+		animationWriter.addAnimationIndex("ABILANIM", PackedImageInfo(0, static_cast<uint32_t>(
+		                                                                     animsContents.size())));
+		assert(animationWriter.write("AnimationTest.ff"));
+
+		{
+			FfReader animationReader("AnimationTest.ff");
+			animationOptions.pool = NULL;
+			animationOptions.layout = StripLayout;
+
+			AnimationDecoder readerAnimations(animationReader, animationOptions);
+			assert(readerAnimations.animationsTotal() == 1);
+
+			PackedImageInfo animationInfo;
+			assert(animationReader.findAnimationIndex(std::string("ABILANIM"), animationInfo));
+			assert(animationInfo.first == 0 && animationInfo.second == animsContents.size());
+
+			AnimationStrip animation;
+			assert(readerAnimations.decode("ABILANIM", animation));
+			assert(animation.frames.size() == 3 && animation.cellsTotal == 2);
+			assert(animation.frames[2].cell == 0 && animation.frames[2].x == animation.frames[0].x);
+			assert(animation.width == 2 * 31 && animation.height == 36);
+			assert(!memcmp(animation.palette, abil->palette, paletteSize));
+
+			for (uint32_t y = 0; y < animation.height; ++y) {
+				assert(!memcmp(&animation.pixels[y * animation.width], &strip.pixels[y * strip.width],
+				               animation.width));
+			}
+		}
+
+		remove("AnimationTest.ff");
+
+		// Decoding serialized image gives back the same parts, truncated contents are rejected
+		PackedImageCopy decoded;
+		assert(FfReader::decodePackedImage(&animsContents[0],
+		                                   static_cast<uint32_t>(animsContents.size()), 0, decoded));
+		assert(decoded.image.frames.size() == 3);
+
+		for (size_t i = 0; i < decoded.image.frames.size(); ++i) {
+			const ImageFrame& frame = decoded.image.frames[i];
+			const ImageFrame& expected = *animationFrames[i];
+
+			assert(!strcmp(frame.name, expected.name) && frame.parts.size() == expected.parts.size());
+			assert(!memcmp(frame.parts.data, expected.parts.data,
+			               expected.parts.size() * sizeof(ImagePart)));
+		}
+
+		// Swapped image keeps views into the arrays it now owns
+		const ImagePart* decodedParts = &decoded.parts[0];
+		PackedImageCopy swapped;
+		swapped.swap(decoded);
+		assert(decoded.image.frames.empty() && decoded.parts.empty());
+		assert(swapped.image.frames.data == &swapped.frames[0]);
+		assert(swapped.image.frames[0].parts.data == decodedParts && decodedParts == &swapped.parts[0]);
+
+#ifdef FFREADER_CXX11
+		PackedImageCopy moved(std::move(swapped));
+		assert(moved.image.frames[0].parts.data == decodedParts && swapped.parts.empty());
+
+		swapped = std::move(moved);
+		assert(swapped.image.frames[0].parts.data == decodedParts && moved.parts.empty());
+#endif
+
+		for (size_t size = 0; size < animsContents.size(); ++size) {
+			assert(!FfReader::decodePackedImage(&animsContents[0], static_cast<uint32_t>(size), 0,
+			                                    decoded));
+		}
+	}
+
+	{
+		PatternPngDecoder patternDecoder;
+
+		AtlasOptions atlasOptions;
+		atlasOptions.decoder = &patternDecoder;
+		atlasOptions.pageWidth = 256;
+		atlasOptions.pageHeight = 256;
+		atlasOptions.transparentIndex = 0;
+
+		// Frames of every image, eleven ABIL images share one packed image
+		TextureAtlas atlas;
+		assert(buildTextureAtlas(file, atlasOptions, atlas));
+		assert(atlas.pages.size() > 1 && atlas.regions.size() == 33);
+
+		for (size_t i = 0; i < atlas.regions.size(); ++i) {
+			const AtlasRegion& region = atlas.regions[i];
+			const AtlasPage& page = atlas.pages[region.page];
+			assert(atlas.findRegion(region.name) == &region);
+			assert(region.x + region.width <= page.width && region.y + region.height <= page.height);
+			assert(region.u1 * page.width == region.x + region.width);
+
+			for (size_t j = 0; j < i; ++j) {
+				const AtlasRegion& other = atlas.regions[j];
+				assert(other.page != region.page || other.x >= region.x + region.width
+				       || region.x >= other.x + other.width || other.y >= region.y + region.height
+				       || region.y >= other.y + other.height);
+			}
+
+			// Frames are named after images, compare with frame unpacked on its own
+			size_t entry = 0;
+			while (strcmp(index.images.names[entry], region.name.c_str())) {
+				++entry;
+			}
+
+			const PackedImage* image = file.getPackedImage(index.images.packedInfo[entry]);
+			const ImageFrame* frame = image->frames.begin();
+			while (strcmp(frame->name, region.name.c_str())) {
+				++frame;
+			}
+
+			std::vector<char> sourceData;
+			std::vector<char> sourcePixels;
+			uint32_t sourceWidth = 0;
+			uint32_t sourceHeight = 0;
+			uint32_t bytesPerPixel = 0;
+			assert(file.getRecordData(index.images.ids[entry], sourceData));
+			assert(patternDecoder.decode(&sourceData[0], static_cast<uint32_t>(sourceData.size()),
+			                             sourcePixels, sourceWidth, sourceHeight, bytesPerPixel));
+
+			std::vector<char> framePixels(frame->width * frame->height);
+			assert(unpackFrame(*frame, &sourcePixels[0], sourceWidth, sourceHeight, 1,
+			                   &framePixels[0]));
+
+			PaletteTable palette;
+			assert(decodePalette(image->palette, palette, RgbaOrder, 0));
+
+			std::vector<char> expected(framePixels.size() * 4);
+			expandPalette(&framePixels[0], frame->width, frame->height, palette, &expected[0]);
+
+			for (uint32_t y = 0; y < region.height; ++y) {
+				assert(!memcmp(&page.pixels[((region.y + y) * page.width + region.x) * 4],
+				               &expected[y * region.width * 4], region.width * 4));
+			}
+		}
+
+		assert(saveTextureAtlas(atlas, "TextureAtlasTest.ffatlas"));
+
+		TextureAtlas loaded;
+		assert(loadTextureAtlas("TextureAtlasTest.ffatlas", loaded));
+		assert(loaded.pages.size() == atlas.pages.size());
+		assert(loaded.regions.size() == atlas.regions.size());
+
+		for (size_t i = 0; i < loaded.pages.size(); ++i) {
+			assert(loaded.pages[i].height == atlas.pages[i].height);
+			assert(loaded.pages[i].pixels == atlas.pages[i].pixels);
+		}
+
+		for (size_t i = 0; i < loaded.regions.size(); ++i) {
+			assert(loaded.regions[i].name == atlas.regions[i].name);
+			assert(loaded.regions[i].x == atlas.regions[i].x && loaded.regions[i].v1 == atlas.regions[i].v1);
+		}
+
+		remove("TextureAtlasTest.ffatlas");
+		assert(!loadTextureAtlas("TextureAtlasTest.ffatlas", loaded));
+
+		// Selected images only, unknown names and frames larger than a page fail
+		std::vector<std::string> imageNames;
+		imageNames.push_back("CITY1");
+		imageNames.push_back("LOGOHU");
+
+		assert(buildTextureAtlas(file, imageNames, atlasOptions, atlas));
+		assert(atlas.pages.size() == 1 && atlas.regions.size() == 6 && atlas.findRegion("LOGOEL"));
+
+		imageNames.push_back("NOT_EXISTING");
+		assert(!buildTextureAtlas(file, imageNames, atlasOptions, atlas) && atlas.regions.empty());
+
+		atlasOptions.pageWidth = 100;
+		assert(!buildTextureAtlas(file, atlasOptions, atlas));
+	}
+
+	{
+		PatternPngDecoder patternDecoder;
+
+		ExportOptions exportOptions;
+		exportOptions.decoder = &patternDecoder;
+		exportOptions.transparentIndex = 0;
+		exportOptions.threadsTotal = 1;
+
+		ExportResult result;
+		assert(exportAssets(file, "ExportTest.ffexport", exportOptions, &result));
+		assert(result.framesTotal == 33 && result.framesEncoded == 33 && !result.errors);
+
+		// Output does not depend on number of workers
+		const std::vector<char> exported = readFile("ExportTest.ffexport");
+		exportOptions.threadsTotal = 4;
+		assert(exportAssets(file, "ExportTest.ffexport", exportOptions));
+		assert(readFile("ExportTest.ffexport") == exported);
+
+		{
+			// Throwing decoder fails its records, export does not wait for them forever
+			ThrowingPngDecoder throwingDecoder;
+			ExportOptions throwingOptions = exportOptions;
+			throwingOptions.decoder = &throwingDecoder;
+
+			ExportResult throwingResult;
+			exportAssets(file, "ExportTestThrowing.ffexport", throwingOptions, &throwingResult);
+			assert(throwingResult.errors && !throwingResult.framesEncoded);
+			remove("ExportTestThrowing.ffexport");
+		}
+
+		// Frames hold the same pixels as atlas built with the same settings
+		AtlasOptions atlasOptions;
+		atlasOptions.decoder = &patternDecoder;
+		atlasOptions.pageWidth = 256;
+		atlasOptions.pageHeight = 256;
+		atlasOptions.transparentIndex = 0;
+
+		TextureAtlas atlas;
+		assert(buildTextureAtlas(file, atlasOptions, atlas));
+
+		ExportArchive archive;
+		assert(archive.open("ExportTest.ffexport"));
+		assert(archive.getEntries().size() == atlas.regions.size());
+
+		for (size_t i = 0; i < archive.getEntries().size(); ++i) {
+			const ExportEntry& entry = archive.getEntries()[i];
+			assert(entry.offset % 64 == 0 && archive.findEntry(entry.name) == &entry);
+			assert(file.findTocRecord(entry.recordId));
+
+			std::vector<char> pixels;
+			assert(archive.readPixels(entry, pixels) && pixels.size() == entry.rawSize);
+
+			const AtlasRegion* region = atlas.findRegion(entry.name);
+			const AtlasPage& page = atlas.pages[region->page];
+			assert(region->width == entry.width && region->height == entry.height);
+
+			for (uint32_t y = 0; y < entry.height; ++y) {
+				assert(!memcmp(&page.pixels[((region->y + y) * page.width + region->x) * 4],
+				               &pixels[y * entry.width * 4], entry.width * 4));
+			}
+		}
+
+		// Unchanged frames are copied from previous export, giving the same file
+		exportOptions.previousExport = &archive;
+		assert(exportAssets(file, "ExportTestIncremental.ffexport", exportOptions, &result));
+		assert(result.framesReused == 33 && result.framesEncoded == 0);
+		assert(readFile("ExportTestIncremental.ffexport") == exported);
+
+		// Frames compressed differently are encoded again
+		ReversingCodec codec;
+		exportOptions.codec = &codec;
+		assert(exportAssets(file, "ExportTestIncremental.ffexport", exportOptions, &result));
+		assert(result.framesReused == 0 && result.framesEncoded == 33);
+
+		ExportArchive compressed;
+		assert(compressed.open("ExportTestIncremental.ffexport"));
+
+		const ExportEntry* entry = compressed.findEntry("CITY1");
+		std::vector<char> pixels;
+		std::vector<char> storedPixels;
+		assert(entry && entry->compression == codec.method());
+		assert(!compressed.readPixels(*entry, pixels));
+		assert(compressed.readPixels(*entry, pixels, &codec));
+		assert(archive.readPixels(*archive.findEntry("CITY1"), storedPixels) && pixels == storedPixels);
+
+		compressed.close();
+		archive.close();
+		remove("ExportTestIncremental.ffexport");
+
+		// Damaged index is rejected
+		FILE* damaged = fopen("ExportTest.ffexport", "r+b");
+		assert(damaged);
+		fseek(damaged, -1, SEEK_END);
+		fputc(0x7f, damaged);
+		fclose(damaged);
+		assert(!archive.open("ExportTest.ffexport"));
+		remove("ExportTest.ffexport");
+	}
+
+	{
+		// Refresh parses again only what changed
+		const std::vector<char> original = readFile("Icons.ff");
+		FILE* copy = fopen("RefreshTest.ff", "wb");
+		assert(copy && fwrite(&original[0], 1, original.size(), copy) == original.size());
+		fclose(copy);
+
+		FfReaderOptions refreshOptions;
+		refreshOptions.memoryMapped = true;
+		FfReader mappedRefreshed("RefreshTest.ff", refreshOptions);
+
+		refreshOptions.memoryMapped = false;
+		refreshOptions.lazyImages = true;
+		FfReader lazyRefreshed("RefreshTest.ff", refreshOptions);
+
+		// Decoded image is kept in lazy cache across refresh
+		const RelativeOffset cachedOffset = file.packedImageOffsets[0];
+		assert(lazyRefreshed.getPackedImage(cachedOffset));
+
+		FfArchiveSet refreshedArchives;
+		refreshedArchives.mount(mappedRefreshed);
+
+		// Unchanged file keeps records and views handed out before
+		const TocRecord* keptRecord = mappedRefreshed.findTocRecord("ICONABIL.PNG");
+		const RecordView keptView = mappedRefreshed.getRecordView("ICONABIL.PNG");
+
+		RefreshResult refreshResult;
+		assert(!mappedRefreshed.refresh(&refreshResult) && !refreshResult.recordsChanged);
+		assert(!refreshResult.namesReparsed && !refreshResult.indexReparsed);
+		assert(mappedRefreshed.findTocRecord("ICONABIL.PNG") == keptRecord);
+		assert(mappedRefreshed.getRecordView("ICONABIL.PNG").data == keptView.data);
+
+		std::vector<char> archiveData;
+		std::vector<char> expectedData;
+		assert(refreshedArchives.getRecordData("ICONABIL.PNG", archiveData));
+		assert(file.getRecordData("ICONABIL.PNG", expectedData) && archiveData == expectedData);
+
+		// Larger contents move the record to the end of file, other records stay in place
+		std::vector<char> patch(file.findTocRecord("CITY1.PNG")->sizeAllocated + 1, 'r');
+		assert(FfWriter::patchRecord("RefreshTest.ff", "CITY1.PNG", &patch[0],
+		                             static_cast<uint32_t>(patch.size())));
+
+		FfReader* refreshedReaders[] = {&mappedRefreshed, &lazyRefreshed};
+		for (size_t i = 0; i < 2; ++i) {
+			FfReader& refreshed = *refreshedReaders[i];
+
+			refreshResult = RefreshResult();
+			assert(refreshed.refresh(&refreshResult) && refreshResult.recordsChanged);
+			assert(!refreshResult.namesReparsed && !refreshResult.indexReparsed
+			       && !refreshResult.imagesReparsed);
+
+			std::vector<char> data;
+			assert(refreshed.getRecordData("CITY1.PNG", data) && data == patch);
+			assert(refreshed.getNames() == file.getNames());
+
+			const IndexData& refreshedIndex = refreshed.indexData;
+			assert(refreshedIndex.images.names.size() == file.indexData.images.names.size());
+			for (size_t j = 0; j < refreshedIndex.images.names.size(); ++j) {
+				assert(!strcmp(refreshedIndex.images.names[j], file.indexData.images.names[j]));
+			}
+
+			const PackedImage* refreshedImage = refreshed.getPackedImage(cachedOffset);
+			const PackedImage* originalImage = file.getPackedImage(cachedOffset);
+			assert(refreshedImage && originalImage);
+			assert(!memcmp(refreshedImage->palette, originalImage->palette, paletteSize));
+			assert(!strcmp(refreshedImage->frames[0].name, originalImage->frames[0].name));
+
+			assert(!refreshed.refresh());
+		}
+
+		const RecordView patchedView = mappedRefreshed.getRecordView("CITY1.PNG");
+		assert(patchedView.size == patch.size() && !memcmp(patchedView.data, &patch[0], patch.size()));
+
+		// Mounted archive resolves records of refreshed reader
+		assert(refreshedArchives.getRecordData("CITY1.PNG", archiveData) && archiveData == patch);
+		assert(refreshedArchives.getRecordData("ICONABIL.PNG", archiveData));
+		assert(archiveData == expectedData);
+
+		const RecordView archiveView = refreshedArchives.getRecordView("CITY1.PNG");
+		assert(archiveView.size == patch.size() && !memcmp(archiveView.data, &patch[0], patch.size()));
+
+		refreshedArchives.remount();
+		assert(refreshedArchives.namesTotal() == file.getNames().size());
+		assert(refreshedArchives.find("CITY1.PNG")->reader == &mappedRefreshed);
+		remove("RefreshTest.ff");
+	}
+
+	{
+		// Content hash matches XXH64
+		assert(contentHash("", 0) == UINT64_C(0xef46db3751d8e999));
+		assert(contentHash("abc", 3) == UINT64_C(0x44bc2cf5ad770999));
+		const char sentence[] = "Nobody inspects the spammish repetition";
+		assert(contentHash(sentence, sizeof(sentence) - 1) == UINT64_C(0xfbcea83c8a378bf1));
+
+		// Identical contents are found under other names and without a name
+		const std::vector<char> shared(100, 'd');
+		const std::vector<char> unique(100, 'u');
+
+		FfWriter writer;
+		assert(writer.addRecord(10, "FIRST.PNG", shared));
+		assert(writer.addRecord(11, "SECOND.PNG", shared));
+		assert(writer.addRecord(12, "THIRD.PNG", unique));
+		assert(writer.addRecord(13, "", shared));
+		assert(writer.write("ContentIndexTest.ff"));
+
+		ContentIndexOptions contentOptions;
+		contentOptions.threadsTotal = 3;
+
+		FfReader duplicated("ContentIndexTest.ff");
+		ContentIndex contents;
+		assert(contents.build(duplicated, contentOptions));
+		assert(contents.size() == 4);
+		assert(contents.duplicatesTotal() == 2 && contents.duplicateBytes() == 200);
+
+		const ArrayView<ContentRecord> same = contents.findDuplicates(0, 11);
+		assert(same.size() == 3 && same[0].recordId == 10 && same[1].recordId == 11
+		       && same[2].recordId == 13);
+		assert(same[0].hash == contentHash(&shared[0], shared.size()));
+		assert(contents.findDuplicates(0, 12).size() == 1);
+		assert(contents.findDuplicates(0, 14).empty() && !contents.findRecord(1, 10));
+		assert(contents.find(contentHash(&unique[0], unique.size()), 100).size() == 1);
+		assert(contents.find(contentHash(&unique[0], unique.size()), 99).empty());
+
+		// Archive mounted twice repeats every record
+		ContentIndex single;
+		assert(single.build(file));
+
+		FfArchiveSet archives;
+		archives.mount(file);
+		archives.mount(file);
+
+		ContentIndex merged;
+		assert(merged.build(archives, contentOptions));
+		assert(merged.size() == 2 * single.size());
+		assert(merged.duplicatesTotal() == single.size() + single.duplicatesTotal());
+
+		const RecordId iconId = file.findTocRecord("ICONABIL.PNG")->recordId;
+		const ArrayView<ContentRecord> mounted = merged.findDuplicates(1, iconId);
+		assert(mounted.size() >= 2 && mounted[0].archiveIndex == 0);
+		remove("ContentIndexTest.ff");
+	}
+
+	{
+		NameIndex units;
+		assert(units.insert("G000UU0002", 10, 2));
+		assert(units.insert("G000UU0001", 10, 1));
+		assert(units.insert("G000AA0001", 10, 3));
+		assert(units.insert("XG000UU", 7, 4));
+		assert(units.insert("UU", 2, 5));
+
+		NameQuery query(units);
+		std::vector<NameIndex::Item> matches;
+
+		// Prefix matches come in name order
+		assert(query.findPrefix("G000UU", matches) == 2);
+		assert(!strcmp(matches[0].name, "G000UU0001") && matches[0].value == 1);
+		assert(!strcmp(matches[1].name, "G000UU0002") && matches[1].value == 2);
+		assert(query.findPrefix("", matches) == units.size());
+		assert(!query.findPrefix("G000UU00010", matches) && !query.findPrefix("Z", matches));
+
+		// Substring matches come in names insertion order
+		assert(query.findSubstring("000UU", matches) == 3);
+		assert(matches[0].value == 2 && matches[1].value == 1 && matches[2].value == 4);
+		assert(query.findSubstring("UU", matches) == 4);
+		assert(!query.findSubstring("UUU", matches) && !query.findSubstring("000BB", matches));
+
+		// Every substring of every name is found with and without trigrams
+		NameQueryOptions scanOptions;
+		scanOptions.trigrams = false;
+
+		const NameIndex& iconNames = file.getNameIndex();
+		NameQuery indexed(iconNames);
+		NameQuery scanned(iconNames, scanOptions);
+		assert(scanned.memoryUsed() < indexed.memoryUsed());
+
+		std::vector<NameIndex::Item> expected;
+
+		for (size_t i = 0; i < iconNames.size(); ++i) {
+			const std::string name(iconNames.name(i), iconNames.nameLength(i));
+
+			for (size_t length = 1; length <= 5 && length <= name.size(); ++length) {
+				const std::string part = name.substr(name.size() - length);
+
+				indexed.findSubstring(part, matches);
+				scanned.findSubstring(part, expected);
+				assert(!matches.empty() && matches.size() == expected.size());
+
+				for (size_t j = 0; j < matches.size(); ++j) {
+					assert(matches[j].value == expected[j].value);
+				}
+
+				assert(indexed.findPrefix(name.substr(0, length), matches));
+			}
+		}
+	}
+
+#ifndef FFREADER_NO_STATS
+	{
+		RecordingHook hook;
+
+		FfReaderOptions statsOptions;
+		statsOptions.timeLookups = true;
+		statsOptions.statsHook = &hook;
+
+		FfReader statsReader("Icons.ff", statsOptions);
+		assert(hook.phases == 5 && !strcmp(ffReaderPhaseName(TableOfContentsPhase), "toc"));
+
+		FfReaderStats stats = statsReader.getStats();
+		assert(stats.bytesRead == hook.bytes && stats.readCalls && stats.seeks);
+		assert(stats.mappedBytes == 0);
+
+		// Parsing looks up special records too
+		const uint64_t openLookups = stats.lookups;
+		assert(stats.metadataBytes && stats.peakMetadataBytes >= stats.metadataBytes);
+
+		const TocRecord* city = statsReader.findTocRecord("CITY1.PNG");
+		assert(city && statsReader.getRecordData(city->recordId, streamData));
+		assert(!statsReader.findTocRecord("NOT_EXISTING.PNG"));
+
+		stats = statsReader.getStats();
+		assert(stats.lookups == openLookups + 3 && hook.lookups == stats.lookups);
+		assert(stats.bytesRead == hook.bytes);
+
+		uint64_t timedLookups = 0;
+		for (size_t i = 0; i < lookupLatencyBuckets; ++i) {
+			timedLookups += stats.lookupLatency[i];
+		}
+		assert(timedLookups == stats.lookups);
+
+		{
+			// Coalesced reads of AsyncReader are counted as well
+			AsyncReadOptions asyncOptions;
+			asyncOptions.coalesceGap = 1024 * 1024;
+
+			AsyncReader asyncReader(statsReader, asyncOptions);
+			ReadBatch batch;
+			uint64_t recordBytes = 0;
+
+			for (size_t i = 0; i < names.size(); ++i) {
+				batch.add(names[i]);
+				recordBytes += statsReader.findTocRecord(names[i])->size;
+			}
+
+			asyncReader.submit(batch);
+			batch.wait();
+
+			const FfReaderStats asyncStats = statsReader.getStats();
+			assert(asyncStats.readCalls > stats.readCalls);
+			assert(asyncStats.bytesRead >= stats.bytesRead + recordBytes);
+			assert(asyncStats.bytesRead == hook.bytes);
+
+			// Scans read through their own handle and are counted as well
+			RecordScanner statsScanner(statsReader);
+			ScannedRecord scanned;
+			while (statsScanner.next(scanned)) {
+			}
+
+			const FfReaderStats scanStats = statsReader.getStats();
+			assert(scanStats.readCalls > asyncStats.readCalls);
+			assert(scanStats.bytesRead >= asyncStats.bytesRead + recordBytes);
+			assert(scanStats.bytesRead == hook.bytes);
+		}
+
+		// Lazy image cache counts hits, misses and evictions
+		FfReaderOptions lazyStatsOptions;
+		lazyStatsOptions.lazyImages = true;
+		lazyStatsOptions.imageCacheLimit = 1;
+		lazyStatsOptions.memoryMapped = true;
+		lazyStatsOptions.collectStats = true;
+
+		FfReader lazyStatsReader("Icons.ff", lazyStatsOptions);
+		assert(lazyStatsReader.getPackedImage(index.images.packedInfo[0]));
+		assert(lazyStatsReader.getPackedImage(index.images.packedInfo[0]));
+		assert(lazyStatsReader.getPackedImage(index.images.packedInfo[11]));
+		assert(lazyStatsReader.getRecordData("CITY1.PNG", streamData));
+
+		stats = lazyStatsReader.getStats();
+		assert(stats.imageCacheHits == 1 && stats.imageCacheMisses == 2);
+		assert(stats.imageCacheEvictions == 1 && stats.mappedBytes == streamData.size());
+		assert(stats.metadataBytes < stats.peakMetadataBytes);
+
+		// Reads and lookups are not counted unless asked for
+		lazyStatsOptions.collectStats = false;
+		FfReader uncountedReader("Icons.ff", lazyStatsOptions);
+		assert(uncountedReader.getRecordData("CITY1.PNG", streamData));
+
+		stats = uncountedReader.getStats();
+		assert(!stats.lookups && !stats.readCalls && !stats.mappedBytes);
+		assert(stats.metadataBytes);
+	}
+#endif
+
+	// Parallel open parses the same contents, with stream reads and with the mapping
+	for (int mapped = 0; mapped < 2; ++mapped) {
+		FfReaderOptions parallelOptions;
+		parallelOptions.memoryMapped = mapped != 0;
+		parallelOptions.parseThreads = 4;
+
+		FfReader parallel("Icons.ff", parallelOptions);
+		assert(parallel.getNames() == file.getNames());
+		assert(parallel.indexData.images.ids == index.images.ids);
+		assert(parallel.indexData.images.packedInfo == index.images.packedInfo);
+		assert(parallel.packedImageOffsets == file.packedImageOffsets);
+		assert(parallel.imageParts.size() == file.imageParts.size());
+		assert(!memcmp(&parallel.imageParts[0], &file.imageParts[0],
+		               file.imageParts.size() * sizeof(ImagePart)));
+
+		for (size_t i = 0; i < index.images.packedInfo.size(); ++i) {
+			const PackedImage* expected = file.getPackedImage(index.images.packedInfo[i]);
+			const PackedImage* image = parallel.getPackedImage(index.images.packedInfo[i]);
+
+			assert(image && image->frames.size() == expected->frames.size());
+			assert(!strcmp(image->frames[0].name, expected->frames[0].name));
+		}
+
+		RecordId recordId = 0;
+		PackedImageInfo packedInfo;
+		assert(parallel.findImageIndex("CITY1", recordId, packedInfo));
+	}
+
+	const std::string sidecarPath = indexSidecarPath("Icons.ff");
+	assert(sidecarPath == "Icons.ffidx");
+	remove(sidecarPath.c_str());
+
+	FfReaderOptions sidecarOptions;
+	sidecarOptions.loadIndexSidecar = true;
+	sidecarOptions.writeIndexSidecar = true;
+
+	// First reader parses the file and writes sidecar, the next one loads it
+	assert(!FfReader("Icons.ff", sidecarOptions).isIndexSidecarLoaded());
+
+	FfReader loaded("Icons.ff", sidecarOptions);
+	assert(loaded.isIndexSidecarLoaded());
+	assert(loaded.getNames() == file.getNames());
+	assert(loaded.tableOfContents.size() == file.tableOfContents.size());
+	assert(loaded.findTocRecord("CITY1.PNG") && loaded.getRecordData("CITY1.PNG", mappedData));
+	assert(mappedData == streamData);
+
+	const IndexData& loadedIndex = loaded.indexData;
+	assert(loadedIndex.images.ids == index.images.ids);
+	assert(loadedIndex.images.packedInfo == index.images.packedInfo);
+
+	{
+		RecordId recordId = 0;
+		PackedImageInfo packedInfo;
+		assert(loaded.findImageIndex("CITY1", recordId, packedInfo));
+		assert(recordId == file.findTocRecord("CITY1.PNG")->recordId);
+	}
+	for (size_t i = 0; i < index.images.names.size(); ++i) {
+		assert(!strcmp(loadedIndex.images.names[i], index.images.names[i]));
+
+		const PackedImage* expected = file.getPackedImage(index.images.packedInfo[i]);
+		const PackedImage* image = loaded.getPackedImage(index.images.packedInfo[i]);
+
+		assert(image && !memcmp(image->palette, expected->palette, paletteSize));
+		assert(image->frames.size() == expected->frames.size());
+
+		for (size_t j = 0; j < image->frames.size(); ++j) {
+			assert(!strcmp(image->frames[j].name, expected->frames[j].name));
+			assert(image->frames[j].parts.size() == expected->frames[j].parts.size());
+			assert(!memcmp(image->frames[j].parts.data, expected->frames[j].parts.data,
+			               image->frames[j].parts.size() * sizeof(ImagePart)));
+		}
+	}
+
+	sidecarOptions.lazyImages = true;
+	FfReader lazyLoaded("Icons.ff", sidecarOptions);
+	assert(lazyLoaded.isIndexSidecarLoaded());
+	assert(lazyLoaded.packedImageOffsets == loaded.packedImageOffsets);
+	assert(lazyLoaded.getPackedImage(index.images.packedInfo[0]));
+
+	// Damaged sidecar is ignored
+	FILE* sidecar = fopen(sidecarPath.c_str(), "r+b");
+	assert(sidecar);
+	fseek(sidecar, -1, SEEK_END);
+	const int last = fgetc(sidecar);
+	fseek(sidecar, -1, SEEK_END);
+	fputc(last ^ 0xff, sidecar);
+	fclose(sidecar);
+
+	sidecarOptions.writeIndexSidecar = false;
+	assert(!FfReader("Icons.ff", sidecarOptions).isIndexSidecarLoaded());
+	remove(sidecarPath.c_str());
+
+	{
+		// Concurrent writers of the same file do not share temporary file, the last commit wins
+		ReplacingFile first;
+		ReplacingFile second;
+		FILE* firstFile = first.open("ReplacingTest.bin");
+		FILE* secondFile = second.open("ReplacingTest.bin");
+		assert(firstFile && secondFile && firstFile != secondFile);
+
+		fputs("first", firstFile);
+		fputs("second", secondFile);
+
+		const std::string firstText("first");
+		const std::string secondText("second");
+
+		assert(first.commit());
+		assert(readFile("ReplacingTest.bin") == std::vector<char>(firstText.begin(), firstText.end()));
+		assert(second.commit() && !second.commit());
+		assert(readFile("ReplacingTest.bin") == std::vector<char>(secondText.begin(), secondText.end()));
+
+		// Discarded contents never reach the target
+		ReplacingFile discarded;
+		FILE* discardedFile = discarded.open("ReplacingTest.bin");
+		assert(discardedFile);
+		fputs("discarded", discardedFile);
+		discarded.discard();
+		assert(readFile("ReplacingTest.bin") == std::vector<char>(secondText.begin(), secondText.end()));
+
+		remove("ReplacingTest.bin");
+	}
+
+	// Sidecar written before record was patched in place is ignored, even with same file size
+	{
+		const std::vector<char> icons = readFile("Icons.ff");
+		FILE* copy = fopen("SidecarTest.ff", "wb");
+		assert(copy && fwrite(&icons[0], 1, icons.size(), copy) == icons.size());
+		fclose(copy);
+
+		const std::string patchedSidecarPath = indexSidecarPath("SidecarTest.ff");
+		remove(patchedSidecarPath.c_str());
+
+		sidecarOptions.writeIndexSidecar = true;
+		assert(!FfReader("SidecarTest.ff", sidecarOptions).isIndexSidecarLoaded());
+		const std::vector<char> staleSidecar = readFile(patchedSidecarPath.c_str());
+
+		const char patch[] = "0123456789";
+		assert(FfWriter::patchRecord("SidecarTest.ff", "CITY1.PNG", patch, sizeof(patch) - 1));
+		assert(readFile("SidecarTest.ff").size() == icons.size());
+		assert(!fopen(patchedSidecarPath.c_str(), "rb"));
+
+		// Put stale sidecar back, as if it was written after the patch at same modification time
+		FILE* restored = fopen(patchedSidecarPath.c_str(), "wb");
+		assert(restored && fwrite(&staleSidecar[0], 1, staleSidecar.size(), restored)
+		       == staleSidecar.size());
+		fclose(restored);
+
+		sidecarOptions.writeIndexSidecar = false;
+		FfReader patched("SidecarTest.ff", sidecarOptions);
+		assert(!patched.isIndexSidecarLoaded());
+		assert(patched.findTocRecord("CITY1.PNG")->size == sizeof(patch) - 1);
+		assert(patched.getRecordData("CITY1.PNG", mappedData));
+		assert(mappedData == std::vector<char>(patch, patch + sizeof(patch) - 1));
+
+		remove(patchedSidecarPath.c_str());
+		remove("SidecarTest.ff");
+	}
+
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,366 @@
+#include "SyntheticArchive.hpp"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/** Streamed contents are written in pieces of this size. */
+static const size_t flushSize = 1024 * 1024;
+
+const char syntheticOptionsUsage[] =
+	"  --record-size BYTES  size of each data record, 4096 by default\n"
+	"  --listed PERCENT     data records named in names list, 100 by default\n"
+	"  --unused PERCENT     unused copies of data records listed under their names, 0 by default\n"
+	"  --images N           '-INDEX.OPT' entries and packed images per data record, 1 by default\n"
+	"  --frames N           frames of each packed image, 1 by default\n"
+	"  --parts N            parts each frame is shuffled into, 4 by default\n"
+	"  --frame-size N       width and height of each frame, 64 by default\n";
+
+static void appendUint32(std::vector<char>& buffer, uint32_t value)
+{
+	const char* bytes = reinterpret_cast<const char*>(&value);
+	buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+}
+
+static void appendString(std::vector<char>& buffer, const std::string& string)
+{
+	buffer.insert(buffer.end(), string.c_str(), string.c_str() + string.size() + 1);
+}
+
+static uint32_t filePosition(std::ofstream& file)
+{
+	const std::streamoff position = file.tellp();
+	if (position < 0 || position > static_cast<std::streamoff>(0xffffffffu)) {
+		throw std::runtime_error("Synthetic MQDB file does not fit into 4 GB");
+	}
+
+	return static_cast<uint32_t>(position);
+}
+
+static void writeHeader(std::ofstream& file, RecordId recordId, uint32_t size, bool used)
+{
+	MqrcHeader header;
+	memcpy(&header.signature, "MQRC", 4);
+	header.unknown = 0;
+	header.recordId = recordId;
+	header.size = size;
+	header.sizeAllocated = size;
+	header.used = used ? 1 : 0;
+	header.unknown2 = 0;
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+static void writeRecord(std::ofstream& file, std::vector<TocRecord>& toc,
+                        RecordId recordId, const std::vector<char>& contents, bool used = true)
+{
+	TocRecord record;
+	record.recordId = recordId;
+	record.size = static_cast<uint32_t>(contents.size());
+	record.sizeAllocated = record.size;
+	record.offset = filePosition(file);
+
+	writeHeader(file, recordId, record.size, used);
+	if (!contents.empty()) {
+		file.write(&contents[0], contents.size());
+	}
+
+	toc.push_back(record);
+}
+
+/** Streams contents of a single MQRC record, header is written when record is finished. */
+class RecordStream
+{
+public:
+	RecordStream(std::ofstream& file, RecordId recordId)
+		: file(file)
+		, recordId(recordId)
+		, offset(filePosition(file))
+		, written(0)
+	{
+		// Placeholder, size is not known yet
+		writeHeader(file, recordId, 0, true);
+	}
+
+	std::vector<char>& contents()
+	{
+		return buffer;
+	}
+
+	/** Writes buffered contents once enough of them were collected. */
+	void flush(bool force = false)
+	{
+		if (buffer.empty() || (!force && buffer.size() < flushSize)) {
+			return;
+		}
+
+		file.write(&buffer[0], buffer.size());
+		written += buffer.size();
+		buffer.clear();
+	}
+
+	void finish(std::vector<TocRecord>& toc)
+	{
+		flush(true);
+
+		const uint32_t end = filePosition(file);
+
+		TocRecord record;
+		record.recordId = recordId;
+		record.size = static_cast<uint32_t>(written);
+		record.sizeAllocated = record.size;
+		record.offset = offset;
+		toc.push_back(record);
+
+		file.seekp(offset);
+		writeHeader(file, recordId, record.size, true);
+		file.seekp(end);
+	}
+
+private:
+	std::ofstream& file;
+	RecordId recordId;
+	uint32_t offset;
+	size_t written;
+	std::vector<char> buffer;
+};
+
+std::string syntheticRecordName(uint32_t index)
+{
+	char name[32];
+	sprintf(name, "SYN%07u.PNG", index);
+	return name;
+}
+
+/** Returns name of packed image inside '-INDEX.OPT'. */
+static std::string syntheticImageName(uint32_t index, uint32_t image)
+{
+	char name[32];
+	if (image) {
+		sprintf(name, "SYN%07u_%u", index, image);
+	} else {
+		sprintf(name, "SYN%07u", index);
+	}
+
+	return name;
+}
+
+static uint32_t percentOf(uint32_t total, uint32_t percent)
+{
+	return static_cast<uint32_t>(static_cast<uint64_t>(total) * percent / 100);
+}
+
+uint32_t syntheticListedRecords(const SyntheticOptions& options)
+{
+	return std::min(options.records, percentOf(options.records, options.listedPercent));
+}
+
+void writeSyntheticArchive(const std::string& filePath, const SyntheticOptions& options)
+{
+	std::ofstream file(filePath.c_str(), std::ios_base::binary | std::ios_base::trunc);
+	if (!file) {
+		throw std::runtime_error("Could not create synthetic MQDB file");
+	}
+
+	MqdbHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(&header.signature, "MQDB", 4);
+	header.version = 9;
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	// Placeholder for ToC offset
+	const uint32_t tocOffsetPlaceholder = 0;
+	file.write(reinterpret_cast<const char*>(&tocOffsetPlaceholder), sizeof(uint32_t));
+
+	std::vector<TocRecord> toc;
+
+	const uint32_t unusedTotal = options.records ? percentOf(options.records, options.unusedPercent)
+	                                             : 0;
+	const bool hasImages = options.imagesPerRecord && options.framesPerImage;
+
+	const RecordId firstDataId = 3;
+	const RecordId firstUnusedId = firstDataId + options.records;
+	const RecordId indexId = firstUnusedId + unusedTotal;
+	const RecordId imagesId = indexId + 1;
+
+	Random random;
+	std::vector<char> contents(options.recordSize);
+
+	for (uint32_t i = 0; i < options.records; ++i) {
+		for (size_t j = 0; j < contents.size(); ++j) {
+			contents[j] = static_cast<char>(random.next());
+		}
+
+		writeRecord(file, toc, firstDataId + i, contents);
+	}
+
+	for (uint32_t i = 0; i < unusedTotal; ++i) {
+		writeRecord(file, toc, firstUnusedId + i, contents, false);
+	}
+
+	// Images go first, index entries need their offsets and sizes
+	std::vector<uint32_t> imageOffsets;
+	std::vector<uint32_t> imageSizes;
+
+	if (hasImages) {
+		const uint32_t parts = std::max(1u, std::min(options.partsPerFrame, options.frameSize));
+		const uint32_t stripHeight = options.frameSize / parts;
+
+		imageOffsets.reserve(static_cast<size_t>(options.records) * options.imagesPerRecord);
+		imageSizes.reserve(imageOffsets.capacity());
+
+		RecordStream images(file, imagesId);
+		uint32_t imagesSize = 0;
+
+		for (uint32_t i = 0; i < options.records; ++i) {
+			for (uint32_t k = 0; k < options.imagesPerRecord; ++k) {
+				std::vector<char>& buffer = images.contents();
+				const size_t imageStart = buffer.size();
+				const std::string name = syntheticImageName(i, k);
+
+				// 11-byte palette header and 256 colors
+				for (size_t j = 0; j < 11 + 1024; ++j) {
+					buffer.push_back(static_cast<char>(j));
+				}
+
+				appendUint32(buffer, options.framesPerImage);
+
+				for (uint32_t f = 0; f < options.framesPerImage; ++f) {
+					char frameName[48];
+					sprintf(frameName, "%s_F%u", name.c_str(), f);
+
+					appendString(buffer, f ? std::string(frameName) : name);
+					appendUint32(buffer, parts);
+					appendUint32(buffer, options.frameSize);
+					appendUint32(buffer, options.frameSize);
+
+					for (uint32_t j = 0; j < parts; ++j) {
+						const uint32_t height = j + 1 == parts ? options.frameSize - stripHeight * j
+						                                       : stripHeight;
+
+						// Strips are stored in reverse order inside shuffled image
+						appendUint32(buffer, 0);
+						appendUint32(buffer, stripHeight * j);
+						appendUint32(buffer, 0);
+						appendUint32(buffer, options.frameSize - stripHeight * j - height);
+						appendUint32(buffer, options.frameSize);
+						appendUint32(buffer, height);
+					}
+				}
+
+				const uint32_t imageSize = static_cast<uint32_t>(buffer.size() - imageStart);
+				imageOffsets.push_back(imagesSize);
+				imageSizes.push_back(imageSize);
+				imagesSize += imageSize;
+
+				images.flush();
+			}
+		}
+
+		images.finish(toc);
+
+		RecordStream index(file, indexId);
+		appendUint32(index.contents(), static_cast<uint32_t>(imageOffsets.size()));
+
+		size_t image = 0;
+		for (uint32_t i = 0; i < options.records; ++i) {
+			for (uint32_t k = 0; k < options.imagesPerRecord; ++k, ++image) {
+				std::vector<char>& buffer = index.contents();
+
+				appendUint32(buffer, firstDataId + i);
+				appendString(buffer, syntheticImageName(i, k));
+				appendUint32(buffer, imageOffsets[image]);
+				appendUint32(buffer, imageSizes[image]);
+
+				index.flush();
+			}
+		}
+
+		index.finish(toc);
+	}
+
+	const uint32_t listedTotal = syntheticListedRecords(options);
+	const uint32_t namesTotal = listedTotal + unusedTotal + (hasImages ? 2 : 0);
+
+	RecordStream namesList(file, NameList);
+	appendUint32(namesList.contents(), namesTotal);
+
+	for (uint32_t i = 0; i < listedTotal + unusedTotal; ++i) {
+		// Unused copies repeat names of their originals
+		const bool original = i < listedTotal;
+		const uint32_t recordIndex = original ? i : (i - listedTotal) % options.records;
+
+		char name[256] = {0};
+		strncpy(name, syntheticRecordName(recordIndex).c_str(), sizeof(name) - 1);
+
+		std::vector<char>& buffer = namesList.contents();
+		buffer.insert(buffer.end(), name, name + sizeof(name));
+		appendUint32(buffer, original ? firstDataId + i : firstUnusedId + i - listedTotal);
+
+		namesList.flush();
+	}
+
+	if (hasImages) {
+		const char* sectionNames[2] = {"-INDEX.OPT", "-IMAGES.OPT"};
+		const RecordId sectionIds[2] = {indexId, imagesId};
+
+		for (int i = 0; i < 2; ++i) {
+			char name[256] = {0};
+			strncpy(name, sectionNames[i], sizeof(name) - 1);
+
+			std::vector<char>& buffer = namesList.contents();
+			buffer.insert(buffer.end(), name, name + sizeof(name));
+			appendUint32(buffer, sectionIds[i]);
+		}
+	}
+
+	namesList.finish(toc);
+
+	const uint32_t tocOffset = filePosition(file);
+	const uint32_t tocTotal = static_cast<uint32_t>(toc.size());
+
+	file.write(reinterpret_cast<const char*>(&tocTotal), sizeof(tocTotal));
+	file.write(reinterpret_cast<const char*>(&toc[0]), toc.size() * sizeof(TocRecord));
+
+	file.seekp(sizeof(MqdbHeader));
+	file.write(reinterpret_cast<const char*>(&tocOffset), sizeof(tocOffset));
+
+	if (!file) {
+		throw std::runtime_error("Could not write synthetic MQDB file");
+	}
+}
+
+bool parseSyntheticOption(int argc, char* argv[], int& i, SyntheticOptions& options)
+{
+	if (i + 1 >= argc) {
+		return false;
+	}
+
+	const std::string argument = argv[i];
+	uint32_t* value = NULL;
+
+	if (argument == "--record-size") {
+		value = &options.recordSize;
+	} else if (argument == "--listed") {
+		value = &options.listedPercent;
+	} else if (argument == "--unused") {
+		value = &options.unusedPercent;
+	} else if (argument == "--images") {
+		value = &options.imagesPerRecord;
+	} else if (argument == "--frames") {
+		value = &options.framesPerImage;
+	} else if (argument == "--parts") {
+		value = &options.partsPerFrame;
+	} else if (argument == "--frame-size") {
+		value = &options.frameSize;
+	} else {
+		return false;
+	}
+
+	*value = static_cast<uint32_t>(strtoul(argv[++i], NULL, 10));
+	return true;
+}
@@ -0,0 +1,75 @@
+#ifndef SyntheticArchive_hpp
+#define SyntheticArchive_hpp
+
+#include <FfReader.hpp>
+#include <string>
+
+/** Parameters of generated MQDB file. */
+struct SyntheticOptions
+{
+	SyntheticOptions()
+		: records(10000)
+		, recordSize(4096)
+		, listedPercent(100)
+		, unusedPercent(0)
+		, imagesPerRecord(1)
+		, framesPerImage(1)
+		, partsPerFrame(4)
+		, frameSize(64)
+	{ }
+
+	uint32_t records;         /**< Number of data records. */
+	uint32_t recordSize;      /**< Size of each data record, in bytes. */
+	uint32_t listedPercent;   /**< Percent of data records named in names list, others are ToC only. */
+	/**
+	 * Unused copies of data records, in percent of data records.
+	 * Copies are listed under names of their originals, like D2ResExplorer leaves them.
+	 */
+	uint32_t unusedPercent;
+	uint32_t imagesPerRecord; /**< '-INDEX.OPT' entries and packed images of each data record. */
+	uint32_t framesPerImage;  /**< Frames of each packed image. */
+	uint32_t partsPerFrame;   /**< Number of horizontal strips each frame is shuffled into. */
+	uint32_t frameSize;       /**< Width and height of each frame. */
+};
+
+/** Generates deterministic pseudo random bytes. */
+class Random
+{
+public:
+	Random()
+		: state(12345u)
+	{ }
+
+	uint32_t next()
+	{
+		state = state * 1664525u + 1013904223u;
+		return state >> 8;
+	}
+
+private:
+	uint32_t state;
+};
+
+/** Returns name of data record with specified index, as stored in names list. */
+std::string syntheticRecordName(uint32_t index);
+
+/** Returns number of data records that are named in names list. */
+uint32_t syntheticListedRecords(const SyntheticOptions& options);
+
+/**
+ * Writes MQDB file with data records, names list, '-INDEX.OPT' and '-IMAGES.OPT'.
+ * Contents are streamed to file, so archives of a million records need little memory.
+ * Throws std::runtime_error exception if file could not be written.
+ */
+void writeSyntheticArchive(const std::string& filePath, const SyntheticOptions& options);
+
+/**
+ * Parses generator option at argv[i] and its value, advancing i past the value.
+ * @returns false if argument is not a generator option.
+ */
+bool parseSyntheticOption(int argc, char* argv[], int& i, SyntheticOptions& options);
+
+/** Describes options accepted by parseSyntheticOption(). */
+extern const char syntheticOptionsUsage[];
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef AnimationDecoder_hpp
+#define AnimationDecoder_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BatchExtractor.hpp"
+#include "FfReader.hpp"
+#include "ThreadPool.hpp"
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/** How AnimationDecoder arranges frames inside the output buffer. */
+enum AnimationLayout
+{
+    StripLayout, /**< All frames in a single row. */
+    AtlasLayout  /**< Frames in rows of AnimationOptions::columns frames. */
+};
+
+/** Options of AnimationDecoder. */
+struct AnimationOptions
+{
+    AnimationOptions()
+        : decoder(NULL)
+        , pool(NULL)
+        , layout(StripLayout)
+        , columns(0)
+    { }
+
+    ImageDecoder* decoder; /**< Decodes source records into pixels, required. */
+    /**
+     * If set, frames are unpacked on threads of this pool, otherwise on the calling thread.
+     * Pool may be shared with other work, decoder only waits for its own tasks.
+     */
+    ThreadPool* pool;
+    AnimationLayout layout;
+    /** Frames per atlas row, 0 picks the smallest square that holds every frame. */
+    uint32_t columns;
+};
+
+/** Position of animation frame inside AnimationStrip pixels. */
+struct AnimationFrame
+{
+    const char* name; /**< Null terminated frame name, points into FfReader contents. */
+    uint32_t x;       /**< Left pixel of frame inside strip. */
+    uint32_t y;       /**< Top pixel of frame inside strip. */
+    uint32_t width;
+    uint32_t height;
+    uint32_t cell;    /**< Index of strip cell, frames with identical parts share cells. */
+};
+
+/**
+ * Every frame of an animation unpacked into a single buffer.
+ * Frames are stored in cells of cellWidth by cellHeight pixels, left to right, top to bottom.
+ */
+struct AnimationStrip
+{
+    AnimationStrip()
+        : palette(NULL)
+        , width(0)
+        , height(0)
+        , cellWidth(0)
+        , cellHeight(0)
+        , cellsTotal(0)
+        , bytesPerPixel(0)
+    { }
+
+    /** Palette shared by every frame, points into FfReader or AnimationDecoder contents. */
+    const char* palette;
+    uint32_t width;  /**< Width of strip, in pixels. */
+    uint32_t height; /**< Height of strip, in pixels. */
+    uint32_t cellWidth;
+    uint32_t cellHeight;
+    uint32_t cellsTotal;
+    uint32_t bytesPerPixel;       /**< Bytes per pixel of decoded source records. */
+    std::vector<AnimationFrame> frames; /**< In playback order. */
+    std::vector<char> pixels;     /**< Rows of width pixels, uncovered pixels are zero. */
+};
+
+/**
+ * Turns animations described by '-INDEX.OPT' into ready to play frame strips.
+ * Animations are looked up in AnimationIndices and decoded from '-ANIMS.OPT',
+ * each of their frames is unpacked from the record of the image with the same name.
+ * Multi-frame images of ImageIndices are accepted too, their frames share the image record.
+ * Every source record is decoded once per animation and frames with identical
+ * source regions are unpacked once.
+ * Decoder is immutable after construction and can be used from several threads at once.
+ */
+class AnimationDecoder
+{
+public:
+    AnimationDecoder(const FfReader& reader, const AnimationOptions& options);
+
+    /**
+     * Decodes specified animation or image into strip.
+     * @returns false if name is unknown, any source record could not be read or decoded,
+     * sources have different pixel formats or frame parts lie outside of their sources.
+     */
+    bool decode(const char* name, AnimationStrip& strip) const;
+    bool decode(const std::string& name, AnimationStrip& strip) const;
+
+    /** Returns number of animations that can be decoded from '-ANIMS.OPT'. */
+    size_t animationsTotal() const;
+
+private:
+    AnimationDecoder(const AnimationDecoder&);
+    AnimationDecoder& operator=(const AnimationDecoder&);
+
+    struct FrameSource;
+    struct Context;
+    class UnpackTask;
+
+    /**
+     * Decodes packed image of animation or image and finds source record of each of its frames.
+     * @returns false if name is unknown or image could not be decoded.
+     */
+    bool resolve(const char* name,
+                 PackedImageCopy& image,
+                 std::vector<RecordId>& frameRecords) const;
+
+    /** Returns contents of '-ANIMS.OPT', either inside the mapping or animsContents. */
+    RecordView animsView() const;
+
+    const FfReader& reader;
+    AnimationOptions options;
+
+    RecordId animsRecordId;
+    bool hasAnims;
+    std::vector<char> animsContents; /**< Copy of '-ANIMS.OPT' when reader is not mapped. */
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef AssetCache_hpp
+#define AssetCache_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BatchExtractor.hpp"
+#include "FfReader.hpp"
+#include "Mutex.hpp"
+#include <stddef.h>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Options of AssetCache. */
+struct AssetCacheOptions
+{
+    AssetCacheOptions()
+        : byteBudget(64 * 1024 * 1024)
+        , shardsTotal(16)
+        , decoder(NULL)
+    { }
+
+    /** Maximum number of bytes kept by cache, split evenly between shards. */
+    size_t byteBudget;
+    /** Number of independently locked parts of the cache, threads rarely wait on each other. */
+    size_t shardsTotal;
+    /** Decodes records for frame unpacking, frames are not available without it. */
+    ImageDecoder* decoder;
+};
+
+/** Counters of AssetCache, summed over all shards. */
+struct AssetCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries; /**< Number of cached records and frames. */
+    size_t bytes;   /**< Bytes charged against budget. */
+};
+
+/** Unpacked frame returned by AssetCache. */
+struct CachedFrame
+{
+    std::vector<char> pixels; /**< Tightly packed rows of width pixels. */
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerPixel;
+};
+
+/**
+ * Keeps raw record contents and unpacked frames of a single FfReader in memory,
+ * so repeated requests skip reading and decoding.
+ * Entries are keyed by record id and frame name, least recently used ones are evicted
+ * when cache exceeds its byte budget. Results are copied out, so entries can be evicted
+ * while callers use them. All methods are thread-safe.
+ */
+class AssetCache
+{
+public:
+    explicit AssetCache(const FfReader& reader, const AssetCacheOptions& options = AssetCacheOptions());
+    ~AssetCache();
+
+    /** Copies record contents, reading record on miss. */
+    bool getRecordData(RecordId recordId, std::vector<char>& data);
+
+    /**
+     * Copies unpacked frame of packed image whose parts are stored in specified record.
+     * On miss record is decoded and frame is unpacked from it.
+     * @returns false if frame was not found or could not be unpacked.
+     */
+    bool getFrame(RecordId recordId, const std::string& frameName, CachedFrame& frame);
+
+    /** Drops all entries, counters are kept. */
+    void clear();
+
+    AssetCacheStats stats() const;
+
+private:
+    AssetCache(const AssetCache&);
+    AssetCache& operator=(const AssetCache&);
+
+    /** Record id and frame name, empty name stands for raw record contents. */
+    typedef std::pair<RecordId, std::string> Key;
+
+    struct Entry
+    {
+        CachedFrame asset; /**< Raw records keep their contents in pixels. */
+        size_t cost;
+        std::list<Key>::iterator position;
+    };
+
+    struct Shard
+    {
+        mutable Mutex mutex;
+        std::map<Key, Entry> entries;
+        std::list<Key> order; /**< Most recently used entries first. */
+        size_t bytes;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+    Shard& shardOf(const Key& key) const;
+
+    /** Copies cached asset and marks it as recently used. @returns false on miss. */
+    bool lookup(const Key& key, CachedFrame& asset);
+    void store(const Key& key, const CachedFrame& asset);
+
+    /** Decodes record, unpacks named frame from it. */
+    bool unpack(RecordId recordId, const std::string& frameName, CachedFrame& frame);
+
+    const FfReader& reader;
+    ImageDecoder* decoder;
+    std::vector<Shard*> shards;
+    size_t shardBudget;
+    /** Offsets of packed images by record id of their source record, sorted. */
+    std::vector<std::pair<RecordId, RelativeOffset> > imagesById;
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef AssetExporter_hpp
+#define AssetExporter_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BatchExtractor.hpp"
+#include "FfReader.hpp"
+#include "ImageUnpacker.hpp"
+#include "NameIndex.hpp"
+#include "RandomAccessFile.hpp"
+#include <string>
+#include <vector>
+
+class ExportArchive;
+
+/** Compression method of blobs that are stored as is. */
+static const uint32_t storedBlobs = 0;
+
+/**
+ * Compresses exported frames, e.g. with LZ4 or zstd, and decompresses them when loading.
+ * Called from worker threads concurrently, implementation must be thread-safe
+ * and produce the same output for the same input.
+ */
+class BlobCodec
+{
+public:
+    virtual ~BlobCodec()
+    { }
+
+    /**
+     * Identifies compression method in exported file, loaders pick codec by it.
+     * Must not be storedBlobs.
+     */
+    virtual uint32_t method() const = 0;
+
+    /** @returns false if data could not be compressed. */
+    virtual bool compress(const char* data, size_t size, std::vector<char>& output) = 0;
+
+    /**
+     * Decompresses blob into output holding exactly rawSize bytes.
+     * @returns false if blob is corrupted.
+     */
+    virtual bool decompress(const char* data,
+                            size_t size,
+                            char* output,
+                            size_t rawSize) = 0;
+};
+
+/** Options of exportAssets(). */
+struct ExportOptions
+{
+    ExportOptions()
+        : threadsTotal(0)
+        , decoder(NULL)
+        , codec(NULL)
+        , order(RgbaOrder)
+        , transparentIndex(noTransparentIndex)
+        , previousExport(NULL)
+    { }
+
+    size_t threadsTotal;   /**< Number of worker threads, 0 means one per hardware thread. */
+    ImageDecoder* decoder; /**< Decodes records that frames are unpacked from, required. */
+    BlobCodec* codec;      /**< Compresses frames, frames are stored as is when not set. */
+    PixelOrder order;      /**< Byte order of pixels expanded from palettized records. */
+    int transparentIndex;  /**< Palette index that gets zero alpha. */
+    /**
+     * Export made earlier from the same or older version of archive.
+     * Frames whose sources and settings did not change are copied from it
+     * without decoding and compressing them again.
+     */
+    const ExportArchive* previousExport;
+};
+
+/** Outcome of exportAssets(). */
+struct ExportResult
+{
+    ExportResult()
+        : framesTotal(0)
+        , framesEncoded(0)
+        , framesReused(0)
+        , errors(0)
+    { }
+
+    size_t framesTotal;   /**< Frames written to exported file. */
+    size_t framesEncoded; /**< Frames that were decoded, unpacked and compressed. */
+    size_t framesReused;  /**< Frames copied from previous export. */
+    size_t errors;        /**< Records that could not be read, decoded or unpacked. */
+};
+
+/** Frame stored in exported file. */
+struct ExportEntry
+{
+    std::string name;        /**< Name of the frame. */
+    RecordId recordId;       /**< Record that frame was unpacked from. */
+    uint32_t width;
+    uint32_t height;
+    uint32_t compression;    /**< storedBlobs or BlobCodec::method() of codec used. */
+    uint64_t offset;         /**< Offset of blob in file, 64-byte aligned. */
+    uint32_t storedSize;     /**< Size of blob in file. */
+    uint32_t rawSize;        /**< Size of 32-bit frame pixels, width * height * 4 bytes. */
+    uint64_t sourceChecksum; /**< Checksum of record, packed image and settings frame came from. */
+    uint64_t blobChecksum;   /**< Checksum of stored blob. */
+};
+
+/**
+ * Exports frames of every '-INDEX.OPT' image as 32-bit pixels into a single file.
+ * Records are read, decoded, unpacked, expanded and compressed on a pool of worker threads,
+ * while calling thread writes finished frames in order. Only a few records per worker
+ * are in flight at once, so memory use does not depend on archive size.
+ * Blobs are 64-byte aligned and followed by a single index of all frames.
+ * Output depends only on archive contents and options, not on number of threads.
+ * Frames with the same name are stored once, empty frames are skipped.
+ * Existing file is replaced only when export succeeds.
+ * @returns false if any record could not be exported or file could not be written.
+ */
+bool exportAssets(const FfReader& reader,
+                  const std::string& exportPath,
+                  const ExportOptions& options,
+                  ExportResult* result = NULL);
+
+/**
+ * Reads files written by exportAssets().
+ * Reads are positional, several threads can read the same archive at once.
+ */
+class ExportArchive
+{
+public:
+    /**
+     * Opens exported file and loads its index.
+     * @returns false if file is missing, corrupted or written by another version.
+     */
+    bool open(const std::string& exportPath);
+
+    void close();
+
+    /** Returns frames in the order they are stored. */
+    const std::vector<ExportEntry>& getEntries() const;
+
+    /** @returns entry of frame with specified name or nullptr. */
+    const ExportEntry* findEntry(const std::string& name) const;
+
+    /**
+     * Reads blob of entry as it is stored.
+     * @returns false if blob could not be read or its checksum does not match.
+     */
+    bool readBlob(const ExportEntry& entry, std::vector<char>& blob) const;
+
+    /**
+     * Reads 32-bit pixels of entry, decompressing them with codec when needed.
+     * @returns false if blob could not be read or codec is missing or does not match.
+     */
+    bool readPixels(const ExportEntry& entry,
+                    std::vector<char>& pixels,
+                    BlobCodec* codec = NULL) const;
+
+private:
+    RandomAccessFile file;
+    std::vector<ExportEntry> entries;
+    NameIndex entryNames; /**< Frame names mapped to their indices in entries. */
+};
+
+#endif
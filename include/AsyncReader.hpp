@@ -0,0 +1,156 @@
+#ifndef AsyncReader_hpp
+#define AsyncReader_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FfReader.hpp"
+#include "Mutex.hpp"
+#include "ThreadPool.hpp"
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/** Receives records of ReadBatch as soon as they are read. */
+class ReadCallback
+{
+public:
+    virtual ~ReadCallback()
+    { }
+
+    /**
+     * Called from worker threads, possibly concurrently, implementation must be thread-safe.
+     * Data is valid only during the call.
+     */
+    virtual void onRead(size_t requestIndex, RecordId recordId, const char* data, uint32_t size) = 0;
+
+    /** Called for each record that was not found or could not be read. */
+    virtual void onError(size_t /* requestIndex */, RecordId /* recordId */)
+    { }
+};
+
+/**
+ * Set of records requested together from AsyncReader.
+ * Records are added first, then batch is submitted and its results are available
+ * after wait() returns. Batch must stay alive until it is done.
+ */
+class ReadBatch
+{
+public:
+    ReadBatch();
+
+    /** Adds request, @returns its index. */
+    size_t add(RecordId recordId);
+    size_t add(const std::string& recordName);
+
+    size_t size() const;
+
+    /** Blocks until every request of submitted batch is finished. */
+    void wait();
+
+    /** Returns true if every request of submitted batch is finished. */
+    bool isDone() const;
+
+    /** Returns true if request was read. Call after wait(). */
+    bool succeeded(size_t requestIndex) const;
+
+    /** Returns contents of request. Call after wait(). */
+    const std::vector<char>& data(size_t requestIndex) const;
+
+private:
+    friend class AsyncReader;
+
+    ReadBatch(const ReadBatch&);
+    ReadBatch& operator=(const ReadBatch&);
+
+    struct Request
+    {
+        RecordId recordId;
+        std::string name; /**< Used instead of id when not empty. */
+        const TocRecord* record;
+        std::vector<char> data;
+        bool succeeded;
+    };
+
+    /** Marks specified number of requests as finished. */
+    void finish(size_t requestsTotal);
+
+    std::vector<Request> requests;
+    ReadCallback* callback;
+    size_t pending;
+    mutable Mutex mutex;
+    Condition done;
+};
+
+/** Options of AsyncReader. */
+struct AsyncReadOptions
+{
+    AsyncReadOptions()
+        : threadsTotal(4)
+        , coalesceGap(64 * 1024)
+        , coalescedSizeLimit(4 * 1024 * 1024)
+    { }
+
+    size_t threadsTotal; /**< Number of I/O threads, 0 means one per hardware thread. */
+    /**
+     * Records separated by at most this many bytes are read with a single call,
+     * the gap is read and thrown away.
+     */
+    uint32_t coalesceGap;
+    /** Coalesced reads do not grow past this size, larger records are read on their own. */
+    size_t coalescedSizeLimit;
+};
+
+/**
+ * Reads batches of records of a single FfReader in background, so I/O overlaps with
+ * caller work such as decoding previous batch.
+ * Requests of a batch are sorted by offset and records stored close to each other
+ * are read with a single positional read.
+ */
+class AsyncReader
+{
+public:
+    explicit AsyncReader(const FfReader& reader, const AsyncReadOptions& options = AsyncReadOptions());
+
+    /** Waits for submitted batches. */
+    ~AsyncReader();
+
+    /**
+     * Starts reading every request of batch and returns immediately.
+     * If callback is set, it is called for each request as soon as it is finished.
+     * Batch must not be submitted again until it is done.
+     */
+    void submit(ReadBatch& batch, ReadCallback* callback = NULL);
+
+    /** Blocks until all submitted batches are done. */
+    void wait();
+
+private:
+    AsyncReader(const AsyncReader&);
+    AsyncReader& operator=(const AsyncReader&);
+
+    class CoalescedRead;
+    struct RequestOffsetLess;
+
+    const FfReader& reader;
+    AsyncReadOptions options;
+    ThreadPool pool;
+};
+
+#endif
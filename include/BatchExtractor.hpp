@@ -0,0 +1,127 @@
+#ifndef BatchExtractor_hpp
+#define BatchExtractor_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FfReader.hpp"
+#include <string>
+#include <vector>
+
+/**
+ * Decodes raw record contents (PNG, TGA, etc.) into pixels for frame unpacking.
+ * Called from worker threads concurrently, implementation must be thread-safe.
+ */
+class ImageDecoder
+{
+public:
+    virtual ~ImageDecoder()
+    { }
+
+    /**
+     * Decodes record contents into tightly packed rows of 1 or 4 byte pixels.
+     * @returns false if contents could not be decoded.
+     */
+    virtual bool decode(const char* data,
+                        uint32_t size,
+                        std::vector<char>& pixels,
+                        uint32_t& width,
+                        uint32_t& height,
+                        uint32_t& bytesPerPixel) = 0;
+};
+
+/** Receives results of batch extraction. */
+class RecordSink
+{
+public:
+    virtual ~RecordSink()
+    { }
+
+    /** Called for each record that was read. Data is valid only during the call. */
+    virtual void onRecord(RecordId recordId,
+                          const std::string& name,
+                          const char* data,
+                          uint32_t size) = 0;
+
+    /**
+     * Called for each frame unpacked from record when ImageDecoder is set.
+     * Pixels are tightly packed rows of frame.width pixels, valid only during the call.
+     */
+    virtual void onFrame(RecordId /* recordId */,
+                         const ImageFrame& /* frame */,
+                         const char* /* pixels */,
+                         uint32_t /* bytesPerPixel */)
+    { }
+
+    /** Called for each record that could not be read, decoded or unpacked. */
+    virtual void onError(RecordId /* recordId */, const std::string& /* name */)
+    { }
+};
+
+/** Options of BatchExtractor. */
+struct BatchOptions
+{
+    BatchOptions()
+        : threadsTotal(0)
+        , decoder(NULL)
+        , concurrentSink(false)
+    { }
+
+    size_t threadsTotal;   /**< Number of worker threads, 0 means one per hardware thread. */
+    ImageDecoder* decoder; /**< If set, frames of '-INDEX.OPT' images are unpacked too. */
+    /**
+     * If false, sink calls are serialized and sink does not need to be thread-safe.
+     * If true, sink is called concurrently from worker threads.
+     */
+    bool concurrentSink;
+};
+
+/**
+ * Reads many records of a single FfReader on a pool of worker threads.
+ * Records are processed in the order they are stored in file for sequential I/O.
+ */
+class BatchExtractor
+{
+public:
+    BatchExtractor(FfReader& reader, const BatchOptions& options = BatchOptions());
+
+    /**
+     * Extracts records with specified names, unknown names are reported as errors.
+     * @returns number of records that were extracted without errors.
+     */
+    size_t extract(const std::vector<std::string>& names, RecordSink& sink);
+
+    /** Extracts records with specified ids, unknown ids are reported as errors. */
+    size_t extract(const std::vector<RecordId>& recordIds, RecordSink& sink);
+
+    /** Extracts every record from names list. */
+    size_t extractAll(RecordSink& sink);
+
+private:
+    struct Item;
+    struct Context;
+    class ExtractTask;
+
+    size_t run(std::vector<Item>& items, RecordSink& sink);
+
+    FfReader& reader;
+    BatchOptions options;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef ByteCursor_hpp
+#define ByteCursor_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pstdint.h"
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define FFREADER_BIG_ENDIAN
+#endif
+#endif
+
+/** Converts 4-byte little endian value, as stored in MQDB files, to host byte order. */
+inline uint32_t fromLittleEndian(uint32_t value)
+{
+#ifdef FFREADER_BIG_ENDIAN
+    return (value >> 24) | ((value >> 8) & 0xff00u) | ((value << 8) & 0xff0000u) | (value << 24);
+#else
+    return value;
+#endif
+}
+
+/**
+ * Reads little endian values from a span of bytes.
+ * Loads go through memcpy, so values do not need to be aligned.
+ * Checked methods return false or nullptr if span ends too early and do not move cursor.
+ * Methods starting with 'take' and skip() are unchecked: caller checks space with has()
+ * once for a group of values, then reads them without checking each one.
+ */
+class ByteCursor
+{
+public:
+    ByteCursor(const char* data, size_t size)
+        : data(data)
+        , size(size)
+        , position(0)
+    { }
+
+    size_t offset() const
+    {
+        return position;
+    }
+
+    size_t remaining() const
+    {
+        return size - position;
+    }
+
+    const char* current() const
+    {
+        return data + position;
+    }
+
+    /** Moves cursor to specified offset from the start of span. */
+    bool seek(size_t offset)
+    {
+        if (offset > size) {
+            return false;
+        }
+
+        position = offset;
+        return true;
+    }
+
+    /** Returns true if span has at least specified number of bytes left. */
+    bool has(size_t bytes) const
+    {
+        return bytes <= size - position;
+    }
+
+    /** Returns true if span has space for specified number of elements of given size. */
+    bool has(size_t count, size_t elementSize) const
+    {
+        return count <= (size - position) / elementSize;
+    }
+
+    void skip(size_t bytes)
+    {
+        position += bytes;
+    }
+
+    uint32_t takeUint32()
+    {
+        uint32_t value;
+        memcpy(&value, data + position, sizeof(value));
+        position += sizeof(value);
+
+        return fromLittleEndian(value);
+    }
+
+    /** Copies raw bytes, caller converts byte order of copied values. */
+    void take(void* destination, size_t bytes)
+    {
+        memcpy(destination, data + position, bytes);
+        position += bytes;
+    }
+
+    bool readUint32(uint32_t& value)
+    {
+        if (!has(sizeof(value))) {
+            return false;
+        }
+
+        value = takeUint32();
+        return true;
+    }
+
+    /**
+     * Reads null terminated string, terminator search is bounded by the end of span.
+     * Cursor is moved past the terminator.
+     * @returns pointer to string inside the span or nullptr if it is not terminated.
+     */
+    const char* readString(size_t& length)
+    {
+        if (position == size) {
+            return NULL;
+        }
+
+        const char* string = data + position;
+        const char* end = static_cast<const char*>(memchr(string, '\0', size - position));
+
+        if (!end) {
+            return NULL;
+        }
+
+        length = static_cast<size_t>(end - string);
+        position += length + 1;
+
+        return string;
+    }
+
+private:
+    const char* data;
+    size_t size;
+    size_t position;
+};
+
+#endif
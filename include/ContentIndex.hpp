@@ -0,0 +1,118 @@
+#ifndef ContentIndex_hpp
+#define ContentIndex_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FfReader.hpp"
+#include <stddef.h>
+#include <vector>
+
+class FfArchiveSet;
+
+/**
+ * Computes 64-bit hash of contents, compatible with XXH64.
+ * Input is consumed in 32-byte stripes of four independent lanes,
+ * so compilers can keep lanes in registers or vectorize them.
+ */
+uint64_t contentHash(const char* data, size_t size, uint64_t seed = 0);
+
+/** Record identified by hash of its contents. */
+struct ContentRecord
+{
+    uint64_t hash;         /**< contentHash() of record contents. */
+    uint32_t size;         /**< Size of record contents, in bytes. */
+    uint32_t archiveIndex; /**< Mount index of the archive, 0 for a single reader. */
+    RecordId recordId;
+};
+
+/** Options of ContentIndex. */
+struct ContentIndexOptions
+{
+    ContentIndexOptions()
+        : threadsTotal(0)
+    { }
+
+    size_t threadsTotal; /**< Number of worker threads, 0 means one per hardware thread. */
+};
+
+/**
+ * Maps contents hashes to records, so identical payloads stored under different names,
+ * ids or archives can be found and stored once.
+ * Records with the same hash and size are treated as identical,
+ * callers that can not tolerate 64-bit hash collisions should compare contents.
+ * Every ToC record except table of contents and names list is hashed,
+ * records are read in the order they are stored in file on a pool of worker threads.
+ */
+class ContentIndex
+{
+public:
+    ContentIndex();
+
+    /**
+     * Hashes records of a single archive, replacing previous contents.
+     * Records that could not be read are skipped.
+     * @returns false if any record could not be read.
+     */
+    bool build(const FfReader& reader, const ContentIndexOptions& options = ContentIndexOptions());
+
+    /** Hashes records of every archive mounted into the set. */
+    bool build(const FfArchiveSet& archives,
+               const ContentIndexOptions& options = ContentIndexOptions());
+
+    /** Returns number of hashed records. */
+    size_t size() const;
+
+    /** Returns hashed records sorted by hash and size, identical contents are adjacent. */
+    const std::vector<ContentRecord>& getRecords() const;
+
+    /**
+     * Searches for records with specified contents hash and size.
+     * @returns records ordered by archive index and record id, empty view if there are none.
+     */
+    ArrayView<ContentRecord> find(uint64_t hash, uint32_t size) const;
+
+    /** Searches for hashed record of the archive. */
+    const ContentRecord* findRecord(uint32_t archiveIndex, RecordId recordId) const;
+
+    /** Returns records whose contents are the same as of specified one, including it. */
+    ArrayView<ContentRecord> findDuplicates(uint32_t archiveIndex, RecordId recordId) const;
+
+    /** Returns number of records that repeat contents of an earlier record. */
+    size_t duplicatesTotal() const;
+
+    /** Returns number of bytes saved by storing each distinct contents once. */
+    uint64_t duplicateBytes() const;
+
+private:
+    struct Item;
+    class HashTask;
+
+    /** Adds every ToC record of reader except table of contents and names list. */
+    static void appendItems(const FfReader& reader, uint32_t archiveIndex, std::vector<Item>& items);
+
+    bool build(std::vector<Item>& items, const ContentIndexOptions& options);
+
+    std::vector<ContentRecord> records;  /**< Sorted by hash, size, archive and record id. */
+    std::vector<uint32_t> recordsById;   /**< Indices of records sorted by archive and id. */
+    size_t duplicates;
+    uint64_t duplicatedBytes;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef FfArchiveSet_hpp
+#define FfArchiveSet_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FfReader.hpp"
+#include "NameIndex.hpp"
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/**
+ * Record found by FfArchiveSet.
+ * Record is kept by id and resolved on each read,
+ * so it stays valid when archive is refreshed, see FfReader::refresh().
+ */
+struct ArchiveRecord
+{
+    const FfReader* reader; /**< Archive containing the record. */
+    RecordId recordId;      /**< Record inside the archive. */
+    uint32_t archiveIndex;  /**< Mount index of the archive. */
+};
+
+/**
+ * Several MQDB archives searched as one, like the game does with base archives and mods.
+ * Archives mounted later take priority: when names clash, the most recently mounted wins.
+ * Names of all archives are merged into a single hash index as archives are mounted,
+ * so a lookup is one probe however many archives are mounted.
+ * Lookups are thread-safe once all archives are mounted.
+ */
+class FfArchiveSet
+{
+public:
+    FfArchiveSet();
+    ~FfArchiveSet();
+
+    /**
+     * Mounts reader that is not owned by the set and must outlive it.
+     * @returns mount index of the archive.
+     */
+    uint32_t mount(const FfReader& reader);
+
+    /**
+     * Opens archive and mounts it, set owns the reader.
+     * Throws std::runtime_error exception if archive could not be opened.
+     * @returns mount index of the archive.
+     */
+    uint32_t mount(const std::string& ffFilePath, const FfReaderOptions& options = FfReaderOptions());
+
+    /**
+     * Merges names of mounted archives again.
+     * Call it after FfReader::refresh() parsed names list of any mounted archive again.
+     * Must not be called while other threads use the set.
+     */
+    void remount();
+
+    /** Returns number of mounted archives. */
+    size_t size() const;
+
+    /** Returns reader of archive with specified mount index. */
+    const FfReader& archive(uint32_t archiveIndex) const;
+
+    /**
+     * Searches for record with specified name in all archives.
+     * @returns record of the archive with the highest priority or nullptr.
+     */
+    const ArchiveRecord* find(const char* recordName) const;
+    const ArchiveRecord* find(const std::string& recordName) const;
+
+    /** Reads contents of named record from the archive with the highest priority. */
+    bool getRecordData(const std::string& recordName, std::vector<char>& data) const;
+
+    /** Returns view of named record in memory mapped archive, see FfReader::getRecordView(). */
+    RecordView getRecordView(const std::string& recordName) const;
+
+    /** Returns number of unique names across all archives. */
+    size_t namesTotal() const;
+
+    /**
+     * Returns names of all archives merged, e.g. to build NameQuery.
+     * Values are indices of records, see record().
+     */
+    const NameIndex& getNameIndex() const;
+
+    /** Returns record of the archive with the highest priority by index from getNameIndex(). */
+    const ArchiveRecord& record(uint32_t recordIndex) const;
+
+private:
+    FfArchiveSet(const FfArchiveSet&);
+    FfArchiveSet& operator=(const FfArchiveSet&);
+
+    struct Archive
+    {
+        const FfReader* reader;
+        bool owned;
+    };
+
+    /** Adds names of archive to merged names, overriding names of archives mounted earlier. */
+    void mergeNames(uint32_t archiveIndex);
+
+    std::vector<Archive> archives;
+    NameIndex recordNames;                /**< Maps names to indices of records. */
+    std::vector<ArchiveRecord> records;   /**< Winning record of each name. */
+};
+
+#endif
@@ -21,11 +21,21 @@
  */
 
 #include "pstdint.h"
+#include "FfReaderConfig.hpp"
+#include "FfReaderStats.hpp"
+#include "MappedFile.hpp"
+#include "Mutex.hpp"
+#include "NameIndex.hpp"
+#include "RandomAccessFile.hpp"
+#include "Stopwatch.hpp"
 #include <fstream>
+#include <list>
 #include <map>
 #include <utility>
 #include <vector>
 
+class ThreadPool;
+
 /** Header of MQDB (.ff) file. */
 struct MqdbHeader
 {
@@ -38,7 +48,8 @@ struct MqdbHeader
 /** Special MQRC records have their own predefined ids. */
 enum SpecialId
 {
-    NameList = 2 /**< Names list MQRC record. */
+    TableOfContents = 0, /**< MQRC record holding ToC, file header points to its contents. */
+    NameList = 2         /**< Names list MQRC record. */
 };
 
 typedef uint32_t RecordId;
@@ -64,7 +75,42 @@ struct MqrcHeader
     uint32_t unknown2;
 };
 
-
+/**
+ * Read-only array of elements owned by FfReader.
+ * Parsed metadata keeps elements of the same kind in a single FfReader allocation
+ * and refers to them with views instead of allocating a std::vector per object.
+ */
+template <typename T>
+struct ArrayView
+{
+    const T* data;  /**< First element, NULL if view is empty. */
+    uint32_t count; /**< Number of elements. */
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    const T& operator[](size_t index) const
+    {
+        return data[index];
+    }
+
+    const T* begin() const
+    {
+        return data;
+    }
+
+    const T* end() const
+    {
+        return data + count;
+    }
+};
 
 /**
  * Describes part of a packed image.
@@ -91,10 +137,13 @@ struct ImageFrame
         : name(name)
         , width(width)
         , height(height)
-    { }
+    {
+        parts.data = NULL;
+        parts.count = 0;
+    }
 
-    std::vector<ImagePart> parts; /**< Parts used for unpacking. */
-    std::string name;             /**< Name of this frame. */
+    const char* name;            /**< Null terminated name of this frame, stored in place. */
+    ArrayView<ImagePart> parts;  /**< Parts used for unpacking. */
     uint32_t width;          /**< Width of unpacked frame. */
     uint32_t height;         /**< Height of unpacked frame. */
 };
@@ -107,8 +156,52 @@ struct ImageFrame
  */
 struct PackedImage
 {
-    std::vector<char> palette; /**< 11 + 1024 bytes. 11-byte header and 256 4-byte colors. */
+    /**
+     * 11 + 1024 bytes. 11-byte header and 256 4-byte colors.
+     * Points into '-IMAGES.OPT' contents kept by FfReader.
+     */
+    const char* palette;
+    ArrayView<ImageFrame> frames;
+};
+
+/**
+ * Packed image that owns copies of its frames and parts.
+ * Palette and frame names still point into FfReader contents
+ * and stay valid as long as FfReader that produced the image.
+ */
+struct PackedImageCopy
+{
+    PackedImageCopy();
+    PackedImageCopy(const PackedImageCopy& other);
+    PackedImageCopy& operator=(const PackedImageCopy& other);
+#ifdef FFREADER_CXX11
+    PackedImageCopy(PackedImageCopy&& other)
+        : PackedImageCopy()
+    {
+        swap(other);
+    }
+
+    PackedImageCopy& operator=(PackedImageCopy&& other)
+    {
+        if (this != &other) {
+            PackedImageCopy moved;
+            moved.swap(other);
+            swap(moved);
+        }
+
+        return *this;
+    }
+#endif
+
+    /** Replaces contents with a copy of specified image frames and parts. */
+    void assign(const PackedImage& packedImage);
+
+    /** Exchanges contents without copying frames and parts, views stay valid. */
+    void swap(PackedImageCopy& other);
+
+    PackedImage image; /**< Views point into frames and parts below. */
     std::vector<ImageFrame> frames;
+    std::vector<ImagePart> parts;
 };
 
 typedef uint32_t RelativeOffset;
@@ -130,7 +223,7 @@ typedef std::pair<RelativeOffset, /**< Offset from the beginning of '-IMAGES.OPT
 struct ImageIndices
 {
     std::vector<RecordId> ids;      /**< Ids of MQRC records where raw data is stored. */
-    std::vector<std::string> names; /**< Names of images. */
+    std::vector<const char*> names; /**< Names of images, stored in place. */
     std::vector<PackedImageInfo> packedInfo;
 };
 
@@ -141,7 +234,7 @@ struct ImageIndices
  */
 struct AnimationIndices
 {
-    std::vector<std::string> names; /**< Names of animations. */
+    std::vector<const char*> names; /**< Names of animations, stored in place. */
     std::vector<PackedImageInfo> packedInfo;
 };
 
@@ -152,12 +245,121 @@ struct IndexData
     AnimationIndices animations;
 };
 
+/**
+ * Read-only view of MQRC record contents, past its MqrcHeader.
+ * Points directly into memory mapped file and stays valid as long as FfReader that created it.
+ */
+struct RecordView
+{
+    const char* data; /**< First byte of record contents, NULL if view is empty. */
+    uint32_t size;    /**< Size of record contents, in bytes. */
+};
+
+/** Options that control how FfReader opens and reads MQDB (.ff) file. */
+struct FfReaderOptions
+{
+    FfReaderOptions()
+        : readImageData(true)
+        , memoryMapped(false)
+        , lazyImages(false)
+        , imageCacheLimit(0)
+        , loadIndexSidecar(false)
+        , writeIndexSidecar(false)
+        , collectStats(false)
+        , timeLookups(false)
+        , statsHook(NULL)
+        , parseThreads(1)
+    { }
+
+    bool readImageData; /**< Read and cache contents of '-IMAGES.OPT'. */
+    /**
+     * Map file into memory once and serve all record reads from the mapping.
+     * If mapping fails, reader silently falls back to positional file reads.
+     */
+    bool memoryMapped;
+    /**
+     * Do not decode '-IMAGES.OPT' at open time, only remember where each PackedImage starts.
+     * Images are decoded on first FfReader::getPackedImage() call.
+     */
+    bool lazyImages;
+    /** Maximum number of decoded images kept in lazy mode, 0 means no limit. */
+    size_t imageCacheLimit;
+    /**
+     * Load parsed contents from index sidecar next to .ff file when it is fresh.
+     * Stale or missing sidecar falls back to parsing the whole file.
+     */
+    bool loadIndexSidecar;
+    /** Write index sidecar after parsing the whole file. Write errors are ignored. */
+    bool writeIndexSidecar;
+    /**
+     * Count reads and lookups reported by FfReader::getStats().
+     * Every thread using the reader updates the same counters, which costs
+     * an atomic add per read and lookup. Enabled by timeLookups and statsHook as well.
+     */
+    bool collectStats;
+    /** Measure latency of every ToC lookup, costs two clock reads per lookup. */
+    bool timeLookups;
+    /** Receives statistics events, must outlive the reader. */
+    FfReaderStatsHook* statsHook;
+    /**
+     * Number of threads parsing names list, '-INDEX.OPT' and '-IMAGES.OPT' at open time.
+     * 1 parses them one after another on calling thread, 0 means one per hardware thread.
+     * Durations of parallel phases overlap.
+     */
+    size_t parseThreads;
+};
+
+/** Describes what FfReader::refresh() had to parse again. */
+struct RefreshResult
+{
+    RefreshResult()
+        : recordsChanged(0)
+        , namesReparsed(false)
+        , indexReparsed(false)
+        , imagesReparsed(false)
+    { }
+
+    size_t recordsChanged; /**< ToC records that were added, removed, moved or resized. */
+    bool namesReparsed;
+    bool indexReparsed;
+    bool imagesReparsed;
+};
+
+/**
+ * Read and lookup counters of FfReader, see FfReaderStats.
+ * Allocated separately from the reader, so threads updating them
+ * do not write to cache lines holding its read-only indices.
+ */
+struct FfReaderCounters
+{
+    AtomicCounter bytesRead;
+    AtomicCounter readCalls;
+    AtomicCounter seeks;
+    AtomicCounter mappedBytes;
+    AtomicCounter lookups;
+    AtomicCounter lookupLatency[lookupLatencyBuckets];
+};
+
+/**
+ * Reads MQDB (.ff) files.
+ * Contents are parsed in constructor and stay immutable afterwards,
+ * so all const methods can be called from several threads at once.
+ * Record reads use memory mapping or positional reads on a single file handle
+ * and never share stream state between calls.
+ */
 class FfReader
 {
 public:
     FfReader(const std::string& ffFilePath, bool readImageData = true);
+    FfReader(const std::string& ffFilePath, const FfReaderOptions& options);
     ~FfReader();
 
+    /** Returns true if record reads are served from memory mapping. */
+    bool isMemoryMapped() const;
+
+    /** Returns true if contents were loaded from index sidecar instead of being parsed. */
+    bool isIndexSidecarLoaded() const;
+
     /**
      * Searches for table of contents record by specified id.
      * @returns found record or nullptr.
@@ -170,14 +372,153 @@ public:
     /** Searches for table of contents record by name. */
     const TocRecord* findTocRecord(const char* recordName) const;
     const TocRecord* findTocRecord(const std::string& recordName) const;
+    const TocRecord* findTocRecord(const char* recordName, size_t nameLength) const;
+#ifdef FFREADER_STRING_VIEW
+    const TocRecord* findTocRecord(std::string_view recordName) const
+    {
+        return findTocRecord(recordName.data(), recordName.size());
+    }
+#endif
+
+    /**
+     * Copies record contents without MqrcHeader into data. Thread-safe.
+     * Capacity of data is reused, keep the same buffer between calls to avoid allocations.
+     */
+    bool getRecordData(const char* recordName, std::vector<char>& data) const;
+    bool getRecordData(const std::string& recordName, std::vector<char>& data) const;
+    bool getRecordData(RecordId recordId, std::vector<char>& data) const;
+#ifdef FFREADER_STRING_VIEW
+    bool getRecordData(std::string_view recordName, std::vector<char>& data) const
+    {
+        const TocRecord* record = findTocRecord(recordName);
+        return record && getRecordData(*record, data);
+    }
+#endif
+
+    /**
+     * Returns view of record contents without copying them.
+     * Requires memory mapped reader, see FfReaderOptions::memoryMapped.
+     * @returns empty view if record was not found,
+     * points outside of the file or reader is not memory mapped.
+     */
+    RecordView getRecordView(const char* recordName) const;
+    RecordView getRecordView(const std::string& recordName) const;
+    RecordView getRecordView(RecordId recordId) const;
+#ifdef FFREADER_STRING_VIEW
+    RecordView getRecordView(std::string_view recordName) const
+    {
+        const TocRecord* record = findTocRecord(recordName);
+        if (!record) {
+            RecordView empty = {NULL, 0};
+            return empty;
+        }
+
+        return getRecordView(*record);
+    }
+#endif
 
-    bool getRecordData(const std::string& recordName, std::vector<char>& data);
-    bool getRecordData(RecordId recordId, std::vector<char>& data);
+    /**
+     * Searches for packed image stored at specified offset inside '-IMAGES.OPT'.
+     * Returned image and its frames are stored in FfReader and stay valid as long as it.
+     * In lazy mode image is decoded on first access and cached, cache is guarded by a mutex.
+     * When FfReaderOptions::imageCacheLimit is set, returned pointer stays valid
+     * only until the next getPackedImage() call from any thread,
+     * use the copying overload when sharing such reader between threads.
+     * @returns found image or nullptr.
+     */
+    const PackedImage* getPackedImage(RelativeOffset offset) const;
+    /** Searches for packed image described by '-INDEX.OPT' entry. */
+    const PackedImage* getPackedImage(const PackedImageInfo& packedInfo) const;
+
+    /**
+     * Copies packed image stored at specified offset inside '-IMAGES.OPT'.
+     * Thread-safe regardless of cache limit.
+     * @returns false if image was not found.
+     */
+    bool getPackedImage(RelativeOffset offset, PackedImageCopy& packedImage) const;
+
+    /**
+     * Decodes packed image stored at specified offset of '-IMAGES.OPT' or '-ANIMS.OPT' contents.
+     * Palette and frame names of decoded image point into contents.
+     * @returns false if image does not fit into contents.
+     */
+    static bool decodePackedImage(const char* contents,
+                                  uint32_t contentsSize,
+                                  RelativeOffset offset,
+                                  PackedImageCopy& packedImage);
+
+    /**
+     * Searches for '-INDEX.OPT' image entry by name using hash table built at open time.
+     * @returns false if there is no image with such name.
+     */
+    bool findImageIndex(const char* imageName, RecordId& recordId, PackedImageInfo& packedInfo) const;
+    bool findImageIndex(const std::string& imageName,
+                        RecordId& recordId,
+                        PackedImageInfo& packedInfo) const;
+    bool findImageIndex(const char* imageName,
+                        size_t nameLength,
+                        RecordId& recordId,
+                        PackedImageInfo& packedInfo) const;
+#ifdef FFREADER_STRING_VIEW
+    bool findImageIndex(std::string_view imageName,
+                        RecordId& recordId,
+                        PackedImageInfo& packedInfo) const
+    {
+        return findImageIndex(imageName.data(), imageName.size(), recordId, packedInfo);
+    }
+#endif
+
+    /** Searches for '-INDEX.OPT' animation entry by name. */
+    bool findAnimationIndex(const char* animationName, PackedImageInfo& packedInfo) const;
+    bool findAnimationIndex(const std::string& animationName, PackedImageInfo& packedInfo) const;
+    bool findAnimationIndex(const char* animationName,
+                            size_t nameLength,
+                            PackedImageInfo& packedInfo) const;
+#ifdef FFREADER_STRING_VIEW
+    bool findAnimationIndex(std::string_view animationName, PackedImageInfo& packedInfo) const
+    {
+        return findAnimationIndex(animationName.data(), animationName.size(), packedInfo);
+    }
+#endif
 
     /** Returns names from names list record. */
     std::vector<std::string> getNames() const;
 
+    /**
+     * Returns names from names list record mapped to their ids, in names list order.
+     * Unlike getNames(), iterating it does not copy names.
+     */
+    const NameIndex& getNameIndex() const;
+
+    /**
+     * Re-reads table of contents after file was changed and parses again only what changed.
+     * Records are compared by ToC offset, size and allocated size, records rewritten in place
+     * with the same size are not noticed. Names list is kept unless a listed record appears,
+     * disappears or changes its used flag, '-INDEX.OPT' and '-IMAGES.OPT' are kept
+     * unless their records changed. When nothing changed, reader is left as it was.
+     * Otherwise memory mapping and file handle are reopened, views kept by the reader
+     * are moved to the new mapping, and when true is returned these become invalid:
+     * TocRecord pointers from findTocRecord(), RecordView from getRecordView(),
+     * '-INDEX.OPT' names when index was parsed again, PackedImage pointers
+     * when images were parsed again.
+     * FfArchiveSet and AnimationDecoder keep records by id and stay valid,
+     * call FfArchiveSet::remount() when names were parsed again.
+     * Must not be called while other threads use the reader.
+     * Throws std::runtime_error exception in case of errors, reader must not be used then.
+     * @returns true if anything changed.
+     */
+    bool refresh(RefreshResult* result = NULL);
+
+    /** Returns snapshot of statistics collected since the reader was opened. Thread-safe. */
+    FfReaderStats getStats() const;
+
     // protected:
+    /**
+     * Opens MQDB file and parses its contents according to options.
+     * Throws std::runtime_error exception in case of errors.
+     */
+    void open(const FfReaderOptions& options);
+
     /**
      * Reads and checks if MQDB file header is correct.
      * Throws std::runtime_error exception if not.
@@ -191,33 +532,166 @@ public:
     void readTableOfContents(std::ifstream& file);
 
     /**
-     * Reads and caches names list contents.
+     * Reads names list contents and checks that its entries fit.
+     * Throws std::runtime_error exception in case of errors.
+     */
+    void readNameListContents(std::ifstream& file, std::vector<char>& contents) const;
+
+    /**
+     * Searches names list contents for used record with specified name.
+     * Gives the same result as findTocRecord() after readNameList(),
+     * so sections can be located before names are stored.
+     * Throws std::runtime_error exception in case of errors.
+     */
+    const TocRecord* findListedRecord(std::ifstream& file,
+                                      const std::vector<char>& contents,
+                                      const char* recordName) const;
+
+    /**
+     * Checks whether listed records from changedIds appeared, disappeared
+     * or changed their used flag, so names stored by readNameList would differ.
+     * Throws std::runtime_error exception in case of errors.
+     */
+    bool nameListChanged(std::ifstream& file,
+                         const std::vector<char>& contents,
+                         const std::vector<RecordId>& changedIds) const;
+
+    /**
+     * Caches names list contents read by readNameListContents.
      * Throws std::runtime_error exception in case of errors.
      */
-    void readNameList(std::ifstream& file);
+    void readNameList(std::ifstream& file, const std::vector<char>& contents);
 
     /**
      * Reads and caches contents of '-INDEX.OPT' MQRC record, if present.
      * Throws std::runtime_error exception in case of errors.
      */
-    void readIndex(std::ifstream& file);
+    void readIndex(std::ifstream& file, const TocRecord* record);
 
     /**
      * Reads and caches contents of '-IMAGES.OPT' MQRC record, if present.
+     * Packed images are decoded in chunks on specified pool, if any.
      * Throws std::runtime_error exception in case of errors.
      */
-    void readImages(std::ifstream& file);
+    void readImages(std::ifstream& file, const TocRecord* record, ThreadPool* pool);
 
-    bool getRecordData(const TocRecord& record, std::vector<char>& data);
+    /**
+     * Parses names list, '-INDEX.OPT' and '-IMAGES.OPT' concurrently.
+     * Throws std::runtime_error exception in case of errors.
+     */
+    void readSections(std::ifstream& file,
+                      const std::vector<char>& nameListContents,
+                      const FfReaderOptions& options);
+
+    /**
+     * Reads MQRC record header at specified offset, from mapping if reader is memory mapped.
+     * @returns false if header could not be read.
+     */
+    bool readRecordHeader(std::ifstream& file, uint32_t offset, MqrcHeader& header) const;
 
-    std::map<RecordId, TocRecord> tableOfContents;
-    std::map<std::string, RecordId> recordNames;
+    /**
+     * Reads contents of MQRC record during parsing, from mapping if reader is memory mapped.
+     * @returns false if contents could not be read.
+     */
+    bool readRecordContents(std::ifstream& file,
+                            const TocRecord& record,
+                            std::vector<char>& contents) const;
+
+    bool getRecordData(const TocRecord& record, std::vector<char>& data) const;
+
+    /**
+     * Searches for packed image in lazy cache, decodes and caches it if needed.
+     * Must be called with imageCacheMutex locked.
+     */
+    const PackedImage* findCachedImage(RelativeOffset offset) const;
+    RecordView getRecordView(const TocRecord& record) const;
+
+    /** Searches for table of contents record by id without counting the lookup. */
+    const TocRecord* searchTocRecord(RecordId recordId) const;
+
+    /** Counts read call against file. */
+    void countRead(uint64_t bytes) const;
+    void countSeek() const;
+
+    /**
+     * Reads bytes at specified offset of file with recordFile and counts the read.
+     * @returns false if recordFile is not open or range is outside of file.
+     */
+    bool readFileRange(uint64_t offset, char* buffer, size_t size) const;
+
+    /** Counts lookup that started at specified Stopwatch::now() time, if it was timed. */
+    void countLookup(double startTime) const;
+
+    /** Stores duration of finished phase and restarts stopwatch for the next one. */
+    void finishPhase(FfReaderPhase phase, Stopwatch& stopwatch);
+
+    /** Recomputes memory used by parsed metadata, lazy image cache is accounted separately. */
+    void updateMetadataBytes();
+
+    /** Moves views pointing into old mapping to the same offsets of the new one. */
+    void rebaseViews(const char* oldData, size_t oldSize, const char* newData);
+
+    std::vector<TocRecord> tableOfContents; /**< Sorted by record id. */
+    NameIndex recordNames;                   /**< Record names mapped to their ids. */
 
     IndexData indexData;
+    /** Image names of '-INDEX.OPT' mapped to their indices in indexData.images. */
+    NameIndex imageIndexNames;
+    /** Animation names of '-INDEX.OPT' mapped to their indices in indexData.animations. */
+    NameIndex animationIndexNames;
 
-    std::map<RelativeOffset, PackedImage> packedImages;
+    /**
+     * Decoded packed images, in the same order as packedImageOffsets.
+     * Frames and parts of every image are stored in imageFrames and imageParts,
+     * palettes and names point into '-IMAGES.OPT' contents. Not used in lazy mode.
+     */
+    std::vector<PackedImage> packedImages;
+    std::vector<ImageFrame> imageFrames;
+    std::vector<ImagePart> imageParts;
 
     std::string ffFilePath;
+
+    MappedFile mappedFile;
+    RandomAccessFile recordFile; /**< Used for reads when file is not memory mapped. */
+
+    /** Lazily decoded packed image and its position in least recently used list. */
+    struct CachedImage
+    {
+        PackedImageCopy image;
+        std::list<RelativeOffset>::iterator position;
+    };
+
+    /**
+     * Contents of '-INDEX.OPT' holding index names, unless they are inside the mapping.
+     * Holds names section of index sidecar when it was loaded.
+     */
+    std::vector<char> indexContents;
+
+    /** Contents of '-IMAGES.OPT', either inside the mapping or imagesContents. */
+    RecordView imagesRecord;
+    std::vector<char> imagesContents;
+    /** Sorted offsets of packed images inside '-IMAGES.OPT'. */
+    std::vector<RelativeOffset> packedImageOffsets;
+
+    mutable std::map<RelativeOffset, CachedImage> imageCache;
+    mutable std::list<RelativeOffset> imageCacheOrder; /**< Most recently used images first. */
+    mutable Mutex imageCacheMutex;
+    size_t imageCacheLimit;
+    bool lazyImages;
+    bool readImageData;
+    bool indexSidecarLoaded;
+
+    // Statistics, see FfReaderStats. Cache statistics are guarded by imageCacheMutex
+    FfReaderCounters* counters; /**< NULL unless read and lookup statistics are collected. */
+    double phaseSeconds[PhasesTotal];
+    mutable uint64_t imageCacheHits;
+    mutable uint64_t imageCacheMisses;
+    mutable uint64_t imageCacheEvictions;
+    mutable size_t imageCacheBytes; /**< Memory used by decoded images of lazy cache. */
+    mutable size_t peakMetadataBytes;
+    size_t metadataBytes;
+    bool timeLookups;
+    FfReaderStatsHook* statsHook;
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef FfReaderConfig_hpp
+#define FfReaderConfig_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Optional C++11 and C++17 API layer, enabled when compiler of the including file supports it.
+ * Define FFREADER_NO_CXX11 to use C++98 API only with a newer compiler.
+ * Everything in the layer is defined inline on top of C++98 API, so library built
+ * with one standard can be used by code built with another one.
+ *
+ * FFREADER_CXX11       move constructors and assignments of types that own copies.
+ * FFREADER_STRING_VIEW lookups taking std::string_view, names are not copied.
+ */
+
+#if defined(_MSVC_LANG)
+#define FFREADER_CPLUSPLUS _MSVC_LANG
+#else
+#define FFREADER_CPLUSPLUS __cplusplus
+#endif
+
+#if !defined(FFREADER_NO_CXX11) && FFREADER_CPLUSPLUS >= 201103L
+#define FFREADER_CXX11
+#endif
+
+#if defined(FFREADER_CXX11) && FFREADER_CPLUSPLUS >= 201703L
+#define FFREADER_STRING_VIEW
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef FfReaderStats_hpp
+#define FfReaderStats_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pstdint.h"
+#include <stddef.h>
+
+/**
+ * Statistics are collected unless FFREADER_NO_STATS is defined when building the library.
+ * Without them FfReader::getStats() returns zeros and hooks are never called,
+ * layout of FfReader stays the same either way.
+ * Read and lookup counters are shared by all threads, so they are only updated
+ * when FfReaderOptions::collectStats, timeLookups or statsHook asks for them.
+ */
+
+/** Parsing phases of FfReader constructor. */
+enum FfReaderPhase
+{
+    HeaderPhase,          /**< File header check. */
+    TableOfContentsPhase, /**< ToC records. */
+    NameListPhase,        /**< Names list and record header checks. */
+    IndexPhase,           /**< '-INDEX.OPT' entries. */
+    ImagesPhase,          /**< '-IMAGES.OPT' contents. */
+    SidecarLoadPhase,     /**< Index sidecar load attempt. */
+    SidecarWritePhase,    /**< Index sidecar write. */
+    PhasesTotal
+};
+
+/** Returns printable name of phase, e.g. "toc" for TableOfContentsPhase. */
+const char* ffReaderPhaseName(FfReaderPhase phase);
+
+/**
+ * Number of buckets in lookup latency histogram.
+ * Bucket i counts lookups that took less than 128 << i nanoseconds,
+ * the last one counts slower lookups too.
+ */
+static const size_t lookupLatencyBuckets = 16;
+
+/**
+ * Snapshot of FfReader statistics.
+ * Counters only grow, exporters compute rates from differences between snapshots.
+ */
+struct FfReaderStats
+{
+    FfReaderStats();
+
+    uint64_t bytesRead;   /**< Bytes read from file by parsing and record reads. */
+    uint64_t readCalls;   /**< Number of read calls made against file. */
+    uint64_t seeks;       /**< Number of stream seeks, positional reads do not seek. */
+    uint64_t mappedBytes; /**< Bytes copied out of memory mapping. */
+
+    uint64_t lookups; /**< ToC lookups by name or id, including failed ones. */
+    /** Lookup latencies, collected only with FfReaderOptions::timeLookups. */
+    uint64_t lookupLatency[lookupLatencyBuckets];
+
+    double phaseSeconds[PhasesTotal]; /**< Time spent in constructor phases. */
+
+    uint64_t imageCacheHits;      /**< Lazy image cache lookups that found decoded image. */
+    uint64_t imageCacheMisses;    /**< Lazy image cache lookups that decoded image. */
+    uint64_t imageCacheEvictions; /**< Images evicted from lazy image cache. */
+
+    size_t metadataBytes;     /**< Bytes currently allocated for parsed metadata. */
+    size_t peakMetadataBytes; /**< Largest metadataBytes seen so far. */
+};
+
+/**
+ * Receives FfReader events as they happen, e.g. to forward them to a metrics exporter.
+ * Called from any thread that uses reader, implementation must be thread-safe and cheap.
+ */
+class FfReaderStatsHook
+{
+public:
+    virtual ~FfReaderStatsHook()
+    { }
+
+    /** Called from constructor after each phase. */
+    virtual void onPhase(FfReaderPhase /* phase */, double /* seconds */)
+    { }
+
+    /** Called after each read call made against file. */
+    virtual void onRead(uint64_t /* bytes */)
+    { }
+
+    /** Called after each timed lookup, see FfReaderOptions::timeLookups. */
+    virtual void onLookup(double /* seconds */)
+    { }
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef FfWriter_hpp
+#define FfWriter_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FfReader.hpp"
+#include "NameIndex.hpp"
+#include <stddef.h>
+#include <set>
+#include <string>
+#include <vector>
+
+/** Options of FfWriter. */
+struct FfWriterOptions
+{
+    FfWriterOptions()
+        : bufferSize(4 * 1024 * 1024)
+        , recordSlack(0)
+    { }
+
+    /**
+     * Size of write buffer. Headers and small records are gathered in it,
+     * contents that do not fit are written directly from caller memory.
+     */
+    size_t bufferSize;
+    /**
+     * Extra bytes allocated after contents of each record,
+     * so record can be patched with larger contents in place later.
+     */
+    uint32_t recordSlack;
+};
+
+/**
+ * Builds MQDB (.ff) files.
+ * Records, '-INDEX.OPT' entries and packed images are collected first,
+ * write() computes every offset up front and writes the whole file in a single sequential pass:
+ * file header, MQRC records, '-INDEX.OPT', '-IMAGES.OPT', names list and ToC record.
+ */
+class FfWriter
+{
+public:
+    explicit FfWriter(const FfWriterOptions& options = FfWriterOptions());
+
+    /**
+     * Adds record with specified id and name, records without name are stored in ToC only.
+     * Contents are not copied and must stay valid until write() returns.
+     * @returns false if id is reserved or already used, name is already used
+     * or does not fit into names list.
+     */
+    bool addRecord(RecordId recordId, const std::string& name, const char* data, uint32_t size);
+    bool addRecord(RecordId recordId, const std::string& name, const std::vector<char>& contents);
+
+    /**
+     * Appends packed image to '-IMAGES.OPT', palette and frames are copied.
+     * Missing palette is written as zeros.
+     * @returns offset and size of the image to be used in '-INDEX.OPT' entries.
+     */
+    PackedImageInfo addPackedImage(const PackedImage& packedImage);
+
+    /** Adds '-INDEX.OPT' entry of image whose parts are stored in specified record. */
+    void addImageIndex(RecordId recordId, const std::string& name, const PackedImageInfo& packedInfo);
+
+    /** Adds '-INDEX.OPT' entry of animation frame. */
+    void addAnimationIndex(const std::string& name, const PackedImageInfo& packedInfo);
+
+    /**
+     * Writes MQDB file, replacing existing one.
+     * '-INDEX.OPT' and '-IMAGES.OPT' records are created when any image or index entry was added,
+     * records with these names must not be added explicitly then.
+     * @returns false if file could not be written.
+     */
+    bool write(const std::string& ffFilePath) const;
+
+    /**
+     * Replaces contents of named record inside existing MQDB file without rewriting the file.
+     * Contents that fit into record allocation are written in place.
+     * Larger contents are appended to the end of file, ToC entry is pointed to the new copy
+     * and old record is marked unused.
+     * File must not be modified by anyone else during the call.
+     * Index sidecar of the file is removed once file was opened for writing.
+     * @returns false if record was not found or file could not be updated.
+     */
+    static bool patchRecord(const std::string& ffFilePath,
+                            const std::string& recordName,
+                            const char* data,
+                            uint32_t size);
+
+private:
+    struct Record
+    {
+        RecordId recordId;
+        std::string name;
+        const char* data;
+        uint32_t size;
+    };
+
+    FfWriterOptions options;
+    std::vector<Record> records;
+    NameIndex recordNames;
+    std::set<RecordId> recordIds;
+
+    uint32_t indexTotal;              /**< Number of '-INDEX.OPT' entries. */
+    std::vector<char> indexEntries;   /**< '-INDEX.OPT' contents without entries total. */
+    std::vector<char> imagesContents; /**< '-IMAGES.OPT' contents. */
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef ImageUnpacker_hpp
+#define ImageUnpacker_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FfReader.hpp"
+#include <stddef.h>
+
+/**
+ * Describes shuffled image pixels that frame parts are copied from.
+ * Usually these are decoded pixels of MQRC record referenced by '-INDEX.OPT'.
+ */
+struct SourceImage
+{
+    const char* pixels;     /**< First pixel of top row. */
+    uint32_t width;         /**< Width of image, in pixels. */
+    uint32_t height;        /**< Height of image, in pixels. */
+    size_t pitch;           /**< Distance between rows, in bytes. */
+    uint32_t bytesPerPixel; /**< 1 for palettized images, 4 for 32-bit images. */
+};
+
+/**
+ * Reassembles frame from shuffled source image by copying each of its parts.
+ * Target buffer must hold frame.height rows of frame.width pixels
+ * with the same bytes per pixel as source image, targetPitch bytes apart.
+ * Pixels that are not covered by any part are left untouched.
+ * @param targetPitch distance between target rows in bytes, 0 means tightly packed rows.
+ * @returns false if any part lies outside of source image or frame, nothing is copied then.
+ */
+bool unpackFrame(const ImageFrame& frame,
+                 const SourceImage& source,
+                 char* targetPixels,
+                 size_t targetPitch = 0);
+
+/**
+ * Convenience overload for tightly packed source image.
+ * @param bytesPerPixel 1 for palettized images, 4 for 32-bit images.
+ */
+bool unpackFrame(const ImageFrame& frame,
+                 const char* sourcePixels,
+                 uint32_t sourceWidth,
+                 uint32_t sourceHeight,
+                 uint32_t bytesPerPixel,
+                 char* targetPixels,
+                 size_t targetPitch = 0);
+
+/** Byte order of 32-bit pixels produced by palette expansion. */
+enum PixelOrder
+{
+    RgbaOrder, /**< Red, green, blue, alpha bytes in memory. */
+    BgraOrder  /**< Blue, green, red, alpha bytes in memory. */
+};
+
+/** No palette index is treated as transparent. */
+static const int noTransparentIndex = -1;
+
+/**
+ * Palette of PackedImage decoded into ready to store 32-bit pixels.
+ * Decode it once per image and reuse it for every frame.
+ */
+struct PaletteTable
+{
+    uint32_t colors[256];
+};
+
+/**
+ * Decodes PackedImage::palette into 32-bit pixels of requested byte order.
+ * Palette colors are stored as blue, green, red and unused bytes after 11-byte header.
+ * All colors are opaque except the one at transparentIndex, which gets zero alpha.
+ * @returns false if palette is missing.
+ */
+bool decodePalette(const char* palette,
+                   PaletteTable& table,
+                   PixelOrder order = RgbaOrder,
+                   int transparentIndex = noTransparentIndex);
+
+/**
+ * Expands row of 8-bit palette indices into 32-bit pixels.
+ * Uses AVX2 gathers on x86 processors that support them, unrolled table lookups otherwise.
+ */
+void expandPalette(const char* indices, size_t pixelsTotal, const PaletteTable& table, char* target);
+
+/**
+ * Expands rectangular 8-bit image into 32-bit pixels row by row.
+ * @param sourcePitch distance between source rows in bytes, 0 means width bytes.
+ * @param targetPitch distance between target rows in bytes, 0 means width * 4 bytes.
+ */
+void expandPalette(const char* indices,
+                   uint32_t width,
+                   uint32_t height,
+                   const PaletteTable& table,
+                   char* target,
+                   size_t sourcePitch = 0,
+                   size_t targetPitch = 0);
+
+#endif
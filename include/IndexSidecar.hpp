@@ -0,0 +1,53 @@
+#ifndef IndexSidecar_hpp
+#define IndexSidecar_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FfReader.hpp"
+#include <string>
+
+/**
+ * Index sidecar is a file stored next to .ff file with everything FfReader parses at open time:
+ * sorted ToC, names hash table, '-INDEX.OPT' entries and flattened '-IMAGES.OPT' frame tables.
+ * All sections are plain arrays of 4-byte aligned values, so loading does not parse anything.
+ * Sidecar remembers size, modification time and ToC checksum of .ff file
+ * and is ignored when any of them changes.
+ */
+
+/** Returns sidecar path for specified .ff file: 'Icons.ff' gets 'Icons.ffidx'. */
+std::string indexSidecarPath(const std::string& ffFilePath);
+
+/**
+ * Writes index sidecar of opened reader, replacing existing file.
+ * Frame tables are written only when reader has read '-IMAGES.OPT'.
+ * @returns false if sidecar could not be written.
+ */
+bool writeIndexSidecar(const FfReader& reader, const std::string& sidecarPath);
+
+/**
+ * Loads parsed contents of reader from index sidecar.
+ * Sidecar is rejected when it is missing, corrupted, written by another version,
+ * does not match current .ff file or lacks frame tables that readImageData asks for.
+ * Reader must have its file opened, reader contents stay unchanged on failure.
+ * @returns true if sidecar was loaded.
+ */
+bool loadIndexSidecar(FfReader& reader, const std::string& sidecarPath, bool readImageData);
+
+#endif
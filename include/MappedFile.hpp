@@ -0,0 +1,65 @@
+#ifndef MappedFile_hpp
+#define MappedFile_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <string>
+
+/**
+ * Read-only view of a whole file mapped into memory.
+ * Uses mmap on POSIX systems and MapViewOfFile on Windows.
+ * Mapping stays valid until close() is called or object is destroyed.
+ */
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    /**
+     * Maps specified file into memory, unmapping previous one.
+     * @returns false if file could not be opened or mapped.
+     */
+    bool open(const std::string& filePath);
+
+    /** Unmaps file, if any. */
+    void close();
+
+    /** Exchanges mappings, pointers into both of them stay valid. */
+    void swap(MappedFile& other);
+
+    bool isOpen() const;
+
+    /** Returns pointer to the first byte of the mapping or NULL. */
+    const char* data() const;
+
+    /** Returns size of the mapping, in bytes. */
+    size_t size() const;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char* mappedData;
+    size_t mappedSize;
+};
+
+#endif
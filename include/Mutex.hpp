@@ -0,0 +1,137 @@
+#ifndef Mutex_hpp
+#define Mutex_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pstdint.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/**
+ * Minimal threading primitives on top of POSIX threads or Win32,
+ * since the library has to build with C++98 where std::thread is not available.
+ */
+
+/** Non-recursive mutex. */
+class Mutex
+{
+public:
+    Mutex();
+    ~Mutex();
+
+    void lock();
+    void unlock();
+
+private:
+    friend class Condition;
+
+    Mutex(const Mutex&);
+    Mutex& operator=(const Mutex&);
+
+    struct Impl;
+    Impl* impl;
+};
+
+/** Locks mutex for the lifetime of the object. */
+class ScopedLock
+{
+public:
+    explicit ScopedLock(Mutex& mutex)
+        : mutex(mutex)
+    {
+        mutex.lock();
+    }
+
+    ~ScopedLock()
+    {
+        mutex.unlock();
+    }
+
+private:
+    ScopedLock(const ScopedLock&);
+    ScopedLock& operator=(const ScopedLock&);
+
+    Mutex& mutex;
+};
+
+/**
+ * 64-bit counter updated from several threads without locking.
+ * Uses compiler intrinsics, so it stays header only and cheap enough for hot paths.
+ */
+class AtomicCounter
+{
+public:
+    AtomicCounter()
+        : count(0)
+    { }
+
+    void add(uint64_t value)
+    {
+#ifdef _MSC_VER
+        _InterlockedExchangeAdd64(&count, static_cast<__int64>(value));
+#else
+        __sync_fetch_and_add(&count, value);
+#endif
+    }
+
+    uint64_t value() const
+    {
+#ifdef _MSC_VER
+        return static_cast<uint64_t>(
+            _InterlockedCompareExchange64(const_cast<volatile __int64*>(&count), 0, 0));
+#else
+        return __sync_fetch_and_add(const_cast<volatile uint64_t*>(&count), 0);
+#endif
+    }
+
+private:
+    AtomicCounter(const AtomicCounter&);
+    AtomicCounter& operator=(const AtomicCounter&);
+
+#ifdef _MSC_VER
+    volatile __int64 count;
+#else
+    volatile uint64_t count;
+#endif
+};
+
+/** Condition variable that works with Mutex. */
+class Condition
+{
+public:
+    Condition();
+    ~Condition();
+
+    /** Atomically unlocks mutex and waits, mutex is locked again on return. */
+    void wait(Mutex& mutex);
+    void notifyOne();
+    void notifyAll();
+
+private:
+    Condition(const Condition&);
+    Condition& operator=(const Condition&);
+
+    struct Impl;
+    Impl* impl;
+};
+
+#endif
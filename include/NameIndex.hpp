@@ -0,0 +1,200 @@
+#ifndef NameIndex_hpp
+#define NameIndex_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pstdint.h"
+#include "FfReaderConfig.hpp"
+#include <stddef.h>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#ifdef FFREADER_STRING_VIEW
+#include <string_view>
+#endif
+
+/**
+ * Maps unique names to 32-bit values.
+ * Names are stored one after another in a single arena,
+ * lookups use open addressing hash table with linear probing.
+ * Entries keep insertion order and can be accessed by index.
+ */
+class NameIndex
+{
+public:
+    NameIndex();
+
+    /** Prepares index for specified number of names to avoid rehashing. */
+    void reserve(size_t namesTotal);
+
+    void clear();
+    void swap(NameIndex& other);
+
+    /**
+     * Adds name with associated value.
+     * @returns false if name is already present, in that case its value is not changed.
+     */
+    bool insert(const char* name, size_t nameLength, uint32_t value);
+    bool insert(const std::string& name, uint32_t value);
+
+    /**
+     * Searches for name.
+     * @returns pointer to associated value or nullptr.
+     */
+    const uint32_t* find(const char* name, size_t nameLength) const;
+    const uint32_t* find(const char* name) const;
+    const uint32_t* find(const std::string& name) const;
+#ifdef FFREADER_STRING_VIEW
+    const uint32_t* find(std::string_view name) const
+    {
+        return find(name.data(), name.size());
+    }
+#endif
+
+    /** Returns number of stored names. */
+    size_t size() const;
+    bool empty() const;
+
+    /** Returns number of bytes allocated for names, entries and hash table. */
+    size_t memoryUsed() const;
+
+    /** Returns null terminated name of entry with specified index. */
+    const char* name(size_t index) const;
+    size_t nameLength(size_t index) const;
+    uint32_t value(size_t index) const;
+
+    /** Entry as seen through const_iterator, name points into the index. */
+    struct Item
+    {
+        const char* name; /**< Null terminated. */
+        size_t nameLength;
+        uint32_t value;
+    };
+
+    /** Iterates entries in insertion order without copying names. */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Item value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const Item* pointer;
+        typedef const Item& reference;
+
+        const_iterator()
+            : index(NULL)
+            , position(0)
+        { }
+
+        const_iterator(const NameIndex* index, size_t position)
+            : index(index)
+            , position(position)
+        { }
+
+        reference operator*() const
+        {
+            item.name = index->name(position);
+            item.nameLength = index->nameLength(position);
+            item.value = index->value(position);
+            return item;
+        }
+
+        pointer operator->() const
+        {
+            return &operator*();
+        }
+
+        const_iterator& operator++()
+        {
+            ++position;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator previous(*this);
+            ++position;
+            return previous;
+        }
+
+        bool operator==(const const_iterator& other) const
+        {
+            return position == other.position && index == other.index;
+        }
+
+        bool operator!=(const const_iterator& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        const NameIndex* index;
+        size_t position;
+        mutable Item item;
+    };
+
+    const_iterator begin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(this, size());
+    }
+
+    /**
+     * Appends names, entries and hash table to output as is, so they can be loaded
+     * without rehashing. Sections are padded to 4 bytes.
+     */
+    void save(std::vector<char>& output) const;
+
+    /**
+     * Replaces contents with index saved at specified offset of data.
+     * Adjusts offset after reading.
+     * @returns false if saved index is truncated or inconsistent, contents are unchanged then.
+     */
+    bool load(const char* data, size_t size, size_t& byteOffset);
+
+    /** Hash function used by index, 32-bit FNV-1a. */
+    static uint32_t hash(const char* name, size_t nameLength);
+
+private:
+    struct Entry
+    {
+        uint32_t nameOffset; /**< Offset of name inside names arena. */
+        uint32_t nameLength;
+        uint32_t hash;
+        uint32_t value;
+    };
+
+    static const uint32_t emptySlot = 0xffffffffu;
+
+    /** Returns slot holding specified name or empty slot where it can be placed. */
+    size_t findSlot(const char* name, size_t nameLength, uint32_t nameHash) const;
+    void rehash(size_t slotsTotal);
+
+    std::vector<char> names;     /**< Null terminated names, one after another. */
+    std::vector<Entry> entries;  /**< Entries in insertion order. */
+    std::vector<uint32_t> slots; /**< Entry indices or emptySlot, size is a power of two. */
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef NameQuery_hpp
+#define NameQuery_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "NameIndex.hpp"
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/** Options of NameQuery. */
+struct NameQueryOptions
+{
+    NameQueryOptions()
+        : trigrams(true)
+    { }
+
+    /**
+     * Build trigram index for substring queries.
+     * Without it substring queries check every name.
+     */
+    bool trigrams;
+};
+
+/**
+ * Prefix and substring queries over names of NameIndex, e.g. FfReader::getNameIndex().
+ * Names are not copied: index keeps entry indices sorted by name for prefix queries
+ * and lists of entries containing each 3-byte sequence for substring queries.
+ * Queries are case-sensitive and thread-safe.
+ * Index must be built again after names change, names must outlive it.
+ */
+class NameQuery
+{
+public:
+    NameQuery();
+    explicit NameQuery(const NameIndex& names, const NameQueryOptions& options = NameQueryOptions());
+
+    /** Replaces contents with index of specified names. */
+    void build(const NameIndex& names, const NameQueryOptions& options = NameQueryOptions());
+
+    /**
+     * Searches for names starting with prefix, empty prefix matches every name.
+     * Matches are stored in name order, names point into NameIndex.
+     * Capacity of matches is reused, keep the same vector between calls to avoid allocations.
+     * @returns number of matches.
+     */
+    size_t findPrefix(const char* prefix,
+                      size_t prefixLength,
+                      std::vector<NameIndex::Item>& matches) const;
+    size_t findPrefix(const std::string& prefix, std::vector<NameIndex::Item>& matches) const;
+
+    /**
+     * Searches for names containing substring, empty substring matches every name.
+     * Substrings shorter than 3 bytes check every name.
+     * Matches are stored in names insertion order.
+     * @returns number of matches.
+     */
+    size_t findSubstring(const char* substring,
+                         size_t substringLength,
+                         std::vector<NameIndex::Item>& matches) const;
+    size_t findSubstring(const std::string& substring,
+                         std::vector<NameIndex::Item>& matches) const;
+
+    /** Returns number of indexed names. */
+    size_t size() const;
+
+    /** Returns number of bytes allocated for sorted names and trigram lists. */
+    size_t memoryUsed() const;
+
+private:
+    class NameLess;
+
+    void appendMatch(uint32_t entry, std::vector<NameIndex::Item>& matches) const;
+
+    /** Returns bounds of entries containing trigram, begin equals end if there are none. */
+    void findTrigram(uint32_t trigram, size_t& begin, size_t& end) const;
+
+    const NameIndex* names;
+    std::vector<uint32_t> sortedEntries; /**< Entry indices sorted by name. */
+
+    // Entries containing each trigram, in insertion order
+    std::vector<uint32_t> trigramKeys;    /**< Sorted unique trigrams. */
+    std::vector<uint32_t> trigramStarts;  /**< First element of each trigram list, plus end. */
+    std::vector<uint32_t> trigramEntries; /**< Lists of entry indices, one after another. */
+};
+
+#endif
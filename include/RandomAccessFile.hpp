@@ -0,0 +1,71 @@
+#ifndef RandomAccessFile_hpp
+#define RandomAccessFile_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pstdint.h"
+#include <stddef.h>
+#include <string>
+
+/**
+ * Read-only file handle with positional reads.
+ * Uses pread on POSIX systems and ReadFile with explicit offsets on Windows,
+ * so reads do not share file position and can be issued from several threads at once.
+ */
+class RandomAccessFile
+{
+public:
+    RandomAccessFile();
+    ~RandomAccessFile();
+
+    /**
+     * Opens specified file, closing previous one.
+     * If sequentialScan is set, system is told that file will be read mostly front to back,
+     * so it can read ahead aggressively and drop pages that were already read.
+     * @returns false if file could not be opened.
+     */
+    bool open(const std::string& filePath, bool sequentialScan = false);
+
+    void close();
+
+    bool isOpen() const;
+
+    /** Returns size of the file at the moment it was opened, in bytes. */
+    uint64_t size() const;
+
+    /**
+     * Reads exactly size bytes starting at specified offset. Thread-safe.
+     * @returns false if read failed or file is too short.
+     */
+    bool read(uint64_t offset, void* buffer, size_t size) const;
+
+private:
+    RandomAccessFile(const RandomAccessFile&);
+    RandomAccessFile& operator=(const RandomAccessFile&);
+
+#ifdef _WIN32
+    void* handle;
+#else
+    int handle;
+#endif
+    uint64_t fileSize;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef RecordScanner_hpp
+#define RecordScanner_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FfReader.hpp"
+#include "RandomAccessFile.hpp"
+#include <stddef.h>
+#include <vector>
+
+/** Options of RecordScanner. */
+struct ScanOptions
+{
+    ScanOptions()
+        : bufferSize(8 * 1024 * 1024)
+        , skipUnused(true)
+        , sequentialHint(true)
+    { }
+
+    /**
+     * Size of readahead buffer, several records are read at once while they fit.
+     * Records larger than buffer are read on their own, growing it.
+     * Not used when reader is memory mapped.
+     */
+    size_t bufferSize;
+    bool skipUnused;     /**< Skip records whose MqrcHeader::used is zero. */
+    bool sequentialHint; /**< Tell system that file is read front to back. */
+};
+
+/** Record visited by RecordScanner. */
+struct ScannedRecord
+{
+    RecordId recordId;
+    /** Null terminated name from names list, empty if record is not in names list. */
+    const char* name;
+    MqrcHeader header;
+    /**
+     * Record contents, valid until next RecordScanner call.
+     * Data is NULL if record could not be read or has wrong MQRC signature.
+     */
+    RecordView contents;
+};
+
+/**
+ * Visits every record of a single FfReader in the order records are stored in file.
+ * Unlike random access reads, records are read with large sequential reads through
+ * a single buffer, so whole archive is processed with constant memory.
+ * Memory mapped readers are scanned in place, file reads are counted in FfReaderStats.
+ * Scanner is not thread-safe, but several scanners can share one reader.
+ */
+class RecordScanner
+{
+public:
+    explicit RecordScanner(const FfReader& reader, const ScanOptions& options = ScanOptions());
+
+    /**
+     * Advances to the next record.
+     * @returns false when all records were visited.
+     */
+    bool next(ScannedRecord& record);
+
+    /** Starts scan from the first record again. */
+    void rewind();
+
+private:
+    RecordScanner(const RecordScanner&);
+    RecordScanner& operator=(const RecordScanner&);
+
+    /** Returns record header followed by contents or NULL if they could not be read. */
+    const char* readRecord(const TocRecord& record);
+
+    const FfReader& reader;
+    ScanOptions options;
+
+    std::vector<const TocRecord*> records; /**< Sorted by offset. */
+    std::vector<const char*> names;        /**< Names of records, in the same order. */
+    size_t position;
+
+    RandomAccessFile file;
+    std::vector<char> buffer;
+    uint64_t bufferOffset; /**< File offset of the first buffer byte. */
+    size_t bufferFill;     /**< Number of bytes read into buffer. */
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef ReplacingFile_hpp
+#define ReplacingFile_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string>
+
+/**
+ * Writes file through a temporary file next to it and replaces target in one step.
+ * Temporary name is unique per process and object, so concurrent writers of the same target
+ * do not truncate each other's output. Readers see either old or new target, never a partial
+ * one and never a missing one: rename replaces target atomically on POSIX systems,
+ * MoveFileEx with MOVEFILE_REPLACE_EXISTING is used on Windows.
+ */
+class ReplacingFile
+{
+public:
+    ReplacingFile();
+
+    /** Removes temporary file unless it was committed. */
+    ~ReplacingFile();
+
+    /**
+     * Creates temporary file for specified target, discarding previous one.
+     * @returns stream to write contents to, or NULL if file could not be created.
+     */
+    FILE* open(const std::string& targetPath);
+
+    /**
+     * Closes temporary file and moves it over target.
+     * Temporary file is removed if closing or replacing failed.
+     * @returns false if target was not replaced.
+     */
+    bool commit();
+
+    /** Closes and removes temporary file, target stays as it was. */
+    void discard();
+
+private:
+    ReplacingFile(const ReplacingFile&);
+    ReplacingFile& operator=(const ReplacingFile&);
+
+    std::string targetPath;
+    std::string temporaryPath;
+    FILE* file;
+};
+
+#endif
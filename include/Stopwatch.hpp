@@ -0,0 +1,45 @@
+#ifndef Stopwatch_hpp
+#define Stopwatch_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Measures elapsed wall clock time using monotonic high resolution clock.
+ * Uses clock_gettime on POSIX systems and QueryPerformanceCounter on Windows.
+ */
+class Stopwatch
+{
+public:
+    /** Starts measuring right away. */
+    Stopwatch();
+
+    void restart();
+
+    /** Returns time passed since construction or last restart, in seconds. */
+    double elapsed() const;
+
+    /** Returns current value of monotonic clock, in seconds. */
+    static double now();
+
+private:
+    double start;
+};
+
+#endif
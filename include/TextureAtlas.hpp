@@ -0,0 +1,115 @@
+#ifndef TextureAtlas_hpp
+#define TextureAtlas_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BatchExtractor.hpp"
+#include "FfReader.hpp"
+#include "ImageUnpacker.hpp"
+#include <string>
+#include <vector>
+
+/** Options of buildTextureAtlas(). */
+struct AtlasOptions
+{
+    AtlasOptions()
+        : pageWidth(2048)
+        , pageHeight(2048)
+        , padding(1)
+        , decoder(NULL)
+        , order(RgbaOrder)
+        , transparentIndex(noTransparentIndex)
+    { }
+
+    uint32_t pageWidth;  /**< Width of atlas pages, in pixels. */
+    uint32_t pageHeight; /**< Maximum height of atlas pages, last rows are trimmed when unused. */
+    /** Empty pixels kept right and below each frame, so filtering does not bleed neighbours. */
+    uint32_t padding;
+    ImageDecoder* decoder; /**< Decodes records that frames are unpacked from, required. */
+    PixelOrder order;      /**< Byte order of pixels expanded from palettized records. */
+    int transparentIndex;  /**< Palette index that gets zero alpha. */
+};
+
+/** Placement of a single frame inside atlas. */
+struct AtlasRegion
+{
+    std::string name; /**< Name of the frame. */
+    uint32_t page;    /**< Index of atlas page holding the frame. */
+    uint32_t x;       /**< Left pixel of frame inside page. */
+    uint32_t y;       /**< Top pixel of frame inside page. */
+    uint32_t width;
+    uint32_t height;
+    /** Texture coordinates of frame corners, in 0..1 range of page size. */
+    float u0;
+    float v0;
+    float u1;
+    float v1;
+};
+
+/** Single texture of atlas, rows of width 32-bit pixels. */
+struct AtlasPage
+{
+    uint32_t width;
+    uint32_t height;
+    std::vector<char> pixels;
+};
+
+/** Frames of many packed images arranged into a few large pages. */
+struct TextureAtlas
+{
+    std::vector<AtlasPage> pages;
+    std::vector<AtlasRegion> regions; /**< Sorted by name. */
+
+    /** @returns region of frame with specified name or nullptr. */
+    const AtlasRegion* findRegion(const std::string& name) const;
+};
+
+/**
+ * Packs frames of specified '-INDEX.OPT' images into atlas pages.
+ * Frames are placed with skyline bottom-left heuristic, tallest frames first.
+ * Palettized records are expanded with palettes of their images,
+ * 32-bit records are copied as decoded. Each record is decoded once.
+ * Frames with the same name are stored once, images sharing a packed image are packed once,
+ * empty frames are skipped.
+ * @returns false if any name is unknown, frame does not fit into a page
+ * or any record could not be read, decoded or unpacked.
+ */
+bool buildTextureAtlas(const FfReader& reader,
+                       const std::vector<std::string>& imageNames,
+                       const AtlasOptions& options,
+                       TextureAtlas& atlas);
+
+/** Packs frames of every '-INDEX.OPT' image. */
+bool buildTextureAtlas(const FfReader& reader, const AtlasOptions& options, TextureAtlas& atlas);
+
+/**
+ * Writes atlas file, replacing existing one in a single step, see ReplacingFile.
+ * Atlas does not remember .ff file it was built from, callers rebuild it when sources change.
+ * @returns false if file could not be written.
+ */
+bool saveTextureAtlas(const TextureAtlas& atlas, const std::string& atlasPath);
+
+/**
+ * Loads atlas written by saveTextureAtlas().
+ * @returns false if file is missing, corrupted or written by another version.
+ */
+bool loadTextureAtlas(const std::string& atlasPath, TextureAtlas& atlas);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Mutex.hpp"
+#include <stddef.h>
+#include <deque>
+#include <vector>
+
+/** Unit of work executed by ThreadPool. */
+class Task
+{
+public:
+    virtual ~Task()
+    { }
+
+    /**
+     * Exceptions escaping run() are swallowed by the pool.
+     * Tasks that signal completion to someone must catch them and signal failure instead.
+     */
+    virtual void run() = 0;
+};
+
+/**
+ * Fixed number of worker threads executing tasks in submission order.
+ * Pool does not own tasks, they must stay alive until wait() returns.
+ */
+class ThreadPool
+{
+public:
+    /** Starts specified number of threads, 0 means one per hardware thread. */
+    explicit ThreadPool(size_t threadsTotal = 0);
+
+    /** Waits for submitted tasks and stops worker threads. */
+    ~ThreadPool();
+
+    void submit(Task* task);
+
+    /** Blocks until all submitted tasks are finished. */
+    void wait();
+
+    size_t size() const;
+
+    /** Returns number of hardware threads, at least 1. */
+    static size_t hardwareThreads();
+
+    /** Worker thread entry point, not intended to be called directly. */
+    static void workerMain(void* pool);
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    struct Thread;
+
+    void work();
+
+    std::vector<Thread*> threads;
+    std::deque<Task*> tasks;
+    Mutex mutex;
+    Condition taskAdded;
+    Condition tasksDone;
+    size_t tasksRunning;
+    bool stopping;
+};
+
+#endif
@@ -0,0 +1,375 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <AnimationDecoder.hpp>
+#include <ImageUnpacker.hpp>
+#include <Mutex.hpp>
+#include <algorithm>
+#include <math.h>
+
+static const char animsOptRecordName[] = "-ANIMS.OPT";
+
+/** Decoded pixels of a record that animation frames are unpacked from. */
+struct AnimationDecoder::FrameSource
+{
+    RecordId recordId;
+    std::vector<char> pixels;
+    uint32_t width;
+    uint32_t height;
+};
+
+/** State of a single decode() call shared by its unpack tasks. */
+struct AnimationDecoder::Context
+{
+    const PackedImage* image;
+    const std::vector<FrameSource>* sources;
+    const std::vector<size_t>* frameSources; /**< Index of source of each frame. */
+    const std::vector<size_t>* cellFrames;   /**< Index of first frame stored in each cell. */
+    AnimationStrip* strip;
+
+    Mutex mutex;
+    Condition done;
+    size_t pending; /**< Number of tasks that are not finished yet. */
+    bool failed;
+};
+
+/** Unpacks consecutive cells of a strip. */
+class AnimationDecoder::UnpackTask : public Task
+{
+public:
+    UnpackTask(Context& context, size_t begin, size_t end)
+        : context(context)
+        , begin(begin)
+        , end(end)
+    { }
+
+    void run()
+    {
+        AnimationStrip& strip = *context.strip;
+        const size_t pitch = static_cast<size_t>(strip.width) * strip.bytesPerPixel;
+
+        bool unpacked = true;
+
+        try {
+            for (size_t i = begin; i < end && unpacked; ++i) {
+                const size_t frameIndex = (*context.cellFrames)[i];
+                const ImageFrame& frame = context.image->frames[frameIndex];
+                const FrameSource& source = (*context.sources)[(*context.frameSources)[frameIndex]];
+                const AnimationFrame& cell = strip.frames[frameIndex];
+
+                SourceImage sourceImage;
+                sourceImage.pixels = &source.pixels[0];
+                sourceImage.width = source.width;
+                sourceImage.height = source.height;
+                sourceImage.pitch = static_cast<size_t>(source.width) * strip.bytesPerPixel;
+                sourceImage.bytesPerPixel = strip.bytesPerPixel;
+
+                char* target = &strip.pixels[cell.y * pitch + cell.x * strip.bytesPerPixel];
+                unpacked = unpackFrame(frame, sourceImage, target, pitch);
+            }
+        } catch (...) {
+            // Pending count must drop even if unpacking failed unexpectedly
+            unpacked = false;
+        }
+
+        ScopedLock lock(context.mutex);
+        context.failed |= !unpacked;
+
+        if (!--context.pending) {
+            context.done.notifyAll();
+        }
+    }
+
+private:
+    Context& context;
+    size_t begin;
+    size_t end;
+};
+
+/** Returns true if frames have the same size and their parts describe the same regions. */
+static bool sameParts(const ImageFrame& a, const ImageFrame& b)
+{
+    if (a.width != b.width || a.height != b.height || a.parts.size() != b.parts.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.parts.size(); ++i) {
+        const ImagePart& partA = a.parts[i];
+        const ImagePart& partB = b.parts[i];
+
+        if (partA.sourceX != partB.sourceX || partA.sourceY != partB.sourceY
+            || partA.targetX != partB.targetX || partA.targetY != partB.targetY
+            || partA.width != partB.width || partA.height != partB.height) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+AnimationDecoder::AnimationDecoder(const FfReader& reader, const AnimationOptions& options)
+    : reader(reader)
+    , options(options)
+    , animsRecordId(0)
+    , hasAnims(false)
+{
+    const TocRecord* record = reader.findTocRecord(animsOptRecordName);
+    if (!record) {
+        return;
+    }
+
+    animsRecordId = record->recordId;
+
+    // Mapped contents are viewed on each use, mapping changes when reader is refreshed
+    hasAnims = reader.isMemoryMapped()
+                   ? reader.getRecordView(*record).data != NULL
+                   : reader.getRecordData(*record, animsContents) && !animsContents.empty();
+}
+
+bool AnimationDecoder::decode(const char* name, AnimationStrip& strip) const
+{
+    strip = AnimationStrip();
+
+    if (!options.decoder) {
+        return false;
+    }
+
+    PackedImageCopy image;
+    std::vector<RecordId> frameRecords;
+
+    if (!resolve(name, image, frameRecords)) {
+        return false;
+    }
+
+    const ArrayView<ImageFrame>& frames = image.image.frames;
+
+    // Frames usually share one or a few records, decode each of them once
+    std::vector<FrameSource> sources;
+    std::vector<size_t> frameSources(frames.size());
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        size_t sourceIndex = 0;
+        while (sourceIndex < sources.size() && sources[sourceIndex].recordId != frameRecords[i]) {
+            ++sourceIndex;
+        }
+
+        if (sourceIndex == sources.size()) {
+            sources.push_back(FrameSource());
+            sources.back().recordId = frameRecords[i];
+        }
+
+        frameSources[i] = sourceIndex;
+    }
+
+    std::vector<char> recordData;
+
+    for (size_t i = 0; i < sources.size(); ++i) {
+        FrameSource& source = sources[i];
+
+        RecordView view = reader.getRecordView(source.recordId);
+        if (!view.data) {
+            if (!reader.getRecordData(source.recordId, recordData) || recordData.empty()) {
+                return false;
+            }
+
+            view.data = &recordData[0];
+            view.size = static_cast<uint32_t>(recordData.size());
+        }
+
+        uint32_t bytesPerPixel = 0;
+
+        if (!options.decoder->decode(view.data, view.size, source.pixels, source.width,
+                                     source.height, bytesPerPixel)
+            || source.pixels.empty()
+            || (strip.bytesPerPixel && strip.bytesPerPixel != bytesPerPixel)) {
+            return false;
+        }
+
+        strip.bytesPerPixel = bytesPerPixel;
+    }
+
+    // Frames repeating source regions of earlier frames share their cells
+    std::vector<size_t> cellFrames;
+    strip.frames.resize(frames.size());
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        const ImageFrame& frame = frames[i];
+
+        size_t cell = 0;
+        for (; cell < cellFrames.size(); ++cell) {
+            const size_t other = cellFrames[cell];
+
+            if (frameSources[other] == frameSources[i] && sameParts(frames[other], frame)) {
+                break;
+            }
+        }
+
+        if (cell == cellFrames.size()) {
+            cellFrames.push_back(i);
+        }
+
+        AnimationFrame& stripFrame = strip.frames[i];
+        stripFrame.name = frame.name;
+        stripFrame.width = frame.width;
+        stripFrame.height = frame.height;
+        stripFrame.cell = static_cast<uint32_t>(cell);
+
+        strip.cellWidth = std::max(strip.cellWidth, frame.width);
+        strip.cellHeight = std::max(strip.cellHeight, frame.height);
+    }
+
+    strip.palette = image.image.palette;
+    strip.cellsTotal = static_cast<uint32_t>(cellFrames.size());
+
+    if (!strip.cellsTotal || !strip.cellWidth || !strip.cellHeight) {
+        strip.frames.clear();
+        return true;
+    }
+
+    uint32_t columns = strip.cellsTotal;
+    if (options.layout == AtlasLayout) {
+        columns = options.columns ? std::min(options.columns, strip.cellsTotal)
+                                  : static_cast<uint32_t>(ceil(sqrt(double(strip.cellsTotal))));
+    }
+
+    const uint32_t rows = (strip.cellsTotal + columns - 1) / columns;
+
+    strip.width = columns * strip.cellWidth;
+    strip.height = rows * strip.cellHeight;
+    strip.pixels.assign(static_cast<size_t>(strip.width) * strip.height * strip.bytesPerPixel,
+                        '\0');
+
+    for (size_t i = 0; i < strip.frames.size(); ++i) {
+        AnimationFrame& stripFrame = strip.frames[i];
+
+        stripFrame.x = (stripFrame.cell % columns) * strip.cellWidth;
+        stripFrame.y = (stripFrame.cell / columns) * strip.cellHeight;
+    }
+
+    Context context;
+    context.image = &image.image;
+    context.sources = &sources;
+    context.frameSources = &frameSources;
+    context.cellFrames = &cellFrames;
+    context.strip = &strip;
+    context.failed = false;
+
+    const size_t tasksTotal = options.pool ? std::min(cellFrames.size(), options.pool->size()) : 1;
+    const size_t chunkSize = (cellFrames.size() + tasksTotal - 1) / tasksTotal;
+
+    if (tasksTotal == 1) {
+        context.pending = 1;
+        UnpackTask(context, 0, cellFrames.size()).run();
+    } else {
+        std::vector<UnpackTask*> tasks;
+
+        for (size_t begin = 0; begin < cellFrames.size(); begin += chunkSize) {
+            tasks.push_back(new UnpackTask(context, begin,
+                                           std::min(cellFrames.size(), begin + chunkSize)));
+        }
+
+        context.pending = tasks.size();
+
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            options.pool->submit(tasks[i]);
+        }
+
+        {
+            ScopedLock lock(context.mutex);
+
+            while (context.pending) {
+                context.done.wait(context.mutex);
+            }
+        }
+
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            delete tasks[i];
+        }
+    }
+
+    if (context.failed) {
+        strip = AnimationStrip();
+        return false;
+    }
+
+    return true;
+}
+
+bool AnimationDecoder::decode(const std::string& name, AnimationStrip& strip) const
+{
+    return decode(name.c_str(), strip);
+}
+
+size_t AnimationDecoder::animationsTotal() const
+{
+    return animsView().data ? reader.indexData.animations.names.size() : 0;
+}
+
+RecordView AnimationDecoder::animsView() const
+{
+    if (!hasAnims) {
+        RecordView empty = {NULL, 0};
+        return empty;
+    }
+
+    if (reader.isMemoryMapped()) {
+        return reader.getRecordView(animsRecordId);
+    }
+
+    RecordView view = {&animsContents[0], static_cast<uint32_t>(animsContents.size())};
+    return view;
+}
+
+bool AnimationDecoder::resolve(const char* name,
+                               PackedImageCopy& image,
+                               std::vector<RecordId>& frameRecords) const
+{
+    PackedImageInfo packedInfo;
+    const RecordView animsRecord = animsView();
+
+    if (animsRecord.data && reader.findAnimationIndex(name, packedInfo)) {
+        if (!FfReader::decodePackedImage(animsRecord.data, animsRecord.size, packedInfo.first,
+                                         image)) {
+            return false;
+        }
+
+        // Animation frames are stored in records of images with the same names
+        const ArrayView<ImageFrame>& frames = image.image.frames;
+        frameRecords.resize(frames.size());
+
+        for (size_t i = 0; i < frames.size(); ++i) {
+            PackedImageInfo frameInfo;
+            if (!reader.findImageIndex(frames[i].name, frameRecords[i], frameInfo)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    RecordId recordId = 0;
+    if (!reader.findImageIndex(name, recordId, packedInfo)
+        || !reader.getPackedImage(packedInfo.first, image)) {
+        return false;
+    }
+
+    frameRecords.assign(image.image.frames.size(), recordId);
+    return true;
+}
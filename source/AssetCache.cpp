@@ -0,0 +1,251 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <AssetCache.hpp>
+#include <ImageUnpacker.hpp>
+#include <NameIndex.hpp>
+#include <algorithm>
+#include <string.h>
+
+/** Approximate bookkeeping cost of an entry besides its data. */
+static const size_t entryOverhead = 128;
+
+AssetCache::AssetCache(const FfReader& reader, const AssetCacheOptions& options)
+    : reader(reader)
+    , decoder(options.decoder)
+{
+    const size_t shardsTotal = std::max<size_t>(options.shardsTotal, 1);
+
+    shards.reserve(shardsTotal);
+    for (size_t i = 0; i < shardsTotal; ++i) {
+        Shard* shard = new Shard;
+        shard->bytes = 0;
+        shard->hits = 0;
+        shard->misses = 0;
+        shard->evictions = 0;
+
+        shards.push_back(shard);
+    }
+
+    shardBudget = options.byteBudget / shardsTotal;
+
+    const ImageIndices& images = reader.indexData.images;
+    for (size_t i = 0; i < images.ids.size(); ++i) {
+        imagesById.push_back(std::make_pair(images.ids[i], images.packedInfo[i].first));
+    }
+
+    std::sort(imagesById.begin(), imagesById.end());
+    imagesById.erase(std::unique(imagesById.begin(), imagesById.end()), imagesById.end());
+}
+
+AssetCache::~AssetCache()
+{
+    for (size_t i = 0; i < shards.size(); ++i) {
+        delete shards[i];
+    }
+}
+
+bool AssetCache::getRecordData(RecordId recordId, std::vector<char>& data)
+{
+    const Key key(recordId, std::string());
+
+    CachedFrame asset;
+    if (lookup(key, asset)) {
+        data.swap(asset.pixels);
+        return true;
+    }
+
+    const TocRecord* record = reader.findTocRecord(recordId);
+    if (!record || !reader.getRecordData(*record, asset.pixels)) {
+        return false;
+    }
+
+    asset.width = 0;
+    asset.height = 0;
+    asset.bytesPerPixel = 0;
+    store(key, asset);
+
+    data.swap(asset.pixels);
+    return true;
+}
+
+bool AssetCache::getFrame(RecordId recordId, const std::string& frameName, CachedFrame& frame)
+{
+    if (frameName.empty()) {
+        // Empty name is reserved for raw records
+        return false;
+    }
+
+    const Key key(recordId, frameName);
+
+    if (lookup(key, frame)) {
+        return true;
+    }
+
+    if (!unpack(recordId, frameName, frame)) {
+        return false;
+    }
+
+    store(key, frame);
+    return true;
+}
+
+void AssetCache::clear()
+{
+    for (size_t i = 0; i < shards.size(); ++i) {
+        Shard& shard = *shards[i];
+        ScopedLock lock(shard.mutex);
+
+        shard.entries.clear();
+        shard.order.clear();
+        shard.bytes = 0;
+    }
+}
+
+AssetCacheStats AssetCache::stats() const
+{
+    AssetCacheStats total;
+    memset(&total, 0, sizeof(total));
+
+    for (size_t i = 0; i < shards.size(); ++i) {
+        const Shard& shard = *shards[i];
+        ScopedLock lock(shard.mutex);
+
+        total.hits += shard.hits;
+        total.misses += shard.misses;
+        total.evictions += shard.evictions;
+        total.entries += shard.entries.size();
+        total.bytes += shard.bytes;
+    }
+
+    return total;
+}
+
+AssetCache::Shard& AssetCache::shardOf(const Key& key) const
+{
+    // Mix record id into name hash, frames of one record spread over shards
+    const uint32_t hash = NameIndex::hash(key.second.c_str(), key.second.size())
+                          ^ (key.first * 2654435761u);
+
+    return *shards[hash % shards.size()];
+}
+
+bool AssetCache::lookup(const Key& key, CachedFrame& asset)
+{
+    Shard& shard = shardOf(key);
+    ScopedLock lock(shard.mutex);
+
+    std::map<Key, Entry>::iterator it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        ++shard.misses;
+        return false;
+    }
+
+    ++shard.hits;
+    shard.order.splice(shard.order.begin(), shard.order, it->second.position);
+
+    asset = it->second.asset;
+    return true;
+}
+
+void AssetCache::store(const Key& key, const CachedFrame& asset)
+{
+    const size_t cost = asset.pixels.size() + key.second.size() + entryOverhead;
+    if (cost > shardBudget) {
+        // Would evict everything else and still not fit
+        return;
+    }
+
+    Shard& shard = shardOf(key);
+    ScopedLock lock(shard.mutex);
+
+    if (shard.entries.count(key)) {
+        // Another thread stored it while we were reading
+        return;
+    }
+
+    while (shard.bytes + cost > shardBudget && !shard.order.empty()) {
+        std::map<Key, Entry>::iterator oldest = shard.entries.find(shard.order.back());
+
+        shard.bytes -= oldest->second.cost;
+        shard.entries.erase(oldest);
+        shard.order.pop_back();
+        ++shard.evictions;
+    }
+
+    shard.order.push_front(key);
+
+    Entry& entry = shard.entries[key];
+    entry.asset = asset;
+    entry.cost = cost;
+    entry.position = shard.order.begin();
+
+    shard.bytes += cost;
+}
+
+bool AssetCache::unpack(RecordId recordId, const std::string& frameName, CachedFrame& frame)
+{
+    if (!decoder) {
+        return false;
+    }
+
+    std::vector<std::pair<RecordId, RelativeOffset> >::const_iterator it = std::lower_bound(
+        imagesById.begin(), imagesById.end(), std::make_pair(recordId, RelativeOffset(0)));
+
+    for (; it != imagesById.end() && it->first == recordId; ++it) {
+        // Copy, so bounded lazy cache of the reader can not evict image while it is used
+        PackedImageCopy copy;
+        if (!reader.getPackedImage(it->second, copy)) {
+            continue;
+        }
+
+        for (size_t i = 0; i < copy.image.frames.size(); ++i) {
+            const ImageFrame& imageFrame = copy.image.frames[i];
+            if (frameName != imageFrame.name) {
+                continue;
+            }
+
+            std::vector<char> contents;
+            std::vector<char> sourcePixels;
+            uint32_t width = 0;
+            uint32_t height = 0;
+            uint32_t bytesPerPixel = 0;
+
+            // Raw record goes through the cache too, other frames of it are likely to follow
+            if (!getRecordData(recordId, contents) || contents.empty()
+                || !decoder->decode(&contents[0], static_cast<uint32_t>(contents.size()),
+                                    sourcePixels, width, height, bytesPerPixel)
+                || sourcePixels.empty()) {
+                return false;
+            }
+
+            frame.width = imageFrame.width;
+            frame.height = imageFrame.height;
+            frame.bytesPerPixel = bytesPerPixel;
+            frame.pixels.assign(static_cast<size_t>(frame.width) * frame.height * bytesPerPixel,
+                                '\0');
+
+            return !frame.pixels.empty()
+                   && unpackFrame(imageFrame, &sourcePixels[0], width, height, bytesPerPixel,
+                                  &frame.pixels[0]);
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,682 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <AssetExporter.hpp>
+#include <ReplacingFile.hpp>
+#include <ThreadPool.hpp>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+
+#define EXPORTSIGNATURE(a, b, c, d)                                                                \
+    ((static_cast<uint32_t>(d) << 24) | (static_cast<uint32_t>(c) << 16)                           \
+     | (static_cast<uint32_t>(b) << 8) | static_cast<uint32_t>(a))
+
+static const uint32_t exportSignature = EXPORTSIGNATURE('F', 'F', 'E', 'X');
+/** Increment whenever layout of exported file changes. */
+static const uint32_t exportVersion = 1;
+
+/** Blobs and the index start at multiples of this, so they can be used in place. */
+static const uint64_t blobAlignment = 64;
+
+static const uint32_t paletteSize = 11 + 1024;
+
+/** Exported frames always store 32-bit pixels. */
+static const uint32_t exportBytesPerPixel = 4;
+
+/** Each worker has this many records in flight on average, writer waits for the oldest one. */
+static const size_t recordsPerThread = 4;
+
+static const uint64_t checksumBasis = UINT64_C(14695981039346656037);
+
+struct ExportHeader
+{
+    uint32_t signature;
+    uint32_t version;
+    uint32_t entriesTotal;
+    uint32_t namesSize;     /**< Size of names section following index entries. */
+    uint64_t indexOffset;   /**< Offset of index entries, 64-byte aligned. */
+    uint64_t indexChecksum; /**< Checksum of index entries and names. */
+};
+
+struct ExportIndexEntry
+{
+    uint64_t offset;
+    uint64_t sourceChecksum;
+    uint64_t blobChecksum;
+    uint32_t nameOffset; /**< Offset of null terminated name in names section. */
+    uint32_t recordId;
+    uint32_t width;
+    uint32_t height;
+    uint32_t compression;
+    uint32_t storedSize;
+    uint32_t rawSize;
+    uint32_t reserved;
+};
+
+/** 64-bit FNV-1a, continues from specified value. */
+static uint64_t checksum(const void* data, size_t size, uint64_t value = checksumBasis)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+    for (size_t i = 0; i < size; ++i) {
+        value ^= bytes[i];
+        value *= UINT64_C(1099511628211);
+    }
+
+    return value;
+}
+
+static uint64_t checksum(uint32_t data, uint64_t value)
+{
+    return checksum(&data, sizeof(data), value);
+}
+
+/** Frame waiting to be exported. */
+struct ExportFrame
+{
+    size_t image; /**< Index of packed image the frame belongs to. */
+    size_t frame; /**< Index of frame inside packed image. */
+    uint64_t sourceChecksum;
+    uint32_t compression;
+    bool reused;
+    std::vector<char> blob; /**< Stored contents, released once written. */
+};
+
+/** Record with frames unpacked from it, processed by a single task. */
+struct ExportItem
+{
+    const TocRecord* record;
+    size_t firstFrame;
+    size_t endFrame;
+    bool done;
+    bool failed;
+
+    static bool lessByOffset(const ExportItem& a, const ExportItem& b)
+    {
+        return a.record->offset < b.record->offset;
+    }
+};
+
+struct ExportContext
+{
+    const FfReader* reader;
+    const ExportOptions* options;
+    std::vector<PackedImageCopy> images;
+    std::vector<ExportFrame> frames;
+    std::vector<ExportItem> items;
+
+    Mutex mutex;
+    Condition itemDone;
+};
+
+class ExportTask : public Task
+{
+public:
+    ExportTask(ExportContext& context, ExportItem& item)
+        : context(context)
+        , item(item)
+    { }
+
+    void run()
+    {
+        bool exported = false;
+
+        try {
+            exported = process();
+        } catch (...) {
+            // Codec, decoder or allocation failed, item must still be marked done
+        }
+
+        ScopedLock lock(context.mutex);
+        item.failed = !exported;
+        item.done = true;
+        context.itemDone.notifyAll();
+    }
+
+private:
+    bool process()
+    {
+        const FfReader& reader = *context.reader;
+        const ExportOptions& options = *context.options;
+
+        RecordView view = reader.getRecordView(*item.record);
+        if (!view.data) {
+            if (!reader.getRecordData(*item.record, recordData) || recordData.empty()) {
+                return false;
+            }
+
+            view.data = &recordData[0];
+            view.size = static_cast<uint32_t>(recordData.size());
+        }
+
+        const uint32_t compression = options.codec ? options.codec->method() : storedBlobs;
+
+        uint64_t settings = checksum(compression, checksumBasis);
+        settings = checksum(static_cast<uint32_t>(options.order), settings);
+        settings = checksum(static_cast<uint32_t>(options.transparentIndex), settings);
+
+        const uint64_t recordChecksum = checksum(view.data, view.size, settings);
+        bool decodeNeeded = false;
+
+        for (size_t i = item.firstFrame; i < item.endFrame; ++i) {
+            ExportFrame& exportFrame = context.frames[i];
+            const PackedImage& image = context.images[exportFrame.image].image;
+            const ImageFrame& frame = image.frames[exportFrame.frame];
+
+            // Frame pixels depend on record, palette, frame layout and export settings
+            uint64_t sourceChecksum = checksum(image.palette, paletteSize, recordChecksum);
+            sourceChecksum = checksum(frame.width, sourceChecksum);
+            sourceChecksum = checksum(frame.height, sourceChecksum);
+            sourceChecksum = checksum(frame.parts.data, frame.parts.size() * sizeof(ImagePart),
+                                      sourceChecksum);
+
+            exportFrame.sourceChecksum = sourceChecksum;
+            exportFrame.compression = compression;
+            exportFrame.reused = reuse(exportFrame, frame);
+
+            decodeNeeded = decodeNeeded || !exportFrame.reused;
+        }
+
+        if (!decodeNeeded) {
+            return true;
+        }
+
+        uint32_t sourceWidth = 0;
+        uint32_t sourceHeight = 0;
+        uint32_t bytesPerPixel = 0;
+
+        if (!options.decoder->decode(view.data, view.size, sourcePixels, sourceWidth, sourceHeight,
+                                     bytesPerPixel)
+            || sourcePixels.empty()
+            || (bytesPerPixel != 1 && bytesPerPixel != exportBytesPerPixel)) {
+            return false;
+        }
+
+        SourceImage source;
+        source.pixels = &sourcePixels[0];
+        source.width = sourceWidth;
+        source.height = sourceHeight;
+        source.pitch = static_cast<size_t>(sourceWidth) * bytesPerPixel;
+        source.bytesPerPixel = bytesPerPixel;
+
+        size_t paletteImage = context.images.size();
+
+        for (size_t i = item.firstFrame; i < item.endFrame; ++i) {
+            ExportFrame& exportFrame = context.frames[i];
+            if (exportFrame.reused) {
+                continue;
+            }
+
+            const PackedImage& image = context.images[exportFrame.image].image;
+            const ImageFrame& frame = image.frames[exportFrame.frame];
+
+            // Pixels not covered by parts stay zero, so output does not depend on old buffers
+            pixels.assign(static_cast<size_t>(frame.width) * frame.height * exportBytesPerPixel,
+                          '\0');
+
+            if (bytesPerPixel == exportBytesPerPixel) {
+                if (!unpackFrame(frame, source, &pixels[0])) {
+                    return false;
+                }
+            } else {
+                if (paletteImage != exportFrame.image) {
+                    if (!decodePalette(image.palette, palette, options.order,
+                                       options.transparentIndex)) {
+                        return false;
+                    }
+
+                    paletteImage = exportFrame.image;
+                }
+
+                indices.assign(static_cast<size_t>(frame.width) * frame.height, '\0');
+                if (!unpackFrame(frame, source, &indices[0])) {
+                    return false;
+                }
+
+                expandPalette(&indices[0], frame.width, frame.height, palette, &pixels[0]);
+            }
+
+            if (options.codec) {
+                if (!options.codec->compress(&pixels[0], pixels.size(), exportFrame.blob)) {
+                    return false;
+                }
+            } else {
+                exportFrame.blob.swap(pixels);
+            }
+        }
+
+        return true;
+    }
+
+    /** Copies blob of unchanged frame from previous export. */
+    bool reuse(ExportFrame& exportFrame, const ImageFrame& frame)
+    {
+        const ExportArchive* previous = context.options->previousExport;
+        if (!previous) {
+            return false;
+        }
+
+        const ExportEntry* entry = previous->findEntry(frame.name);
+
+        return entry && entry->sourceChecksum == exportFrame.sourceChecksum
+               && entry->compression == exportFrame.compression && entry->width == frame.width
+               && entry->height == frame.height && previous->readBlob(*entry, exportFrame.blob);
+    }
+
+    ExportContext& context;
+    ExportItem& item;
+
+    std::vector<char> recordData;
+    std::vector<char> sourcePixels;
+    std::vector<char> indices;
+    std::vector<char> pixels;
+    PaletteTable palette;
+};
+
+/** Collects frames of every '-INDEX.OPT' image and groups them by records they come from. */
+static bool collectFrames(const FfReader& reader, ExportContext& context, size_t& errors)
+{
+    const ImageIndices& indices = reader.indexData.images;
+
+    // Images sharing a packed image are exported once
+    std::map<RelativeOffset, size_t> imagesByOffset;
+    std::vector<RecordId> imageRecords;
+
+    context.images.reserve(indices.packedInfo.size());
+
+    for (size_t i = 0; i < indices.packedInfo.size(); ++i) {
+        const RelativeOffset offset = indices.packedInfo[i].first;
+
+        if (imagesByOffset.find(offset) != imagesByOffset.end()) {
+            continue;
+        }
+
+        PackedImageCopy image;
+        if (!reader.getPackedImage(offset, image)) {
+            return false;
+        }
+
+        imagesByOffset[offset] = context.images.size();
+        context.images.push_back(PackedImageCopy());
+        context.images.back().swap(image);
+        imageRecords.push_back(indices.ids[i]);
+    }
+
+    // The first frame with a name wins, in '-INDEX.OPT' order
+    std::set<std::string> frameNames;
+    std::map<RecordId, std::vector<std::pair<size_t, size_t> > > framesByRecord;
+
+    for (size_t i = 0; i < context.images.size(); ++i) {
+        const ArrayView<ImageFrame>& frames = context.images[i].image.frames;
+
+        for (size_t j = 0; j < frames.size(); ++j) {
+            const ImageFrame& frame = frames[j];
+
+            if (!frame.width || !frame.height || !frameNames.insert(frame.name).second) {
+                continue;
+            }
+
+            framesByRecord[imageRecords[i]].push_back(std::make_pair(i, j));
+        }
+    }
+
+    std::map<RecordId, std::vector<std::pair<size_t, size_t> > >::const_iterator it;
+    for (it = framesByRecord.begin(); it != framesByRecord.end(); ++it) {
+        ExportItem item;
+        item.record = reader.findTocRecord(it->first);
+        item.done = false;
+        item.failed = false;
+
+        if (!item.record) {
+            ++errors;
+            continue;
+        }
+
+        item.firstFrame = context.items.size();
+        item.endFrame = 0;
+        context.items.push_back(item);
+    }
+
+    // Records are read in file order, frames of each record are kept together
+    std::sort(context.items.begin(), context.items.end(), ExportItem::lessByOffset);
+
+    for (size_t i = 0; i < context.items.size(); ++i) {
+        ExportItem& item = context.items[i];
+        const std::vector<std::pair<size_t, size_t> >& frames = framesByRecord[item.record
+                                                                                   ->recordId];
+
+        item.firstFrame = context.frames.size();
+        item.endFrame = item.firstFrame + frames.size();
+        context.frames.resize(item.endFrame);
+
+        for (size_t j = 0; j < frames.size(); ++j) {
+            ExportFrame& frame = context.frames[item.firstFrame + j];
+            frame.image = frames[j].first;
+            frame.frame = frames[j].second;
+            frame.sourceChecksum = 0;
+            frame.compression = storedBlobs;
+            frame.reused = false;
+        }
+    }
+
+    return true;
+}
+
+/** Writes bytes and keeps track of file position. */
+class ExportWriter
+{
+public:
+    explicit ExportWriter(FILE* file)
+        : file(file)
+        , position(0)
+        , good(true)
+    { }
+
+    void write(const void* data, size_t size)
+    {
+        if (good && size) {
+            good = fwrite(data, size, 1, file) == 1;
+        }
+
+        position += size;
+    }
+
+    /** Pads file with zeroes up to the next multiple of blobAlignment. */
+    void align()
+    {
+        static const char zeroes[blobAlignment] = {0};
+        write(zeroes, static_cast<size_t>((blobAlignment - position % blobAlignment)
+                                          % blobAlignment));
+    }
+
+    FILE* file;
+    uint64_t position;
+    bool good;
+};
+
+bool exportAssets(const FfReader& reader,
+                  const std::string& exportPath,
+                  const ExportOptions& options,
+                  ExportResult* result)
+{
+    ExportResult exportResult;
+    if (result) {
+        *result = exportResult;
+    }
+
+    if (!options.decoder) {
+        return false;
+    }
+
+    ExportContext context;
+    context.reader = &reader;
+    context.options = &options;
+
+    if (!collectFrames(reader, context, exportResult.errors)) {
+        return false;
+    }
+
+    // Failed export leaves previous one in place
+    ReplacingFile output;
+    FILE* file = output.open(exportPath);
+    if (!file) {
+        return false;
+    }
+
+    ExportWriter writer(file);
+
+    // Header is written last, when index position is known
+    ExportHeader header;
+    memset(&header, 0, sizeof(header));
+    writer.write(&header, sizeof(header));
+
+    std::vector<ExportIndexEntry> indexEntries;
+    std::vector<char> names;
+    indexEntries.reserve(context.frames.size());
+
+    std::vector<ExportTask*> tasks(context.items.size(), static_cast<ExportTask*>(NULL));
+
+    {
+        ThreadPool pool(std::min(options.threadsTotal ? options.threadsTotal
+                                                      : ThreadPool::hardwareThreads(),
+                                 std::max(context.items.size(), size_t(1))));
+
+        // Only a bounded window of records is in flight, writer releases them in order
+        const size_t window = pool.size() * recordsPerThread;
+        size_t submitted = 0;
+
+        for (; submitted < std::min(window, context.items.size()); ++submitted) {
+            tasks[submitted] = new ExportTask(context, context.items[submitted]);
+            pool.submit(tasks[submitted]);
+        }
+
+        for (size_t i = 0; i < context.items.size(); ++i) {
+            ExportItem& item = context.items[i];
+
+            {
+                ScopedLock lock(context.mutex);
+                while (!item.done) {
+                    context.itemDone.wait(context.mutex);
+                }
+            }
+
+            if (item.failed) {
+                ++exportResult.errors;
+            }
+
+            for (size_t j = item.firstFrame; j < item.endFrame && !item.failed; ++j) {
+                ExportFrame& frame = context.frames[j];
+                const ImageFrame& imageFrame = context.images[frame.image].image.frames[frame.frame];
+
+                writer.align();
+
+                ExportIndexEntry entry;
+                entry.offset = writer.position;
+                entry.sourceChecksum = frame.sourceChecksum;
+                entry.blobChecksum = checksum(frame.blob.empty() ? NULL : &frame.blob[0],
+                                              frame.blob.size());
+                entry.nameOffset = static_cast<uint32_t>(names.size());
+                entry.recordId = item.record->recordId;
+                entry.width = imageFrame.width;
+                entry.height = imageFrame.height;
+                entry.compression = frame.compression;
+                entry.storedSize = static_cast<uint32_t>(frame.blob.size());
+                entry.rawSize = imageFrame.width * imageFrame.height * exportBytesPerPixel;
+                entry.reserved = 0;
+
+                names.insert(names.end(), imageFrame.name, imageFrame.name + strlen(imageFrame.name)
+                                                               + 1);
+                indexEntries.push_back(entry);
+
+                writer.write(frame.blob.empty() ? NULL : &frame.blob[0], frame.blob.size());
+                std::vector<char>().swap(frame.blob);
+
+                ++exportResult.framesTotal;
+                ++(frame.reused ? exportResult.framesReused : exportResult.framesEncoded);
+            }
+
+            delete tasks[i];
+            tasks[i] = NULL;
+
+            if (submitted < context.items.size()) {
+                tasks[submitted] = new ExportTask(context, context.items[submitted]);
+                pool.submit(tasks[submitted]);
+                ++submitted;
+            }
+        }
+    }
+
+    writer.align();
+
+    header.signature = exportSignature;
+    header.version = exportVersion;
+    header.entriesTotal = static_cast<uint32_t>(indexEntries.size());
+    header.namesSize = static_cast<uint32_t>(names.size());
+    header.indexOffset = writer.position;
+    header.indexChecksum = checksum(names.empty() ? NULL : &names[0], names.size(),
+                                    checksum(indexEntries.empty() ? NULL : &indexEntries[0],
+                                             indexEntries.size() * sizeof(ExportIndexEntry)));
+
+    writer.write(indexEntries.empty() ? NULL : &indexEntries[0],
+                 indexEntries.size() * sizeof(ExportIndexEntry));
+    writer.write(names.empty() ? NULL : &names[0], names.size());
+
+    const bool written = writer.good && fseek(file, 0, SEEK_SET) == 0
+                         && fwrite(&header, sizeof(header), 1, file) == 1
+                         && !exportResult.errors && output.commit();
+
+    if (result) {
+        *result = exportResult;
+    }
+
+    return written;
+}
+
+bool ExportArchive::open(const std::string& exportPath)
+{
+    close();
+
+    if (!file.open(exportPath)) {
+        return false;
+    }
+
+    ExportHeader header;
+    if (!file.read(0, &header, sizeof(header)) || header.signature != exportSignature
+        || header.version != exportVersion || header.indexOffset > file.size()) {
+        close();
+        return false;
+    }
+
+    const uint64_t indexSize = static_cast<uint64_t>(header.entriesTotal)
+                                   * sizeof(ExportIndexEntry)
+                               + header.namesSize;
+
+    if (file.size() - header.indexOffset != indexSize) {
+        close();
+        return false;
+    }
+
+    std::vector<ExportIndexEntry> indexEntries(header.entriesTotal);
+    std::vector<char> names(header.namesSize);
+
+    if ((!indexEntries.empty()
+         && !file.read(header.indexOffset, &indexEntries[0],
+                       indexEntries.size() * sizeof(ExportIndexEntry)))
+        || (!names.empty()
+            && !file.read(header.indexOffset + indexEntries.size() * sizeof(ExportIndexEntry),
+                          &names[0], names.size()))) {
+        close();
+        return false;
+    }
+
+    const uint64_t indexChecksum = checksum(names.empty() ? NULL : &names[0], names.size(),
+                                            checksum(indexEntries.empty() ? NULL
+                                                                          : &indexEntries[0],
+                                                     indexEntries.size()
+                                                         * sizeof(ExportIndexEntry)));
+
+    if (indexChecksum != header.indexChecksum || (!names.empty() && names.back() != '\0')) {
+        close();
+        return false;
+    }
+
+    entries.resize(indexEntries.size());
+    entryNames.reserve(indexEntries.size());
+
+    for (size_t i = 0; i < indexEntries.size(); ++i) {
+        const ExportIndexEntry& indexEntry = indexEntries[i];
+
+        if (indexEntry.nameOffset >= names.size() || indexEntry.offset > header.indexOffset
+            || header.indexOffset - indexEntry.offset < indexEntry.storedSize) {
+            close();
+            return false;
+        }
+
+        ExportEntry& entry = entries[i];
+        entry.name = &names[indexEntry.nameOffset];
+        entry.recordId = indexEntry.recordId;
+        entry.width = indexEntry.width;
+        entry.height = indexEntry.height;
+        entry.compression = indexEntry.compression;
+        entry.offset = indexEntry.offset;
+        entry.storedSize = indexEntry.storedSize;
+        entry.rawSize = indexEntry.rawSize;
+        entry.sourceChecksum = indexEntry.sourceChecksum;
+        entry.blobChecksum = indexEntry.blobChecksum;
+
+        entryNames.insert(entry.name, static_cast<uint32_t>(i));
+    }
+
+    return true;
+}
+
+void ExportArchive::close()
+{
+    file.close();
+    entries.clear();
+    entryNames.clear();
+}
+
+const std::vector<ExportEntry>& ExportArchive::getEntries() const
+{
+    return entries;
+}
+
+const ExportEntry* ExportArchive::findEntry(const std::string& name) const
+{
+    const uint32_t* index = entryNames.find(name);
+
+    return index ? &entries[*index] : NULL;
+}
+
+bool ExportArchive::readBlob(const ExportEntry& entry, std::vector<char>& blob) const
+{
+    blob.resize(entry.storedSize);
+
+    if (!blob.empty() && !file.read(entry.offset, &blob[0], blob.size())) {
+        return false;
+    }
+
+    return checksum(blob.empty() ? NULL : &blob[0], blob.size()) == entry.blobChecksum;
+}
+
+bool ExportArchive::readPixels(const ExportEntry& entry,
+                               std::vector<char>& pixels,
+                               BlobCodec* codec) const
+{
+    if (entry.compression == storedBlobs) {
+        return readBlob(entry, pixels) && pixels.size() == entry.rawSize;
+    }
+
+    if (!codec || codec->method() != entry.compression) {
+        return false;
+    }
+
+    std::vector<char> blob;
+    if (!readBlob(entry, blob)) {
+        return false;
+    }
+
+    pixels.resize(entry.rawSize);
+    return codec->decompress(blob.empty() ? NULL : &blob[0], blob.size(),
+                             pixels.empty() ? NULL : &pixels[0], pixels.size());
+}
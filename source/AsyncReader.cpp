@@ -0,0 +1,294 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <AsyncReader.hpp>
+#include <algorithm>
+#include <assert.h>
+
+ReadBatch::ReadBatch()
+    : callback(NULL)
+    , pending(0)
+{
+}
+
+size_t ReadBatch::add(RecordId recordId)
+{
+    assert(isDone() && "Requests can not be added while batch is being read");
+
+    Request request;
+    request.recordId = recordId;
+    request.record = NULL;
+    request.succeeded = false;
+
+    requests.push_back(request);
+    return requests.size() - 1;
+}
+
+size_t ReadBatch::add(const std::string& recordName)
+{
+    const size_t requestIndex = add(RecordId(0));
+    requests.back().name = recordName;
+
+    return requestIndex;
+}
+
+size_t ReadBatch::size() const
+{
+    return requests.size();
+}
+
+void ReadBatch::wait()
+{
+    ScopedLock lock(mutex);
+
+    while (pending) {
+        done.wait(mutex);
+    }
+}
+
+bool ReadBatch::isDone() const
+{
+    ScopedLock lock(mutex);
+    return pending == 0;
+}
+
+bool ReadBatch::succeeded(size_t requestIndex) const
+{
+    return requests[requestIndex].succeeded;
+}
+
+const std::vector<char>& ReadBatch::data(size_t requestIndex) const
+{
+    return requests[requestIndex].data;
+}
+
+void ReadBatch::finish(size_t requestsTotal)
+{
+    ScopedLock lock(mutex);
+
+    pending -= requestsTotal;
+    if (!pending) {
+        // Notify under the lock, waiter may destroy batch as soon as it wakes up
+        done.notifyAll();
+    }
+}
+
+/** Reads several requests of a batch stored close to each other with a single read. */
+class AsyncReader::CoalescedRead : public Task
+{
+public:
+    CoalescedRead(const FfReader& reader,
+                  ReadBatch& batch,
+                  const std::vector<size_t>& requestIndices,
+                  uint64_t begin,
+                  uint64_t end)
+        : reader(reader)
+        , batch(batch)
+        , requestIndices(requestIndices)
+        , begin(begin)
+        , end(end)
+    { }
+
+    /**
+     * Deletes itself when done, nothing owns submitted reads.
+     * Exceptions fail requests instead of escaping, batch must be finished either way.
+     */
+    void run()
+    {
+        try {
+            read();
+        } catch (...) {
+            for (size_t i = 0; i < requestIndices.size(); ++i) {
+                batch.requests[requestIndices[i]].succeeded = false;
+            }
+        }
+
+        ReadCallback* callback = batch.callback;
+
+        for (size_t i = 0; callback && i < requestIndices.size(); ++i) {
+            ReadBatch::Request& request = batch.requests[requestIndices[i]];
+
+            try {
+                if (request.succeeded) {
+                    callback->onRead(requestIndices[i], request.recordId,
+                                     request.data.empty() ? NULL : &request.data[0],
+                                     static_cast<uint32_t>(request.data.size()));
+                } else {
+                    callback->onError(requestIndices[i], request.recordId);
+                }
+            } catch (...) {
+                request.succeeded = false;
+            }
+        }
+
+        batch.finish(requestIndices.size());
+        delete this;
+    }
+
+private:
+    void read()
+    {
+        if (reader.isMemoryMapped() || !reader.recordFile.isOpen()) {
+            // Nothing to coalesce, copy from mapping or let reader fall back to streams
+            for (size_t i = 0; i < requestIndices.size(); ++i) {
+                ReadBatch::Request& request = batch.requests[requestIndices[i]];
+                request.succeeded = reader.getRecordData(*request.record, request.data);
+            }
+
+            return;
+        }
+
+        if (requestIndices.size() == 1) {
+            // Single record is read straight into its own buffer
+            ReadBatch::Request& request = batch.requests[requestIndices[0]];
+            request.succeeded = reader.getRecordData(*request.record, request.data);
+            return;
+        }
+
+        std::vector<char> buffer(static_cast<size_t>(end - begin));
+        const bool succeeded = buffer.empty()
+                               || reader.readFileRange(begin, &buffer[0], buffer.size());
+
+        for (size_t i = 0; i < requestIndices.size(); ++i) {
+            ReadBatch::Request& request = batch.requests[requestIndices[i]];
+            const uint64_t contentsOffset = request.record->offset + sizeof(MqrcHeader);
+            const char* contents = buffer.empty()
+                                       ? NULL
+                                       : &buffer[static_cast<size_t>(contentsOffset - begin)];
+
+            request.succeeded = succeeded;
+            if (succeeded) {
+                request.data.assign(contents, contents + request.record->size);
+            }
+        }
+    }
+
+    const FfReader& reader;
+    ReadBatch& batch;
+    std::vector<size_t> requestIndices;
+    uint64_t begin; /**< File offset of the first byte to read. */
+    uint64_t end;   /**< File offset past the last byte to read. */
+};
+
+/** Orders batch requests by offset of their records. */
+struct AsyncReader::RequestOffsetLess
+{
+    explicit RequestOffsetLess(const std::vector<ReadBatch::Request>& requests)
+        : requests(requests)
+    { }
+
+    bool operator()(size_t a, size_t b) const
+    {
+        return requests[a].record->offset < requests[b].record->offset;
+    }
+
+    const std::vector<ReadBatch::Request>& requests;
+};
+
+AsyncReader::AsyncReader(const FfReader& reader, const AsyncReadOptions& options)
+    : reader(reader)
+    , options(options)
+    , pool(options.threadsTotal)
+{
+}
+
+AsyncReader::~AsyncReader()
+{
+    wait();
+}
+
+void AsyncReader::submit(ReadBatch& batch, ReadCallback* callback)
+{
+    assert(batch.isDone() && "Batch is already being read");
+
+    batch.callback = callback;
+
+    std::vector<size_t> found;
+    std::vector<size_t> missing;
+
+    for (size_t i = 0; i < batch.requests.size(); ++i) {
+        ReadBatch::Request& request = batch.requests[i];
+
+        request.record = request.name.empty() ? reader.findTocRecord(request.recordId)
+                                              : reader.findTocRecord(request.name);
+        request.succeeded = false;
+        request.data.clear();
+
+        if (request.record) {
+            request.recordId = request.record->recordId;
+            found.push_back(i);
+        } else {
+            missing.push_back(i);
+        }
+    }
+
+    {
+        ScopedLock lock(batch.mutex);
+        batch.pending = batch.requests.size();
+    }
+
+    std::sort(found.begin(), found.end(), RequestOffsetLess(batch.requests));
+
+    std::vector<size_t> group;
+    uint64_t groupBegin = 0;
+    uint64_t groupEnd = 0;
+
+    for (size_t i = 0; i < found.size(); ++i) {
+        const TocRecord& record = *batch.requests[found[i]].record;
+        const uint64_t recordBegin = record.offset + static_cast<uint64_t>(sizeof(MqrcHeader));
+        const uint64_t recordEnd = recordBegin + record.size;
+
+        if (!group.empty()) {
+            const uint64_t gap = recordBegin > groupEnd ? recordBegin - groupEnd : 0;
+            const uint64_t coalescedEnd = std::max(groupEnd, recordEnd);
+
+            if (gap <= options.coalesceGap
+                && coalescedEnd - groupBegin <= options.coalescedSizeLimit) {
+                group.push_back(found[i]);
+                groupEnd = coalescedEnd;
+                continue;
+            }
+
+            pool.submit(new CoalescedRead(reader, batch, group, groupBegin, groupEnd));
+            group.clear();
+        }
+
+        group.push_back(found[i]);
+        groupBegin = recordBegin;
+        groupEnd = recordEnd;
+    }
+
+    if (!group.empty()) {
+        pool.submit(new CoalescedRead(reader, batch, group, groupBegin, groupEnd));
+    }
+
+    // Unknown records are reported right away
+    for (size_t i = 0; callback && i < missing.size(); ++i) {
+        callback->onError(missing[i], batch.requests[missing[i]].recordId);
+    }
+
+    if (!missing.empty()) {
+        batch.finish(missing.size());
+    }
+}
+
+void AsyncReader::wait()
+{
+    pool.wait();
+}
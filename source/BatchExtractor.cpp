@@ -0,0 +1,355 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <BatchExtractor.hpp>
+#include <ImageUnpacker.hpp>
+#include <ThreadPool.hpp>
+#include <algorithm>
+#include <deque>
+#include <utility>
+
+/** Each worker gets this many chunks on average, so uneven records balance out. */
+static const size_t chunksPerThread = 8;
+
+struct BatchExtractor::Item
+{
+    const TocRecord* record;
+    RecordId recordId;
+    std::string name;
+    std::vector<const PackedImage*> images; /**< Packed images using this record as source. */
+
+    static bool lessByOffset(const Item& a, const Item& b)
+    {
+        return a.record->offset < b.record->offset;
+    }
+};
+
+struct BatchExtractor::Context
+{
+    FfReader* reader;
+    const BatchOptions* options;
+    RecordSink* sink;
+    std::vector<Item>* items;
+
+    Mutex sinkMutex;
+    Mutex resultMutex;
+    size_t extracted;
+};
+
+class BatchExtractor::ExtractTask : public Task
+{
+public:
+    ExtractTask(Context& context, size_t begin, size_t end)
+        : context(context)
+        , begin(begin)
+        , end(end)
+    { }
+
+    void run()
+    {
+        size_t extracted = 0;
+
+        for (size_t i = begin; i < end; ++i) {
+            const Item& item = (*context.items)[i];
+
+            try {
+                if (extract(item)) {
+                    ++extracted;
+                }
+            } catch (...) {
+                // Decoder, sink or allocation failed, the record is reported as not extracted
+                try {
+                    reportError(item);
+                } catch (...) {
+                }
+            }
+        }
+
+        ScopedLock lock(context.resultMutex);
+        context.extracted += extracted;
+    }
+
+private:
+    bool extract(const Item& item)
+    {
+        FfReader& reader = *context.reader;
+
+        RecordView view = reader.getRecordView(*item.record);
+        if (!view.data) {
+            if (reader.isMemoryMapped() || !reader.getRecordData(*item.record, recordData)) {
+                reportError(item);
+                return false;
+            }
+
+            view.data = recordData.empty() ? NULL : &recordData[0];
+            view.size = static_cast<uint32_t>(recordData.size());
+        }
+
+        {
+            SinkLock lock(context);
+            context.sink->onRecord(item.recordId, item.name, view.data, view.size);
+        }
+
+        if (item.images.empty()) {
+            return true;
+        }
+
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t bytesPerPixel = 0;
+
+        if (!context.options->decoder->decode(view.data, view.size, sourcePixels, width, height,
+                                              bytesPerPixel)
+            || sourcePixels.empty()) {
+            reportError(item);
+            return false;
+        }
+
+        bool unpacked = true;
+
+        for (size_t i = 0; i < item.images.size(); ++i) {
+            const ArrayView<ImageFrame>& frames = item.images[i]->frames;
+
+            for (size_t j = 0; j < frames.size(); ++j) {
+                const ImageFrame& frame = frames[j];
+
+                framePixels.assign(static_cast<size_t>(frame.width) * frame.height * bytesPerPixel,
+                                   '\0');
+                if (framePixels.empty()) {
+                    continue;
+                }
+
+                if (!unpackFrame(frame, &sourcePixels[0], width, height, bytesPerPixel,
+                                 &framePixels[0])) {
+                    unpacked = false;
+                    continue;
+                }
+
+                SinkLock lock(context);
+                context.sink->onFrame(item.recordId, frame, &framePixels[0], bytesPerPixel);
+            }
+        }
+
+        if (!unpacked) {
+            reportError(item);
+        }
+
+        return unpacked;
+    }
+
+    void reportError(const Item& item)
+    {
+        SinkLock lock(context);
+        context.sink->onError(item.recordId, item.name);
+    }
+
+    /** Serializes sink calls unless sink is allowed to be called concurrently. */
+    class SinkLock
+    {
+    public:
+        explicit SinkLock(Context& context)
+            : mutex(context.options->concurrentSink ? NULL : &context.sinkMutex)
+        {
+            if (mutex) {
+                mutex->lock();
+            }
+        }
+
+        ~SinkLock()
+        {
+            if (mutex) {
+                mutex->unlock();
+            }
+        }
+
+    private:
+        Mutex* mutex;
+    };
+
+    Context& context;
+    size_t begin;
+    size_t end;
+
+    // Buffers are reused between records of the same chunk
+    std::vector<char> recordData;
+    std::vector<char> sourcePixels;
+    std::vector<char> framePixels;
+};
+
+BatchExtractor::BatchExtractor(FfReader& reader, const BatchOptions& options)
+    : reader(reader)
+    , options(options)
+{
+}
+
+size_t BatchExtractor::extract(const std::vector<std::string>& names, RecordSink& sink)
+{
+    std::vector<Item> items(names.size());
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        Item& item = items[i];
+        item.record = reader.findTocRecord(names[i]);
+        item.recordId = item.record ? item.record->recordId : 0;
+        item.name = names[i];
+    }
+
+    return run(items, sink);
+}
+
+size_t BatchExtractor::extract(const std::vector<RecordId>& recordIds, RecordSink& sink)
+{
+    // Names list maps names to ids, reverse it to name records
+    std::vector<std::pair<RecordId, size_t> > namesById;
+    namesById.reserve(reader.recordNames.size());
+
+    for (size_t i = 0; i < reader.recordNames.size(); ++i) {
+        namesById.push_back(std::make_pair(reader.recordNames.value(i), i));
+    }
+
+    std::sort(namesById.begin(), namesById.end());
+
+    std::vector<Item> items(recordIds.size());
+
+    for (size_t i = 0; i < recordIds.size(); ++i) {
+        Item& item = items[i];
+        item.record = reader.findTocRecord(recordIds[i]);
+        item.recordId = recordIds[i];
+
+        std::vector<std::pair<RecordId, size_t> >::const_iterator it = std::lower_bound(
+            namesById.begin(), namesById.end(), std::make_pair(recordIds[i], size_t(0)));
+
+        if (it != namesById.end() && it->first == recordIds[i]) {
+            item.name.assign(reader.recordNames.name(it->second),
+                             reader.recordNames.nameLength(it->second));
+        }
+    }
+
+    return run(items, sink);
+}
+
+size_t BatchExtractor::extractAll(RecordSink& sink)
+{
+    std::vector<Item> items(reader.recordNames.size());
+
+    for (size_t i = 0; i < reader.recordNames.size(); ++i) {
+        Item& item = items[i];
+        item.recordId = reader.recordNames.value(i);
+        item.record = reader.findTocRecord(item.recordId);
+        item.name.assign(reader.recordNames.name(i), reader.recordNames.nameLength(i));
+    }
+
+    return run(items, sink);
+}
+
+size_t BatchExtractor::run(std::vector<Item>& items, RecordSink& sink)
+{
+    // Report unknown records right away, workers only see existing ones
+    std::vector<Item> found;
+    found.reserve(items.size());
+
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (items[i].record) {
+            found.push_back(items[i]);
+        } else {
+            sink.onError(items[i].recordId, items[i].name);
+        }
+    }
+
+    // Bounded lazy cache may evict images while workers use them, keep own copies then
+    std::deque<PackedImageCopy> imageCopies;
+
+    if (options.decoder) {
+        // Find packed images whose parts are stored in each record
+        std::vector<std::pair<RecordId, RelativeOffset> > imagesById;
+
+        const ImageIndices& indices = reader.indexData.images;
+        for (size_t i = 0; i < indices.ids.size(); ++i) {
+            imagesById.push_back(std::make_pair(indices.ids[i], indices.packedInfo[i].first));
+        }
+
+        std::sort(imagesById.begin(), imagesById.end());
+        imagesById.erase(std::unique(imagesById.begin(), imagesById.end()), imagesById.end());
+
+        const bool copyImages = reader.lazyImages && reader.imageCacheLimit;
+
+        for (size_t i = 0; i < found.size(); ++i) {
+            Item& item = found[i];
+
+            std::vector<std::pair<RecordId, RelativeOffset> >::const_iterator it = std::lower_bound(
+                imagesById.begin(), imagesById.end(), std::make_pair(item.recordId, RelativeOffset(0)));
+
+            for (; it != imagesById.end() && it->first == item.recordId; ++it) {
+                if (copyImages) {
+                    // Cached image may be evicted by another thread, copy it under reader lock
+                    imageCopies.push_back(PackedImageCopy());
+                    if (!reader.getPackedImage(it->second, imageCopies.back())) {
+                        imageCopies.pop_back();
+                        continue;
+                    }
+
+                    item.images.push_back(&imageCopies.back().image);
+                    continue;
+                }
+
+                const PackedImage* image = reader.getPackedImage(it->second);
+                if (image) {
+                    item.images.push_back(image);
+                }
+            }
+        }
+    }
+
+    if (found.empty()) {
+        return 0;
+    }
+
+    std::sort(found.begin(), found.end(), Item::lessByOffset);
+
+    Context context;
+    context.reader = &reader;
+    context.options = &options;
+    context.sink = &sink;
+    context.items = &found;
+    context.extracted = 0;
+
+    ThreadPool pool(std::min(options.threadsTotal ? options.threadsTotal
+                                                  : ThreadPool::hardwareThreads(),
+                             found.size()));
+
+    // Workers take consecutive chunks in file order, keeping reads mostly sequential
+    const size_t chunksTotal = std::min(found.size(), pool.size() * chunksPerThread);
+    const size_t chunkSize = (found.size() + chunksTotal - 1) / chunksTotal;
+
+    std::vector<ExtractTask*> tasks;
+
+    for (size_t begin = 0; begin < found.size(); begin += chunkSize) {
+        const size_t end = std::min(found.size(), begin + chunkSize);
+
+        tasks.push_back(new ExtractTask(context, begin, end));
+        pool.submit(tasks.back());
+    }
+
+    pool.wait();
+
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        delete tasks[i];
+    }
+
+    return context.extracted;
+}
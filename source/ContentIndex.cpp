@@ -0,0 +1,457 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ByteCursor.hpp>
+#include <ContentIndex.hpp>
+#include <FfArchiveSet.hpp>
+#include <ThreadPool.hpp>
+#include <algorithm>
+#include <string.h>
+
+/** Each worker gets this many chunks on average, so uneven records balance out. */
+static const size_t chunksPerThread = 8;
+
+static const uint64_t prime1 = UINT64_C(11400714785074694791);
+static const uint64_t prime2 = UINT64_C(14029467366897019727);
+static const uint64_t prime3 = UINT64_C(1609587929392839161);
+static const uint64_t prime4 = UINT64_C(9650029242287828579);
+static const uint64_t prime5 = UINT64_C(2870177450012600261);
+
+static inline uint64_t rotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t load64(const char* data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+
+#ifdef FFREADER_BIG_ENDIAN
+    value = (static_cast<uint64_t>(fromLittleEndian(static_cast<uint32_t>(value))) << 32)
+            | fromLittleEndian(static_cast<uint32_t>(value >> 32));
+#endif
+    return value;
+}
+
+static inline uint32_t load32(const char* data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+
+    return fromLittleEndian(value);
+}
+
+static inline uint64_t hashRound(uint64_t lane, uint64_t input)
+{
+    lane += input * prime2;
+    lane = rotateLeft(lane, 31);
+    return lane * prime1;
+}
+
+static inline uint64_t mergeLane(uint64_t hash, uint64_t lane)
+{
+    hash ^= hashRound(0, lane);
+    return hash * prime1 + prime4;
+}
+
+uint64_t contentHash(const char* data, size_t size, uint64_t seed)
+{
+    const char* position = data;
+    const char* end = data + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t lane1 = seed + prime1 + prime2;
+        uint64_t lane2 = seed + prime2;
+        uint64_t lane3 = seed;
+        uint64_t lane4 = seed - prime1;
+
+        // Lanes do not depend on each other, so their rounds overlap
+        const char* lastStripe = end - 32;
+        for (; position <= lastStripe; position += 32) {
+            lane1 = hashRound(lane1, load64(position));
+            lane2 = hashRound(lane2, load64(position + 8));
+            lane3 = hashRound(lane3, load64(position + 16));
+            lane4 = hashRound(lane4, load64(position + 24));
+        }
+
+        hash = rotateLeft(lane1, 1) + rotateLeft(lane2, 7) + rotateLeft(lane3, 12)
+               + rotateLeft(lane4, 18);
+        hash = mergeLane(hash, lane1);
+        hash = mergeLane(hash, lane2);
+        hash = mergeLane(hash, lane3);
+        hash = mergeLane(hash, lane4);
+    } else {
+        hash = seed + prime5;
+    }
+
+    hash += static_cast<uint64_t>(size);
+
+    for (; end - position >= 8; position += 8) {
+        hash ^= hashRound(0, load64(position));
+        hash = rotateLeft(hash, 27) * prime1 + prime4;
+    }
+
+    if (end - position >= 4) {
+        hash ^= static_cast<uint64_t>(load32(position)) * prime1;
+        hash = rotateLeft(hash, 23) * prime2 + prime3;
+        position += 4;
+    }
+
+    for (; position < end; ++position) {
+        hash ^= static_cast<uint64_t>(static_cast<unsigned char>(*position)) * prime5;
+        hash = rotateLeft(hash, 11) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+static bool contentLess(const ContentRecord& a, const ContentRecord& b)
+{
+    if (a.hash != b.hash) {
+        return a.hash < b.hash;
+    }
+
+    if (a.size != b.size) {
+        return a.size < b.size;
+    }
+
+    if (a.archiveIndex != b.archiveIndex) {
+        return a.archiveIndex < b.archiveIndex;
+    }
+
+    return a.recordId < b.recordId;
+}
+
+static bool sameContents(const ContentRecord& a, const ContentRecord& b)
+{
+    return a.hash == b.hash && a.size == b.size;
+}
+
+struct ContentIndex::Item
+{
+    const FfReader* reader;
+    const TocRecord* record;
+    uint32_t archiveIndex;
+
+    static bool lessByOffset(const Item& a, const Item& b)
+    {
+        if (a.archiveIndex != b.archiveIndex) {
+            return a.archiveIndex < b.archiveIndex;
+        }
+
+        return a.record->offset < b.record->offset;
+    }
+};
+
+/** Orders indices of records by archive and record id. */
+class RecordIdLess
+{
+public:
+    explicit RecordIdLess(const std::vector<ContentRecord>& records)
+        : records(records)
+    { }
+
+    bool operator()(uint32_t a, uint32_t b) const
+    {
+        const ContentRecord& first = records[a];
+        const ContentRecord& second = records[b];
+
+        if (first.archiveIndex != second.archiveIndex) {
+            return first.archiveIndex < second.archiveIndex;
+        }
+
+        return first.recordId < second.recordId;
+    }
+
+    bool operator()(uint32_t a, const ContentRecord& key) const
+    {
+        const ContentRecord& record = records[a];
+
+        if (record.archiveIndex != key.archiveIndex) {
+            return record.archiveIndex < key.archiveIndex;
+        }
+
+        return record.recordId < key.recordId;
+    }
+
+private:
+    const std::vector<ContentRecord>& records;
+};
+
+class ContentIndex::HashTask : public Task
+{
+public:
+    HashTask(const std::vector<Item>& items,
+             std::vector<ContentRecord>& results,
+             std::vector<char>& hashed,
+             size_t begin,
+             size_t end)
+        : items(items)
+        , results(results)
+        , hashed(hashed)
+        , begin(begin)
+        , end(end)
+    { }
+
+    void run()
+    {
+        for (size_t i = begin; i < end; ++i) {
+            const Item& item = items[i];
+
+            RecordView view = item.reader->getRecordView(*item.record);
+            if (!view.data) {
+                if (item.reader->isMemoryMapped()
+                    || !item.reader->getRecordData(*item.record, recordData)) {
+                    continue;
+                }
+
+                view.data = recordData.empty() ? NULL : &recordData[0];
+                view.size = static_cast<uint32_t>(recordData.size());
+            }
+
+            ContentRecord& result = results[i];
+            result.hash = contentHash(view.data, view.size);
+            result.size = view.size;
+            result.archiveIndex = item.archiveIndex;
+            result.recordId = item.record->recordId;
+
+            // Each task writes its own elements, no locking needed
+            hashed[i] = 1;
+        }
+    }
+
+private:
+    const std::vector<Item>& items;
+    std::vector<ContentRecord>& results;
+    std::vector<char>& hashed;
+    size_t begin;
+    size_t end;
+
+    std::vector<char> recordData; /**< Reused between records of the same chunk. */
+};
+
+ContentIndex::ContentIndex()
+    : duplicates(0)
+    , duplicatedBytes(0)
+{
+}
+
+bool ContentIndex::build(const FfReader& reader, const ContentIndexOptions& options)
+{
+    std::vector<Item> items;
+    appendItems(reader, 0, items);
+
+    return build(items, options);
+}
+
+bool ContentIndex::build(const FfArchiveSet& archives, const ContentIndexOptions& options)
+{
+    std::vector<Item> items;
+
+    for (size_t i = 0; i < archives.size(); ++i) {
+        const uint32_t archiveIndex = static_cast<uint32_t>(i);
+        appendItems(archives.archive(archiveIndex), archiveIndex, items);
+    }
+
+    return build(items, options);
+}
+
+size_t ContentIndex::size() const
+{
+    return records.size();
+}
+
+const std::vector<ContentRecord>& ContentIndex::getRecords() const
+{
+    return records;
+}
+
+ArrayView<ContentRecord> ContentIndex::find(uint64_t hash, uint32_t size) const
+{
+    ContentRecord key;
+    key.hash = hash;
+    key.size = size;
+    key.archiveIndex = 0;
+    key.recordId = 0;
+
+    // Archive index and record id of the key are the smallest possible
+    std::vector<ContentRecord>::const_iterator first = std::lower_bound(records.begin(),
+                                                                        records.end(), key,
+                                                                        contentLess);
+    std::vector<ContentRecord>::const_iterator last = first;
+
+    while (last != records.end() && sameContents(*last, key)) {
+        ++last;
+    }
+
+    ArrayView<ContentRecord> view;
+    view.data = first != last ? &*first : NULL;
+    view.count = static_cast<uint32_t>(last - first);
+
+    return view;
+}
+
+const ContentRecord* ContentIndex::findRecord(uint32_t archiveIndex, RecordId recordId) const
+{
+    ContentRecord key;
+    key.hash = 0;
+    key.size = 0;
+    key.archiveIndex = archiveIndex;
+    key.recordId = recordId;
+
+    const RecordIdLess less(records);
+
+    std::vector<uint32_t>::const_iterator it = std::lower_bound(recordsById.begin(),
+                                                                recordsById.end(), key, less);
+
+    if (it == recordsById.end()) {
+        return NULL;
+    }
+
+    const ContentRecord& record = records[*it];
+    if (record.archiveIndex != archiveIndex || record.recordId != recordId) {
+        return NULL;
+    }
+
+    return &record;
+}
+
+ArrayView<ContentRecord> ContentIndex::findDuplicates(uint32_t archiveIndex,
+                                                      RecordId recordId) const
+{
+    const ContentRecord* record = findRecord(archiveIndex, recordId);
+    if (!record) {
+        ArrayView<ContentRecord> empty;
+        empty.data = NULL;
+        empty.count = 0;
+
+        return empty;
+    }
+
+    return find(record->hash, record->size);
+}
+
+size_t ContentIndex::duplicatesTotal() const
+{
+    return duplicates;
+}
+
+uint64_t ContentIndex::duplicateBytes() const
+{
+    return duplicatedBytes;
+}
+
+void ContentIndex::appendItems(const FfReader& reader,
+                               uint32_t archiveIndex,
+                               std::vector<Item>& items)
+{
+    const std::vector<TocRecord>& toc = reader.tableOfContents;
+    items.reserve(items.size() + toc.size());
+
+    for (size_t i = 0; i < toc.size(); ++i) {
+        const RecordId recordId = toc[i].recordId;
+
+        // Special records describe archive itself, not its payload
+        if (recordId == TableOfContents || recordId == NameList) {
+            continue;
+        }
+
+        Item item;
+        item.reader = &reader;
+        item.record = &toc[i];
+        item.archiveIndex = archiveIndex;
+        items.push_back(item);
+    }
+}
+
+bool ContentIndex::build(std::vector<Item>& items, const ContentIndexOptions& options)
+{
+    records.clear();
+    recordsById.clear();
+    duplicates = 0;
+    duplicatedBytes = 0;
+
+    if (items.empty()) {
+        return true;
+    }
+
+    std::sort(items.begin(), items.end(), Item::lessByOffset);
+
+    std::vector<ContentRecord> results(items.size());
+    std::vector<char> hashed(items.size(), 0);
+
+    {
+        ThreadPool pool(std::min(options.threadsTotal ? options.threadsTotal
+                                                      : ThreadPool::hardwareThreads(),
+                                 items.size()));
+
+        // Workers take consecutive chunks in file order, keeping reads mostly sequential
+        const size_t chunksTotal = std::min(items.size(), pool.size() * chunksPerThread);
+        const size_t chunkSize = (items.size() + chunksTotal - 1) / chunksTotal;
+
+        std::vector<HashTask*> tasks;
+
+        for (size_t begin = 0; begin < items.size(); begin += chunkSize) {
+            const size_t end = std::min(items.size(), begin + chunkSize);
+
+            tasks.push_back(new HashTask(items, results, hashed, begin, end));
+            pool.submit(tasks.back());
+        }
+
+        pool.wait();
+
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            delete tasks[i];
+        }
+    }
+
+    records.reserve(items.size());
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (hashed[i]) {
+            records.push_back(results[i]);
+        }
+    }
+
+    std::sort(records.begin(), records.end(), contentLess);
+
+    for (size_t i = 1; i < records.size(); ++i) {
+        if (sameContents(records[i - 1], records[i])) {
+            ++duplicates;
+            duplicatedBytes += records[i].size;
+        }
+    }
+
+    recordsById.resize(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        recordsById[i] = static_cast<uint32_t>(i);
+    }
+
+    std::sort(recordsById.begin(), recordsById.end(), RecordIdLess(records));
+
+    return records.size() == items.size();
+}
@@ -0,0 +1,159 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <FfArchiveSet.hpp>
+#include <assert.h>
+
+FfArchiveSet::FfArchiveSet()
+{
+}
+
+FfArchiveSet::~FfArchiveSet()
+{
+    for (size_t i = 0; i < archives.size(); ++i) {
+        if (archives[i].owned) {
+            delete archives[i].reader;
+        }
+    }
+}
+
+uint32_t FfArchiveSet::mount(const FfReader& reader)
+{
+    const uint32_t archiveIndex = static_cast<uint32_t>(archives.size());
+
+    Archive archive;
+    archive.reader = &reader;
+    archive.owned = false;
+    archives.push_back(archive);
+
+    mergeNames(archiveIndex);
+
+    return archiveIndex;
+}
+
+void FfArchiveSet::remount()
+{
+    recordNames.clear();
+    records.clear();
+
+    for (size_t i = 0; i < archives.size(); ++i) {
+        mergeNames(static_cast<uint32_t>(i));
+    }
+}
+
+void FfArchiveSet::mergeNames(uint32_t archiveIndex)
+{
+    const FfReader& reader = *archives[archiveIndex].reader;
+
+    const NameIndex& names = reader.recordNames;
+    recordNames.reserve(recordNames.size() + names.size());
+    records.reserve(records.size() + names.size());
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        ArchiveRecord record;
+        record.reader = &reader;
+        record.recordId = names.value(i);
+        record.archiveIndex = archiveIndex;
+
+        if (!reader.findTocRecord(record.recordId)) {
+            continue;
+        }
+
+        const uint32_t recordIndex = static_cast<uint32_t>(records.size());
+
+        if (recordNames.insert(names.name(i), names.nameLength(i), recordIndex)) {
+            records.push_back(record);
+            continue;
+        }
+
+        // Name is already known, archive mounted later overrides it
+        const uint32_t* existing = recordNames.find(names.name(i), names.nameLength(i));
+        assert(existing);
+
+        records[*existing] = record;
+    }
+}
+
+uint32_t FfArchiveSet::mount(const std::string& ffFilePath, const FfReaderOptions& options)
+{
+    const uint32_t archiveIndex = mount(*new FfReader(ffFilePath, options));
+    archives.back().owned = true;
+
+    return archiveIndex;
+}
+
+size_t FfArchiveSet::size() const
+{
+    return archives.size();
+}
+
+const FfReader& FfArchiveSet::archive(uint32_t archiveIndex) const
+{
+    return *archives[archiveIndex].reader;
+}
+
+const ArchiveRecord* FfArchiveSet::find(const char* recordName) const
+{
+    const uint32_t* recordIndex = recordNames.find(recordName);
+
+    return recordIndex ? &records[*recordIndex] : NULL;
+}
+
+const ArchiveRecord* FfArchiveSet::find(const std::string& recordName) const
+{
+    const uint32_t* recordIndex = recordNames.find(recordName);
+
+    return recordIndex ? &records[*recordIndex] : NULL;
+}
+
+bool FfArchiveSet::getRecordData(const std::string& recordName, std::vector<char>& data) const
+{
+    const ArchiveRecord* found = find(recordName);
+    if (!found) {
+        return false;
+    }
+
+    return found->reader->getRecordData(found->recordId, data);
+}
+
+RecordView FfArchiveSet::getRecordView(const std::string& recordName) const
+{
+    const ArchiveRecord* found = find(recordName);
+    if (!found) {
+        RecordView empty = {NULL, 0};
+        return empty;
+    }
+
+    return found->reader->getRecordView(found->recordId);
+}
+
+size_t FfArchiveSet::namesTotal() const
+{
+    return records.size();
+}
+
+const NameIndex& FfArchiveSet::getNameIndex() const
+{
+    return recordNames;
+}
+
+const ArchiveRecord& FfArchiveSet::record(uint32_t recordIndex) const
+{
+    return records[recordIndex];
+}
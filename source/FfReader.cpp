@@ -17,12 +17,44 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <ByteCursor.hpp>
 #include <FfReader.hpp>
+#include <IndexSidecar.hpp>
+#include <ThreadPool.hpp>
 #include <stdexcept>
+#include <algorithm>
 #include <assert.h>
 #include <limits>
 #include <string.h>
 
+#ifndef FFREADER_NO_STATS
+/** Measures lookup from construction to destruction. */
+class LookupTimer
+{
+public:
+    explicit LookupTimer(const FfReader& reader)
+        : reader(reader)
+        , startTime(reader.timeLookups ? Stopwatch::now() : 0.0)
+    { }
+
+    ~LookupTimer()
+    {
+        reader.countLookup(startTime);
+    }
+
+private:
+    const FfReader& reader;
+    double startTime;
+};
+#else
+class LookupTimer
+{
+public:
+    explicit LookupTimer(const FfReader&)
+    { }
+};
+#endif
+
 #define FFSIGNATURE(a, b, c, d)                                                                    \
     ((static_cast<uint32_t>(d) << 24) | (static_cast<uint32_t>(c) << 16)                 \
      | (static_cast<uint32_t>(b) << 8) | static_cast<uint32_t>(a))
@@ -36,16 +68,97 @@ static const char imagesOptRecordName[] = "-IMAGES.OPT";
 
 static uint32_t paletteSize = 11 + 1024;
 
+/** Parallel open splits '-IMAGES.OPT' into this many chunks per worker, on average. */
+static const size_t imageChunksPerThread = 4;
+
+/** Each names list entry is a 256-byte name followed by 4-byte record id. */
+static const size_t nameListNameSize = 256;
+static const size_t nameListEntrySize = nameListNameSize + sizeof(RecordId);
+
+/** Names list entry waiting for its MQRC header to be checked. */
+struct NameListEntry
+{
+    size_t nameOffset;     /**< Offset of entry name inside names list contents. */
+    uint32_t recordOffset; /**< Offset of associated MQRC record in file. */
+    RecordId recordId;
+    bool used;
+
+    static bool lessByOffset(const NameListEntry* a, const NameListEntry* b)
+    {
+        return a->recordOffset < b->recordOffset;
+    }
+};
+
+static bool tocRecordLess(const TocRecord& a, const TocRecord& b)
+{
+    return a.recordId < b.recordId;
+}
+
+static bool tocRecordIdLess(const TocRecord& record, RecordId recordId)
+{
+    return record.recordId < recordId;
+}
+
 /**
- * Reads 4-byte value from buffer at specified offset.
- * Adjusts offset after reading.
+ * Collects sorted ids of records that were added, removed, moved or resized.
+ * Both tables of contents must be sorted by record id.
  */
-static inline uint32_t readUint32(const char* contents, size_t& byteOffset)
+static void collectChangedRecords(const std::vector<TocRecord>& previous,
+                                  const std::vector<TocRecord>& current,
+                                  std::vector<RecordId>& changedIds)
 {
-    const uint32_t value = *reinterpret_cast<const uint32_t*>(&contents[byteOffset]);
-    byteOffset += sizeof(uint32_t);
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < previous.size() || j < current.size()) {
+        if (j == current.size()
+            || (i < previous.size() && previous[i].recordId < current[j].recordId)) {
+            changedIds.push_back(previous[i++].recordId);
+        } else if (i == previous.size() || current[j].recordId < previous[i].recordId) {
+            changedIds.push_back(current[j++].recordId);
+        } else {
+            const TocRecord& before = previous[i++];
+            const TocRecord& after = current[j++];
 
-    return value;
+            if (before.offset != after.offset || before.size != after.size
+                || before.sizeAllocated != after.sizeAllocated) {
+                changedIds.push_back(after.recordId);
+            }
+        }
+    }
+}
+
+/** Returns true if section record appeared, disappeared, now has other id or changed. */
+static bool sectionChanged(bool hadRecord,
+                           RecordId previousId,
+                           const TocRecord* current,
+                           const std::vector<RecordId>& changedIds)
+{
+    if (!hadRecord || !current) {
+        return hadRecord != (current != NULL);
+    }
+
+    return previousId != current->recordId
+           || std::binary_search(changedIds.begin(), changedIds.end(), current->recordId);
+}
+
+/** Moves pointer into old mapping to the same offset of the new one, others are kept. */
+static inline void rebasePointer(const char*& pointer,
+                                 const char* oldData,
+                                 size_t oldSize,
+                                 const char* newData)
+{
+    if (pointer && pointer >= oldData && pointer < oldData + oldSize) {
+        pointer = newData + (pointer - oldData);
+    }
+}
+
+/** Returns length of a string stored in fixed size buffer that may lack null terminator. */
+static inline size_t boundedLength(const char* string, size_t maxLength)
+{
+    const char* end = static_cast<const char*>(memchr(string, '\0', maxLength));
+
+    return end ? static_cast<size_t>(end - string) : maxLength;
 }
 
 /** Reads 4-byte value from file. */
@@ -57,39 +170,524 @@ static inline uint32_t readUint32(std::ifstream& file)
     return value;
 }
 
+/**
+ * Points views of packed image, its frames and their parts at arena elements.
+ * Frames of the image start at firstFrame, their parts are stored one after another
+ * starting at firstPart.
+ */
+static void bindViews(PackedImage& packedImage,
+                      std::vector<ImageFrame>& frames,
+                      size_t firstFrame,
+                      std::vector<ImagePart>& parts,
+                      size_t firstPart)
+{
+    const uint32_t framesTotal = static_cast<uint32_t>(frames.size() - firstFrame);
+
+    packedImage.frames.data = framesTotal ? &frames[firstFrame] : NULL;
+    packedImage.frames.count = framesTotal;
+
+    for (size_t i = firstFrame; i < frames.size(); ++i) {
+        ArrayView<ImagePart>& frameParts = frames[i].parts;
+
+        frameParts.data = frameParts.count ? &parts[firstPart] : NULL;
+        firstPart += frameParts.count;
+    }
+}
+
+/**
+ * Reads array of image parts with a single copy.
+ * Position in final image is stored first, followed by position in shuffled image,
+ * so coordinates are swapped in place after copying.
+ * Caller checks that parts fit into cursor span.
+ */
+static void takeImageParts(ByteCursor& cursor, ImagePart* parts, uint32_t partsTotal)
+{
+    cursor.take(parts, partsTotal * sizeof(ImagePart));
+
+    for (uint32_t i = 0; i < partsTotal; ++i) {
+        ImagePart& part = parts[i];
+
+        const uint32_t targetX = fromLittleEndian(part.sourceX);
+        const uint32_t targetY = fromLittleEndian(part.sourceY);
+
+        part.sourceX = fromLittleEndian(part.targetX);
+        part.sourceY = fromLittleEndian(part.targetY);
+        part.targetX = targetX;
+        part.targetY = targetY;
+#ifdef FFREADER_BIG_ENDIAN
+        part.width = fromLittleEndian(part.width);
+        part.height = fromLittleEndian(part.height);
+#endif
+    }
+}
+
+/**
+ * Reads PackedImage starting at cursor position in '-IMAGES.OPT' contents.
+ * Image must be validated with skipPackedImage() first, frames and parts are written
+ * into arrays large enough to hold them. Palette and names point into contents.
+ */
+static void readPackedImage(ByteCursor& cursor,
+                            PackedImage& packedImage,
+                            ImageFrame* frames,
+                            ImagePart* parts)
+{
+    packedImage.palette = cursor.current();
+    cursor.skip(paletteSize);
+
+    const uint32_t framesTotal = cursor.takeUint32();
+
+    packedImage.frames.data = framesTotal ? frames : NULL;
+    packedImage.frames.count = framesTotal;
+
+    for (uint32_t i = 0; i < framesTotal; ++i) {
+        size_t nameLength = 0;
+        const char* frameName = cursor.readString(nameLength);
+
+        const uint32_t partsTotal = cursor.takeUint32();
+        const uint32_t frameWidth = cursor.takeUint32();
+        const uint32_t frameHeight = cursor.takeUint32();
+
+        ImageFrame& frame = frames[i];
+        frame = ImageFrame(frameName, frameWidth, frameHeight);
+
+        if (partsTotal) {
+            frame.parts.data = parts;
+            frame.parts.count = partsTotal;
+
+            takeImageParts(cursor, parts, partsTotal);
+            parts += partsTotal;
+        }
+    }
+}
+
+/**
+ * Reads validated PackedImage with specified number of frames and parts into its own copy.
+ */
+static void readPackedImage(ByteCursor& cursor,
+                            size_t framesTotal,
+                            size_t partsTotal,
+                            PackedImageCopy& packedImage)
+{
+    packedImage.frames.assign(framesTotal, ImageFrame(NULL, 0, 0));
+    packedImage.parts.resize(partsTotal);
+
+    readPackedImage(cursor, packedImage.image, framesTotal ? &packedImage.frames[0] : NULL,
+                    partsTotal ? &packedImage.parts[0] : NULL);
+}
+
+/**
+ * Skips PackedImage starting at cursor position in '-IMAGES.OPT' contents without decoding it.
+ * Adds number of image frames and parts to specified totals.
+ * Throws std::runtime_error exception if image does not fit into contents.
+ */
+static void skipPackedImage(ByteCursor& cursor, size_t& framesCount, size_t& partsCount)
+{
+    if (!cursor.has(paletteSize + sizeof(uint32_t))) {
+        throw std::runtime_error("Packed image does not fit into '-IMAGES.OPT'");
+    }
+
+    cursor.skip(paletteSize);
+
+    const uint32_t framesTotal = cursor.takeUint32();
+
+    for (uint32_t i = 0; i < framesTotal; ++i) {
+        size_t nameLength = 0;
+
+        // Name is followed by parts total, width and height
+        if (!cursor.readString(nameLength) || !cursor.has(3 * sizeof(uint32_t))) {
+            throw std::runtime_error("Image frame does not fit into '-IMAGES.OPT'");
+        }
+
+        const uint32_t partsTotal = cursor.takeUint32();
+        cursor.skip(2 * sizeof(uint32_t));
+
+        if (!cursor.has(partsTotal, sizeof(ImagePart))) {
+            throw std::runtime_error("Image parts do not fit into '-IMAGES.OPT'");
+        }
+
+        cursor.skip(partsTotal * sizeof(ImagePart));
+        partsCount += partsTotal;
+    }
+
+    framesCount += framesTotal;
+}
+
+#ifndef FFREADER_NO_STATS
+/** Returns memory used by copy of packed image, in bytes. */
+static size_t cachedImageBytes(const PackedImageCopy& image)
+{
+    return sizeof(image) + image.frames.capacity() * sizeof(ImageFrame)
+           + image.parts.capacity() * sizeof(ImagePart);
+}
+
+template <typename T>
+static size_t vectorBytes(const std::vector<T>& array)
+{
+    return array.capacity() * sizeof(T);
+}
+#endif
+
+FfReaderStats::FfReaderStats()
+    : bytesRead(0)
+    , readCalls(0)
+    , seeks(0)
+    , mappedBytes(0)
+    , lookups(0)
+    , imageCacheHits(0)
+    , imageCacheMisses(0)
+    , imageCacheEvictions(0)
+    , metadataBytes(0)
+    , peakMetadataBytes(0)
+{
+    for (size_t i = 0; i < lookupLatencyBuckets; ++i) {
+        lookupLatency[i] = 0;
+    }
+
+    for (int i = 0; i < PhasesTotal; ++i) {
+        phaseSeconds[i] = 0.0;
+    }
+}
+
+const char* ffReaderPhaseName(FfReaderPhase phase)
+{
+    switch (phase) {
+    case HeaderPhase:
+        return "header";
+    case TableOfContentsPhase:
+        return "toc";
+    case NameListPhase:
+        return "names";
+    case IndexPhase:
+        return "index";
+    case ImagesPhase:
+        return "images";
+    case SidecarLoadPhase:
+        return "sidecar load";
+    case SidecarWritePhase:
+        return "sidecar write";
+    case PhasesTotal:
+        break;
+    }
+
+    return "unknown";
+}
+
+PackedImageCopy::PackedImageCopy()
+{
+    image.palette = NULL;
+    image.frames.data = NULL;
+    image.frames.count = 0;
+}
+
+PackedImageCopy::PackedImageCopy(const PackedImageCopy& other)
+{
+    assign(other.image);
+}
+
+PackedImageCopy& PackedImageCopy::operator=(const PackedImageCopy& other)
+{
+    if (this != &other) {
+        assign(other.image);
+    }
+
+    return *this;
+}
+
+void PackedImageCopy::assign(const PackedImage& packedImage)
+{
+    size_t partsTotal = 0;
+    for (size_t i = 0; i < packedImage.frames.size(); ++i) {
+        partsTotal += packedImage.frames[i].parts.size();
+    }
+
+    // Source image may be one of our own, copy everything before touching arrays
+    std::vector<ImageFrame> framesCopy(packedImage.frames.begin(), packedImage.frames.end());
+    std::vector<ImagePart> partsCopy;
+    partsCopy.reserve(partsTotal);
+
+    for (size_t i = 0; i < framesCopy.size(); ++i) {
+        const ArrayView<ImagePart>& frameParts = framesCopy[i].parts;
+        partsCopy.insert(partsCopy.end(), frameParts.begin(), frameParts.end());
+    }
+
+    frames.swap(framesCopy);
+    parts.swap(partsCopy);
+
+    image.palette = packedImage.palette;
+    bindViews(image, frames, 0, parts, 0);
+}
+
+void PackedImageCopy::swap(PackedImageCopy& other)
+{
+    // Vector swap keeps element addresses, so views keep pointing at the right arrays
+    std::swap(image, other.image);
+    frames.swap(other.frames);
+    parts.swap(other.parts);
+}
+
 FfReader::FfReader(const std::string& ffFilePath, bool readImageData)
     : ffFilePath(ffFilePath)
+    , imageCacheLimit(0)
+    , lazyImages(false)
+    , readImageData(false)
+    , indexSidecarLoaded(false)
+    , counters(NULL)
+    , imageCacheHits(0)
+    , imageCacheMisses(0)
+    , imageCacheEvictions(0)
+    , imageCacheBytes(0)
+    , peakMetadataBytes(0)
+    , metadataBytes(0)
+    , timeLookups(false)
+    , statsHook(NULL)
+{
+    FfReaderOptions options;
+    options.readImageData = readImageData;
+
+    try {
+        open(options);
+    } catch (...) {
+        delete counters;
+        throw;
+    }
+}
+
+FfReader::FfReader(const std::string& ffFilePath, const FfReaderOptions& options)
+    : ffFilePath(ffFilePath)
+    , imageCacheLimit(0)
+    , lazyImages(false)
+    , readImageData(false)
+    , indexSidecarLoaded(false)
+    , counters(NULL)
+    , imageCacheHits(0)
+    , imageCacheMisses(0)
+    , imageCacheEvictions(0)
+    , imageCacheBytes(0)
+    , peakMetadataBytes(0)
+    , metadataBytes(0)
+    , timeLookups(false)
+    , statsHook(NULL)
+{
+    try {
+        open(options);
+    } catch (...) {
+        delete counters;
+        throw;
+    }
+}
+
+FfReader::~FfReader()
+{
+    delete counters;
+}
+
+bool FfReader::isMemoryMapped() const
+{
+    return mappedFile.isOpen();
+}
+
+bool FfReader::isIndexSidecarLoaded() const
+{
+    return indexSidecarLoaded;
+}
+
+void FfReader::open(const FfReaderOptions& options)
 {
     assert(sizeof(MqdbHeader) == 24 && "Size of MqdbHeader structure must be exactly 24 bytes");
     assert(sizeof(TocRecord) == 16 && "Size of TocRecord structure must be exactly 16 bytes");
     assert(sizeof(MqrcHeader) == 28 && "Size of MqrcHeader structure must be exactly 28 bytes");
+    assert(sizeof(ImagePart) == 24 && "Size of ImagePart structure must be exactly 24 bytes");
 
     std::ifstream file(ffFilePath.c_str(), std::ios_base::binary);
     if (!file) {
         throw std::runtime_error("Could not open MQDB file");
     }
 
+    imagesRecord.data = NULL;
+    imagesRecord.size = 0;
+    lazyImages = options.lazyImages;
+    readImageData = options.readImageData;
+    imageCacheLimit = options.imageCacheLimit;
+    timeLookups = options.timeLookups;
+    statsHook = options.statsHook;
+
+#ifndef FFREADER_NO_STATS
+    if (options.collectStats || timeLookups || statsHook) {
+        counters = new FfReaderCounters();
+    }
+#endif
+
+    for (int i = 0; i < PhasesTotal; ++i) {
+        phaseSeconds[i] = 0.0;
+    }
+
+    Stopwatch phaseStopwatch;
+
+    if (options.memoryMapped) {
+        // Mapping failure is not fatal, reads will fall back to positional file reads
+        mappedFile.open(ffFilePath);
+    }
+
+    if (!mappedFile.isOpen()) {
+        // Keep one handle open for positional reads, if it fails std::ifstream is used
+        recordFile.open(ffFilePath);
+    }
+
     checkFileHeader(file);
+    finishPhase(HeaderPhase, phaseStopwatch);
+
+    const std::string sidecarPath = indexSidecarPath(ffFilePath);
+
+    if (options.loadIndexSidecar) {
+        indexSidecarLoaded = loadIndexSidecar(*this, sidecarPath, options.readImageData);
+        finishPhase(SidecarLoadPhase, phaseStopwatch);
+
+        if (indexSidecarLoaded) {
+            updateMetadataBytes();
+            return;
+        }
+    }
+
     readTableOfContents(file);
-    readNameList(file);
-    readIndex(file);
+    finishPhase(TableOfContentsPhase, phaseStopwatch);
+
+    std::vector<char> nameListContents;
+    readNameListContents(file, nameListContents);
+
+    if (options.parseThreads != 1) {
+        readSections(file, nameListContents, options);
+    } else {
+        readNameList(file, nameListContents);
+        finishPhase(NameListPhase, phaseStopwatch);
+
+        readIndex(file, findTocRecord(indexOptRecordName));
+        finishPhase(IndexPhase, phaseStopwatch);
+
+        if (options.readImageData) {
+            readImages(file, findTocRecord(imagesOptRecordName), NULL);
+            finishPhase(ImagesPhase, phaseStopwatch);
+        }
+    }
+
+    updateMetadataBytes();
 
-    if (readImageData) {
-        readImages(file);
+    if (options.writeIndexSidecar) {
+        // Sidecar only speeds up next opens, reader is complete without it
+        writeIndexSidecar(*this, sidecarPath);
+        finishPhase(SidecarWritePhase, phaseStopwatch);
     }
 }
 
-FfReader::~FfReader()
+/** Parses names list or '-INDEX.OPT' on a worker thread of parallel open. */
+class SectionTask : public Task
+{
+public:
+    SectionTask(FfReader& reader,
+                FfReaderPhase phase,
+                const std::vector<char>& nameListContents,
+                const TocRecord* record,
+                Mutex& errorMutex,
+                std::string& error)
+        : reader(reader)
+        , phase(phase)
+        , nameListContents(nameListContents)
+        , record(record)
+        , errorMutex(errorMutex)
+        , error(error)
+    { }
+
+    void run()
+    {
+        try {
+            // Stream state can not be shared between threads, each section uses its own
+            std::ifstream file(reader.ffFilePath.c_str(), std::ios_base::binary);
+            if (!file) {
+                throw std::runtime_error("Could not open MQDB file");
+            }
+
+            Stopwatch stopwatch;
+
+            if (phase == NameListPhase) {
+                reader.readNameList(file, nameListContents);
+            } else {
+                reader.readIndex(file, record);
+            }
+
+            reader.finishPhase(phase, stopwatch);
+        } catch (const std::exception& e) {
+            ScopedLock lock(errorMutex);
+            if (error.empty()) {
+                error = e.what();
+            }
+        }
+    }
+
+private:
+    FfReader& reader;
+    FfReaderPhase phase;
+    const std::vector<char>& nameListContents;
+    const TocRecord* record;
+    Mutex& errorMutex;
+    std::string& error;
+};
+
+void FfReader::readSections(std::ifstream& file,
+                            const std::vector<char>& nameListContents,
+                            const FfReaderOptions& options)
 {
+    // Sections are found by name before names are stored, so all of them can start at once
+    const TocRecord* indexRecord = findListedRecord(file, nameListContents, indexOptRecordName);
+    const TocRecord* imagesOptRecord = options.readImageData
+                                           ? findListedRecord(file, nameListContents,
+                                                              imagesOptRecordName)
+                                           : NULL;
+
+    Mutex errorMutex;
+    std::string error;
+
+    SectionTask nameListTask(*this, NameListPhase, nameListContents, NULL, errorMutex, error);
+    SectionTask indexTask(*this, IndexPhase, nameListContents, indexRecord, errorMutex, error);
+
+    // Declared after tasks, so it is destroyed and waits for them first
+    ThreadPool pool(options.parseThreads);
+    pool.submit(&nameListTask);
+    pool.submit(&indexTask);
+
+    if (options.readImageData) {
+        // Calling thread scans '-IMAGES.OPT' meanwhile, then shares decoding with the pool
+        try {
+            Stopwatch stopwatch;
+            readImages(file, imagesOptRecord, &pool);
+            finishPhase(ImagesPhase, stopwatch);
+        } catch (const std::exception& e) {
+            ScopedLock lock(errorMutex);
+            if (error.empty()) {
+                error = e.what();
+            }
+        }
+    }
+
+    pool.wait();
+
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
 }
 
 const TocRecord* FfReader::findTocRecord(RecordId recordId) const
 {
-    std::map<RecordId, TocRecord>::const_iterator it = tableOfContents.find(recordId);
+    LookupTimer timer(*this);
+    return searchTocRecord(recordId);
+}
 
-    return it != tableOfContents.end() ? &it->second : NULL;
+const TocRecord* FfReader::searchTocRecord(RecordId recordId) const
+{
+    std::vector<TocRecord>::const_iterator it = std::lower_bound(tableOfContents.begin(),
+                                                                 tableOfContents.end(),
+                                                                 recordId,
+                                                                 tocRecordIdLess);
 
-    return NULL;
+    return it != tableOfContents.end() && it->recordId == recordId ? &*it : NULL;
 }
 
 const TocRecord* FfReader::findTocRecord(SpecialId recordId) const
@@ -99,54 +697,369 @@ const TocRecord* FfReader::findTocRecord(SpecialId recordId) const
 
 const TocRecord* FfReader::findTocRecord(const char* recordName) const
 {
-    return findTocRecord(std::string(recordName));
+    LookupTimer timer(*this);
+    const RecordId* recordId = recordNames.find(recordName);
+
+    return recordId ? searchTocRecord(*recordId) : NULL;
+}
+
+const TocRecord* FfReader::findTocRecord(const std::string& recordName) const
+{
+    LookupTimer timer(*this);
+    const RecordId* recordId = recordNames.find(recordName);
+
+    return recordId ? searchTocRecord(*recordId) : NULL;
+}
+
+bool FfReader::getRecordData(const char* recordName, std::vector<char>& data) const
+{
+    const TocRecord* record = findTocRecord(recordName);
+    if (!record) {
+        return false;
+    }
+
+    return getRecordData(*record, data);
+}
+
+bool FfReader::getRecordData(const std::string& recordName, std::vector<char>& data) const
+{
+    const TocRecord* record = findTocRecord(recordName);
+    if (!record) {
+        return false;
+    }
+
+    return getRecordData(*record, data);
+}
+
+bool FfReader::getRecordData(RecordId recordId, std::vector<char>& data) const
+{
+    const TocRecord* record = findTocRecord(recordId);
+    if (!record) {
+        return false;
+    }
+
+    return getRecordData(*record, data);
+}
+
+RecordView FfReader::getRecordView(const char* recordName) const
+{
+    const TocRecord* record = findTocRecord(recordName);
+    if (!record) {
+        RecordView empty = {NULL, 0};
+        return empty;
+    }
+
+    return getRecordView(*record);
+}
+
+RecordView FfReader::getRecordView(const std::string& recordName) const
+{
+    const TocRecord* record = findTocRecord(recordName);
+    if (!record) {
+        RecordView empty = {NULL, 0};
+        return empty;
+    }
+
+    return getRecordView(*record);
+}
+
+RecordView FfReader::getRecordView(RecordId recordId) const
+{
+    const TocRecord* record = findTocRecord(recordId);
+    if (!record) {
+        RecordView empty = {NULL, 0};
+        return empty;
+    }
+
+    return getRecordView(*record);
+}
+
+const TocRecord* FfReader::findTocRecord(const char* recordName, size_t nameLength) const
+{
+    LookupTimer timer(*this);
+    const RecordId* recordId = recordNames.find(recordName, nameLength);
+
+    return recordId ? searchTocRecord(*recordId) : NULL;
+}
+
+const NameIndex& FfReader::getNameIndex() const
+{
+    return recordNames;
+}
+
+std::vector<std::string> FfReader::getNames() const
+{
+    std::vector<std::string> namesArray(recordNames.size());
+
+    for (size_t i = 0; i < recordNames.size(); ++i) {
+        namesArray[i].assign(recordNames.name(i), recordNames.nameLength(i));
+    }
+
+    // Keep names sorted, as they were returned before
+    std::sort(namesArray.begin(), namesArray.end());
+
+    return namesArray;
+}
+
+bool FfReader::refresh(RefreshResult* result)
+{
+    RefreshResult refreshed;
+
+    // Remember which records sections were read from, names may change below
+    const TocRecord* previousIndex = findTocRecord(indexOptRecordName);
+    const TocRecord* previousImages = findTocRecord(imagesOptRecordName);
+    const bool hadIndex = previousIndex != NULL;
+    const bool hadImages = previousImages != NULL;
+    const RecordId previousIndexId = hadIndex ? previousIndex->recordId : 0;
+    const RecordId previousImagesId = hadImages ? previousImages->recordId : 0;
+
+    std::ifstream file(ffFilePath.c_str(), std::ios_base::binary);
+    if (!file) {
+        throw std::runtime_error("Could not open MQDB file");
+    }
+
+    checkFileHeader(file);
+
+    std::vector<TocRecord> previousToc;
+    previousToc.swap(tableOfContents);
+    readTableOfContents(file);
+
+    std::vector<RecordId> changedIds;
+    collectChangedRecords(previousToc, tableOfContents, changedIds);
+    refreshed.recordsChanged = changedIds.size();
+
+    if (changedIds.empty()) {
+        // Keep ToC records and mapping that were handed out, they still describe the file
+        tableOfContents.swap(previousToc);
+
+        if (result) {
+            *result = refreshed;
+        }
+
+        return false;
+    }
+
+    // File may have been replaced, reopen it. Unchanged records keep their offsets,
+    // so views into the old mapping are moved to the same place of the new one
+    bool sectionsLost = false;
+
+    if (mappedFile.isOpen()) {
+        MappedFile mapping;
+
+        if (mapping.open(ffFilePath)) {
+            rebaseViews(mappedFile.data(), mappedFile.size(), mapping.data());
+            mappedFile.swap(mapping);
+        } else {
+            // Fall back to positional reads, sections viewing the mapping are parsed again
+            mappedFile.close();
+            recordFile.open(ffFilePath);
+            sectionsLost = true;
+        }
+    } else {
+        recordFile.close();
+        recordFile.open(ffFilePath);
+    }
+
+    std::vector<char> nameListContents;
+    readNameListContents(file, nameListContents);
+
+    if (std::binary_search(changedIds.begin(), changedIds.end(), RecordId(NameList))
+        || nameListChanged(file, nameListContents, changedIds)) {
+        readNameList(file, nameListContents);
+        refreshed.namesReparsed = true;
+    }
+
+    const TocRecord* index = findTocRecord(indexOptRecordName);
+    if (sectionsLost || sectionChanged(hadIndex, previousIndexId, index, changedIds)) {
+        readIndex(file, index);
+        refreshed.indexReparsed = true;
+    }
+
+    const TocRecord* images = findTocRecord(imagesOptRecordName);
+    if (readImageData
+        && (sectionsLost || sectionChanged(hadImages, previousImagesId, images, changedIds))) {
+        readImages(file, images, NULL);
+        refreshed.imagesReparsed = true;
+    }
+
+    updateMetadataBytes();
+
+    if (result) {
+        *result = refreshed;
+    }
+
+    return true;
+}
+
+FfReaderStats FfReader::getStats() const
+{
+    FfReaderStats stats;
+
+#ifndef FFREADER_NO_STATS
+    if (counters) {
+        stats.bytesRead = counters->bytesRead.value();
+        stats.readCalls = counters->readCalls.value();
+        stats.seeks = counters->seeks.value();
+        stats.mappedBytes = counters->mappedBytes.value();
+        stats.lookups = counters->lookups.value();
+
+        for (size_t i = 0; i < lookupLatencyBuckets; ++i) {
+            stats.lookupLatency[i] = counters->lookupLatency[i].value();
+        }
+    }
+
+    for (int i = 0; i < PhasesTotal; ++i) {
+        stats.phaseSeconds[i] = phaseSeconds[i];
+    }
+
+    ScopedLock lock(imageCacheMutex);
+    stats.imageCacheHits = imageCacheHits;
+    stats.imageCacheMisses = imageCacheMisses;
+    stats.imageCacheEvictions = imageCacheEvictions;
+    stats.metadataBytes = metadataBytes + imageCacheBytes;
+    stats.peakMetadataBytes = peakMetadataBytes;
+#endif
+
+    return stats;
+}
+
+void FfReader::countRead(uint64_t bytes) const
+{
+#ifndef FFREADER_NO_STATS
+    if (!counters) {
+        return;
+    }
+
+    counters->bytesRead.add(bytes);
+    counters->readCalls.add(1);
+
+    if (statsHook) {
+        statsHook->onRead(bytes);
+    }
+#else
+    (void)bytes;
+#endif
+}
+
+bool FfReader::readFileRange(uint64_t offset, char* buffer, size_t size) const
+{
+    countRead(size);
+    return recordFile.read(offset, buffer, size);
+}
+
+void FfReader::countSeek() const
+{
+#ifndef FFREADER_NO_STATS
+    if (counters) {
+        counters->seeks.add(1);
+    }
+#endif
+}
+
+void FfReader::countLookup(double startTime) const
+{
+#ifndef FFREADER_NO_STATS
+    if (!counters) {
+        return;
+    }
+
+    counters->lookups.add(1);
+
+    if (!timeLookups) {
+        return;
+    }
+
+    const double seconds = Stopwatch::now() - startTime;
+    const double nanoseconds = seconds * 1e9;
+
+    size_t bucket = 0;
+    for (double limit = 128.0; bucket + 1 < lookupLatencyBuckets && nanoseconds >= limit;
+         limit *= 2.0) {
+        ++bucket;
+    }
+
+    counters->lookupLatency[bucket].add(1);
+
+    if (statsHook) {
+        statsHook->onLookup(seconds);
+    }
+#else
+    (void)startTime;
+#endif
 }
 
-const TocRecord* FfReader::findTocRecord(const std::string& recordName) const
+void FfReader::finishPhase(FfReaderPhase phase, Stopwatch& stopwatch)
 {
-    std::map<std::string, RecordId>::const_iterator it = recordNames.find(recordName);
+#ifndef FFREADER_NO_STATS
+    phaseSeconds[phase] = stopwatch.elapsed();
 
-    return it != recordNames.end() ? findTocRecord(it->second) : NULL;
+    if (statsHook) {
+        statsHook->onPhase(phase, phaseSeconds[phase]);
+    }
 
-    return NULL;
+    stopwatch.restart();
+#else
+    (void)phase;
+    (void)stopwatch;
+#endif
 }
 
-bool FfReader::getRecordData(const std::string& recordName, std::vector<char>& data)
+void FfReader::updateMetadataBytes()
 {
-    const TocRecord* record = findTocRecord(recordName);
-    if (!record) {
-        return false;
-    }
-
-    return getRecordData(*record, data);
+#ifndef FFREADER_NO_STATS
+    metadataBytes = vectorBytes(tableOfContents) + recordNames.memoryUsed()
+                    + vectorBytes(indexData.images.ids) + vectorBytes(indexData.images.names)
+                    + vectorBytes(indexData.images.packedInfo)
+                    + vectorBytes(indexData.animations.names)
+                    + vectorBytes(indexData.animations.packedInfo) + imageIndexNames.memoryUsed()
+                    + animationIndexNames.memoryUsed() + vectorBytes(packedImages)
+                    + vectorBytes(imageFrames) + vectorBytes(imageParts)
+                    + vectorBytes(indexContents) + vectorBytes(imagesContents)
+                    + vectorBytes(packedImageOffsets);
+
+    ScopedLock lock(imageCacheMutex);
+    peakMetadataBytes = std::max(peakMetadataBytes, metadataBytes + imageCacheBytes);
+#endif
 }
 
-bool FfReader::getRecordData(RecordId recordId, std::vector<char>& data)
+void FfReader::rebaseViews(const char* oldData, size_t oldSize, const char* newData)
 {
-    const TocRecord* record = findTocRecord(recordId);
-    if (!record) {
-        return false;
+    for (size_t i = 0; i < indexData.images.names.size(); ++i) {
+        rebasePointer(indexData.images.names[i], oldData, oldSize, newData);
     }
 
-    return getRecordData(*record, data);
-}
+    for (size_t i = 0; i < indexData.animations.names.size(); ++i) {
+        rebasePointer(indexData.animations.names[i], oldData, oldSize, newData);
+    }
 
-std::vector<std::string> FfReader::getNames() const
-{
-    std::vector<std::string> namesArray(recordNames.size());
+    rebasePointer(imagesRecord.data, oldData, oldSize, newData);
 
-    size_t i = 0;
-    for (std::map<std::string, RecordId>::const_iterator pair = recordNames.begin(); pair != recordNames.end(); pair++) {
-        namesArray[i++] = pair->first;
+    for (size_t i = 0; i < packedImages.size(); ++i) {
+        rebasePointer(packedImages[i].palette, oldData, oldSize, newData);
     }
 
-    return namesArray;
+    for (size_t i = 0; i < imageFrames.size(); ++i) {
+        rebasePointer(imageFrames[i].name, oldData, oldSize, newData);
+    }
+
+    ScopedLock lock(imageCacheMutex);
+
+    std::map<RelativeOffset, CachedImage>::iterator it = imageCache.begin();
+    for (; it != imageCache.end(); ++it) {
+        PackedImageCopy& cached = it->second.image;
+        rebasePointer(cached.image.palette, oldData, oldSize, newData);
+
+        for (size_t i = 0; i < cached.frames.size(); ++i) {
+            rebasePointer(cached.frames[i].name, oldData, oldSize, newData);
+        }
+    }
 }
 
 void FfReader::checkFileHeader(std::ifstream& file)
 {
     MqdbHeader header;
     file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    countRead(sizeof(header));
 
     if (header.signature != mqdbFileSignature) {
         throw std::runtime_error("Not a MQDB file");
@@ -160,24 +1073,35 @@ void FfReader::checkFileHeader(std::ifstream& file)
 void FfReader::readTableOfContents(std::ifstream& file)
 {
     const uint32_t tocOffset = readUint32(file);
+    countRead(sizeof(tocOffset));
 
     file.seekg(tocOffset);
+    countSeek();
 
     const uint32_t entriesTotal = readUint32(file);
+    countRead(sizeof(entriesTotal));
+
+    // Read all records at once
+    tableOfContents.resize(entriesTotal);
+    if (entriesTotal) {
+        file.read(reinterpret_cast<char*>(&tableOfContents[0]), entriesTotal * sizeof(TocRecord));
+        countRead(entriesTotal * sizeof(TocRecord));
+    }
+
+    if (!file) {
+        throw std::runtime_error("Could not read MQDB ToC records");
+    }
 
-    for (uint32_t i = 0; i < entriesTotal; ++i) {
-        TocRecord record;
-        file.read(reinterpret_cast<char*>(&record), sizeof(record));
+    std::sort(tableOfContents.begin(), tableOfContents.end(), tocRecordLess);
 
-        if (tableOfContents.find(record.recordId) != tableOfContents.end()) {
+    for (size_t i = 1; i < tableOfContents.size(); ++i) {
+        if (tableOfContents[i - 1].recordId == tableOfContents[i].recordId) {
             throw std::runtime_error("MQDB ToC contains records with non-unique ids");
         }
-
-        tableOfContents[record.recordId] = record;
     }
 }
 
-void FfReader::readNameList(std::ifstream& file)
+void FfReader::readNameListContents(std::ifstream& file, std::vector<char>& contents) const
 {
     const TocRecord* namesList = findTocRecord(NameList);
     if (!namesList) {
@@ -185,33 +1109,148 @@ void FfReader::readNameList(std::ifstream& file)
         throw std::runtime_error("Could not find MQDB names list ToC record");
     }
 
-    // Start reading names list contents, skip record header
-    file.seekg(namesList->offset + sizeof(MqrcHeader));
+    // Read whole names list contents at once, skip record header
+    if (!readRecordContents(file, *namesList, contents) || contents.size() < sizeof(uint32_t)) {
+        throw std::runtime_error("Could not read MQDB names list contents");
+    }
+
+    ByteCursor cursor(&contents[0], contents.size());
+    const uint32_t namesTotal = cursor.takeUint32();
+
+    if (!cursor.has(namesTotal, nameListEntrySize)) {
+        throw std::runtime_error("MQDB names list contains more entries than it can fit");
+    }
+}
+
+const TocRecord* FfReader::findListedRecord(std::ifstream& file,
+                                            const std::vector<char>& contents,
+                                            const char* recordName) const
+{
+    const size_t recordNameLength = strlen(recordName);
+
+    ByteCursor cursor(&contents[0], contents.size());
+    const uint32_t namesTotal = cursor.takeUint32();
+
+    for (uint32_t i = 0; i < namesTotal; ++i) {
+        const char* name = cursor.current();
+        cursor.skip(nameListNameSize);
+
+        const RecordId recordId = cursor.takeUint32();
+
+        if (boundedLength(name, nameListNameSize - 1) != recordNameLength
+            || memcmp(name, recordName, recordNameLength)) {
+            continue;
+        }
+
+        const TocRecord* tocRecord = searchTocRecord(recordId);
+        if (!tocRecord) {
+            continue;
+        }
+
+        // Unused records are skipped by readNameList, the first used one wins
+        MqrcHeader recordHeader;
+        if (!readRecordHeader(file, tocRecord->offset, recordHeader)
+            || recordHeader.signature != mqrcSignature) {
+            throw std::runtime_error("Read wrong MQRC signature while processing names list");
+        }
+
+        if (recordHeader.used) {
+            return tocRecord;
+        }
+    }
+
+    return NULL;
+}
+
+bool FfReader::nameListChanged(std::ifstream& file,
+                               const std::vector<char>& contents,
+                               const std::vector<RecordId>& changedIds) const
+{
+    ByteCursor cursor(&contents[0], contents.size());
+    const uint32_t namesTotal = cursor.takeUint32();
+
+    for (uint32_t i = 0; i < namesTotal; ++i) {
+        const char* name = cursor.current();
+        cursor.skip(nameListNameSize);
+
+        const RecordId recordId = cursor.takeUint32();
+
+        if (!std::binary_search(changedIds.begin(), changedIds.end(), recordId)) {
+            continue;
+        }
+
+        const uint32_t* storedId = recordNames.find(name, boundedLength(name, nameListNameSize - 1));
+        const bool stored = storedId && *storedId == recordId;
+
+        bool used = false;
+
+        const TocRecord* tocRecord = searchTocRecord(recordId);
+        if (tocRecord) {
+            MqrcHeader recordHeader;
+            if (!readRecordHeader(file, tocRecord->offset, recordHeader)
+                || recordHeader.signature != mqrcSignature) {
+                throw std::runtime_error("Read wrong MQRC signature while processing names list");
+            }
+
+            used = recordHeader.used != 0;
+        }
+
+        if (used != stored) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void FfReader::readNameList(std::ifstream& file, const std::vector<char>& contents)
+{
+    recordNames.clear();
+
+    // Contents were validated by readNameListContents
+    ByteCursor cursor(&contents[0], contents.size());
+    const uint32_t namesTotal = cursor.takeUint32();
+
+    std::vector<NameListEntry> entries;
+    entries.reserve(namesTotal);
+    recordNames.reserve(namesTotal);
 
-    const uint32_t namesTotal = readUint32(file);
-    
     for (uint32_t i = 0; i < namesTotal; ++i) {
-        char name[256];
-        file.read(name, sizeof(name));
-        name[255] = '\0';
+        const size_t nameOffset = cursor.offset();
+        cursor.skip(nameListNameSize);
 
-        const RecordId recordId = readUint32(file);
+        const RecordId recordId = cursor.takeUint32();
 
-        // Find record by its id, check if it is deleted or not
-        const TocRecord* tocRecord = findTocRecord(recordId);
+        // Find record by its id
+        const TocRecord* tocRecord = searchTocRecord(recordId);
         if (!tocRecord) {
             // This should never happen
             continue;
         }
 
-        const std::streampos readPosition = file.tellg();
+        NameListEntry entry;
+        entry.nameOffset = nameOffset;
+        entry.recordOffset = tocRecord->offset;
+        entry.recordId = recordId;
+        entry.used = false;
+
+        entries.push_back(entry);
+    }
+
+    // Check headers in the order records are stored in file, so reads stay sequential
+    std::vector<NameListEntry*> byOffset(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        byOffset[i] = &entries[i];
+    }
+
+    std::sort(byOffset.begin(), byOffset.end(), NameListEntry::lessByOffset);
 
-        file.seekg(tocRecord->offset, std::ios_base::beg);
+    for (size_t i = 0; i < byOffset.size(); ++i) {
+        NameListEntry& entry = *byOffset[i];
 
-        
         MqrcHeader recordHeader;
-        file.read(reinterpret_cast<char*>(&recordHeader), sizeof(recordHeader));
-        if (recordHeader.signature != mqrcSignature) {
+        if (!readRecordHeader(file, entry.recordOffset, recordHeader)
+            || recordHeader.signature != mqrcSignature) {
             // Mqrc record header has wrong signature.
             // Either current algorithm is wrong
             // or .ff file contains garbage or unknown structures.
@@ -219,17 +1258,22 @@ void FfReader::readNameList(std::ifstream& file)
             throw std::runtime_error("Read wrong MQRC signature while processing names list");
         }
 
-        // Restore position previously read from
-        file.seekg(readPosition, std::ios_base::beg);
+        entry.used = recordHeader.used != 0;
+    }
+
+    // Store names in the order they appear in names list, so the first duplicate wins
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const NameListEntry& entry = entries[i];
 
-        if (!recordHeader.used) {
+        if (!entry.used) {
             // Record is not used, do not store it in names list
             continue;
         }
-        
-        const std::string nameString = name;
 
-        if (recordNames.find(nameString) != recordNames.end()) {
+        const char* name = &contents[entry.nameOffset];
+        const size_t nameLength = boundedLength(name, nameListNameSize - 1);
+
+        if (!recordNames.insert(name, nameLength, entry.recordId)) {
             // Do not store duplicates, for now.
             // Duplicates shouldn't exist in MQDB files, especially there shouldn't be
             // several MQRC records with the same name, since game loads MQRC contents
@@ -240,144 +1284,545 @@ void FfReader::readNameList(std::ifstream& file)
             // since it does not delete entries
             continue;
         }
-        
-        recordNames[nameString] = recordId;
     }
 }
 
-void FfReader::readIndex(std::ifstream& file)
+void FfReader::readIndex(std::ifstream& file, const TocRecord* record)
 {
-    const TocRecord* record = findTocRecord(indexOptRecordName);
+    indexData = IndexData();
+    indexContents.clear();
+    imageIndexNames.clear();
+    animationIndexNames.clear();
+
     if (!record) {
         // No index record present, skip
         return;
     }
 
-    file.seekg(record->offset + sizeof(MqrcHeader));
+    // Index names are used in place, mapped readers use the mapping, others keep contents
+    RecordView view = getRecordView(*record);
+
+    if (!view.data) {
+        if (!readRecordContents(file, *record, indexContents)) {
+            throw std::runtime_error("Could not read '-INDEX.OPT' contents");
+        }
+
+        if (indexContents.empty()) {
+            return;
+        }
+
+        view.data = &indexContents[0];
+        view.size = static_cast<uint32_t>(indexContents.size());
+    }
+
+    if (!view.size) {
+        return;
+    }
 
-    std::vector<char> contents(record->size, '\0');
-    file.read(&contents[0], record->size);
+    ByteCursor cursor(view.data, view.size);
 
-    const char* contentsPtr = &contents[0];
+    uint32_t total = 0;
+    if (!cursor.readUint32(total)) {
+        throw std::runtime_error("'-INDEX.OPT' is too small");
+    }
 
-    size_t byteOffset = 0;
-    const uint32_t total = readUint32(contentsPtr, byteOffset);
+    // Count entries of each kind first, so tables are allocated once at their final size
+    const size_t firstEntry = cursor.offset();
+    size_t imagesTotal = 0;
 
     for (uint32_t i = 0; i < total; ++i) {
-        const RecordId id = readUint32(contentsPtr, byteOffset);
+        uint32_t id = 0;
+        size_t nameLength = 0;
+
+        // Name is followed by offset and size
+        if (!cursor.readUint32(id) || !cursor.readString(nameLength)
+            || !cursor.has(2 * sizeof(uint32_t))) {
+            throw std::runtime_error("'-INDEX.OPT' entry does not fit into record");
+        }
+
+        cursor.skip(2 * sizeof(uint32_t));
+
+        if (id != std::numeric_limits<RecordId>::max()) {
+            ++imagesTotal;
+        }
+    }
+
+    ImageIndices& images = indexData.images;
+    AnimationIndices& animations = indexData.animations;
+
+    images.ids.reserve(imagesTotal);
+    images.names.reserve(imagesTotal);
+    images.packedInfo.reserve(imagesTotal);
+    imageIndexNames.reserve(imagesTotal);
 
-        const char* name = &contentsPtr[byteOffset];
-        // +1 for null terminator
-        const size_t nameLength = strlen(name) + 1;
+    animations.names.reserve(total - imagesTotal);
+    animations.packedInfo.reserve(total - imagesTotal);
+    animationIndexNames.reserve(total - imagesTotal);
 
-        byteOffset += nameLength;
+    cursor.seek(firstEntry);
 
-        const uint32_t offset = readUint32(contentsPtr, byteOffset);
-        const uint32_t size = readUint32(contentsPtr, byteOffset);
+    for (uint32_t i = 0; i < total; ++i) {
+        // Entries were validated by the first pass
+        const RecordId id = cursor.takeUint32();
+
+        size_t nameLength = 0;
+        const char* name = cursor.readString(nameLength);
 
-        const std::string entryName(name);
+        const uint32_t offset = cursor.takeUint32();
+        const uint32_t size = cursor.takeUint32();
 
+        // Duplicate names keep the first entry, as names list does
         if (id != std::numeric_limits<RecordId>::max()) {
             // Entry has valid id, this is an image entry
-            ImageIndices images = indexData.images;
+            imageIndexNames.insert(name, nameLength, static_cast<uint32_t>(images.ids.size()));
 
             images.ids.push_back(id);
-            images.names.push_back(entryName);
+            images.names.push_back(name);
             images.packedInfo.push_back(PackedImageInfo(offset, size));
         } else {
             // Entries with invalid ids are used for animation frames
-            AnimationIndices animations = indexData.animations;
+            animationIndexNames.insert(name, nameLength,
+                                       static_cast<uint32_t>(animations.names.size()));
 
-            animations.names.push_back(entryName);
+            animations.names.push_back(name);
             animations.packedInfo.push_back(PackedImageInfo(offset, size));
         }
     }
 }
 
-void FfReader::readImages(std::ifstream& file)
+bool FfReader::findImageIndex(const char* imageName,
+                              RecordId& recordId,
+                              PackedImageInfo& packedInfo) const
+{
+    const uint32_t* entry = imageIndexNames.find(imageName);
+    if (!entry) {
+        return false;
+    }
+
+    recordId = indexData.images.ids[*entry];
+    packedInfo = indexData.images.packedInfo[*entry];
+    return true;
+}
+
+bool FfReader::findImageIndex(const std::string& imageName,
+                              RecordId& recordId,
+                              PackedImageInfo& packedInfo) const
+{
+    return findImageIndex(imageName.c_str(), recordId, packedInfo);
+}
+
+bool FfReader::findImageIndex(const char* imageName,
+                              size_t nameLength,
+                              RecordId& recordId,
+                              PackedImageInfo& packedInfo) const
+{
+    const uint32_t* entry = imageIndexNames.find(imageName, nameLength);
+    if (!entry) {
+        return false;
+    }
+
+    recordId = indexData.images.ids[*entry];
+    packedInfo = indexData.images.packedInfo[*entry];
+    return true;
+}
+
+bool FfReader::findAnimationIndex(const char* animationName, PackedImageInfo& packedInfo) const
+{
+    const uint32_t* entry = animationIndexNames.find(animationName);
+    if (!entry) {
+        return false;
+    }
+
+    packedInfo = indexData.animations.packedInfo[*entry];
+    return true;
+}
+
+bool FfReader::findAnimationIndex(const std::string& animationName,
+                                  PackedImageInfo& packedInfo) const
+{
+    return findAnimationIndex(animationName.c_str(), packedInfo);
+}
+
+bool FfReader::findAnimationIndex(const char* animationName,
+                                  size_t nameLength,
+                                  PackedImageInfo& packedInfo) const
+{
+    const uint32_t* entry = animationIndexNames.find(animationName, nameLength);
+    if (!entry) {
+        return false;
+    }
+
+    packedInfo = indexData.animations.packedInfo[*entry];
+    return true;
+}
+
+/** Reads consecutive packed images of '-IMAGES.OPT' into arrays allocated by readImages. */
+class ImagesChunkTask : public Task
+{
+public:
+    ImagesChunkTask(FfReader& reader,
+                    const std::vector<size_t>& firstFrames,
+                    const std::vector<size_t>& firstParts,
+                    size_t begin,
+                    size_t end)
+        : reader(reader)
+        , firstFrames(firstFrames)
+        , firstParts(firstParts)
+        , begin(begin)
+        , end(end)
+    { }
+
+    void run()
+    {
+        ByteCursor cursor(reader.imagesRecord.data, reader.imagesRecord.size);
+        cursor.seek(reader.packedImageOffsets[begin]);
+
+        ImageFrame* frames = reader.imageFrames.empty() ? NULL : &reader.imageFrames[0];
+        ImagePart* parts = reader.imageParts.empty() ? NULL : &reader.imageParts[0];
+
+        // Images are stored one after another, read them in a single pass
+        for (size_t i = begin; i < end; ++i) {
+            readPackedImage(cursor, reader.packedImages[i], frames + firstFrames[i],
+                            parts + firstParts[i]);
+        }
+    }
+
+private:
+    FfReader& reader;
+    const std::vector<size_t>& firstFrames;
+    const std::vector<size_t>& firstParts;
+    size_t begin;
+    size_t end;
+};
+
+void FfReader::readImages(std::ifstream& file, const TocRecord* record, ThreadPool* pool)
 {
-    const TocRecord* record = findTocRecord(imagesOptRecordName);
+    packedImages.clear();
+    imageFrames.clear();
+    imageParts.clear();
+    packedImageOffsets.clear();
+    imagesContents.clear();
+    imagesRecord.data = NULL;
+    imagesRecord.size = 0;
+
+    {
+        ScopedLock lock(imageCacheMutex);
+        imageCache.clear();
+        imageCacheOrder.clear();
+        imageCacheBytes = 0;
+    }
+
     if (!record) {
         // No images record present, skip
         return;
     }
 
-    const uint32_t off = record->offset + sizeof(MqrcHeader);
-    file.seekg(off, std::ios_base::beg);
-
     const uint32_t recordSize = record->size;
 
-    std::vector<char> contents(recordSize, '\0');
-    file.read(&contents[0], recordSize);
+    RecordView view = getRecordView(*record);
+
+    if (!view.data) {
+        // Keep contents alive, palettes and frame names point into them.
+        // Mapped readers use the mapping instead
+        if (!readRecordContents(file, *record, imagesContents)) {
+            throw std::runtime_error("Could not read '-IMAGES.OPT' contents");
+        }
+
+        if (imagesContents.empty()) {
+            return;
+        }
+
+        view.data = &imagesContents[0];
+        view.size = recordSize;
+    }
+
+    imagesRecord = view;
+
+    ByteCursor cursor(view.data, recordSize);
+    size_t framesTotal = 0;
+    size_t partsTotal = 0;
 
-    const char* contentsPtr = &contents[0];
-    size_t byteOffset = 0;
+    // Where frames and parts of each image start in arrays
+    std::vector<size_t> firstFrames;
+    std::vector<size_t> firstParts;
 
-    while (byteOffset < recordSize) {
-        const uint32_t offset = static_cast<RelativeOffset>(byteOffset);
+    // Remember where each packed image starts and count elements to allocate arrays once
+    while (cursor.remaining()) {
+        packedImageOffsets.push_back(static_cast<RelativeOffset>(cursor.offset()));
 
-        PackedImage packedImage;
+        if (!lazyImages) {
+            firstFrames.push_back(framesTotal);
+            firstParts.push_back(partsTotal);
+        }
+
+        skipPackedImage(cursor, framesTotal, partsTotal);
+    }
 
-        packedImage.palette.assign(&contentsPtr[byteOffset],
-                                   &contentsPtr[byteOffset + paletteSize]);
-        byteOffset += paletteSize;
+    if (lazyImages || packedImageOffsets.empty()) {
+        // Decode packed images on demand
+        return;
+    }
 
-        const uint32_t framesTotal = readUint32(contentsPtr, byteOffset);
+    // Views point into arrays, they must not grow after this point
+    imageFrames.assign(framesTotal, ImageFrame(NULL, 0, 0));
+    imageParts.resize(partsTotal);
+    packedImages.resize(packedImageOffsets.size());
 
-        packedImage.frames.reserve(framesTotal);
+    const size_t imagesTotal = packedImageOffsets.size();
 
-        for (uint32_t i = 0; i < framesTotal; ++i) {
-            const char* frameName = &contentsPtr[byteOffset];
-            // +1 for null terminator
-            const size_t nameLength = strlen(frameName) + 1;
+    if (!pool) {
+        ImagesChunkTask(*this, firstFrames, firstParts, 0, imagesTotal).run();
+        return;
+    }
 
-            byteOffset += nameLength;
+    // Images are independent once their positions are known, split them between workers
+    const size_t chunksTotal = std::min(imagesTotal, pool->size() * imageChunksPerThread);
+    const size_t chunkSize = (imagesTotal + chunksTotal - 1) / chunksTotal;
 
-            const uint32_t partsTotal = readUint32(contentsPtr, byteOffset);
-            const uint32_t frameWidth = readUint32(contentsPtr, byteOffset);
-            const uint32_t frameHeight = readUint32(contentsPtr, byteOffset);
+    std::vector<ImagesChunkTask*> tasks;
 
-            ImageFrame frame(frameName, frameWidth, frameHeight);
-            frame.parts.reserve(partsTotal);
+    for (size_t begin = 0; begin < imagesTotal; begin += chunkSize) {
+        const size_t end = std::min(imagesTotal, begin + chunkSize);
 
-            for (uint32_t j = 0; j < partsTotal; ++j) {
-                const uint32_t sourceX = readUint32(contentsPtr, byteOffset);
-                const uint32_t sourceY = readUint32(contentsPtr, byteOffset);
+        tasks.push_back(new ImagesChunkTask(*this, firstFrames, firstParts, begin, end));
+        pool->submit(tasks.back());
+    }
 
-                const uint32_t targetX = readUint32(contentsPtr, byteOffset);
-                const uint32_t targetY = readUint32(contentsPtr, byteOffset);
+    pool->wait();
 
-                const uint32_t partWidth = readUint32(contentsPtr, byteOffset);
-                const uint32_t partHeight = readUint32(contentsPtr, byteOffset);
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        delete tasks[i];
+    }
+}
 
-                ImagePart part;
-                part.sourceX = sourceX;
-                part.sourceY = sourceY;
-                part.targetX = targetX;
-                part.targetY = targetY;
-                part.width   = partWidth;
-                part.height  = partHeight;
+const PackedImage* FfReader::getPackedImage(RelativeOffset offset) const
+{
+    if (!lazyImages) {
+        std::vector<RelativeOffset>::const_iterator it = std::lower_bound(
+            packedImageOffsets.begin(), packedImageOffsets.end(), offset);
 
-                frame.parts.push_back(part);
-            }
+        if (it == packedImageOffsets.end() || *it != offset || packedImages.empty()) {
+            return NULL;
+        }
+
+        return &packedImages[it - packedImageOffsets.begin()];
+    }
+
+    ScopedLock lock(imageCacheMutex);
+    return findCachedImage(offset);
+}
+
+const PackedImage* FfReader::getPackedImage(const PackedImageInfo& packedInfo) const
+{
+    return getPackedImage(packedInfo.first);
+}
+
+bool FfReader::getPackedImage(RelativeOffset offset, PackedImageCopy& packedImage) const
+{
+    if (!lazyImages) {
+        const PackedImage* image = getPackedImage(offset);
+        if (!image) {
+            return false;
+        }
+
+        packedImage.assign(*image);
+        return true;
+    }
+
+    // Copy while holding the lock, so other threads can not evict image in the middle
+    ScopedLock lock(imageCacheMutex);
+
+    const PackedImage* image = findCachedImage(offset);
+    if (!image) {
+        return false;
+    }
+
+    packedImage.assign(*image);
+    return true;
+}
+
+bool FfReader::decodePackedImage(const char* contents,
+                                 uint32_t contentsSize,
+                                 RelativeOffset offset,
+                                 PackedImageCopy& packedImage)
+{
+    if (!contents || offset >= contentsSize) {
+        return false;
+    }
+
+    ByteCursor cursor(contents, contentsSize);
+    cursor.seek(offset);
+
+    size_t framesTotal = 0;
+    size_t partsTotal = 0;
+
+    try {
+        skipPackedImage(cursor, framesTotal, partsTotal);
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    cursor.seek(offset);
+    readPackedImage(cursor, framesTotal, partsTotal, packedImage);
+    return true;
+}
+
+const PackedImage* FfReader::findCachedImage(RelativeOffset offset) const
+{
+    std::map<RelativeOffset, CachedImage>::iterator cached = imageCache.find(offset);
+    if (cached != imageCache.end()) {
+#ifndef FFREADER_NO_STATS
+        ++imageCacheHits;
+#endif
+        // Move image to the front of least recently used list
+        imageCacheOrder.splice(imageCacheOrder.begin(), imageCacheOrder, cached->second.position);
+        return &cached->second.image.image;
+    }
+
+    if (!std::binary_search(packedImageOffsets.begin(), packedImageOffsets.end(), offset)) {
+        // Offset does not point to the start of packed image
+        return NULL;
+    }
+
+    if (imageCacheLimit && imageCache.size() >= imageCacheLimit) {
+#ifndef FFREADER_NO_STATS
+        ++imageCacheEvictions;
+        imageCacheBytes -= cachedImageBytes(imageCache[imageCacheOrder.back()].image);
+#endif
+        imageCache.erase(imageCacheOrder.back());
+        imageCacheOrder.pop_back();
+    }
+
+    imageCacheOrder.push_front(offset);
+
+    CachedImage& entry = imageCache[offset];
+    entry.position = imageCacheOrder.begin();
+
+    ByteCursor cursor(imagesRecord.data, imagesRecord.size);
+    cursor.seek(offset);
+
+    // Image was validated at open time, count its elements to allocate arrays once
+    ByteCursor counter = cursor;
+    size_t framesTotal = 0;
+    size_t partsTotal = 0;
+    skipPackedImage(counter, framesTotal, partsTotal);
+
+    readPackedImage(cursor, framesTotal, partsTotal, entry.image);
+
+#ifndef FFREADER_NO_STATS
+    ++imageCacheMisses;
+    imageCacheBytes += cachedImageBytes(entry.image);
+    peakMetadataBytes = std::max(peakMetadataBytes, metadataBytes + imageCacheBytes);
+#endif
+
+    return &entry.image.image;
+}
+
+bool FfReader::readRecordHeader(std::ifstream& file, uint32_t offset, MqrcHeader& header) const
+{
+    if (mappedFile.isOpen()) {
+        if (offset > mappedFile.size() || mappedFile.size() - offset < sizeof(MqrcHeader)) {
+            return false;
+        }
+
+        memcpy(&header, mappedFile.data() + offset, sizeof(MqrcHeader));
+        return true;
+    }
+
+    file.seekg(offset, std::ios_base::beg);
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    countSeek();
+    countRead(sizeof(header));
+
+    return file.good();
+}
 
-            packedImage.frames.push_back(frame);
+bool FfReader::readRecordContents(std::ifstream& file,
+                                  const TocRecord& record,
+                                  std::vector<char>& contents) const
+{
+    if (mappedFile.isOpen()) {
+        const RecordView view = getRecordView(record);
+        if (!view.data) {
+            return false;
         }
 
-        packedImages[offset] = packedImage;
+        contents.assign(view.data, view.data + view.size);
+        return true;
+    }
+
+    file.seekg(record.offset + sizeof(MqrcHeader), std::ios_base::beg);
+    countSeek();
+
+    contents.resize(record.size);
+    if (record.size) {
+        file.read(&contents[0], record.size);
+        countRead(record.size);
     }
+
+    return file.good();
 }
 
-bool FfReader::getRecordData(const TocRecord& record, std::vector<char>& data)
+bool FfReader::getRecordData(const TocRecord& record, std::vector<char>& data) const
 {
+    if (mappedFile.isOpen()) {
+        const RecordView view = getRecordView(record);
+        if (!view.data) {
+            // Record points outside of the file
+            return false;
+        }
+
+        data.assign(view.data, view.data + view.size);
+#ifndef FFREADER_NO_STATS
+        if (counters) {
+            counters->mappedBytes.add(view.size);
+        }
+#endif
+        return true;
+    }
+
+    if (recordFile.isOpen()) {
+        data.resize(record.size);
+        if (!record.size) {
+            return true;
+        }
+
+        return readFileRange(static_cast<uint64_t>(record.offset) + sizeof(MqrcHeader),
+                             &data[0], record.size);
+    }
+
+    // Fall back to a stream opened for this read only, nothing is shared between calls
     std::ifstream file(ffFilePath.c_str(), std::ios_base::binary);
     if (!file) {
         return false;
     }
 
     file.seekg(record.offset + sizeof(MqrcHeader));
+    countSeek();
 
     data.resize(record.size);
-    file.read(&data[0], record.size);
+    if (record.size) {
+        file.read(&data[0], record.size);
+        countRead(record.size);
+    }
+
     return true;
+}
+
+RecordView FfReader::getRecordView(const TocRecord& record) const
+{
+    RecordView view = {NULL, 0};
+
+    if (!mappedFile.isOpen()) {
+        return view;
+    }
+
+    const size_t begin = static_cast<size_t>(record.offset) + sizeof(MqrcHeader);
+    if (begin > mappedFile.size() || mappedFile.size() - begin < record.size) {
+        return view;
+    }
+
+    view.data = mappedFile.data() + begin;
+    view.size = record.size;
+    return view;
 }
\ No newline at end of file
@@ -0,0 +1,636 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <FfWriter.hpp>
+#include <IndexSidecar.hpp>
+#include <RandomAccessFile.hpp>
+#include <algorithm>
+#include <limits>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+static const char mqdbSignature[4] = {'M', 'Q', 'D', 'B'};
+static const char mqrcSignature[4] = {'M', 'Q', 'R', 'C'};
+static const uint32_t mqdbFileVersion = 9;
+
+static const char indexOptRecordName[] = "-INDEX.OPT";
+static const char imagesOptRecordName[] = "-IMAGES.OPT";
+
+static const uint32_t paletteSize = 11 + 1024;
+static const size_t nameListNameSize = 256;
+
+/** ToC offset follows file header. */
+static const uint32_t firstRecordOffset = sizeof(MqdbHeader) + sizeof(uint32_t);
+
+/** Write-only file handle with sequential and positional writes. */
+class OutputFile
+{
+public:
+    OutputFile()
+#ifdef _WIN32
+        : handle(INVALID_HANDLE_VALUE)
+#else
+        : handle(-1)
+#endif
+    { }
+
+    ~OutputFile()
+    {
+        close();
+    }
+
+    /**
+     * Opens file for writing.
+     * If truncate is set, file is created or emptied, otherwise it must exist.
+     */
+    bool open(const std::string& filePath, bool truncate)
+    {
+#ifdef _WIN32
+        handle = CreateFileA(filePath.c_str(), GENERIC_WRITE, 0, NULL,
+                             truncate ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        return handle != INVALID_HANDLE_VALUE;
+#else
+        handle = ::open(filePath.c_str(), truncate ? O_WRONLY | O_CREAT | O_TRUNC : O_WRONLY, 0644);
+        return handle != -1;
+#endif
+    }
+
+    /** Writes first and then second buffer at current position, second one may be empty. */
+    bool write(const char* first, size_t firstSize, const char* second, size_t secondSize)
+    {
+#ifdef _WIN32
+        return writeAll(first, firstSize) && writeAll(second, secondSize);
+#else
+        // Gather both buffers in a single call, so large contents are never copied
+        struct iovec parts[2];
+        parts[0].iov_base = const_cast<char*>(first);
+        parts[0].iov_len = firstSize;
+        parts[1].iov_base = const_cast<char*>(second);
+        parts[1].iov_len = secondSize;
+
+        struct iovec* part = parts;
+        int partsTotal = 2;
+
+        while (partsTotal) {
+            if (!part->iov_len) {
+                ++part;
+                --partsTotal;
+                continue;
+            }
+
+            const ssize_t written = writev(handle, part, partsTotal);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (written <= 0) {
+                return false;
+            }
+
+            size_t remaining = static_cast<size_t>(written);
+            while (remaining) {
+                const size_t consumed = std::min(remaining, part->iov_len);
+                part->iov_base = static_cast<char*>(part->iov_base) + consumed;
+                part->iov_len -= consumed;
+                remaining -= consumed;
+
+                if (!part->iov_len && remaining) {
+                    ++part;
+                    --partsTotal;
+                }
+            }
+        }
+
+        return true;
+#endif
+    }
+
+    /** Writes data at specified offset, file position is not used. */
+    bool writeAt(uint64_t offset, const void* data, size_t size)
+    {
+        const char* source = static_cast<const char*>(data);
+
+        while (size) {
+#ifdef _WIN32
+            OVERLAPPED overlapped = {0};
+            overlapped.Offset = static_cast<DWORD>(offset);
+            overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+            const DWORD chunk = size > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size);
+            DWORD written = 0;
+
+            if (!WriteFile(handle, source, chunk, &written, &overlapped) || !written) {
+                return false;
+            }
+#else
+            const ssize_t written = pwrite(handle, source, size, static_cast<off_t>(offset));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (written <= 0) {
+                return false;
+            }
+#endif
+
+            source += written;
+            offset += written;
+            size -= static_cast<size_t>(written);
+        }
+
+        return true;
+    }
+
+    /** @returns false if pending data could not be written. */
+    bool close()
+    {
+#ifdef _WIN32
+        if (handle == INVALID_HANDLE_VALUE) {
+            return true;
+        }
+
+        const bool closed = CloseHandle(handle) != 0;
+        handle = INVALID_HANDLE_VALUE;
+#else
+        if (handle == -1) {
+            return true;
+        }
+
+        const bool closed = ::close(handle) == 0;
+        handle = -1;
+#endif
+
+        return closed;
+    }
+
+private:
+    OutputFile(const OutputFile&);
+    OutputFile& operator=(const OutputFile&);
+
+#ifdef _WIN32
+    bool writeAll(const char* data, size_t size)
+    {
+        while (size) {
+            const DWORD chunk = size > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size);
+            DWORD written = 0;
+
+            if (!WriteFile(handle, data, chunk, &written, NULL) || !written) {
+                return false;
+            }
+
+            data += written;
+            size -= written;
+        }
+
+        return true;
+    }
+
+    HANDLE handle;
+#else
+    int handle;
+#endif
+};
+
+/**
+ * Gathers small writes into a fixed size buffer, so file is written in large blocks.
+ * Writes that do not fit into buffer go directly from caller memory.
+ */
+class BufferedOutput
+{
+public:
+    BufferedOutput(OutputFile& file, size_t capacity)
+        : file(file)
+        , capacity(std::max<size_t>(capacity, 4096))
+        , failed(false)
+    {
+        buffer.reserve(this->capacity);
+    }
+
+    void append(const void* data, size_t size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+
+        if (buffer.size() + size <= capacity) {
+            buffer.insert(buffer.end(), bytes, bytes + size);
+            return;
+        }
+
+        if (size < capacity) {
+            flush();
+            buffer.insert(buffer.end(), bytes, bytes + size);
+            return;
+        }
+
+        // Large contents are written together with buffered bytes, without copying
+        if (!failed) {
+            failed = !file.write(buffer.empty() ? NULL : &buffer[0], buffer.size(), bytes, size);
+        }
+
+        buffer.clear();
+    }
+
+    void appendZeros(size_t size)
+    {
+        while (size) {
+            const size_t chunk = std::min(size, capacity - buffer.size());
+            if (!chunk) {
+                flush();
+                continue;
+            }
+
+            buffer.resize(buffer.size() + chunk, '\0');
+            size -= chunk;
+        }
+    }
+
+    /** @returns false if any write failed. */
+    bool flush()
+    {
+        if (!failed && !buffer.empty()) {
+            failed = !file.write(&buffer[0], buffer.size(), NULL, 0);
+        }
+
+        buffer.clear();
+        return !failed;
+    }
+
+private:
+    OutputFile& file;
+    std::vector<char> buffer;
+    size_t capacity;
+    bool failed;
+};
+
+static void appendUint32(std::vector<char>& buffer, uint32_t value)
+{
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+}
+
+static void appendString(std::vector<char>& buffer, const std::string& string)
+{
+    // Null terminator is a part of stored string
+    buffer.insert(buffer.end(), string.c_str(), string.c_str() + string.size() + 1);
+}
+
+static MqrcHeader recordHeader(RecordId recordId, uint32_t size, uint32_t sizeAllocated)
+{
+    MqrcHeader header;
+    memcpy(&header.signature, mqrcSignature, sizeof(mqrcSignature));
+    header.unknown = 0;
+    header.recordId = recordId;
+    header.size = size;
+    header.sizeAllocated = sizeAllocated;
+    header.used = 1;
+    header.unknown2 = 0;
+
+    return header;
+}
+
+FfWriter::FfWriter(const FfWriterOptions& options)
+    : options(options)
+    , indexTotal(0)
+{
+}
+
+bool FfWriter::addRecord(RecordId recordId,
+                         const std::string& name,
+                         const char* data,
+                         uint32_t size)
+{
+    if (recordId == TableOfContents || recordId == NameList
+        || recordId == std::numeric_limits<RecordId>::max()) {
+        return false;
+    }
+
+    if (name.size() >= nameListNameSize || recordIds.count(recordId)) {
+        return false;
+    }
+
+    if (!name.empty() && !recordNames.insert(name, recordId)) {
+        return false;
+    }
+
+    recordIds.insert(recordId);
+
+    Record record;
+    record.recordId = recordId;
+    record.name = name;
+    record.data = data;
+    record.size = size;
+
+    records.push_back(record);
+    return true;
+}
+
+bool FfWriter::addRecord(RecordId recordId,
+                         const std::string& name,
+                         const std::vector<char>& contents)
+{
+    return addRecord(recordId, name, contents.empty() ? NULL : &contents[0],
+                     static_cast<uint32_t>(contents.size()));
+}
+
+PackedImageInfo FfWriter::addPackedImage(const PackedImage& packedImage)
+{
+    const size_t imageOffset = imagesContents.size();
+
+    if (packedImage.palette) {
+        imagesContents.insert(imagesContents.end(), packedImage.palette,
+                              packedImage.palette + paletteSize);
+    } else {
+        imagesContents.resize(imagesContents.size() + paletteSize, '\0');
+    }
+
+    appendUint32(imagesContents, packedImage.frames.count);
+
+    for (size_t i = 0; i < packedImage.frames.size(); ++i) {
+        const ImageFrame& frame = packedImage.frames[i];
+
+        appendString(imagesContents, frame.name ? frame.name : "");
+        appendUint32(imagesContents, frame.parts.count);
+        appendUint32(imagesContents, frame.width);
+        appendUint32(imagesContents, frame.height);
+
+        for (size_t j = 0; j < frame.parts.size(); ++j) {
+            const ImagePart& part = frame.parts[j];
+
+            // Position in final image comes first, followed by position in shuffled image
+            appendUint32(imagesContents, part.targetX);
+            appendUint32(imagesContents, part.targetY);
+            appendUint32(imagesContents, part.sourceX);
+            appendUint32(imagesContents, part.sourceY);
+            appendUint32(imagesContents, part.width);
+            appendUint32(imagesContents, part.height);
+        }
+    }
+
+    return PackedImageInfo(static_cast<RelativeOffset>(imageOffset),
+                           static_cast<PackedImageSize>(imagesContents.size() - imageOffset));
+}
+
+void FfWriter::addImageIndex(RecordId recordId,
+                             const std::string& name,
+                             const PackedImageInfo& packedInfo)
+{
+    appendUint32(indexEntries, recordId);
+    appendString(indexEntries, name);
+    appendUint32(indexEntries, packedInfo.first);
+    appendUint32(indexEntries, packedInfo.second);
+
+    ++indexTotal;
+}
+
+void FfWriter::addAnimationIndex(const std::string& name, const PackedImageInfo& packedInfo)
+{
+    // Animation entries are marked with invalid id
+    addImageIndex(std::numeric_limits<RecordId>::max(), name, packedInfo);
+}
+
+bool FfWriter::write(const std::string& ffFilePath) const
+{
+    std::vector<Record> layout(records);
+
+    std::vector<char> indexContents;
+    const bool hasImages = indexTotal || !imagesContents.empty();
+
+    if (hasImages) {
+        if (recordNames.find(indexOptRecordName) || recordNames.find(imagesOptRecordName)) {
+            // Generated records would duplicate explicitly added ones
+            return false;
+        }
+
+        const RecordId lastId = recordIds.empty() ? static_cast<RecordId>(NameList)
+                                                  : *recordIds.rbegin();
+        if (lastId > std::numeric_limits<RecordId>::max() - 3) {
+            return false;
+        }
+
+        appendUint32(indexContents, indexTotal);
+        indexContents.insert(indexContents.end(), indexEntries.begin(), indexEntries.end());
+
+        Record index = {lastId + 1, indexOptRecordName, &indexContents[0],
+                        static_cast<uint32_t>(indexContents.size())};
+        Record images = {lastId + 2, imagesOptRecordName,
+                         imagesContents.empty() ? NULL : &imagesContents[0],
+                         static_cast<uint32_t>(imagesContents.size())};
+
+        layout.push_back(index);
+        layout.push_back(images);
+    }
+
+    std::vector<char> namesList;
+    appendUint32(namesList, 0);
+
+    uint32_t namesTotal = 0;
+    for (size_t i = 0; i < layout.size(); ++i) {
+        if (layout[i].name.empty()) {
+            continue;
+        }
+
+        char name[nameListNameSize] = {0};
+        memcpy(name, layout[i].name.c_str(), layout[i].name.size());
+
+        namesList.insert(namesList.end(), name, name + sizeof(name));
+        appendUint32(namesList, layout[i].recordId);
+        ++namesTotal;
+    }
+
+    memcpy(&namesList[0], &namesTotal, sizeof(namesTotal));
+
+    Record namesRecord = {NameList, std::string(), &namesList[0],
+                          static_cast<uint32_t>(namesList.size())};
+    layout.push_back(namesRecord);
+
+    // ToC lists itself too, its contents are known once every record is placed
+    const uint32_t recordsTotal = static_cast<uint32_t>(layout.size() + 1);
+    std::vector<char> tocContents(sizeof(uint32_t) + recordsTotal * sizeof(TocRecord));
+
+    Record tocRecord = {TableOfContents, std::string(), &tocContents[0],
+                        static_cast<uint32_t>(tocContents.size())};
+    layout.push_back(tocRecord);
+
+    std::vector<TocRecord> toc(layout.size());
+    uint64_t offset = firstRecordOffset;
+
+    for (size_t i = 0; i < layout.size(); ++i) {
+        TocRecord& entry = toc[i];
+        entry.recordId = layout[i].recordId;
+        entry.size = layout[i].size;
+        entry.offset = static_cast<uint32_t>(offset);
+
+        const uint64_t sizeAllocated = static_cast<uint64_t>(layout[i].size) + options.recordSlack;
+        if (sizeAllocated > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+
+        entry.sizeAllocated = static_cast<uint32_t>(sizeAllocated);
+        offset += sizeof(MqrcHeader) + sizeAllocated;
+
+        if (offset > std::numeric_limits<uint32_t>::max()) {
+            // Offsets are 32-bit
+            return false;
+        }
+    }
+
+    memcpy(&tocContents[0], &recordsTotal, sizeof(recordsTotal));
+    memcpy(&tocContents[sizeof(uint32_t)], &toc[0], toc.size() * sizeof(TocRecord));
+
+    const uint32_t tocOffset = toc.back().offset + sizeof(MqrcHeader);
+
+    OutputFile file;
+    if (!file.open(ffFilePath, true)) {
+        return false;
+    }
+
+    BufferedOutput output(file, options.bufferSize);
+
+    MqdbHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(&header.signature, mqdbSignature, sizeof(mqdbSignature));
+    header.version = mqdbFileVersion;
+
+    output.append(&header, sizeof(header));
+    output.append(&tocOffset, sizeof(tocOffset));
+
+    for (size_t i = 0; i < layout.size(); ++i) {
+        const MqrcHeader recordHeaderData = recordHeader(toc[i].recordId, toc[i].size,
+                                                         toc[i].sizeAllocated);
+
+        output.append(&recordHeaderData, sizeof(recordHeaderData));
+        output.append(layout[i].data, layout[i].size);
+        output.appendZeros(toc[i].sizeAllocated - toc[i].size);
+    }
+
+    const bool flushed = output.flush();
+    return file.close() && flushed;
+}
+
+bool FfWriter::patchRecord(const std::string& ffFilePath,
+                           const std::string& recordName,
+                           const char* data,
+                           uint32_t size)
+{
+    TocRecord record;
+
+    {
+        // Only names are needed, reader must be closed before file is changed
+        const FfReader reader(ffFilePath, false);
+
+        const TocRecord* found = reader.findTocRecord(recordName);
+        if (!found) {
+            return false;
+        }
+
+        record = *found;
+    }
+
+    RandomAccessFile input;
+    if (!input.open(ffFilePath)) {
+        return false;
+    }
+
+    // Reader keeps ToC sorted, find position of the entry inside file
+    uint32_t tocOffset = 0;
+    uint32_t entriesTotal = 0;
+    if (!input.read(sizeof(MqdbHeader), &tocOffset, sizeof(tocOffset))
+        || !input.read(tocOffset, &entriesTotal, sizeof(entriesTotal))) {
+        return false;
+    }
+
+    std::vector<TocRecord> toc(entriesTotal);
+    if (entriesTotal && !input.read(tocOffset + sizeof(uint32_t), &toc[0],
+                                    entriesTotal * sizeof(TocRecord))) {
+        return false;
+    }
+
+    size_t entryIndex = 0;
+    while (entryIndex < toc.size() && toc[entryIndex].recordId != record.recordId) {
+        ++entryIndex;
+    }
+
+    if (entryIndex == toc.size()) {
+        return false;
+    }
+
+    MqrcHeader header;
+    if (!input.read(record.offset, &header, sizeof(header))) {
+        return false;
+    }
+
+    const uint64_t fileSize = input.size();
+    input.close();
+
+    OutputFile file;
+    if (!file.open(ffFilePath, false)) {
+        return false;
+    }
+
+    const uint64_t entryOffset = tocOffset + sizeof(uint32_t) + entryIndex * sizeof(TocRecord);
+    TocRecord& entry = toc[entryIndex];
+    bool patched = false;
+
+    if (size <= record.sizeAllocated) {
+        // Contents fit into allocation, write them first, then publish new size
+        header.size = size;
+        entry.size = size;
+
+        patched = file.writeAt(record.offset + sizeof(MqrcHeader), data, size)
+                  && file.writeAt(record.offset, &header, sizeof(header))
+                  && file.writeAt(entryOffset, &entry, sizeof(entry));
+    } else {
+        if (fileSize + sizeof(MqrcHeader) + size > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+
+        // Write new copy at the end, point ToC to it, then retire the old one
+        const MqrcHeader newHeader = recordHeader(record.recordId, size, size);
+
+        entry.offset = static_cast<uint32_t>(fileSize);
+        entry.size = size;
+        entry.sizeAllocated = size;
+        header.used = 0;
+
+        patched = file.writeAt(fileSize, &newHeader, sizeof(newHeader))
+                  && file.writeAt(fileSize + sizeof(newHeader), data, size)
+                  && file.writeAt(entryOffset, &entry, sizeof(entry))
+                  && file.writeAt(record.offset, &header, sizeof(header));
+    }
+
+    const bool closed = file.close();
+
+    // ToC entry always changes and parsed records may too, sidecar no longer describes the file.
+    // Also removed after failed write, file may be partially patched then
+    remove(indexSidecarPath(ffFilePath).c_str());
+
+    return closed && patched;
+}
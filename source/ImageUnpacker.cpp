@@ -0,0 +1,270 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ImageUnpacker.hpp>
+#include <string.h>
+
+/*
+ * AVX2 kernel is compiled whenever x86 compiler allows it and is picked at run time
+ * when processor supports it. Building with -mavx2 or /arch:AVX2 skips the check.
+ * FFREADER_NO_SIMD leaves only the portable kernel.
+ */
+#if defined(FFREADER_NO_SIMD)
+#elif defined(__AVX2__)
+#define FFREADER_AVX2_ALWAYS
+#define FFREADER_AVX2_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define FFREADER_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define FFREADER_AVX2_TARGET
+#endif
+
+#ifdef FFREADER_AVX2_TARGET
+#include <immintrin.h>
+
+#if defined(_MSC_VER) && !defined(FFREADER_AVX2_ALWAYS)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+#ifndef PF_AVX2_INSTRUCTIONS_AVAILABLE
+#define PF_AVX2_INSTRUCTIONS_AVAILABLE 40
+#endif
+#endif
+#endif
+
+/** Palette contents start after 11-byte header. */
+static const size_t paletteHeaderSize = 11;
+static const size_t paletteColorsTotal = 256;
+
+/** Checks that area fits inside image without overflowing 32-bit coordinates. */
+static inline bool areaFits(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                            uint32_t imageWidth, uint32_t imageHeight)
+{
+    return x <= imageWidth && width <= imageWidth - x
+        && y <= imageHeight && height <= imageHeight - y;
+}
+
+bool unpackFrame(const ImageFrame& frame,
+                 const SourceImage& source,
+                 char* targetPixels,
+                 size_t targetPitch)
+{
+    if (!source.pixels || !targetPixels) {
+        return false;
+    }
+
+    if (source.bytesPerPixel != 1 && source.bytesPerPixel != 4) {
+        return false;
+    }
+
+    const size_t bytesPerPixel = source.bytesPerPixel;
+    const size_t pitch = targetPitch ? targetPitch : frame.width * bytesPerPixel;
+
+    // Validate everything first, so bad parts never leave frame half-copied
+    for (size_t i = 0; i < frame.parts.size(); ++i) {
+        const ImagePart& part = frame.parts[i];
+
+        if (!areaFits(part.sourceX, part.sourceY, part.width, part.height,
+                      source.width, source.height)
+            || !areaFits(part.targetX, part.targetY, part.width, part.height,
+                         frame.width, frame.height)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < frame.parts.size(); ++i) {
+        const ImagePart& part = frame.parts[i];
+
+        const size_t rowSize = part.width * bytesPerPixel;
+        if (!rowSize) {
+            continue;
+        }
+
+        const char* sourceRow = source.pixels + part.sourceY * source.pitch
+                                + part.sourceX * bytesPerPixel;
+        char* targetRow = targetPixels + part.targetY * pitch + part.targetX * bytesPerPixel;
+
+        if (rowSize == source.pitch && rowSize == pitch) {
+            // Part spans whole rows of both images, copy it at once
+            memcpy(targetRow, sourceRow, rowSize * part.height);
+            continue;
+        }
+
+        for (uint32_t y = 0; y < part.height; ++y) {
+            memcpy(targetRow, sourceRow, rowSize);
+
+            sourceRow += source.pitch;
+            targetRow += pitch;
+        }
+    }
+
+    return true;
+}
+
+bool unpackFrame(const ImageFrame& frame,
+                 const char* sourcePixels,
+                 uint32_t sourceWidth,
+                 uint32_t sourceHeight,
+                 uint32_t bytesPerPixel,
+                 char* targetPixels,
+                 size_t targetPitch)
+{
+    SourceImage source;
+    source.pixels = sourcePixels;
+    source.width = sourceWidth;
+    source.height = sourceHeight;
+    source.pitch = static_cast<size_t>(sourceWidth) * bytesPerPixel;
+    source.bytesPerPixel = bytesPerPixel;
+
+    return unpackFrame(frame, source, targetPixels, targetPitch);
+}
+
+bool decodePalette(const char* palette,
+                   PaletteTable& table,
+                   PixelOrder order,
+                   int transparentIndex)
+{
+    if (!palette) {
+        return false;
+    }
+
+    const unsigned char* colors = reinterpret_cast<const unsigned char*>(palette)
+                                  + paletteHeaderSize;
+
+    for (size_t i = 0; i < paletteColorsTotal; ++i) {
+        const unsigned char* color = &colors[i * 4];
+        const unsigned char alpha = static_cast<int>(i) == transparentIndex ? 0 : 0xff;
+
+        unsigned char pixel[4];
+        if (order == RgbaOrder) {
+            pixel[0] = color[2];
+            pixel[1] = color[1];
+            pixel[2] = color[0];
+        } else {
+            pixel[0] = color[0];
+            pixel[1] = color[1];
+            pixel[2] = color[2];
+        }
+
+        pixel[3] = alpha;
+
+        // Byte order in memory matters, not the value, so it works on any endianness
+        memcpy(&table.colors[i], pixel, sizeof(pixel));
+    }
+
+    return true;
+}
+
+#ifdef FFREADER_AVX2_TARGET
+/** Checks that processor and operating system support AVX2. */
+static bool detectAvx2()
+{
+#if defined(FFREADER_AVX2_ALWAYS)
+    return true;
+#elif defined(_MSC_VER)
+    return IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE) != 0;
+#else
+    // May run before libgcc initialized processor model from its own constructor
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+/**
+ * Checked once at load time.
+ * Callers from static constructors of other files may see false and use portable kernel.
+ */
+static const bool avx2Supported = detectAvx2();
+
+/**
+ * Expands whole groups of 8 pixels with AVX2 gathers.
+ * @returns number of pixels expanded.
+ */
+FFREADER_AVX2_TARGET
+static size_t expandPaletteAvx2(const unsigned char* source,
+                                size_t pixelsTotal,
+                                const uint32_t* colors,
+                                char* target)
+{
+    const int* gatherBase = reinterpret_cast<const int*>(colors);
+    size_t i = 0;
+
+    for (; i + 8 <= pixelsTotal; i += 8) {
+        const __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + i));
+        const __m256i offsets = _mm256_cvtepu8_epi32(packed);
+        const __m256i pixels = _mm256_i32gather_epi32(gatherBase, offsets, 4);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i * 4), pixels);
+    }
+
+    return i;
+}
+#endif
+
+void expandPalette(const char* indices, size_t pixelsTotal, const PaletteTable& table, char* target)
+{
+    const unsigned char* source = reinterpret_cast<const unsigned char*>(indices);
+    const uint32_t* colors = table.colors;
+
+    size_t i = 0;
+
+#ifdef FFREADER_AVX2_TARGET
+    if (avx2Supported) {
+        i = expandPaletteAvx2(source, pixelsTotal, colors, target);
+    }
+#endif
+
+    for (; i + 4 <= pixelsTotal; i += 4) {
+        uint32_t pixels[4];
+        pixels[0] = colors[source[i]];
+        pixels[1] = colors[source[i + 1]];
+        pixels[2] = colors[source[i + 2]];
+        pixels[3] = colors[source[i + 3]];
+
+        memcpy(target + i * 4, pixels, sizeof(pixels));
+    }
+
+    for (; i < pixelsTotal; ++i) {
+        memcpy(target + i * 4, &colors[source[i]], sizeof(uint32_t));
+    }
+}
+
+void expandPalette(const char* indices,
+                   uint32_t width,
+                   uint32_t height,
+                   const PaletteTable& table,
+                   char* target,
+                   size_t sourcePitch,
+                   size_t targetPitch)
+{
+    const size_t sourceRow = sourcePitch ? sourcePitch : width;
+    const size_t targetRow = targetPitch ? targetPitch : static_cast<size_t>(width) * 4;
+
+    if (sourceRow == width && targetRow == static_cast<size_t>(width) * 4) {
+        // Rows are tightly packed, expand everything at once
+        expandPalette(indices, static_cast<size_t>(width) * height, table, target);
+        return;
+    }
+
+    for (uint32_t y = 0; y < height; ++y) {
+        expandPalette(indices + y * sourceRow, width, table, target + y * targetRow);
+    }
+}
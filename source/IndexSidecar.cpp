@@ -0,0 +1,596 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <IndexSidecar.hpp>
+#include <RandomAccessFile.hpp>
+#include <ReplacingFile.hpp>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#define SIDECARSIGNATURE(a, b, c, d)                                                               \
+    ((static_cast<uint32_t>(d) << 24) | (static_cast<uint32_t>(c) << 16)                           \
+     | (static_cast<uint32_t>(b) << 8) | static_cast<uint32_t>(a))
+
+static const uint32_t sidecarSignature = SIDECARSIGNATURE('F', 'F', 'I', 'X');
+/** Increment whenever layout of any section changes. */
+static const uint32_t sidecarVersion = 3;
+
+static const char imagesOptRecordName[] = "-IMAGES.OPT";
+static const uint32_t paletteSize = 11 + 1024;
+
+/** Sidecar contains '-IMAGES.OPT' frame tables. */
+static const uint32_t hasImagesFlag = 1;
+
+struct SidecarHeader
+{
+    uint32_t signature;
+    uint32_t version;
+    uint64_t ffFileSize;    /**< Size of .ff file sidecar was written for. */
+    /**
+     * Modification time of .ff file, in nanoseconds.
+     * On Windows in 100-nanosecond intervals, only compared for equality.
+     */
+    int64_t ffModified;
+    uint32_t flags;
+    uint32_t payloadSize;   /**< Number of bytes following the header. */
+    uint32_t checksum;      /**< 32-bit FNV-1a of payload. */
+    uint32_t tocChecksum;   /**< 32-bit FNV-1a of ToC as stored in .ff file. */
+};
+
+/** '-INDEX.OPT' image entry. */
+struct SidecarImageEntry
+{
+    uint32_t recordId;
+    uint32_t nameOffset; /**< Offset of null terminated name in index names section. */
+    uint32_t offset;     /**< Relative offset of packed image. */
+    uint32_t size;
+};
+
+/** '-INDEX.OPT' animation entry. */
+struct SidecarAnimationEntry
+{
+    uint32_t nameOffset;
+    uint32_t offset;
+    uint32_t size;
+};
+
+/** Packed image of '-IMAGES.OPT', its frames follow the frames of previous image. */
+struct SidecarImage
+{
+    uint32_t offset;      /**< Relative offset of packed image and its palette. */
+    uint32_t framesTotal;
+};
+
+/** Packed image frame, its parts follow the parts of previous frame. */
+struct SidecarFrame
+{
+    uint32_t nameOffset; /**< Offset of null terminated name inside '-IMAGES.OPT' contents. */
+    uint32_t partsTotal;
+    uint32_t width;
+    uint32_t height;
+};
+
+static bool readFileStamp(const std::string& filePath, uint64_t& size, int64_t& modified)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExA(filePath.c_str(), GetFileExInfoStandard, &info)) {
+        return false;
+    }
+
+    size = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    modified = static_cast<int64_t>(
+        (static_cast<uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32)
+        | info.ftLastWriteTime.dwLowDateTime);
+#else
+    struct stat info;
+    if (stat(filePath.c_str(), &info)) {
+        return false;
+    }
+
+#ifdef __APPLE__
+    const struct timespec& time = info.st_mtimespec;
+#else
+    const struct timespec& time = info.st_mtim;
+#endif
+
+    size = static_cast<uint64_t>(info.st_size);
+    modified = static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+#endif
+
+    return true;
+}
+
+static uint32_t checksum(const char* data, size_t size)
+{
+    uint32_t value = 2166136261u;
+
+    for (size_t i = 0; i < size; ++i) {
+        value ^= static_cast<unsigned char>(data[i]);
+        value *= 16777619u;
+    }
+
+    return value;
+}
+
+/**
+ * Computes checksum of ToC as stored in .ff file, including number of records.
+ * Records changed in place keep file size and may keep modification time, their ToC does not.
+ * @returns false if ToC could not be read.
+ */
+static bool readTocChecksum(const std::string& ffFilePath, uint32_t& value)
+{
+    RandomAccessFile file;
+    if (!file.open(ffFilePath)) {
+        return false;
+    }
+
+    uint32_t tocOffset = 0;
+    uint32_t entriesTotal = 0;
+
+    if (!file.read(sizeof(MqdbHeader), &tocOffset, sizeof(tocOffset))
+        || !file.read(tocOffset, &entriesTotal, sizeof(entriesTotal))
+        || (file.size() - tocOffset - sizeof(entriesTotal)) / sizeof(TocRecord) < entriesTotal) {
+        return false;
+    }
+
+    std::vector<char> toc(sizeof(entriesTotal) + entriesTotal * sizeof(TocRecord));
+    memcpy(&toc[0], &entriesTotal, sizeof(entriesTotal));
+
+    if (entriesTotal
+        && !file.read(tocOffset + sizeof(entriesTotal), &toc[sizeof(entriesTotal)],
+                      toc.size() - sizeof(entriesTotal))) {
+        return false;
+    }
+
+    value = checksum(&toc[0], toc.size());
+    return true;
+}
+
+/** Appends 4-byte count followed by array elements, padded to 4 bytes. */
+template <typename T>
+static void appendArray(std::vector<char>& output, const std::vector<T>& array)
+{
+    const uint32_t count = static_cast<uint32_t>(array.size());
+    const char* countBytes = reinterpret_cast<const char*>(&count);
+    output.insert(output.end(), countBytes, countBytes + sizeof(count));
+
+    if (!array.empty()) {
+        const char* bytes = reinterpret_cast<const char*>(&array[0]);
+        output.insert(output.end(), bytes, bytes + array.size() * sizeof(T));
+    }
+
+    output.resize((output.size() + 3) & ~static_cast<size_t>(3), '\0');
+}
+
+/**
+ * Reads array written by appendArray at specified offset.
+ * Adjusts offset after reading.
+ * @returns false if array does not fit into data.
+ */
+template <typename T>
+static bool readArray(const char* data, size_t size, size_t& byteOffset, std::vector<T>& array)
+{
+    if (byteOffset > size || size - byteOffset < sizeof(uint32_t)) {
+        return false;
+    }
+
+    uint32_t count = 0;
+    memcpy(&count, data + byteOffset, sizeof(count));
+    byteOffset += sizeof(count);
+
+    if ((size - byteOffset) / sizeof(T) < count) {
+        return false;
+    }
+
+    array.resize(count);
+    if (count) {
+        memcpy(&array[0], data + byteOffset, count * sizeof(T));
+    }
+
+    byteOffset = (byteOffset + count * sizeof(T) + 3) & ~static_cast<size_t>(3);
+    return byteOffset <= size;
+}
+
+/** Adds null terminated name to names section. @returns offset of the name. */
+static uint32_t appendName(std::vector<char>& names, const char* name)
+{
+    const uint32_t offset = static_cast<uint32_t>(names.size());
+    names.insert(names.end(), name, name + strlen(name) + 1);
+
+    return offset;
+}
+
+static bool tocRecordLess(const TocRecord& a, const TocRecord& b)
+{
+    return a.recordId < b.recordId;
+}
+
+std::string indexSidecarPath(const std::string& ffFilePath)
+{
+    const size_t length = ffFilePath.size();
+
+    if (length > 3 && ffFilePath[length - 3] == '.'
+        && (ffFilePath[length - 2] == 'f' || ffFilePath[length - 2] == 'F')
+        && (ffFilePath[length - 1] == 'f' || ffFilePath[length - 1] == 'F')) {
+        return ffFilePath + "idx";
+    }
+
+    return ffFilePath + ".ffidx";
+}
+
+bool writeIndexSidecar(const FfReader& reader, const std::string& sidecarPath)
+{
+    SidecarHeader header;
+    memset(&header, 0, sizeof(header));
+    header.signature = sidecarSignature;
+    header.version = sidecarVersion;
+
+    if (!readFileStamp(reader.ffFilePath, header.ffFileSize, header.ffModified)
+        || !readTocChecksum(reader.ffFilePath, header.tocChecksum)) {
+        return false;
+    }
+
+    std::vector<char> payload;
+    appendArray(payload, reader.tableOfContents);
+    reader.recordNames.save(payload);
+
+    const ImageIndices& images = reader.indexData.images;
+    const AnimationIndices& animations = reader.indexData.animations;
+
+    std::vector<char> indexNames;
+    std::vector<SidecarImageEntry> imageEntries(images.ids.size());
+    std::vector<SidecarAnimationEntry> animationEntries(animations.names.size());
+
+    for (size_t i = 0; i < imageEntries.size(); ++i) {
+        SidecarImageEntry& entry = imageEntries[i];
+        entry.recordId = images.ids[i];
+        entry.nameOffset = appendName(indexNames, images.names[i]);
+        entry.offset = images.packedInfo[i].first;
+        entry.size = images.packedInfo[i].second;
+    }
+
+    for (size_t i = 0; i < animationEntries.size(); ++i) {
+        SidecarAnimationEntry& entry = animationEntries[i];
+        entry.nameOffset = appendName(indexNames, animations.names[i]);
+        entry.offset = animations.packedInfo[i].first;
+        entry.size = animations.packedInfo[i].second;
+    }
+
+    appendArray(payload, indexNames);
+    appendArray(payload, imageEntries);
+    appendArray(payload, animationEntries);
+    reader.imageIndexNames.save(payload);
+    reader.animationIndexNames.save(payload);
+
+    if (reader.imagesRecord.data) {
+        header.flags |= hasImagesFlag;
+
+        std::vector<SidecarImage> packedImages(reader.packedImageOffsets.size());
+        std::vector<SidecarFrame> frames;
+        std::vector<ImagePart> parts;
+
+        for (size_t i = 0; i < packedImages.size(); ++i) {
+            // Lazy readers do not keep all images decoded, copy them one by one
+            PackedImageCopy copy;
+            if (!reader.getPackedImage(reader.packedImageOffsets[i], copy)) {
+                return false;
+            }
+
+            packedImages[i].offset = reader.packedImageOffsets[i];
+            packedImages[i].framesTotal = copy.image.frames.count;
+
+            for (size_t j = 0; j < copy.image.frames.size(); ++j) {
+                const ImageFrame& frame = copy.image.frames[j];
+
+                SidecarFrame sidecarFrame;
+                sidecarFrame.nameOffset = static_cast<uint32_t>(frame.name
+                                                                - reader.imagesRecord.data);
+                sidecarFrame.partsTotal = frame.parts.count;
+                sidecarFrame.width = frame.width;
+                sidecarFrame.height = frame.height;
+
+                frames.push_back(sidecarFrame);
+                parts.insert(parts.end(), frame.parts.begin(), frame.parts.end());
+            }
+        }
+
+        appendArray(payload, packedImages);
+        appendArray(payload, frames);
+        appendArray(payload, parts);
+    }
+
+    header.payloadSize = static_cast<uint32_t>(payload.size());
+    header.checksum = checksum(payload.empty() ? NULL : &payload[0], payload.size());
+
+    // Readers and other processes opening the same archive never see partially written sidecar
+    ReplacingFile output;
+    FILE* file = output.open(sidecarPath);
+    if (!file) {
+        return false;
+    }
+
+    const bool written = fwrite(&header, sizeof(header), 1, file) == 1
+                         && (payload.empty() || fwrite(&payload[0], payload.size(), 1, file) == 1);
+
+    return written && output.commit();
+}
+
+bool loadIndexSidecar(FfReader& reader, const std::string& sidecarPath, bool readImageData)
+{
+    uint64_t ffFileSize = 0;
+    int64_t ffModified = 0;
+    if (!readFileStamp(reader.ffFilePath, ffFileSize, ffModified)) {
+        return false;
+    }
+
+    RandomAccessFile file;
+    if (!file.open(sidecarPath)) {
+        return false;
+    }
+
+    SidecarHeader header;
+    if (!file.read(0, &header, sizeof(header))) {
+        return false;
+    }
+
+    if (header.signature != sidecarSignature || header.version != sidecarVersion
+        || header.ffFileSize != ffFileSize || header.ffModified != ffModified
+        || file.size() != sizeof(header) + static_cast<uint64_t>(header.payloadSize)) {
+        // Stale or foreign sidecar
+        return false;
+    }
+
+    if (readImageData && !(header.flags & hasImagesFlag)) {
+        return false;
+    }
+
+    // Records patched in place keep file size and may keep modification time
+    uint32_t tocChecksum = 0;
+    if (!readTocChecksum(reader.ffFilePath, tocChecksum) || tocChecksum != header.tocChecksum) {
+        return false;
+    }
+
+    std::vector<char> payload(header.payloadSize);
+    if (payload.empty() || !file.read(sizeof(header), &payload[0], payload.size())
+        || checksum(&payload[0], payload.size()) != header.checksum) {
+        return false;
+    }
+
+    const char* data = &payload[0];
+    const size_t size = payload.size();
+    size_t byteOffset = 0;
+
+    std::vector<TocRecord> tableOfContents;
+    NameIndex recordNames;
+    std::vector<char> indexNames;
+    std::vector<SidecarImageEntry> imageEntries;
+    std::vector<SidecarAnimationEntry> animationEntries;
+    NameIndex imageIndexNames;
+    NameIndex animationIndexNames;
+
+    if (!readArray(data, size, byteOffset, tableOfContents)
+        || !recordNames.load(data, size, byteOffset)
+        || !readArray(data, size, byteOffset, indexNames)
+        || !readArray(data, size, byteOffset, imageEntries)
+        || !readArray(data, size, byteOffset, animationEntries)
+        || !imageIndexNames.load(data, size, byteOffset)
+        || !animationIndexNames.load(data, size, byteOffset)) {
+        return false;
+    }
+
+    for (size_t i = 1; i < tableOfContents.size(); ++i) {
+        if (!tocRecordLess(tableOfContents[i - 1], tableOfContents[i])) {
+            return false;
+        }
+    }
+
+    // Every name must be terminated inside names section
+    if (!indexNames.empty() && indexNames.back() != '\0') {
+        return false;
+    }
+
+    // Name tables must point at existing entries
+    for (size_t i = 0; i < imageIndexNames.size(); ++i) {
+        if (imageIndexNames.value(i) >= imageEntries.size()) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < animationIndexNames.size(); ++i) {
+        if (animationIndexNames.value(i) >= animationEntries.size()) {
+            return false;
+        }
+    }
+
+    IndexData indexData;
+    ImageIndices& images = indexData.images;
+    AnimationIndices& animations = indexData.animations;
+
+    images.ids.reserve(imageEntries.size());
+    images.names.reserve(imageEntries.size());
+    images.packedInfo.reserve(imageEntries.size());
+
+    for (size_t i = 0; i < imageEntries.size(); ++i) {
+        const SidecarImageEntry& entry = imageEntries[i];
+        if (entry.nameOffset >= indexNames.size()) {
+            return false;
+        }
+
+        images.ids.push_back(entry.recordId);
+        images.names.push_back(&indexNames[entry.nameOffset]);
+        images.packedInfo.push_back(PackedImageInfo(entry.offset, entry.size));
+    }
+
+    animations.names.reserve(animationEntries.size());
+    animations.packedInfo.reserve(animationEntries.size());
+
+    for (size_t i = 0; i < animationEntries.size(); ++i) {
+        const SidecarAnimationEntry& entry = animationEntries[i];
+        if (entry.nameOffset >= indexNames.size()) {
+            return false;
+        }
+
+        animations.names.push_back(&indexNames[entry.nameOffset]);
+        animations.packedInfo.push_back(PackedImageInfo(entry.offset, entry.size));
+    }
+
+    RecordView imagesRecord = {NULL, 0};
+    std::vector<char> imagesContents;
+    std::vector<RelativeOffset> packedImageOffsets;
+    std::vector<PackedImage> packedImages;
+    std::vector<ImageFrame> imageFrames;
+    std::vector<ImagePart> imageParts;
+
+    if (readImageData) {
+        std::vector<SidecarImage> sidecarImages;
+        std::vector<SidecarFrame> sidecarFrames;
+
+        if (!readArray(data, size, byteOffset, sidecarImages)
+            || !readArray(data, size, byteOffset, sidecarFrames)
+            || !readArray(data, size, byteOffset, imageParts)) {
+            return false;
+        }
+
+        const RecordId* imagesId = recordNames.find(imagesOptRecordName);
+        const TocRecord* record = NULL;
+
+        if (imagesId) {
+            TocRecord key;
+            key.recordId = *imagesId;
+
+            std::vector<TocRecord>::const_iterator it = std::lower_bound(
+                tableOfContents.begin(), tableOfContents.end(), key, tocRecordLess);
+
+            if (it != tableOfContents.end() && it->recordId == *imagesId) {
+                record = &*it;
+            }
+        }
+
+        if (record) {
+            // Frame names and palettes are used in place, contents are needed anyway
+            imagesRecord = reader.getRecordView(*record);
+
+            if (!imagesRecord.data) {
+                if (!reader.getRecordData(*record, imagesContents)) {
+                    return false;
+                }
+
+                imagesRecord.data = imagesContents.empty() ? NULL : &imagesContents[0];
+                imagesRecord.size = static_cast<uint32_t>(imagesContents.size());
+            }
+        }
+
+        if (!imagesRecord.data && !sidecarImages.empty()) {
+            return false;
+        }
+
+        size_t framesTotal = 0;
+        packedImageOffsets.reserve(sidecarImages.size());
+
+        for (size_t i = 0; i < sidecarImages.size(); ++i) {
+            const SidecarImage& image = sidecarImages[i];
+
+            if (image.offset >= imagesRecord.size || imagesRecord.size - image.offset < paletteSize
+                || (i && image.offset <= packedImageOffsets.back())) {
+                return false;
+            }
+
+            packedImageOffsets.push_back(image.offset);
+            framesTotal += image.framesTotal;
+        }
+
+        size_t partsTotal = 0;
+        for (size_t i = 0; i < sidecarFrames.size(); ++i) {
+            if (sidecarFrames[i].nameOffset >= imagesRecord.size) {
+                return false;
+            }
+
+            partsTotal += sidecarFrames[i].partsTotal;
+        }
+
+        if (framesTotal != sidecarFrames.size() || partsTotal != imageParts.size()) {
+            return false;
+        }
+
+        if (!reader.lazyImages) {
+            // Arrays are complete, views can point into them
+            imageFrames.reserve(sidecarFrames.size());
+
+            size_t partIndex = 0;
+            for (size_t i = 0; i < sidecarFrames.size(); ++i) {
+                const SidecarFrame& sidecarFrame = sidecarFrames[i];
+
+                ImageFrame frame(imagesRecord.data + sidecarFrame.nameOffset, sidecarFrame.width,
+                                 sidecarFrame.height);
+                frame.parts.data = sidecarFrame.partsTotal ? &imageParts[partIndex] : NULL;
+                frame.parts.count = sidecarFrame.partsTotal;
+                partIndex += sidecarFrame.partsTotal;
+
+                imageFrames.push_back(frame);
+            }
+
+            packedImages.resize(sidecarImages.size());
+
+            size_t frameIndex = 0;
+            for (size_t i = 0; i < sidecarImages.size(); ++i) {
+                PackedImage& packedImage = packedImages[i];
+                packedImage.palette = imagesRecord.data + sidecarImages[i].offset;
+                packedImage.frames.data = sidecarImages[i].framesTotal ? &imageFrames[frameIndex]
+                                                                       : NULL;
+                packedImage.frames.count = sidecarImages[i].framesTotal;
+                frameIndex += sidecarImages[i].framesTotal;
+            }
+        } else {
+            // Lazy readers decode images on demand
+            imageParts.clear();
+        }
+    }
+
+    reader.tableOfContents.swap(tableOfContents);
+    reader.recordNames.swap(recordNames);
+    reader.indexData.images.ids.swap(images.ids);
+    reader.indexData.images.names.swap(images.names);
+    reader.indexData.images.packedInfo.swap(images.packedInfo);
+    reader.indexData.animations.names.swap(animations.names);
+    reader.indexData.animations.packedInfo.swap(animations.packedInfo);
+    reader.imageIndexNames.swap(imageIndexNames);
+    reader.animationIndexNames.swap(animationIndexNames);
+    reader.indexContents.swap(indexNames);
+
+    reader.imagesContents.swap(imagesContents);
+    reader.imagesRecord = imagesRecord;
+    reader.packedImageOffsets.swap(packedImageOffsets);
+    reader.packedImages.swap(packedImages);
+    reader.imageFrames.swap(imageFrames);
+    reader.imageParts.swap(imageParts);
+
+    return true;
+}
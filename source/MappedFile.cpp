@@ -0,0 +1,160 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <MappedFile.hpp>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    : mappedData(NULL)
+    , mappedSize(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& filePath)
+{
+    close();
+
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        // Empty files can not be mapped
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    // View keeps mapping alive, handles are not needed anymore
+    CloseHandle(mapping);
+    CloseHandle(file);
+
+    if (!view) {
+        return false;
+    }
+
+    mappedData = static_cast<const char*>(view);
+    mappedSize = static_cast<size_t>(fileSize.QuadPart);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mappedData) {
+        UnmapViewOfFile(mappedData);
+    }
+
+    mappedData = NULL;
+    mappedSize = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string& filePath)
+{
+    close();
+
+    const int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+        // Empty files can not be mapped
+        ::close(fd);
+        return false;
+    }
+
+    const size_t fileSize = static_cast<size_t>(fileStat.st_size);
+    void* view = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // Mapping stays valid after descriptor is closed
+    ::close(fd);
+
+    if (view == MAP_FAILED) {
+        return false;
+    }
+
+    mappedData = static_cast<const char*>(view);
+    mappedSize = fileSize;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mappedData) {
+        munmap(const_cast<char*>(mappedData), mappedSize);
+    }
+
+    mappedData = NULL;
+    mappedSize = 0;
+}
+
+#endif
+
+void MappedFile::swap(MappedFile& other)
+{
+    std::swap(mappedData, other.mappedData);
+    std::swap(mappedSize, other.mappedSize);
+}
+
+bool MappedFile::isOpen() const
+{
+    return mappedData != NULL;
+}
+
+const char* MappedFile::data() const
+{
+    return mappedData;
+}
+
+size_t MappedFile::size() const
+{
+    return mappedSize;
+}
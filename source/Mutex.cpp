@@ -0,0 +1,152 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <Mutex.hpp>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef _WIN32
+
+struct Mutex::Impl
+{
+    CRITICAL_SECTION section;
+};
+
+Mutex::Mutex()
+    : impl(new Impl)
+{
+    InitializeCriticalSection(&impl->section);
+}
+
+Mutex::~Mutex()
+{
+    DeleteCriticalSection(&impl->section);
+    delete impl;
+}
+
+void Mutex::lock()
+{
+    EnterCriticalSection(&impl->section);
+}
+
+void Mutex::unlock()
+{
+    LeaveCriticalSection(&impl->section);
+}
+
+struct Condition::Impl
+{
+    CONDITION_VARIABLE variable;
+};
+
+Condition::Condition()
+    : impl(new Impl)
+{
+    InitializeConditionVariable(&impl->variable);
+}
+
+Condition::~Condition()
+{
+    delete impl;
+}
+
+void Condition::wait(Mutex& mutex)
+{
+    SleepConditionVariableCS(&impl->variable, &mutex.impl->section, INFINITE);
+}
+
+void Condition::notifyOne()
+{
+    WakeConditionVariable(&impl->variable);
+}
+
+void Condition::notifyAll()
+{
+    WakeAllConditionVariable(&impl->variable);
+}
+
+#else
+
+struct Mutex::Impl
+{
+    pthread_mutex_t mutex;
+};
+
+Mutex::Mutex()
+    : impl(new Impl)
+{
+    pthread_mutex_init(&impl->mutex, NULL);
+}
+
+Mutex::~Mutex()
+{
+    pthread_mutex_destroy(&impl->mutex);
+    delete impl;
+}
+
+void Mutex::lock()
+{
+    pthread_mutex_lock(&impl->mutex);
+}
+
+void Mutex::unlock()
+{
+    pthread_mutex_unlock(&impl->mutex);
+}
+
+struct Condition::Impl
+{
+    pthread_cond_t condition;
+};
+
+Condition::Condition()
+    : impl(new Impl)
+{
+    pthread_cond_init(&impl->condition, NULL);
+}
+
+Condition::~Condition()
+{
+    pthread_cond_destroy(&impl->condition);
+    delete impl;
+}
+
+void Condition::wait(Mutex& mutex)
+{
+    pthread_cond_wait(&impl->condition, &mutex.impl->mutex);
+}
+
+void Condition::notifyOne()
+{
+    pthread_cond_signal(&impl->condition);
+}
+
+void Condition::notifyAll()
+{
+    pthread_cond_broadcast(&impl->condition);
+}
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <NameIndex.hpp>
+#include <string.h>
+
+/** Smallest hash table size. Tables are kept at most half full. */
+static const size_t minimumSlots = 16;
+
+const uint32_t NameIndex::emptySlot;
+
+NameIndex::NameIndex()
+{
+}
+
+void NameIndex::reserve(size_t namesTotal)
+{
+    entries.reserve(namesTotal);
+
+    size_t slotsTotal = minimumSlots;
+    while (slotsTotal < namesTotal * 2) {
+        slotsTotal *= 2;
+    }
+
+    if (slotsTotal > slots.size()) {
+        rehash(slotsTotal);
+    }
+}
+
+void NameIndex::clear()
+{
+    names.clear();
+    entries.clear();
+    slots.clear();
+}
+
+void NameIndex::swap(NameIndex& other)
+{
+    names.swap(other.names);
+    entries.swap(other.entries);
+    slots.swap(other.slots);
+}
+
+bool NameIndex::insert(const char* name, size_t nameLength, uint32_t value)
+{
+    if ((entries.size() + 1) * 2 > slots.size()) {
+        rehash(slots.empty() ? minimumSlots : slots.size() * 2);
+    }
+
+    const uint32_t nameHash = hash(name, nameLength);
+    const size_t slot = findSlot(name, nameLength, nameHash);
+
+    if (slots[slot] != emptySlot) {
+        return false;
+    }
+
+    Entry entry;
+    entry.nameOffset = static_cast<uint32_t>(names.size());
+    entry.nameLength = static_cast<uint32_t>(nameLength);
+    entry.hash = nameHash;
+    entry.value = value;
+
+    names.insert(names.end(), name, name + nameLength);
+    names.push_back('\0');
+
+    slots[slot] = static_cast<uint32_t>(entries.size());
+    entries.push_back(entry);
+    return true;
+}
+
+bool NameIndex::insert(const std::string& name, uint32_t value)
+{
+    return insert(name.c_str(), name.size(), value);
+}
+
+const uint32_t* NameIndex::find(const char* name, size_t nameLength) const
+{
+    if (entries.empty()) {
+        return NULL;
+    }
+
+    const size_t slot = findSlot(name, nameLength, hash(name, nameLength));
+    if (slots[slot] == emptySlot) {
+        return NULL;
+    }
+
+    return &entries[slots[slot]].value;
+}
+
+const uint32_t* NameIndex::find(const char* name) const
+{
+    return find(name, strlen(name));
+}
+
+const uint32_t* NameIndex::find(const std::string& name) const
+{
+    return find(name.c_str(), name.size());
+}
+
+size_t NameIndex::size() const
+{
+    return entries.size();
+}
+
+bool NameIndex::empty() const
+{
+    return entries.empty();
+}
+
+size_t NameIndex::memoryUsed() const
+{
+    return names.capacity() + entries.capacity() * sizeof(Entry)
+           + slots.capacity() * sizeof(uint32_t);
+}
+
+const char* NameIndex::name(size_t index) const
+{
+    return &names[entries[index].nameOffset];
+}
+
+size_t NameIndex::nameLength(size_t index) const
+{
+    return entries[index].nameLength;
+}
+
+uint32_t NameIndex::value(size_t index) const
+{
+    return entries[index].value;
+}
+
+/** Appends 4-byte value to output. */
+static void appendUint32(std::vector<char>& output, uint32_t value)
+{
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    output.insert(output.end(), bytes, bytes + sizeof(value));
+}
+
+/**
+ * Reads 4-byte count at specified offset, checks that count elements of elementSize follow.
+ * Adjusts offset after reading count.
+ */
+static bool readCount(const char* data,
+                      size_t size,
+                      size_t& byteOffset,
+                      size_t elementSize,
+                      uint32_t& count)
+{
+    if (size - byteOffset < sizeof(uint32_t)) {
+        return false;
+    }
+
+    memcpy(&count, data + byteOffset, sizeof(count));
+    byteOffset += sizeof(uint32_t);
+
+    return (size - byteOffset) / elementSize >= count;
+}
+
+void NameIndex::save(std::vector<char>& output) const
+{
+    appendUint32(output, static_cast<uint32_t>(names.size()));
+    output.insert(output.end(), names.begin(), names.end());
+    output.resize((output.size() + 3) & ~static_cast<size_t>(3), '\0');
+
+    appendUint32(output, static_cast<uint32_t>(entries.size()));
+    if (!entries.empty()) {
+        const char* bytes = reinterpret_cast<const char*>(&entries[0]);
+        output.insert(output.end(), bytes, bytes + entries.size() * sizeof(Entry));
+    }
+
+    appendUint32(output, static_cast<uint32_t>(slots.size()));
+    if (!slots.empty()) {
+        const char* bytes = reinterpret_cast<const char*>(&slots[0]);
+        output.insert(output.end(), bytes, bytes + slots.size() * sizeof(uint32_t));
+    }
+}
+
+bool NameIndex::load(const char* data, size_t size, size_t& byteOffset)
+{
+    if (byteOffset > size) {
+        return false;
+    }
+
+    uint32_t namesSize = 0;
+    if (!readCount(data, size, byteOffset, 1, namesSize)) {
+        return false;
+    }
+
+    const char* namesData = data + byteOffset;
+    // Sections are padded to 4 bytes
+    const size_t namesEnd = byteOffset + ((namesSize + 3) & ~static_cast<size_t>(3));
+    if (namesEnd > size) {
+        return false;
+    }
+
+    size_t offset = namesEnd;
+
+    uint32_t entriesTotal = 0;
+    if (!readCount(data, size, offset, sizeof(Entry), entriesTotal)) {
+        return false;
+    }
+
+    std::vector<Entry> loadedEntries(entriesTotal);
+    if (entriesTotal) {
+        memcpy(&loadedEntries[0], data + offset, entriesTotal * sizeof(Entry));
+        offset += entriesTotal * sizeof(Entry);
+    }
+
+    uint32_t slotsTotal = 0;
+    if (!readCount(data, size, offset, sizeof(uint32_t), slotsTotal)) {
+        return false;
+    }
+
+    // Table must be a power of two and at most half full, otherwise probing breaks
+    if ((slotsTotal & (slotsTotal - 1)) || static_cast<size_t>(entriesTotal) * 2 > slotsTotal) {
+        return false;
+    }
+
+    std::vector<uint32_t> loadedSlots(slotsTotal);
+    if (slotsTotal) {
+        memcpy(&loadedSlots[0], data + offset, slotsTotal * sizeof(uint32_t));
+        offset += slotsTotal * sizeof(uint32_t);
+    }
+
+    for (size_t i = 0; i < loadedSlots.size(); ++i) {
+        if (loadedSlots[i] != emptySlot && loadedSlots[i] >= entriesTotal) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < loadedEntries.size(); ++i) {
+        const Entry& entry = loadedEntries[i];
+
+        if (entry.nameOffset >= namesSize || namesSize - entry.nameOffset <= entry.nameLength
+            || namesData[entry.nameOffset + entry.nameLength] != '\0') {
+            return false;
+        }
+    }
+
+    names.assign(namesData, namesData + namesSize);
+    entries.swap(loadedEntries);
+    slots.swap(loadedSlots);
+
+    byteOffset = offset;
+    return true;
+}
+
+uint32_t NameIndex::hash(const char* name, size_t nameLength)
+{
+    uint32_t value = 2166136261u;
+
+    for (size_t i = 0; i < nameLength; ++i) {
+        value ^= static_cast<unsigned char>(name[i]);
+        value *= 16777619u;
+    }
+
+    return value;
+}
+
+size_t NameIndex::findSlot(const char* name, size_t nameLength, uint32_t nameHash) const
+{
+    const size_t mask = slots.size() - 1;
+    size_t slot = nameHash & mask;
+
+    // Table is never full, so probing always stops at an empty slot
+    for (;;) {
+        const uint32_t index = slots[slot];
+        if (index == emptySlot) {
+            return slot;
+        }
+
+        const Entry& entry = entries[index];
+        if (entry.hash == nameHash && entry.nameLength == nameLength
+            && !memcmp(&names[entry.nameOffset], name, nameLength)) {
+            return slot;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+void NameIndex::rehash(size_t slotsTotal)
+{
+    slots.assign(slotsTotal, emptySlot);
+
+    const size_t mask = slotsTotal - 1;
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        size_t slot = entries[i].hash & mask;
+
+        while (slots[slot] != emptySlot) {
+            slot = (slot + 1) & mask;
+        }
+
+        slots[slot] = static_cast<uint32_t>(i);
+    }
+}
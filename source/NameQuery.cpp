@@ -0,0 +1,282 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <NameQuery.hpp>
+#include <algorithm>
+#include <string.h>
+#include <utility>
+
+/** Packs 3 bytes starting at specified position into trigram key. */
+static inline uint32_t trigramAt(const char* string)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(string);
+
+    return (static_cast<uint32_t>(bytes[0]) << 16) | (static_cast<uint32_t>(bytes[1]) << 8)
+           | bytes[2];
+}
+
+/** Compares names the way std::string does, unsigned bytes first, then length. */
+static inline int compareNames(const char* a, size_t aLength, const char* b, size_t bLength)
+{
+    const int result = memcmp(a, b, std::min(aLength, bLength));
+    if (result) {
+        return result;
+    }
+
+    return aLength < bLength ? -1 : (aLength > bLength ? 1 : 0);
+}
+
+template <typename T>
+static size_t vectorBytes(const std::vector<T>& array)
+{
+    return array.capacity() * sizeof(T);
+}
+
+/** Orders entry indices by their names, entries can also be compared with a prefix. */
+class NameQuery::NameLess
+{
+public:
+    explicit NameLess(const NameIndex& names)
+        : names(names)
+    { }
+
+    bool operator()(uint32_t a, uint32_t b) const
+    {
+        return compareNames(names.name(a), names.nameLength(a), names.name(b),
+                            names.nameLength(b))
+               < 0;
+    }
+
+    bool operator()(uint32_t entry, const std::pair<const char*, size_t>& prefix) const
+    {
+        return compareNames(names.name(entry), names.nameLength(entry), prefix.first,
+                            prefix.second)
+               < 0;
+    }
+
+private:
+    const NameIndex& names;
+};
+
+NameQuery::NameQuery()
+    : names(NULL)
+{
+}
+
+NameQuery::NameQuery(const NameIndex& names, const NameQueryOptions& options)
+    : names(NULL)
+{
+    build(names, options);
+}
+
+void NameQuery::build(const NameIndex& nameIndex, const NameQueryOptions& options)
+{
+    names = &nameIndex;
+    sortedEntries.clear();
+    trigramKeys.clear();
+    trigramStarts.clear();
+    trigramEntries.clear();
+
+    const uint32_t namesTotal = static_cast<uint32_t>(nameIndex.size());
+
+    sortedEntries.resize(namesTotal);
+    for (uint32_t i = 0; i < namesTotal; ++i) {
+        sortedEntries[i] = i;
+    }
+
+    std::sort(sortedEntries.begin(), sortedEntries.end(), NameLess(nameIndex));
+
+    if (!options.trigrams) {
+        return;
+    }
+
+    // Pack trigram and entry into a single value, sorting it groups entries by trigram
+    std::vector<uint64_t> pairs;
+
+    size_t pairsTotal = 0;
+    for (uint32_t i = 0; i < namesTotal; ++i) {
+        const size_t length = nameIndex.nameLength(i);
+        pairsTotal += length >= 3 ? length - 2 : 0;
+    }
+
+    pairs.reserve(pairsTotal);
+
+    for (uint32_t i = 0; i < namesTotal; ++i) {
+        const char* name = nameIndex.name(i);
+        const size_t length = nameIndex.nameLength(i);
+
+        for (size_t j = 0; j + 3 <= length; ++j) {
+            pairs.push_back((static_cast<uint64_t>(trigramAt(name + j)) << 32) | i);
+        }
+    }
+
+    std::sort(pairs.begin(), pairs.end());
+    // Names repeating a trigram are listed once
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    trigramEntries.reserve(pairs.size());
+
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        const uint32_t trigram = static_cast<uint32_t>(pairs[i] >> 32);
+
+        if (trigramKeys.empty() || trigramKeys.back() != trigram) {
+            trigramKeys.push_back(trigram);
+            trigramStarts.push_back(static_cast<uint32_t>(trigramEntries.size()));
+        }
+
+        trigramEntries.push_back(static_cast<uint32_t>(pairs[i]));
+    }
+
+    trigramStarts.push_back(static_cast<uint32_t>(trigramEntries.size()));
+}
+
+size_t NameQuery::findPrefix(const char* prefix,
+                             size_t prefixLength,
+                             std::vector<NameIndex::Item>& matches) const
+{
+    matches.clear();
+
+    if (!names) {
+        return 0;
+    }
+
+    // Names starting with prefix follow it in sorted order
+    std::vector<uint32_t>::const_iterator it = std::lower_bound(
+        sortedEntries.begin(), sortedEntries.end(), std::make_pair(prefix, prefixLength),
+        NameLess(*names));
+
+    for (; it != sortedEntries.end(); ++it) {
+        if (names->nameLength(*it) < prefixLength
+            || memcmp(names->name(*it), prefix, prefixLength)) {
+            break;
+        }
+
+        appendMatch(*it, matches);
+    }
+
+    return matches.size();
+}
+
+size_t NameQuery::findPrefix(const std::string& prefix,
+                             std::vector<NameIndex::Item>& matches) const
+{
+    return findPrefix(prefix.data(), prefix.size(), matches);
+}
+
+size_t NameQuery::findSubstring(const char* substring,
+                                size_t substringLength,
+                                std::vector<NameIndex::Item>& matches) const
+{
+    matches.clear();
+
+    if (!names) {
+        return 0;
+    }
+
+    const char* substringEnd = substring + substringLength;
+
+    if (substringLength < 3 || trigramKeys.empty()) {
+        // Nothing to look trigrams up with, check every name
+        for (uint32_t i = 0; i < names->size(); ++i) {
+            const char* name = names->name(i);
+            const char* nameEnd = name + names->nameLength(i);
+
+            if (std::search(name, nameEnd, substring, substringEnd) != nameEnd) {
+                appendMatch(i, matches);
+            }
+        }
+
+        return matches.size();
+    }
+
+    // Every match contains all trigrams of substring, check names from the shortest list
+    size_t candidatesBegin = 0;
+    size_t candidatesEnd = 0;
+    size_t candidatesTotal = trigramEntries.size() + 1;
+
+    for (size_t i = 0; i + 3 <= substringLength; ++i) {
+        size_t begin = 0;
+        size_t end = 0;
+        findTrigram(trigramAt(substring + i), begin, end);
+
+        if (begin == end) {
+            return 0;
+        }
+
+        if (end - begin < candidatesTotal) {
+            candidatesBegin = begin;
+            candidatesEnd = end;
+            candidatesTotal = end - begin;
+        }
+    }
+
+    for (size_t i = candidatesBegin; i < candidatesEnd; ++i) {
+        const uint32_t entry = trigramEntries[i];
+        const char* name = names->name(entry);
+        const char* nameEnd = name + names->nameLength(entry);
+
+        if (std::search(name, nameEnd, substring, substringEnd) != nameEnd) {
+            appendMatch(entry, matches);
+        }
+    }
+
+    return matches.size();
+}
+
+size_t NameQuery::findSubstring(const std::string& substring,
+                                std::vector<NameIndex::Item>& matches) const
+{
+    return findSubstring(substring.data(), substring.size(), matches);
+}
+
+size_t NameQuery::size() const
+{
+    return sortedEntries.size();
+}
+
+size_t NameQuery::memoryUsed() const
+{
+    return vectorBytes(sortedEntries) + vectorBytes(trigramKeys) + vectorBytes(trigramStarts)
+           + vectorBytes(trigramEntries);
+}
+
+void NameQuery::appendMatch(uint32_t entry, std::vector<NameIndex::Item>& matches) const
+{
+    NameIndex::Item item;
+    item.name = names->name(entry);
+    item.nameLength = names->nameLength(entry);
+    item.value = names->value(entry);
+
+    matches.push_back(item);
+}
+
+void NameQuery::findTrigram(uint32_t trigram, size_t& begin, size_t& end) const
+{
+    std::vector<uint32_t>::const_iterator it = std::lower_bound(trigramKeys.begin(),
+                                                                trigramKeys.end(), trigram);
+
+    if (it == trigramKeys.end() || *it != trigram) {
+        begin = end = 0;
+        return;
+    }
+
+    const size_t key = it - trigramKeys.begin();
+    begin = trigramStarts[key];
+    end = trigramStarts[key + 1];
+}
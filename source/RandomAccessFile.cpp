@@ -0,0 +1,189 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <RandomAccessFile.hpp>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+RandomAccessFile::RandomAccessFile()
+    : handle(INVALID_HANDLE_VALUE)
+    , fileSize(0)
+{
+}
+
+bool RandomAccessFile::open(const std::string& filePath, bool sequentialScan)
+{
+    close();
+
+    const DWORD flags = sequentialScan ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL;
+
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, flags, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    handle = file;
+    fileSize = static_cast<uint64_t>(size.QuadPart);
+    return true;
+}
+
+void RandomAccessFile::close()
+{
+    if (handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(handle);
+    }
+
+    handle = INVALID_HANDLE_VALUE;
+    fileSize = 0;
+}
+
+bool RandomAccessFile::isOpen() const
+{
+    return handle != INVALID_HANDLE_VALUE;
+}
+
+bool RandomAccessFile::read(uint64_t offset, void* buffer, size_t size) const
+{
+    char* target = static_cast<char*>(buffer);
+
+    while (size) {
+        // Offset is passed with each call, so handle position is never shared
+        OVERLAPPED overlapped = {0};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        const DWORD chunk = size > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size);
+        DWORD bytesRead = 0;
+
+        if (!ReadFile(handle, target, chunk, &bytesRead, &overlapped) || !bytesRead) {
+            return false;
+        }
+
+        target += bytesRead;
+        offset += bytesRead;
+        size -= bytesRead;
+    }
+
+    return true;
+}
+
+#else
+
+RandomAccessFile::RandomAccessFile()
+    : handle(-1)
+    , fileSize(0)
+{
+}
+
+bool RandomAccessFile::open(const std::string& filePath, bool sequentialScan)
+{
+    close();
+
+    const int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+    if (sequentialScan) {
+        // Only a hint, reads work the same if it is ignored
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#else
+    (void)sequentialScan;
+#endif
+
+    handle = fd;
+    fileSize = static_cast<uint64_t>(fileStat.st_size);
+    return true;
+}
+
+void RandomAccessFile::close()
+{
+    if (handle != -1) {
+        ::close(handle);
+    }
+
+    handle = -1;
+    fileSize = 0;
+}
+
+bool RandomAccessFile::isOpen() const
+{
+    return handle != -1;
+}
+
+bool RandomAccessFile::read(uint64_t offset, void* buffer, size_t size) const
+{
+    char* target = static_cast<char*>(buffer);
+
+    while (size) {
+        const ssize_t bytesRead = pread(handle, target, size, static_cast<off_t>(offset));
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (bytesRead <= 0) {
+            return false;
+        }
+
+        target += bytesRead;
+        offset += bytesRead;
+        size -= static_cast<size_t>(bytesRead);
+    }
+
+    return true;
+}
+
+#endif
+
+RandomAccessFile::~RandomAccessFile()
+{
+    close();
+}
+
+uint64_t RandomAccessFile::size() const
+{
+    return fileSize;
+}
@@ -0,0 +1,168 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <RecordScanner.hpp>
+#include <algorithm>
+#include <string.h>
+#include <utility>
+
+#define FFSIGNATURE(a, b, c, d)                                                                    \
+    ((static_cast<uint32_t>(d) << 24) | (static_cast<uint32_t>(c) << 16)                           \
+     | (static_cast<uint32_t>(b) << 8) | static_cast<uint32_t>(a))
+
+static const uint32_t mqrcSignature = FFSIGNATURE('M', 'Q', 'R', 'C');
+
+static const char emptyName[] = "";
+
+static bool recordLessByOffset(const TocRecord* a, const TocRecord* b)
+{
+    return a->offset < b->offset;
+}
+
+RecordScanner::RecordScanner(const FfReader& reader, const ScanOptions& options)
+    : reader(reader)
+    , options(options)
+    , position(0)
+    , bufferOffset(0)
+    , bufferFill(0)
+{
+    records.reserve(reader.tableOfContents.size());
+    for (size_t i = 0; i < reader.tableOfContents.size(); ++i) {
+        records.push_back(&reader.tableOfContents[i]);
+    }
+
+    std::sort(records.begin(), records.end(), recordLessByOffset);
+
+    // Names list maps names to ids, reverse it to name records
+    std::vector<std::pair<RecordId, size_t> > namesById;
+    namesById.reserve(reader.recordNames.size());
+
+    for (size_t i = 0; i < reader.recordNames.size(); ++i) {
+        namesById.push_back(std::make_pair(reader.recordNames.value(i), i));
+    }
+
+    std::sort(namesById.begin(), namesById.end());
+
+    names.resize(records.size(), emptyName);
+    for (size_t i = 0; i < records.size(); ++i) {
+        const RecordId recordId = records[i]->recordId;
+
+        std::vector<std::pair<RecordId, size_t> >::const_iterator it = std::lower_bound(
+            namesById.begin(), namesById.end(), std::make_pair(recordId, size_t(0)));
+
+        if (it != namesById.end() && it->first == recordId) {
+            names[i] = reader.recordNames.name(it->second);
+        }
+    }
+
+    if (!reader.isMemoryMapped()) {
+        // Own handle, so access hint does not affect random reads of the reader
+        file.open(reader.ffFilePath, options.sequentialHint);
+    }
+}
+
+bool RecordScanner::next(ScannedRecord& record)
+{
+    while (position < records.size()) {
+        const TocRecord& tocRecord = *records[position];
+        const char* name = names[position];
+        ++position;
+
+        const char* data = readRecord(tocRecord);
+
+        record.recordId = tocRecord.recordId;
+        record.name = name;
+        record.contents.data = NULL;
+        record.contents.size = tocRecord.size;
+
+        if (!data) {
+            memset(&record.header, 0, sizeof(record.header));
+            return true;
+        }
+
+        memcpy(&record.header, data, sizeof(MqrcHeader));
+
+        if (options.skipUnused && !record.header.used) {
+            continue;
+        }
+
+        if (record.header.signature == mqrcSignature) {
+            record.contents.data = data + sizeof(MqrcHeader);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+void RecordScanner::rewind()
+{
+    position = 0;
+}
+
+const char* RecordScanner::readRecord(const TocRecord& record)
+{
+    const uint64_t recordSize = sizeof(MqrcHeader) + static_cast<uint64_t>(record.size);
+
+    if (reader.isMemoryMapped()) {
+        const MappedFile& mapping = reader.mappedFile;
+
+        if (record.offset > mapping.size() || mapping.size() - record.offset < recordSize) {
+            return NULL;
+        }
+
+        return mapping.data() + record.offset;
+    }
+
+    if (!file.isOpen()) {
+        return NULL;
+    }
+
+    if (record.offset >= bufferOffset && record.offset - bufferOffset <= bufferFill
+        && bufferFill - (record.offset - bufferOffset) >= recordSize) {
+        // Record was read ahead together with previous ones
+        return &buffer[static_cast<size_t>(record.offset - bufferOffset)];
+    }
+
+    if (record.offset > file.size() || file.size() - record.offset < recordSize) {
+        return NULL;
+    }
+
+    // Read as much as buffer holds starting at the record, following records come next
+    const uint64_t available = file.size() - record.offset;
+    const size_t readSize = static_cast<size_t>(
+        std::min<uint64_t>(available, std::max<uint64_t>(options.bufferSize, recordSize)));
+
+    if (buffer.size() < readSize) {
+        buffer.resize(readSize);
+    }
+
+    bufferOffset = record.offset;
+    bufferFill = 0;
+
+    // Scanner has its own handle, but reads still count against the reader
+    reader.countRead(readSize);
+    if (!file.read(record.offset, &buffer[0], readSize)) {
+        return NULL;
+    }
+
+    bufferFill = readSize;
+    return &buffer[0];
+}
@@ -0,0 +1,185 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <ReplacingFile.hpp>
+#include <Mutex.hpp>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <sys/stat.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/** Number of names tried before giving up, others may be left by crashed writers. */
+static const int createAttempts = 16;
+
+static Mutex temporaryMutex;
+static unsigned long temporaryCounter = 0;
+
+static void appendNumber(std::string& text, unsigned long value)
+{
+    char digits[24];
+    size_t length = 0;
+
+    do {
+        digits[length++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    while (length) {
+        text += digits[--length];
+    }
+}
+
+/** Returns name that no other ReplacingFile of this process uses at the moment. */
+static std::string temporaryName(const std::string& targetPath)
+{
+    unsigned long counter = 0;
+
+    {
+        ScopedLock lock(temporaryMutex);
+        counter = temporaryCounter++;
+    }
+
+#ifdef _WIN32
+    const unsigned long processId = static_cast<unsigned long>(_getpid());
+#else
+    const unsigned long processId = static_cast<unsigned long>(getpid());
+#endif
+
+    // 'Icons.ffidx' gets 'Icons.ffidx.tmp.<process>.<counter>'
+    std::string name = targetPath + ".tmp.";
+    appendNumber(name, processId);
+    name += '.';
+    appendNumber(name, counter);
+
+    return name;
+}
+
+/** Creates file that must not exist yet and opens it for binary writes. */
+static FILE* createNew(const std::string& filePath, bool& exists)
+{
+#ifdef _WIN32
+    const int handle = _open(filePath.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY,
+                             _S_IREAD | _S_IWRITE);
+#else
+    const int handle = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+#endif
+
+    exists = handle == -1 && errno == EEXIST;
+    if (handle == -1) {
+        return NULL;
+    }
+
+#ifdef _WIN32
+    FILE* file = _fdopen(handle, "wb");
+    if (!file) {
+        _close(handle);
+    }
+#else
+    FILE* file = fdopen(handle, "wb");
+    if (!file) {
+        ::close(handle);
+    }
+#endif
+
+    return file;
+}
+
+ReplacingFile::ReplacingFile()
+    : file(NULL)
+{
+}
+
+ReplacingFile::~ReplacingFile()
+{
+    discard();
+}
+
+FILE* ReplacingFile::open(const std::string& filePath)
+{
+    discard();
+
+    for (int i = 0; i < createAttempts; ++i) {
+        const std::string path = temporaryName(filePath);
+
+        bool exists = false;
+        file = createNew(path, exists);
+
+        if (file) {
+            targetPath = filePath;
+            temporaryPath = path;
+            return file;
+        }
+
+        if (!exists) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+bool ReplacingFile::commit()
+{
+    if (!file) {
+        return false;
+    }
+
+    const bool closed = fclose(file) == 0;
+    file = NULL;
+
+#ifdef _WIN32
+    const bool replaced = closed
+                          && MoveFileExA(temporaryPath.c_str(), targetPath.c_str(),
+                                         MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    const bool replaced = closed && rename(temporaryPath.c_str(), targetPath.c_str()) == 0;
+#endif
+
+    if (!replaced) {
+        remove(temporaryPath.c_str());
+    }
+
+    temporaryPath.clear();
+    return replaced;
+}
+
+void ReplacingFile::discard()
+{
+    if (!file) {
+        return;
+    }
+
+    fclose(file);
+    file = NULL;
+
+    remove(temporaryPath.c_str());
+    temporaryPath.clear();
+}
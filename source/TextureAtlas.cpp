@@ -0,0 +1,694 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <RandomAccessFile.hpp>
+#include <ReplacingFile.hpp>
+#include <TextureAtlas.hpp>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+
+#define ATLASSIGNATURE(a, b, c, d)                                                                 \
+    ((static_cast<uint32_t>(d) << 24) | (static_cast<uint32_t>(c) << 16)                           \
+     | (static_cast<uint32_t>(b) << 8) | static_cast<uint32_t>(a))
+
+static const uint32_t atlasSignature = ATLASSIGNATURE('F', 'F', 'A', 'T');
+/** Increment whenever layout of atlas file changes. */
+static const uint32_t atlasVersion = 1;
+
+/** Atlas pages always store 32-bit pixels. */
+static const uint32_t atlasBytesPerPixel = 4;
+
+struct AtlasHeader
+{
+    uint32_t signature;
+    uint32_t version;
+    uint32_t payloadSize; /**< Number of bytes following the header. */
+    uint32_t checksum;    /**< 32-bit FNV-1a of payload. */
+};
+
+struct AtlasPageEntry
+{
+    uint32_t width;
+    uint32_t height;
+};
+
+struct AtlasRegionEntry
+{
+    uint32_t nameOffset; /**< Offset of null terminated name in names section. */
+    uint32_t page;
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+/** Frame waiting to be placed into atlas. */
+struct AtlasItem
+{
+    size_t image;      /**< Index of packed image the frame belongs to. */
+    size_t frame;      /**< Index of frame inside packed image. */
+    RecordId recordId; /**< Record that frame parts are copied from. */
+    uint32_t width;
+    uint32_t height;
+    uint32_t page;
+    uint32_t x;
+    uint32_t y;
+};
+
+static bool itemTaller(const AtlasItem* a, const AtlasItem* b)
+{
+    if (a->height != b->height) {
+        return a->height > b->height;
+    }
+
+    return a->width > b->width;
+}
+
+static bool itemRecordLess(const AtlasItem* a, const AtlasItem* b)
+{
+    return a->recordId < b->recordId;
+}
+
+static bool regionNameLess(const AtlasRegion& a, const AtlasRegion& b)
+{
+    return a.name < b.name;
+}
+
+/**
+ * Skyline of a single atlas page: top edges of placed rectangles, left to right.
+ * Rectangles are placed at the lowest position where they fit, leftmost on ties.
+ */
+class Skyline
+{
+public:
+    Skyline(uint32_t width, uint32_t height)
+        : usedHeight(0)
+        , width(width)
+        , height(height)
+    {
+        Node node;
+        node.x = 0;
+        node.y = 0;
+        node.width = width;
+        nodes.push_back(node);
+    }
+
+    /** Places rectangle, @returns false if it does not fit. */
+    bool place(uint32_t rectWidth, uint32_t rectHeight, uint32_t& x, uint32_t& y)
+    {
+        size_t bestIndex = nodes.size();
+        uint32_t bestY = height;
+
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            uint32_t nodeY = 0;
+            if (fits(i, rectWidth, rectHeight, nodeY) && (bestIndex == nodes.size() || nodeY < bestY)) {
+                bestIndex = i;
+                bestY = nodeY;
+            }
+        }
+
+        if (bestIndex == nodes.size()) {
+            return false;
+        }
+
+        x = nodes[bestIndex].x;
+        y = bestY;
+        insert(bestIndex, x, y + rectHeight, rectWidth);
+
+        usedHeight = std::max(usedHeight, y + rectHeight);
+        return true;
+    }
+
+    uint32_t usedHeight; /**< Bottom edge of the lowest rectangle. */
+
+private:
+    struct Node
+    {
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+    };
+
+    /** Checks if rectangle with left edge at node fits, stores its top edge in y. */
+    bool fits(size_t index, uint32_t rectWidth, uint32_t rectHeight, uint32_t& y) const
+    {
+        if (nodes[index].x + rectWidth > width) {
+            return false;
+        }
+
+        uint32_t widthLeft = rectWidth;
+        y = 0;
+
+        for (size_t i = index; widthLeft; ++i) {
+            y = std::max(y, nodes[i].y);
+
+            if (y + rectHeight > height) {
+                return false;
+            }
+
+            widthLeft -= std::min(widthLeft, nodes[i].width);
+        }
+
+        return true;
+    }
+
+    /** Adds node of new rectangle top edge and cuts nodes it covers. */
+    void insert(size_t index, uint32_t x, uint32_t y, uint32_t nodeWidth)
+    {
+        Node node;
+        node.x = x;
+        node.y = y;
+        node.width = nodeWidth;
+        nodes.insert(nodes.begin() + index, node);
+
+        const uint32_t right = x + nodeWidth;
+
+        for (size_t i = index + 1; i < nodes.size();) {
+            Node& next = nodes[i];
+            if (next.x >= right) {
+                break;
+            }
+
+            const uint32_t covered = right - next.x;
+            if (next.width <= covered) {
+                nodes.erase(nodes.begin() + i);
+                continue;
+            }
+
+            next.x += covered;
+            next.width -= covered;
+            break;
+        }
+
+        // Merge neighbours of the same height
+        for (size_t i = 0; i + 1 < nodes.size();) {
+            if (nodes[i].y == nodes[i + 1].y) {
+                nodes[i].width += nodes[i + 1].width;
+                nodes.erase(nodes.begin() + i + 1);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    uint32_t width;
+    uint32_t height;
+    std::vector<Node> nodes;
+};
+
+static uint32_t checksum(const char* data, size_t size)
+{
+    uint32_t value = 2166136261u;
+
+    for (size_t i = 0; i < size; ++i) {
+        value ^= static_cast<unsigned char>(data[i]);
+        value *= 16777619u;
+    }
+
+    return value;
+}
+
+/** Appends 4-byte count followed by array elements, padded to 4 bytes. */
+template <typename T>
+static void appendArray(std::vector<char>& output, const T* array, size_t count)
+{
+    const uint32_t count32 = static_cast<uint32_t>(count);
+    const char* countBytes = reinterpret_cast<const char*>(&count32);
+    output.insert(output.end(), countBytes, countBytes + sizeof(count32));
+
+    if (count) {
+        const char* bytes = reinterpret_cast<const char*>(array);
+        output.insert(output.end(), bytes, bytes + count * sizeof(T));
+    }
+
+    output.resize((output.size() + 3) & ~static_cast<size_t>(3), '\0');
+}
+
+template <typename T>
+static void appendArray(std::vector<char>& output, const std::vector<T>& array)
+{
+    appendArray(output, array.empty() ? NULL : &array[0], array.size());
+}
+
+/**
+ * Reads array written by appendArray at specified offset.
+ * Adjusts offset after reading.
+ * @returns false if array does not fit into data.
+ */
+template <typename T>
+static bool readArray(const char* data, size_t size, size_t& byteOffset, std::vector<T>& array)
+{
+    if (byteOffset > size || size - byteOffset < sizeof(uint32_t)) {
+        return false;
+    }
+
+    uint32_t count = 0;
+    memcpy(&count, data + byteOffset, sizeof(count));
+    byteOffset += sizeof(count);
+
+    if ((size - byteOffset) / sizeof(T) < count) {
+        return false;
+    }
+
+    array.resize(count);
+    if (count) {
+        memcpy(&array[0], data + byteOffset, count * sizeof(T));
+    }
+
+    byteOffset = (byteOffset + count * sizeof(T) + 3) & ~static_cast<size_t>(3);
+    return byteOffset <= size;
+}
+
+static void setTextureCoordinates(AtlasRegion& region, const AtlasPage& page)
+{
+    region.u0 = static_cast<float>(region.x) / page.width;
+    region.v0 = static_cast<float>(region.y) / page.height;
+    region.u1 = static_cast<float>(region.x + region.width) / page.width;
+    region.v1 = static_cast<float>(region.y + region.height) / page.height;
+}
+
+/**
+ * Unpacks frames of items into atlas pages.
+ * Items must be sorted by record id, so every record is decoded once.
+ */
+static bool renderItems(const FfReader& reader,
+                        const AtlasOptions& options,
+                        const std::vector<PackedImageCopy>& images,
+                        const std::vector<AtlasItem*>& items,
+                        TextureAtlas& atlas)
+{
+    std::vector<char> recordData;
+    std::vector<char> sourcePixels;
+    std::vector<char> framePixels;
+    uint32_t sourceWidth = 0;
+    uint32_t sourceHeight = 0;
+    uint32_t bytesPerPixel = 0;
+
+    PaletteTable palette;
+    size_t paletteImage = images.size();
+
+    for (size_t i = 0; i < items.size(); ++i) {
+        const AtlasItem& item = *items[i];
+
+        if (!i || items[i - 1]->recordId != item.recordId) {
+            RecordView view = reader.getRecordView(item.recordId);
+            if (!view.data) {
+                if (!reader.getRecordData(item.recordId, recordData) || recordData.empty()) {
+                    return false;
+                }
+
+                view.data = &recordData[0];
+                view.size = static_cast<uint32_t>(recordData.size());
+            }
+
+            if (!options.decoder->decode(view.data, view.size, sourcePixels, sourceWidth,
+                                         sourceHeight, bytesPerPixel)
+                || sourcePixels.empty()
+                || (bytesPerPixel != 1 && bytesPerPixel != atlasBytesPerPixel)) {
+                return false;
+            }
+        }
+
+        const ImageFrame& frame = images[item.image].image.frames[item.frame];
+        AtlasPage& page = atlas.pages[item.page];
+
+        const size_t pitch = static_cast<size_t>(page.width) * atlasBytesPerPixel;
+        char* target = &page.pixels[item.y * pitch + item.x * atlasBytesPerPixel];
+
+        SourceImage source;
+        source.pixels = &sourcePixels[0];
+        source.width = sourceWidth;
+        source.height = sourceHeight;
+        source.pitch = static_cast<size_t>(sourceWidth) * bytesPerPixel;
+        source.bytesPerPixel = bytesPerPixel;
+
+        if (bytesPerPixel == atlasBytesPerPixel) {
+            if (!unpackFrame(frame, source, target, pitch)) {
+                return false;
+            }
+
+            continue;
+        }
+
+        // Palettized frames are unpacked aside and expanded with palette of their image
+        if (paletteImage != item.image) {
+            if (!decodePalette(images[item.image].image.palette, palette, options.order,
+                               options.transparentIndex)) {
+                return false;
+            }
+
+            paletteImage = item.image;
+        }
+
+        framePixels.assign(static_cast<size_t>(frame.width) * frame.height, '\0');
+        if (!unpackFrame(frame, source, &framePixels[0])) {
+            return false;
+        }
+
+        expandPalette(&framePixels[0], frame.width, frame.height, palette, target, 0, pitch);
+    }
+
+    return true;
+}
+
+/** Packs frames of packed images described by specified '-INDEX.OPT' entries. */
+static bool buildAtlas(const FfReader& reader,
+                       const std::vector<size_t>& entries,
+                       const AtlasOptions& options,
+                       TextureAtlas& atlas)
+{
+    atlas = TextureAtlas();
+
+    if (!options.decoder || !options.pageWidth || !options.pageHeight) {
+        return false;
+    }
+
+    const ImageIndices& indices = reader.indexData.images;
+
+    // Images sharing a packed image are packed once
+    std::map<RelativeOffset, size_t> imagesByOffset;
+    std::vector<PackedImageCopy> images;
+    std::vector<RecordId> imageRecords;
+
+    // Growing C++98 vector would copy every image, keep them in place instead
+    images.reserve(entries.size());
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const RelativeOffset offset = indices.packedInfo[entries[i]].first;
+
+        if (imagesByOffset.find(offset) != imagesByOffset.end()) {
+            continue;
+        }
+
+        PackedImageCopy image;
+        if (!reader.getPackedImage(offset, image)) {
+            return false;
+        }
+
+        imagesByOffset[offset] = images.size();
+        images.push_back(PackedImageCopy());
+        images.back().swap(image);
+        imageRecords.push_back(indices.ids[entries[i]]);
+    }
+
+    std::set<std::string> frameNames;
+    std::vector<AtlasItem> items;
+
+    for (size_t i = 0; i < images.size(); ++i) {
+        const ArrayView<ImageFrame>& frames = images[i].image.frames;
+
+        for (size_t j = 0; j < frames.size(); ++j) {
+            const ImageFrame& frame = frames[j];
+
+            if (!frame.width || !frame.height || !frameNames.insert(frame.name).second) {
+                continue;
+            }
+
+            AtlasItem item;
+            item.image = i;
+            item.frame = j;
+            item.recordId = imageRecords[i];
+            item.width = frame.width;
+            item.height = frame.height;
+            item.page = 0;
+            item.x = 0;
+            item.y = 0;
+
+            items.push_back(item);
+        }
+    }
+
+    std::vector<AtlasItem*> order(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        order[i] = &items[i];
+    }
+
+    std::stable_sort(order.begin(), order.end(), itemTaller);
+
+    // Every frame goes to the first page it fits into, new pages are started on demand
+    std::vector<Skyline> skylines;
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        AtlasItem& item = *order[i];
+
+        const uint32_t rectWidth = std::min(item.width + options.padding, options.pageWidth);
+        const uint32_t rectHeight = std::min(item.height + options.padding, options.pageHeight);
+
+        if (item.width > options.pageWidth || item.height > options.pageHeight) {
+            return false;
+        }
+
+        size_t page = 0;
+        for (; page < skylines.size(); ++page) {
+            if (skylines[page].place(rectWidth, rectHeight, item.x, item.y)) {
+                break;
+            }
+        }
+
+        if (page == skylines.size()) {
+            skylines.push_back(Skyline(options.pageWidth, options.pageHeight));
+
+            if (!skylines.back().place(rectWidth, rectHeight, item.x, item.y)) {
+                return false;
+            }
+        }
+
+        item.page = static_cast<uint32_t>(page);
+    }
+
+    atlas.pages.resize(skylines.size());
+
+    for (size_t i = 0; i < skylines.size(); ++i) {
+        AtlasPage& page = atlas.pages[i];
+        page.width = options.pageWidth;
+        page.height = skylines[i].usedHeight;
+        page.pixels.assign(static_cast<size_t>(page.width) * page.height * atlasBytesPerPixel,
+                           '\0');
+    }
+
+    std::stable_sort(order.begin(), order.end(), itemRecordLess);
+
+    if (!renderItems(reader, options, images, order, atlas)) {
+        atlas = TextureAtlas();
+        return false;
+    }
+
+    atlas.regions.resize(items.size());
+
+    for (size_t i = 0; i < items.size(); ++i) {
+        const AtlasItem& item = items[i];
+        AtlasRegion& region = atlas.regions[i];
+
+        region.name = images[item.image].image.frames[item.frame].name;
+        region.page = item.page;
+        region.x = item.x;
+        region.y = item.y;
+        region.width = item.width;
+        region.height = item.height;
+        setTextureCoordinates(region, atlas.pages[item.page]);
+    }
+
+    std::sort(atlas.regions.begin(), atlas.regions.end(), regionNameLess);
+    return true;
+}
+
+const AtlasRegion* TextureAtlas::findRegion(const std::string& name) const
+{
+    AtlasRegion key;
+    key.name = name;
+
+    std::vector<AtlasRegion>::const_iterator it = std::lower_bound(regions.begin(), regions.end(),
+                                                                   key, regionNameLess);
+    if (it == regions.end() || it->name != name) {
+        return NULL;
+    }
+
+    return &*it;
+}
+
+bool buildTextureAtlas(const FfReader& reader,
+                       const std::vector<std::string>& imageNames,
+                       const AtlasOptions& options,
+                       TextureAtlas& atlas)
+{
+    std::vector<size_t> entries;
+    entries.reserve(imageNames.size());
+
+    for (size_t i = 0; i < imageNames.size(); ++i) {
+        const uint32_t* entry = reader.imageIndexNames.find(imageNames[i]);
+        if (!entry) {
+            atlas = TextureAtlas();
+            return false;
+        }
+
+        entries.push_back(*entry);
+    }
+
+    return buildAtlas(reader, entries, options, atlas);
+}
+
+bool buildTextureAtlas(const FfReader& reader, const AtlasOptions& options, TextureAtlas& atlas)
+{
+    std::vector<size_t> entries(reader.indexData.images.names.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entries[i] = i;
+    }
+
+    return buildAtlas(reader, entries, options, atlas);
+}
+
+bool saveTextureAtlas(const TextureAtlas& atlas, const std::string& atlasPath)
+{
+    std::vector<AtlasPageEntry> pageEntries(atlas.pages.size());
+    for (size_t i = 0; i < atlas.pages.size(); ++i) {
+        pageEntries[i].width = atlas.pages[i].width;
+        pageEntries[i].height = atlas.pages[i].height;
+    }
+
+    std::vector<char> names;
+    std::vector<AtlasRegionEntry> regionEntries(atlas.regions.size());
+
+    for (size_t i = 0; i < atlas.regions.size(); ++i) {
+        const AtlasRegion& region = atlas.regions[i];
+        AtlasRegionEntry& entry = regionEntries[i];
+
+        entry.nameOffset = static_cast<uint32_t>(names.size());
+        names.insert(names.end(), region.name.begin(), region.name.end());
+        names.push_back('\0');
+
+        entry.page = region.page;
+        entry.x = region.x;
+        entry.y = region.y;
+        entry.width = region.width;
+        entry.height = region.height;
+    }
+
+    std::vector<char> payload;
+    appendArray(payload, pageEntries);
+    appendArray(payload, names);
+    appendArray(payload, regionEntries);
+
+    for (size_t i = 0; i < atlas.pages.size(); ++i) {
+        appendArray(payload, atlas.pages[i].pixels);
+    }
+
+    AtlasHeader header;
+    header.signature = atlasSignature;
+    header.version = atlasVersion;
+    header.payloadSize = static_cast<uint32_t>(payload.size());
+    header.checksum = checksum(payload.empty() ? NULL : &payload[0], payload.size());
+
+    ReplacingFile output;
+    FILE* file = output.open(atlasPath);
+    if (!file) {
+        return false;
+    }
+
+    const bool written = fwrite(&header, sizeof(header), 1, file) == 1
+                         && (payload.empty() || fwrite(&payload[0], payload.size(), 1, file) == 1);
+
+    return written && output.commit();
+}
+
+bool loadTextureAtlas(const std::string& atlasPath, TextureAtlas& atlas)
+{
+    RandomAccessFile file;
+    if (!file.open(atlasPath)) {
+        return false;
+    }
+
+    AtlasHeader header;
+    if (!file.read(0, &header, sizeof(header))) {
+        return false;
+    }
+
+    if (header.signature != atlasSignature || header.version != atlasVersion
+        || file.size() != sizeof(header) + static_cast<uint64_t>(header.payloadSize)) {
+        return false;
+    }
+
+    std::vector<char> payload(header.payloadSize);
+    if (payload.empty() || !file.read(sizeof(header), &payload[0], payload.size())
+        || checksum(&payload[0], payload.size()) != header.checksum) {
+        return false;
+    }
+
+    const char* data = &payload[0];
+    const size_t size = payload.size();
+    size_t byteOffset = 0;
+
+    std::vector<AtlasPageEntry> pageEntries;
+    std::vector<char> names;
+    std::vector<AtlasRegionEntry> regionEntries;
+
+    if (!readArray(data, size, byteOffset, pageEntries)
+        || !readArray(data, size, byteOffset, names)
+        || !readArray(data, size, byteOffset, regionEntries)) {
+        return false;
+    }
+
+    TextureAtlas loaded;
+    loaded.pages.resize(pageEntries.size());
+
+    for (size_t i = 0; i < pageEntries.size(); ++i) {
+        AtlasPage& page = loaded.pages[i];
+        page.width = pageEntries[i].width;
+        page.height = pageEntries[i].height;
+
+        if (!readArray(data, size, byteOffset, page.pixels)
+            || page.pixels.size()
+                   != static_cast<size_t>(page.width) * page.height * atlasBytesPerPixel) {
+            return false;
+        }
+    }
+
+    loaded.regions.resize(regionEntries.size());
+
+    for (size_t i = 0; i < regionEntries.size(); ++i) {
+        const AtlasRegionEntry& entry = regionEntries[i];
+
+        if (entry.page >= loaded.pages.size() || entry.nameOffset >= names.size()
+            || names.back() != '\0') {
+            return false;
+        }
+
+        const AtlasPage& page = loaded.pages[entry.page];
+        if (entry.x > page.width || page.width - entry.x < entry.width || entry.y > page.height
+            || page.height - entry.y < entry.height) {
+            return false;
+        }
+
+        AtlasRegion& region = loaded.regions[i];
+        region.name = &names[entry.nameOffset];
+        region.page = entry.page;
+        region.x = entry.x;
+        region.y = entry.y;
+        region.width = entry.width;
+        region.height = entry.height;
+        setTextureCoordinates(region, page);
+    }
+
+    atlas.pages.swap(loaded.pages);
+    atlas.regions.swap(loaded.regions);
+    return true;
+}
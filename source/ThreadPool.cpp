@@ -0,0 +1,199 @@
+/*
+ * This file is part of the random scenario generator for Disciples 2.
+ * (https://github.com/VladimirMakeev/D2RSG)
+ * Copyright (C) 2023 Vladimir Makeev.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ThreadPool.hpp>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+struct ThreadPool::Thread
+{
+    HANDLE handle;
+};
+
+static unsigned __stdcall threadEntry(void* pool)
+{
+    ThreadPool::workerMain(pool);
+    return 0;
+}
+
+#else
+
+struct ThreadPool::Thread
+{
+    pthread_t handle;
+};
+
+extern "C" {
+static void* threadEntry(void* pool)
+{
+    ThreadPool::workerMain(pool);
+    return NULL;
+}
+}
+
+#endif
+
+ThreadPool::ThreadPool(size_t threadsTotal)
+    : tasksRunning(0)
+    , stopping(false)
+{
+    if (!threadsTotal) {
+        threadsTotal = hardwareThreads();
+    }
+
+    threads.reserve(threadsTotal);
+
+    for (size_t i = 0; i < threadsTotal; ++i) {
+        Thread* thread = new Thread;
+
+#ifdef _WIN32
+        const uintptr_t handle = _beginthreadex(NULL, 0, threadEntry, this, 0, NULL);
+        const bool started = handle != 0;
+        thread->handle = reinterpret_cast<HANDLE>(handle);
+#else
+        const bool started = pthread_create(&thread->handle, NULL, threadEntry, this) == 0;
+#endif
+
+        if (!started) {
+            delete thread;
+            break;
+        }
+
+        threads.push_back(thread);
+    }
+
+    if (threads.empty()) {
+        throw std::runtime_error("Could not start thread pool workers");
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+
+    {
+        ScopedLock lock(mutex);
+        stopping = true;
+    }
+
+    taskAdded.notifyAll();
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+#ifdef _WIN32
+        WaitForSingleObject(threads[i]->handle, INFINITE);
+        CloseHandle(threads[i]->handle);
+#else
+        pthread_join(threads[i]->handle, NULL);
+#endif
+        delete threads[i];
+    }
+}
+
+void ThreadPool::submit(Task* task)
+{
+    {
+        ScopedLock lock(mutex);
+        tasks.push_back(task);
+    }
+
+    taskAdded.notifyOne();
+}
+
+void ThreadPool::wait()
+{
+    ScopedLock lock(mutex);
+
+    while (!tasks.empty() || tasksRunning) {
+        tasksDone.wait(mutex);
+    }
+}
+
+size_t ThreadPool::size() const
+{
+    return threads.size();
+}
+
+size_t ThreadPool::hardwareThreads()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const long processors = static_cast<long>(info.dwNumberOfProcessors);
+#else
+    const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return processors > 0 ? static_cast<size_t>(processors) : 1;
+}
+
+void ThreadPool::workerMain(void* pool)
+{
+    static_cast<ThreadPool*>(pool)->work();
+}
+
+void ThreadPool::work()
+{
+    for (;;) {
+        Task* task = NULL;
+
+        {
+            ScopedLock lock(mutex);
+
+            while (tasks.empty() && !stopping) {
+                taskAdded.wait(mutex);
+            }
+
+            if (tasks.empty()) {
+                // Stopping and nothing left to do
+                return;
+            }
+
+            task = tasks.front();
+            tasks.pop_front();
+            ++tasksRunning;
+        }
+
+        try {
+            task->run();
+        } catch (...) {
+            // Tasks signal their own failures, an escaped exception must not kill the worker
+        }
+
+        {
+            ScopedLock lock(mutex);
+            --tasksRunning;
+
+            if (tasks.empty() && !tasksRunning) {
+                tasksDone.notifyAll();
+            }
+        }
+    }
+}